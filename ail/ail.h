@@ -40,6 +40,10 @@ SOFTWARE.
 #include <string.h>
 #define AIL_MEMCPY(dst, src, n) memcpy(dst, src, n)
 #endif
+#ifndef AIL_MEMMOVE
+#include <string.h>
+#define AIL_MEMMOVE(dst, src, n) memmove(dst, src, n)
+#endif
 
 // AIL_DEF and AIL_DEF_INLINE only effect the AIL_ALLOC functions
 // They do however serve as defaults for the other ail headers
@@ -213,6 +217,16 @@ typedef char*    str;
 	#define AIL_LIKELY(expr)   (expr)
 #endif
 
+// Hints the CPU to load the cache line containing `ptr`, so that a following access doesn't stall on a cache miss
+#if defined(__GNUC__) || defined(__clang__)
+	#define AIL_PREFETCH(ptr) __builtin_prefetch(ptr)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	#include <intrin.h>
+	#define AIL_PREFETCH(ptr) _mm_prefetch((const char *)(ptr), _MM_HINT_T0)
+#else
+	#define AIL_PREFETCH(ptr) ((void)(ptr))
+#endif
+
 #define AIL_DBG_EXIT() do { int *X = 0; *X = 0; exit(1); } while(0)
 #define AIL_ASSERT_COMMON(expr, msg) do { if (!(expr)) { AIL_DBG_PRINT("Assertion failed in " __FILE__ ":" AIL_STR_LINE "\n  " msg); AIL_DBG_EXIT(); } } while(0)
 #define AIL_ASSERT_MSG(expr, msg) AIL_ASSERT_COMMON(expr, "with message '" msg "'")
@@ -240,6 +254,68 @@ typedef char*    str;
         out += (out==0);                                                                                                                      \
     } while(0)
 
+// Thread-local storage and atomic operations on integers & pointers
+// Relaxed operations only guarantee atomicity, Acquire/Release additionally order surrounding memory accesses
+#if defined(__cplusplus) && __cplusplus >= 201103L
+	#define AIL_THREAD_LOCAL thread_local
+#elif defined(_MSC_VER)
+	#define AIL_THREAD_LOCAL __declspec(thread)
+#else
+	#define AIL_THREAD_LOCAL __thread
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+	#define AIL_ATOMIC_LOAD(ptr)              __atomic_load_n(ptr, __ATOMIC_RELAXED)
+	#define AIL_ATOMIC_LOAD_ACQUIRE(ptr)      __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+	#define AIL_ATOMIC_STORE(ptr, val)        __atomic_store_n(ptr, val, __ATOMIC_RELAXED)
+	#define AIL_ATOMIC_STORE_RELEASE(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+	#define AIL_ATOMIC_ADD(ptr, val)          __atomic_fetch_add(ptr, val, __ATOMIC_RELAXED)
+	#define AIL_ATOMIC_SUB(ptr, val)          __atomic_fetch_sub(ptr, val, __ATOMIC_RELAXED)
+	#define AIL_ATOMIC_OR(ptr, val)           __atomic_fetch_or(ptr, val, __ATOMIC_RELAXED)
+	#define AIL_ATOMIC_XCHG_ACQUIRE(ptr, val) __atomic_exchange_n(ptr, val, __ATOMIC_ACQUIRE)
+	#define AIL_ATOMIC_CAS(ptr, expected, desired) __atomic_compare_exchange_n(ptr, expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+	#if defined(__x86_64__) || defined(__i386__)
+		#define AIL_CPU_RELAX() __builtin_ia32_pause()
+	#else
+		#define AIL_CPU_RELAX() ((void)0)
+	#endif
+#elif defined(_MSC_VER)
+	#include <intrin.h>
+	// @Note: All Interlocked functions are full barriers on x86/x64, so the ordering variants map to the same intrinsics
+	// @Note: Only 32- and 64-bit integers are supported here
+	#define AIL_ATOMIC_LOAD(ptr)              AIL_ATOMIC_ADD(ptr, 0)
+	#define AIL_ATOMIC_LOAD_ACQUIRE(ptr)      AIL_ATOMIC_ADD(ptr, 0)
+	#define AIL_ATOMIC_STORE(ptr, val)        ((void)AIL_ATOMIC_XCHG_ACQUIRE(ptr, val))
+	#define AIL_ATOMIC_STORE_RELEASE(ptr, val) ((void)AIL_ATOMIC_XCHG_ACQUIRE(ptr, val))
+	#define AIL_ATOMIC_ADD(ptr, val)          (sizeof(*(ptr)) == 8 ? _InterlockedExchangeAdd64((volatile long long *)(ptr), (long long)(val)) : _InterlockedExchangeAdd((volatile long *)(ptr), (long)(val)))
+	#define AIL_ATOMIC_SUB(ptr, val)          AIL_ATOMIC_ADD(ptr, -(i64)(val))
+	#define AIL_ATOMIC_OR(ptr, val)           (sizeof(*(ptr)) == 8 ? _InterlockedOr64((volatile long long *)(ptr), (long long)(val)) : _InterlockedOr((volatile long *)(ptr), (long)(val)))
+	#define AIL_ATOMIC_XCHG_ACQUIRE(ptr, val) (sizeof(*(ptr)) == 8 ? _InterlockedExchange64((volatile long long *)(ptr), (long long)(val)) : _InterlockedExchange((volatile long *)(ptr), (long)(val)))
+	#define AIL_ATOMIC_CAS(ptr, expected, desired) _ail_atomic_cas_msvc_((volatile void *)(ptr), (void *)(expected), (u64)(desired), sizeof(*(ptr)))
+	static inline int _ail_atomic_cas_msvc_(volatile void *ptr, void *expected, unsigned long long desired, size_t size)
+	{
+		if (size == 8) {
+			long long e = *(long long *)expected, old = _InterlockedCompareExchange64((volatile long long *)ptr, (long long)desired, e);
+			*(long long *)expected = old;
+			return old == e;
+		} else {
+			long e = *(long *)expected, old = _InterlockedCompareExchange((volatile long *)ptr, (long)desired, e);
+			*(long *)expected = old;
+			return old == e;
+		}
+	}
+	#define AIL_CPU_RELAX() _mm_pause()
+#endif
+
+// Minimal spin-lock, meant for very short critical sections
+// A lock is simply an integer that is 0 when unlocked
+#define AIL_SPIN_LOCK(lockPtr) do {                                                             \
+		while (AIL_ATOMIC_XCHG_ACQUIRE(lockPtr, 1)) {                                           \
+			while (AIL_ATOMIC_LOAD(lockPtr)) AIL_CPU_RELAX();                                   \
+		}                                                                                       \
+	} while(0)
+#define AIL_SPIN_UNLOCK(lockPtr) AIL_ATOMIC_STORE_RELEASE(lockPtr, 0)
+
 
 
 /////////////////////////
@@ -310,6 +386,8 @@ void __ail_default_allocator_unused__(void)
 /////////////////////////
 // Dynamic Array Implementation
 // Define `AIL_DA_INIT_CAP` to set a different initial capacity for dynamic arrays
+// Define `AIL_DA_GROWTH_NUM` and `AIL_DA_GROWTH_DEN` to set a different growth factor (default is 2x, 3 and 2 would give 1.5x)
+// Define `AIL_DA_MIN_CAP` to set the smallest capacity, that an empty array grows to
 // This implementation is heavily inspired by:
 // - nob.h (https://github.com/tsoding/musializer/blob/master/src/nob.h)
 // - stb_ds.h (https://github.com/nothings/stb/blob/master/stb_ds.h)
@@ -323,6 +401,20 @@ void __ail_default_allocator_unused__(void)
 #define AIL_DA_INIT_CAP 256
 #endif
 
+#if !defined(AIL_DA_GROWTH_NUM) && !defined(AIL_DA_GROWTH_DEN)
+#define AIL_DA_GROWTH_NUM 2
+#define AIL_DA_GROWTH_DEN 1
+#elif !defined(AIL_DA_GROWTH_NUM) || !defined(AIL_DA_GROWTH_DEN)
+#error "You must define both AIL_DA_GROWTH_NUM and AIL_DA_GROWTH_DEN or none of them."
+#endif
+
+#ifndef AIL_DA_MIN_CAP
+#define AIL_DA_MIN_CAP 8
+#endif
+
+// The capacity an array with capacity `cap` grows to, when it needs to hold at least `minCap` elements
+#define ail_da_grow_cap(cap, minCap) AIL_MAX(AIL_MAX((cap)*AIL_DA_GROWTH_NUM/AIL_DA_GROWTH_DEN, (unsigned int)(minCap)), AIL_DA_MIN_CAP)
+
 #define AIL_DA_INIT(T) typedef struct AIL_DA_##T { T *data; unsigned int len; unsigned int cap; AIL_Allocator *allocator; } AIL_DA_##T
 #define AIL_DA(T) AIL_DA_##T
 
@@ -374,15 +466,40 @@ AIL_DA_INIT(str);
 		}                                                                                  \
 	} while(0)
 
+// Sets the capacity to exactly `newCap`. The allocator's re_alloc is used, so the memory may be extended in-place
 #define ail_da_resize(daPtr, newCap) do {                                                                                         \
 		(daPtr)->data = (daPtr)->allocator->re_alloc((daPtr)->allocator->data, (daPtr)->data, sizeof(*((daPtr)->data))*(newCap)); \
+		AIL_ASSERT((daPtr)->data != NULL || (newCap) == 0);                                                                       \
 		(daPtr)->cap  = (newCap);                                                                                                 \
 		if ((daPtr)->len > (daPtr)->cap) (daPtr)->len = (daPtr)->cap;                                                             \
 	} while(0)
 
-#define ail_da_maybe_grow(daPtr, n) do {                                       \
-		if ((daPtr)->len + (n) > (daPtr)->cap)								   \
-			ail_da_resize(daPtr, AIL_MAX(2*(daPtr)->cap, (daPtr)->cap + (n))); \
+// Ensures that the capacity is at least `minCap` without growing any further than that
+// Use this before bulk-appending elements, when the final length is already known
+#define ail_da_reserve(daPtr, minCap) do {                         \
+		if ((minCap) > (daPtr)->cap) ail_da_resize(daPtr, minCap); \
+	} while(0)
+
+#define ail_da_maybe_grow(daPtr, n) do {                                             \
+		if (AIL_UNLIKELY((daPtr)->len + (n) > (daPtr)->cap))                         \
+			ail_da_resize(daPtr, ail_da_grow_cap((daPtr)->cap, (daPtr)->len + (n))); \
+	} while(0)
+
+// Shrinks the capacity to the array's length (shrinking is never done implicitly)
+#define ail_da_shrink(daPtr) do {                                                  \
+		if ((daPtr)->len == 0) {                                                   \
+			(daPtr)->allocator->free_one((daPtr)->allocator->data, (daPtr)->data); \
+			(daPtr)->data = NULL;                                                  \
+			(daPtr)->cap  = 0;                                                     \
+		} else if ((daPtr)->len < (daPtr)->cap) {                                  \
+			ail_da_resize(daPtr, (daPtr)->len);                                    \
+		}                                                                          \
+	} while(0)
+
+// Only shrinks the array, if less than a quarter of its capacity is used, and leaves room for growing again
+#define ail_da_maybe_shrink(daPtr) do {                                       \
+		if ((daPtr)->len*4 < (daPtr)->cap && 2*(daPtr)->len > AIL_DA_MIN_CAP) \
+			ail_da_resize(daPtr, 2*(daPtr)->len);                             \
 	} while(0)
 
 #define ail_da_push(daPtr, elem) do {           \
@@ -396,26 +513,23 @@ AIL_DA_INIT(str);
 		(daPtr)->len += (n);                                                             \
 	} while(0)
 
-#define ail_da_grow_with_gap(daPtr, gapStart, gapLen, newCap, elSize) do {                                                                 \
-		(daPtr)->cap = (newCap);                                                                                                           \
-		char *_ail_da_gwg_ptr_ = (char *) (daPtr)->data;                                                                                   \
-		(daPtr)->data = (daPtr)->allocator->alloc((daPtr)->allocator->data, (elSize)*(newCap));                                            \
-		AIL_ASSERT((daPtr)->data != NULL);                                                                                                 \
-		AIL_MEMCPY((daPtr)->data, _ail_da_gwg_ptr_, (elSize)*(gapStart));                                                                  \
-		AIL_MEMCPY(&(daPtr)->data[((gapStart) + (gapLen))], &_ail_da_gwg_ptr_[(elSize)*(gapStart)], (elSize)*((daPtr)->len - (gapStart))); \
-		(daPtr)->allocator->free_one((daPtr)->allocator->data, _ail_da_gwg_ptr_);                                                          \
-		(daPtr)->len += (gapLen);                                                                                                          \
+// Appends all elements of the dynamic array `srcPtr` points to with a single capacity check and copy
+#define ail_da_extend_from(daPtr, srcPtr) ail_da_pushn(daPtr, (srcPtr)->data, (srcPtr)->len)
+
+// Grows the capacity to `newCap` and moves all elements from `gapStart` onwards back by `gapLen`
+#define ail_da_grow_with_gap(daPtr, gapStart, gapLen, newCap, elSize) do { \
+		ail_da_resize(daPtr, newCap);                                      \
+		ail_da_move_gap(daPtr, gapStart, gapLen, elSize);                  \
+	} while(0)
+
+#define ail_da_move_gap(daPtr, gapStart, gapLen, elSize) do {                                                                 \
+		AIL_MEMMOVE(&(daPtr)->data[(gapStart) + (gapLen)], &(daPtr)->data[(gapStart)], (elSize)*((daPtr)->len - (gapStart))); \
+		(daPtr)->len += (gapLen);                                                                                             \
 	} while(0)
 
-#define ail_da_maybe_grow_with_gap(daPtr, idx, n) do {                                                                        \
-		if ((daPtr)->len + (n) > (daPtr)->cap) {                                                                              \
-			ail_da_grow_with_gap((daPtr), (idx), (n), AIL_MAX(2*(daPtr)->cap, (daPtr)->cap + (n)), sizeof(*((daPtr)->data))); \
-		} else {                                                                                                              \
-			for (unsigned int _ail_da_i_ = 1; _ail_da_i_ <= ((daPtr)->len - (idx)); _ail_da_i_++) {                           \
-				(daPtr)->data[((daPtr)->len + (n)) - _ail_da_i_] =  (daPtr)->data[(daPtr)->len - _ail_da_i_];                 \
-			}                                                                                                                 \
-			(daPtr)->len += (n);                                                                                              \
-		}                                                                                                                     \
+#define ail_da_maybe_grow_with_gap(daPtr, idx, n) do {                  \
+		ail_da_maybe_grow(daPtr, n);                                    \
+		ail_da_move_gap((daPtr), (idx), (n), sizeof(*((daPtr)->data))); \
 	} while(0)
 
 #define ail_da_insert(daPtr, idx, elem) do {       \
@@ -428,15 +542,116 @@ AIL_DA_INIT(str);
 		ail_da_setn(daPtr, idx, elems, n);         \
 	} while(0)
 
-// @TODO: Add ail_da_shrink & ail_da_maybe_shrink (they should only ever be explicitly called by the user)
-
-#define ail_da_rm(daPtr, idx) do {                                                       \
-        (daPtr)->len--;                                                                  \
-        for (u32 _ail_da_rm_i_ = (idx); _ail_da_rm_i_ < (daPtr)->len; _ail_da_rm_i_++) { \
-            (daPtr)->data[_ail_da_rm_i_] = (daPtr)->data[_ail_da_rm_i_ + 1];             \
-        }                                                                                \
-    } while(0)
+#define ail_da_rm(daPtr, idx) do {                                                                                      \
+		(daPtr)->len--;                                                                                                 \
+		AIL_MEMMOVE(&(daPtr)->data[(idx)], &(daPtr)->data[(idx) + 1], sizeof(*((daPtr)->data))*((daPtr)->len - (idx))); \
+	} while(0)
 
 #define ail_da_rm_swap(daPtr, idx) (daPtr)->data[(idx)] = (daPtr)->data[--(daPtr)->len]
 
+/////////////////////////
+// Small Dynamic Array
+// `AIL_SDA(T, N)` works like `AIL_DA(T)`, but keeps its first N elements inline in the struct
+// and only spills to its allocator once more than N elements are stored.
+// The `ail_sda_*` macros mirror their `ail_da_*` counterparts, but they are a separate family:
+// The macros can't tell both kinds of arrays apart, so an `AIL_SDA` must never be passed to an `ail_da_*` macro
+// that allocates, reallocates or frees (e.g. `ail_da_push`, `ail_da_resize` or `ail_da_free`), which would
+// hand the inline buffer to the allocator. Only `data` and `len` of a fixed-up array may be read like an `AIL_DA`'s.
+//
+// While the elements are stored inline, `cap` is always N (a spilled array always has a greater capacity),
+// so `data` can be restored from that after the struct was copied or moved. Every `ail_sda_*` macro does so
+// (see `ail_sda_fix`), but reading `data` directly requires a fixed-up array.
+/////////////////////////
+#define AIL_SDA_INIT(T, N) typedef struct AIL_SDA_##T##_##N { T *data; unsigned int len; unsigned int cap; AIL_Allocator *allocator; T buf[N]; } AIL_SDA_##T##_##N
+#define AIL_SDA(T, N) AIL_SDA_##T##_##N
+
+#define ail_sda_new_with_alloc(T, N, alPtr) (AIL_SDA(T, N)) { .data = NULL, .len = 0, .cap = (N), .allocator = (alPtr) }
+#define ail_sda_new(T, N)                   ail_sda_new_with_alloc(T, N, &ail_default_allocator)
+
+#define ail_sda_inline_cap(daPtr) (sizeof((daPtr)->buf)/sizeof((daPtr)->buf[0]))
+#define ail_sda_is_inline(daPtr)  ((daPtr)->cap == ail_sda_inline_cap(daPtr))
+#define ail_sda_fix(daPtr) do {                                     \
+		if (ail_sda_is_inline(daPtr)) (daPtr)->data = (daPtr)->buf; \
+	} while(0)
+
+#define ail_sda_free(daPtr) do {                                                                              \
+		if (!ail_sda_is_inline(daPtr)) (daPtr)->allocator->free_one((daPtr)->allocator->data, (daPtr)->data); \
+		(daPtr)->data = (daPtr)->buf;                                                                         \
+		(daPtr)->len  = 0;                                                                                    \
+		(daPtr)->cap  = ail_sda_inline_cap(daPtr);                                                            \
+	} while(0)
+
+#define ail_sda_resize(daPtr, newCap) do {                                                                                                 \
+		unsigned int _ail_sda_cap_ = (newCap);                                                                                             \
+		ail_sda_fix(daPtr);                                                                                                                \
+		if ((daPtr)->len > _ail_sda_cap_) (daPtr)->len = _ail_sda_cap_;                                                                    \
+		if (_ail_sda_cap_ <= ail_sda_inline_cap(daPtr)) {                                                                                  \
+			if (!ail_sda_is_inline(daPtr)) {                                                                                               \
+				AIL_MEMCPY((daPtr)->buf, (daPtr)->data, sizeof(*((daPtr)->data))*(daPtr)->len);                                            \
+				(daPtr)->allocator->free_one((daPtr)->allocator->data, (daPtr)->data);                                                     \
+				(daPtr)->data = (daPtr)->buf;                                                                                              \
+				(daPtr)->cap  = ail_sda_inline_cap(daPtr);                                                                                 \
+			}                                                                                                                              \
+		} else if (ail_sda_is_inline(daPtr)) {                                                                                             \
+			(daPtr)->data = (daPtr)->allocator->alloc((daPtr)->allocator->data, sizeof(*((daPtr)->data))*_ail_sda_cap_);                   \
+			AIL_ASSERT((daPtr)->data != NULL);                                                                                             \
+			AIL_MEMCPY((daPtr)->data, (daPtr)->buf, sizeof(*((daPtr)->data))*(daPtr)->len);                                                \
+			(daPtr)->cap  = _ail_sda_cap_;                                                                                                 \
+		} else {                                                                                                                           \
+			(daPtr)->data = (daPtr)->allocator->re_alloc((daPtr)->allocator->data, (daPtr)->data, sizeof(*((daPtr)->data))*_ail_sda_cap_); \
+			AIL_ASSERT((daPtr)->data != NULL);                                                                                             \
+			(daPtr)->cap  = _ail_sda_cap_;                                                                                                 \
+		}                                                                                                                                  \
+	} while(0)
+
+#define ail_sda_reserve(daPtr, minCap) do {                         \
+		ail_sda_fix(daPtr);                                         \
+		if ((minCap) > (daPtr)->cap) ail_sda_resize(daPtr, minCap); \
+	} while(0)
+
+#define ail_sda_maybe_grow(daPtr, n) do {                                             \
+		ail_sda_fix(daPtr);                                                           \
+		if (AIL_UNLIKELY((daPtr)->len + (n) > (daPtr)->cap))                          \
+			ail_sda_resize(daPtr, ail_da_grow_cap((daPtr)->cap, (daPtr)->len + (n))); \
+	} while(0)
+
+// Moves the elements back inline if they fit, otherwise shrinks the capacity to the array's length
+#define ail_sda_shrink(daPtr) ail_sda_resize(daPtr, (daPtr)->len)
+
+#define ail_sda_push(daPtr, elem) do {          \
+		ail_sda_maybe_grow(daPtr, 1);           \
+		(daPtr)->data[(daPtr)->len++] = (elem); \
+	} while(0)
+
+#define ail_sda_pushn(daPtr, elems, n) do {                                              \
+		ail_sda_maybe_grow(daPtr, n);                                                    \
+		AIL_MEMCPY((daPtr)->data + (daPtr)->len, (elems), sizeof(*((daPtr)->data))*(n)); \
+		(daPtr)->len += (n);                                                             \
+	} while(0)
+
+#define ail_sda_extend_from(daPtr, srcPtr) ail_sda_pushn(daPtr, (srcPtr)->data, (srcPtr)->len)
+
+#define ail_sda_insert(daPtr, idx, elem) do {                     \
+		ail_sda_maybe_grow(daPtr, 1);                             \
+		ail_da_move_gap(daPtr, idx, 1, sizeof(*((daPtr)->data))); \
+		(daPtr)->data[(idx)] = (elem);                            \
+	} while(0)
+
+#define ail_sda_insertn(daPtr, idx, elems, n) do {                \
+		ail_sda_maybe_grow(daPtr, n);                             \
+		ail_da_move_gap(daPtr, idx, n, sizeof(*((daPtr)->data))); \
+		ail_da_setn(daPtr, idx, elems, n);                        \
+	} while(0)
+
+#define ail_sda_rm(daPtr, idx) do { \
+		ail_sda_fix(daPtr);         \
+		ail_da_rm(daPtr, idx);      \
+	} while(0)
+
+#define ail_sda_rm_swap(daPtr, idx) do { \
+		ail_sda_fix(daPtr);              \
+		ail_da_rm_swap(daPtr, idx);      \
+	} while(0)
+
+
 #endif // AIL_H_
\ No newline at end of file
@@ -3,6 +3,9 @@
 // Define AIL_ALLOC_IMPL in some file, to include the function bodies
 // Define AIL_ALLOC_ALIGNMENT to change the alignment used by all custom allocators
 // Define AIL_ALLOC_PRINT_MEM to track allocations
+// Define _GNU_SOURCE before including any system header on Linux, so that the page allocator can grow allocations with mremap
+// instead of copying them and can advise huge pages with madvise. AIL_ALLOC_PAGE_REMAP tells whether it does, otherwise a
+// warning is emitted on Linux (define AIL_ALLOC_NO_REMAP_WARNING to silence it)
 //
 // @TODO: Add some way to drop-in replace C malloc calls without having to change the code
 //
@@ -70,7 +73,20 @@ typedef struct AIL_Alloc_Size_Header {
 	u64 size;
 } AIL_Alloc_Size_Header;
 
-typedef AIL_Alloc_Size_Header AIL_Alloc_Page_Header;
+typedef AIL_Alloc_Size_Header AIL_Alloc_Page_Header; // @Note: size includes the header and is always a multiple of AIL_ALLOC_PAGE_SIZE
+
+typedef struct AIL_Alloc_VM {
+	u8  *base;
+	u64  reserved;  // Size of the reserved range
+	u64  committed; // Amount of bytes at the start of the range that can be accessed
+	bool huge_pages;
+} AIL_Alloc_VM;
+
+typedef struct AIL_Alloc_VM_Arena {
+	AIL_Alloc_VM vm;
+	u64 idx;       // Offset of the next allocation from vm.base
+	u64 start_idx; // Offset of the first allocation, since the arena itself is stored at the start of the range
+} AIL_Alloc_VM_Arena;
 
 typedef struct AIL_Alloc_Buffer {
 	u64 size;  // @Note: Does not include the 16 bytes of the buffer's header itself
@@ -94,21 +110,72 @@ typedef struct AIL_Allloc_Pool_Free_Node {
 	struct AIL_Allloc_Pool_Free_Node *next;
 } AIL_Allloc_Pool_Free_Node;
 
+// Additional regions are allocated once all buckets of a pool are in use
+// The buckets of a region follow directly after its header
 typedef struct AIL_Alloc_Pool_Region {
-
 	struct AIL_Alloc_Pool_Region *next;
+	u64 bucket_amount;
 } AIL_Alloc_Pool_Region;
 
 typedef struct AIL_Alloc_Pool {
 	u8 *buf;
-	u64 bucket_amount;
+	u64 bucket_amount; // @Note: Only counts the buckets in buf, not those in additional regions
 	u64 bucket_size;
+	u64 total_bucket_amount;
 	AIL_Allloc_Pool_Free_Node *head;
+	AIL_Alloc_Pool_Region *regions;
 	AIL_Allocator *backing_allocator;
 } AIL_Alloc_Pool;
 
 typedef struct AIL_Alloc_Size_Header AIL_Alloc_Pool_Header;
 
+#ifndef AIL_ALLOC_STATS_BUCKETS
+#define AIL_ALLOC_STATS_BUCKETS 32 // Bucket 0 counts allocations of 0 bytes, bucket i counts sizes in [2^(i-1), 2^i) and the last bucket counts all larger sizes as well
+#endif
+
+// All counters are updated with relaxed atomics, so a snapshot is not guaranteed to be consistent across different counters while other threads are allocating
+typedef struct AIL_Alloc_Stats_Snapshot {
+	u64 live_bytes;  // Bytes currently allocated (excluding the allocator's own headers)
+	u64 peak_bytes;  // Maximum of live_bytes since the allocator was created
+	u64 allocs;      // Calls to alloc (including re_alloc of NULL)
+	u64 zero_allocs;
+	u64 re_allocs;
+	u64 re_alloc_moves; // Calls to re_alloc that returned a different pointer than they were given
+	u64 frees;
+	u64 free_alls;
+	u64 size_histogram[AIL_ALLOC_STATS_BUCKETS]; // Requested sizes of alloc, zero_alloc and re_alloc
+} AIL_Alloc_Stats_Snapshot;
+
+typedef struct AIL_Alloc_Stats {
+	AIL_Alloc_Stats_Snapshot counters;
+	AIL_Allocator *inner;
+} AIL_Alloc_Stats;
+
+typedef AIL_Alloc_Size_Header AIL_Alloc_Stats_Header;
+
+// Size classes of the slab allocator are 8, 16, 24, 32, 48, 64, 96, ..., 3072, 4096 bytes
+// Every class is served by its own pool, larger allocations are served by the page allocator
+#define AIL_ALLOC_SLAB_CLASSES  18
+#define AIL_ALLOC_SLAB_MAX_SIZE 4096
+#ifndef AIL_ALLOC_SLAB_REGION_SIZE
+#define AIL_ALLOC_SLAB_REGION_SIZE (16*1024) // Size of the first region of each class's pool, later regions double in size
+#endif
+
+// Large allocations are kept in a list, so they can be released in free_all
+typedef struct AIL_Alloc_Slab_Large {
+	struct AIL_Alloc_Slab_Large *prev;
+	struct AIL_Alloc_Slab_Large *next;
+} AIL_Alloc_Slab_Large;
+
+typedef struct AIL_Alloc_Slab {
+	AIL_Allocator pools[AIL_ALLOC_SLAB_CLASSES]; // Pools are only created once their class is first used
+	AIL_Alloc_Slab_Large *large;
+	AIL_Allocator *backing_allocator;
+} AIL_Alloc_Slab;
+
+// Stores the usable size of the allocation, which is the size of its class for small allocations
+typedef AIL_Alloc_Size_Header AIL_Alloc_Slab_Header;
+
 // Aligns size to AIL_ALLOC_ALIGNMENT
 AIL_ALLOC_DEF size_t ail_alloc_align_size(size_t size);
 // Alignment must be greater than 0 and a power of 2
@@ -127,6 +194,23 @@ AIL_ALLOC_DEF void *ail_alloc_page_realloc(void *data, void *ptr, size_t size);
 AIL_ALLOC_DEF void ail_alloc_page_free(void *data, void *ptr);
 AIL_ALLOC_DEF void ail_alloc_page_free_all(void *data);
 
+// Reserves a range of virtual memory, that can then be committed incrementally
+// If huge_pages is true, the system is asked to back the range with huge pages (currently only supported on linux)
+AIL_ALLOC_DEF AIL_Alloc_VM ail_alloc_vm_reserve(u64 size, bool huge_pages);
+AIL_ALLOC_DEF bool ail_alloc_vm_commit(AIL_Alloc_VM *vm, u64 size);   // Makes sure that at least the first size bytes of the range are committed
+AIL_ALLOC_DEF void ail_alloc_vm_decommit(AIL_Alloc_VM *vm, u64 keep); // Returns all committed pages after the first keep bytes to the OS
+AIL_ALLOC_DEF void ail_alloc_vm_release(AIL_Alloc_VM *vm);
+
+// Arena that lives in a single reserved range of virtual memory and thus never needs to move or chain regions
+// Reallocating the most recent allocation grows it in place
+AIL_ALLOC_DEF AIL_Allocator ail_alloc_vm_arena_new(u64 reserve_size, bool huge_pages);
+AIL_ALLOC_DEF void *ail_alloc_vm_arena_alloc(void *data, size_t size);
+AIL_ALLOC_DEF void *ail_alloc_vm_arena_calloc(void *data, size_t nelem, size_t elsize);
+AIL_ALLOC_DEF void *ail_alloc_vm_arena_realloc(void *data, void *ptr, size_t size);
+AIL_ALLOC_DEF void ail_alloc_vm_arena_free(void *data, void *ptr);
+AIL_ALLOC_DEF void ail_alloc_vm_arena_free_all(void *data);
+AIL_ALLOC_DEF void ail_alloc_vm_arena_release(AIL_Allocator *allocator); // Releases the whole reserved range
+
 AIL_ALLOC_DEF AIL_Allocator ail_alloc_buffer_new(u64 n, u8 *mem);
 AIL_ALLOC_DEF void *ail_alloc_buffer_alloc(void *data, size_t size);
 AIL_ALLOC_DEF void *ail_alloc_buffer_calloc(void *data, size_t nelem, size_t elsize);
@@ -149,6 +233,26 @@ AIL_ALLOC_DEF void *ail_alloc_pool_realloc(void *data, void *ptr, size_t size);
 AIL_ALLOC_DEF void ail_alloc_pool_free(void *data, void *ptr);
 AIL_ALLOC_DEF void ail_alloc_pool_free_all(void *data);
 
+// Not thread-safe. Small allocations are rounded up to their size class, which bounds the internal fragmentation to 33%
+AIL_ALLOC_DEF AIL_Allocator ail_alloc_slab_new(AIL_Allocator *backing_allocator);
+AIL_ALLOC_DEF u32  ail_alloc_slab_class(size_t size); // Index of the smallest size class that fits size
+AIL_ALLOC_DEF u64  ail_alloc_slab_class_size(u32 class_idx);
+AIL_ALLOC_DEF void *ail_alloc_slab_alloc(void *data, size_t size);
+AIL_ALLOC_DEF void *ail_alloc_slab_calloc(void *data, size_t nelem, size_t elsize);
+AIL_ALLOC_DEF void *ail_alloc_slab_realloc(void *data, void *ptr, size_t size);
+AIL_ALLOC_DEF void ail_alloc_slab_free(void *data, void *ptr);
+AIL_ALLOC_DEF void ail_alloc_slab_free_all(void *data);
+
+// Wraps another allocator and tracks how it is used. Each allocation is prefixed with a small header storing its size
+// The counters themselves are allocated with ail_default_allocator, so that they stay valid after free_all
+AIL_ALLOC_DEF AIL_Allocator ail_alloc_stats_new(AIL_Allocator *inner);
+AIL_ALLOC_DEF AIL_Alloc_Stats_Snapshot ail_alloc_stats_snapshot(AIL_Allocator *allocator);
+AIL_ALLOC_DEF void *ail_alloc_stats_alloc(void *data, size_t size);
+AIL_ALLOC_DEF void *ail_alloc_stats_calloc(void *data, size_t nelem, size_t elsize);
+AIL_ALLOC_DEF void *ail_alloc_stats_realloc(void *data, void *ptr, size_t size);
+AIL_ALLOC_DEF void ail_alloc_stats_free(void *data, void *ptr);
+AIL_ALLOC_DEF void ail_alloc_stats_free_all(void *data);
+
 #endif // AIL_ALLOC_H_
 
 #define AIL_ALLOC_IMPL
@@ -165,17 +269,27 @@ AIL_ALLOC_DEF void ail_alloc_pool_free_all(void *data);
 #include <sys/mman.h>
 #endif
 
+// glibc only declares mremap (and madvise in strict C modes) if _GNU_SOURCE was defined before the first system header was included
+#if defined(__linux__) && defined(MREMAP_MAYMOVE)
+#define AIL_ALLOC_PAGE_REMAP 1
+#else
+#define AIL_ALLOC_PAGE_REMAP 0
+#if defined(__linux__) && !defined(AIL_ALLOC_NO_REMAP_WARNING)
+#warning "mremap is not available without _GNU_SOURCE, so the page allocator copies allocations when growing them and doesn't advise huge pages"
+#endif
+#endif // AIL_ALLOC_PAGE_REMAP
+
 // For tracing memory
 #ifndef AIL_ALLOC_PRINT_MEM
 #define AIL_ALLOC_LOG(...) do { if (0) printf(__VA_ARGS__); } while(0)
 #else
 #define AIL_ALLOC_LOG(...) do { AIL_DBG_PRINT("Memory Trace: " __VA_ARGS__); AIL_DBG_PRINT("\n"); } while(0)
 #endif // AIL_ALLOC_PRINT_MEM
-#define AIL_ALLOC_LOG_ALLOC(allocator, ptr, size)           AIL_ALLOC_LOG("Malloc  %4llu bytes at %p in '" allocator "' allocator", (size), (ptr));
-#define AIL_ALLOC_LOG_CALLOC(allocator, ptr, nelem, elsize) AIL_ALLOC_LOG("Calloc  %4llu elements of size %4llu at %p in '" allocator "' allocator", (nelem), (elsize), (ptr));
-#define AIL_ALLOC_LOG_REALLOC(allocator, nptr, optr, size)  AIL_ALLOC_LOG("Relloc  %4llu bytes from %p to %p in '" allocator "' allocator", (size), (optr), (nptr));
-#define AIL_ALLOC_LOG_FREE(allocator, ptr, size)            AIL_ALLOC_LOG("Free    %4llu bytes at %p in '" allocator "' allocator", (size), (ptr));
-#define AIL_ALLOC_LOG_FREE_ALL(allocator, size)             AIL_ALLOC_LOG("FreeAll %4llu bytes in '" allocator "' allocator", (size));
+#define AIL_ALLOC_LOG_ALLOC(allocator, ptr, size)           AIL_ALLOC_LOG("Malloc  %4llu bytes at %p in '" allocator "' allocator", (unsigned long long)(size), (ptr));
+#define AIL_ALLOC_LOG_CALLOC(allocator, ptr, nelem, elsize) AIL_ALLOC_LOG("Calloc  %4llu elements of size %4llu at %p in '" allocator "' allocator", (unsigned long long)(nelem), (unsigned long long)(elsize), (ptr));
+#define AIL_ALLOC_LOG_REALLOC(allocator, nptr, optr, size)  AIL_ALLOC_LOG("Relloc  %4llu bytes from %p to %p in '" allocator "' allocator", (unsigned long long)(size), (optr), (nptr));
+#define AIL_ALLOC_LOG_FREE(allocator, ptr, size)            AIL_ALLOC_LOG("Free    %4llu bytes at %p in '" allocator "' allocator", (unsigned long long)(size), (ptr));
+#define AIL_ALLOC_LOG_FREE_ALL(allocator, size)             AIL_ALLOC_LOG("FreeAll %4llu bytes in '" allocator "' allocator", (unsigned long long)(size));
 
 size_t ail_alloc_align_size(size_t size)
 {
@@ -288,6 +402,12 @@ void __ail_alloc_page_unused__(void)
 #define AIL_ALLOC_PAGE_SIZE 4*1024
 #endif
 
+#define AIL_ALLOC_HUGE_PAGE_SIZE (2*1024*1024)
+// Allocations of at least this size are backed by huge pages if AIL_ALLOC_HUGE_PAGES is defined
+#ifndef AIL_ALLOC_HUGE_PAGE_MIN
+#define AIL_ALLOC_HUGE_PAGE_MIN AIL_ALLOC_HUGE_PAGE_SIZE
+#endif
+
 // Assumes that size is page-size-aligned
 static inline void ail_alloc_internal_free_pages(void *ptr, u64 size)
 {
@@ -298,56 +418,92 @@ static inline void ail_alloc_internal_free_pages(void *ptr, u64 size)
 #endif
 }
 
+static inline void ail_alloc_internal_advise_huge(void *ptr, u64 size)
+{
+#if defined(MADV_HUGEPAGE) && (AIL_ALLOC_PAGE_REMAP || !defined(__linux__))
+	madvise(ptr, size, MADV_HUGEPAGE);
+#else
+	AIL_UNUSED(ptr);
+	AIL_UNUSED(size);
+#endif
+}
+
 void *ail_alloc_page_alloc(void *data, size_t size)
 {
 	AIL_UNUSED(data);
 	u64 aligned_size = ail_alloc_align_forward(size + sizeof(AIL_Alloc_Page_Header), AIL_ALLOC_PAGE_SIZE);
-	size = aligned_size - sizeof(AIL_Alloc_Page_Header);
 #if defined(_WIN32)
-	void *ptr = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	void *ptr = VirtualAlloc(NULL, aligned_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
 #else
-	void *ptr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+	void *ptr = mmap(NULL, aligned_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+	if (ptr == MAP_FAILED) ptr = NULL;
+#endif
+	if (AIL_UNLIKELY(!ptr)) {
+		AIL_ALLOC_LOG_ALLOC("page", NULL, size);
+		return NULL;
+	}
+#ifdef AIL_ALLOC_HUGE_PAGES
+	if (aligned_size >= AIL_ALLOC_HUGE_PAGE_MIN) ail_alloc_internal_advise_huge(ptr, aligned_size);
 #endif
 	((AIL_Alloc_Page_Header *)ptr)->size = aligned_size;
+	AIL_ALLOC_LOG_ALLOC("page", (char *)ptr + sizeof(AIL_Alloc_Page_Header), size);
 	return (char *)ptr + sizeof(AIL_Alloc_Page_Header);
 }
 
 void *ail_alloc_page_calloc(void *data, size_t nelem, size_t elsize)
 {
 	AIL_UNUSED(data);
-	size_t size = nelem*elsize;
-	void *ptr   = ail_alloc_page_alloc(data, size);
-	memset(ptr, 0, size);
-	return ptr;
+	// Freshly mapped pages are always zeroed by the OS
+	return ail_alloc_page_alloc(data, nelem*elsize);
 }
 
 void *ail_alloc_page_realloc(void *data, void *ptr, size_t size)
 {
-	// @TODO: Track some metadata in the data pointer to allow checking the old size before reallocating
 	AIL_UNUSED(data);
+	if (!ptr) return ail_alloc_page_alloc(data, size);
 	AIL_Alloc_Page_Header *header = AIL_ALLOC_GET_HEADER(ptr, AIL_Alloc_Page_Header);
 	u64 old_size = header->size;
-	if (size <= old_size) {
-		u64 sz_diff = old_size - size;
-		u64 aligned_sz_diff = ail_alloc_align_forward(sz_diff, AIL_ALLOC_PAGE_SIZE);
-		if (aligned_sz_diff >= AIL_ALLOC_PAGE_SIZE) {
-			ail_alloc_internal_free_pages((void *)ail_alloc_align_forward((size_t)((char *)ptr + size), AIL_ALLOC_PAGE_SIZE), aligned_sz_diff);
-		}
-		header->size = size;
+	u64 new_size = ail_alloc_align_forward(size + sizeof(AIL_Alloc_Page_Header), AIL_ALLOC_PAGE_SIZE);
+	if (new_size <= old_size) {
+		// Shrinking only needs to return the pages at the end
+		if (new_size < old_size) ail_alloc_internal_free_pages((u8 *)header + new_size, old_size - new_size);
+		header->size = new_size;
+		AIL_ALLOC_LOG_REALLOC("page", ptr, ptr, size);
 		return ptr;
-	} else {
-		// @TODO: VirtualAlloc can take the previous pointer to potentially just increase the size
-		// @TODO: mmap has some kind of hint system, that probably does more or less the same
+	}
+#if AIL_ALLOC_PAGE_REMAP
+	// mremap grows the mapping in place if possible and otherwise moves the pages without copying their contents
+	void *mem = mremap(header, old_size, new_size, MREMAP_MAYMOVE);
+	if (mem == MAP_FAILED) return NULL;
+	header = (AIL_Alloc_Page_Header *)mem;
+#ifdef AIL_ALLOC_HUGE_PAGES
+	if (new_size >= AIL_ALLOC_HUGE_PAGE_MIN) ail_alloc_internal_advise_huge(mem, new_size);
+#endif
+	header->size = new_size;
+	AIL_ALLOC_LOG_REALLOC("page", (void *)&header[1], ptr, size);
+	return &header[1];
+#else
+	void *out = ail_alloc_page_alloc(data, size);
+	if (out) {
+		memcpy(out, ptr, old_size - sizeof(AIL_Alloc_Page_Header));
 		ail_alloc_page_free(data, ptr);
-		return ail_alloc_page_alloc(data, size);
 	}
+	AIL_ALLOC_LOG_REALLOC("page", out, ptr, size);
+	return out;
+#endif
 }
 
 void ail_alloc_page_free(void *data, void *ptr)
 {
 	AIL_UNUSED(data);
+	if (AIL_UNLIKELY(!ptr)) return;
 	AIL_Alloc_Page_Header *header = AIL_ALLOC_GET_HEADER(ptr, AIL_Alloc_Page_Header);
-	ail_alloc_internal_free_pages((void *)header, ail_alloc_align_forward(header->size, AIL_ALLOC_PAGE_SIZE));
+	AIL_ALLOC_LOG_FREE("page", ptr, header->size);
+#if defined(_WIN32)
+	VirtualFree(header, 0, MEM_RELEASE);
+#else
+	munmap(header, header->size);
+#endif
 }
 
 void ail_alloc_page_free_all(void *data)
@@ -357,6 +513,176 @@ void ail_alloc_page_free_all(void *data)
 }
 
 
+////////////////////
+// Virtual Memory //
+////////////////////
+
+AIL_Alloc_VM ail_alloc_vm_reserve(u64 size, bool huge_pages)
+{
+	AIL_Alloc_VM vm = {0};
+	u64 alignment = huge_pages ? AIL_ALLOC_HUGE_PAGE_SIZE : AIL_ALLOC_PAGE_SIZE;
+	size = ail_alloc_align_forward(size, alignment);
+#if defined(_WIN32)
+	vm.base = (u8 *)VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+	if (!vm.base) return vm;
+#else
+	// Reserve more than needed, to be able to align the range to the huge page size
+	u64 mapped = huge_pages ? size + alignment : size;
+	u8 *mem    = (u8 *)mmap(NULL, mapped, PROT_NONE, MAP_PRIVATE|MAP_ANON|MAP_NORESERVE, -1, 0);
+	if (mem == MAP_FAILED) return vm;
+	vm.base = (u8 *)ail_alloc_align_forward((size_t)mem, alignment);
+	if (vm.base != mem)                 munmap(mem, vm.base - mem);
+	if (vm.base + size != mem + mapped) munmap(vm.base + size, (mem + mapped) - (vm.base + size));
+	if (huge_pages) ail_alloc_internal_advise_huge(vm.base, size);
+#endif
+	vm.reserved   = size;
+	vm.huge_pages = huge_pages;
+	return vm;
+}
+
+bool ail_alloc_vm_commit(AIL_Alloc_VM *vm, u64 size)
+{
+	if (AIL_LIKELY(size <= vm->committed)) return true;
+	if (size > vm->reserved) return false;
+	// Committing in larger steps keeps the amount of syscalls low
+	u64 granularity   = vm->huge_pages ? AIL_ALLOC_HUGE_PAGE_SIZE : 16*AIL_ALLOC_PAGE_SIZE;
+	u64 new_committed = AIL_MIN(ail_alloc_align_forward(size, granularity), vm->reserved);
+#if defined(_WIN32)
+	if (!VirtualAlloc(vm->base + vm->committed, new_committed - vm->committed, MEM_COMMIT, PAGE_READWRITE)) return false;
+#else
+	if (mprotect(vm->base + vm->committed, new_committed - vm->committed, PROT_READ|PROT_WRITE)) return false;
+#endif
+	vm->committed = new_committed;
+	return true;
+}
+
+void ail_alloc_vm_decommit(AIL_Alloc_VM *vm, u64 keep)
+{
+	keep = ail_alloc_align_forward(keep, AIL_ALLOC_PAGE_SIZE);
+	if (keep >= vm->committed) return;
+#if defined(_WIN32)
+	VirtualFree(vm->base + keep, vm->committed - keep, MEM_DECOMMIT);
+#else
+	// Mapping fresh pages over the range gives the old ones back and makes it inaccessible again, while it stays reserved
+	// Unlike madvise, this is available without _GNU_SOURCE
+	mmap(vm->base + keep, vm->committed - keep, PROT_NONE, MAP_PRIVATE|MAP_ANON|MAP_FIXED|MAP_NORESERVE, -1, 0);
+#endif
+	vm->committed = keep;
+}
+
+void ail_alloc_vm_release(AIL_Alloc_VM *vm)
+{
+	if (!vm->base) return;
+#if defined(_WIN32)
+	VirtualFree(vm->base, 0, MEM_RELEASE);
+#else
+	munmap(vm->base, vm->reserved);
+#endif
+	vm->base      = NULL;
+	vm->reserved  = 0;
+	vm->committed = 0;
+}
+
+AIL_Allocator ail_alloc_vm_arena_new(u64 reserve_size, bool huge_pages)
+{
+	AIL_Alloc_VM vm = ail_alloc_vm_reserve(reserve_size + sizeof(AIL_Alloc_VM_Arena), huge_pages);
+	AIL_ASSERT(vm.base != NULL);
+	bool committed = ail_alloc_vm_commit(&vm, sizeof(AIL_Alloc_VM_Arena));
+	AIL_ASSERT(committed);
+	AIL_Alloc_VM_Arena *arena = (AIL_Alloc_VM_Arena *)vm.base;
+	arena->vm        = vm;
+	arena->start_idx = ail_alloc_align_size(sizeof(AIL_Alloc_VM_Arena));
+	arena->idx       = arena->start_idx;
+	return (AIL_Allocator) {
+		.data       = arena,
+		.alloc      = &ail_alloc_vm_arena_alloc,
+		.zero_alloc = &ail_alloc_vm_arena_calloc,
+		.re_alloc   = &ail_alloc_vm_arena_realloc,
+		.free_one   = &ail_alloc_vm_arena_free,
+		.free_all   = &ail_alloc_vm_arena_free_all,
+	};
+}
+
+void *ail_alloc_vm_arena_alloc(void *data, size_t size)
+{
+	AIL_Alloc_VM_Arena *arena = (AIL_Alloc_VM_Arena *)data;
+	u64 header_size = ail_alloc_align_size(sizeof(AIL_Alloc_Arena_Header));
+	    size        = ail_alloc_align_size(size);
+	if (AIL_UNLIKELY(!ail_alloc_vm_commit(&arena->vm, arena->idx + header_size + size))) {
+		AIL_ALLOC_LOG_ALLOC("vm_arena", NULL, size);
+		return NULL;
+	}
+	AIL_Alloc_Arena_Header *header = (AIL_Alloc_Arena_Header *)&arena->vm.base[arena->idx];
+	header->size = size;
+	void *ptr    = &arena->vm.base[arena->idx + header_size];
+	arena->idx  += header_size + size;
+	AIL_ALLOC_LOG_ALLOC("vm_arena", ptr, size);
+	return ptr;
+}
+
+void *ail_alloc_vm_arena_calloc(void *data, size_t nelem, size_t elsize)
+{
+	void *ptr = ail_alloc_vm_arena_alloc(data, nelem*elsize);
+	if (ptr) memset(ptr, 0, nelem*elsize);
+	AIL_ALLOC_LOG_CALLOC("vm_arena", ptr, nelem, elsize);
+	return ptr;
+}
+
+void *ail_alloc_vm_arena_realloc(void *data, void *ptr, size_t size)
+{
+	AIL_Alloc_VM_Arena *arena = (AIL_Alloc_VM_Arena *)data;
+	if (!ptr) return ail_alloc_vm_arena_alloc(data, size);
+	AIL_ASSERT((u8 *)ptr > arena->vm.base && (u8 *)ptr < arena->vm.base + arena->idx); // Bounds checking
+	AIL_Alloc_Arena_Header *header = AIL_ALLOC_GET_HEADER(ptr, AIL_Alloc_Arena_Header);
+	u64 old_size = header->size;
+	size = ail_alloc_align_size(size);
+	if ((u8 *)ptr + old_size == arena->vm.base + arena->idx) {
+		// The last allocation can always grow or shrink in place
+		u64 idx = (u64)((u8 *)ptr - arena->vm.base);
+		if (!ail_alloc_vm_commit(&arena->vm, idx + size)) return NULL;
+		header->size = size;
+		arena->idx   = idx + size;
+		AIL_ALLOC_LOG_REALLOC("vm_arena", ptr, ptr, size);
+		return ptr;
+	}
+	if (size <= old_size) {
+		AIL_ALLOC_LOG_REALLOC("vm_arena", ptr, ptr, size);
+		return ptr;
+	}
+	void *out = ail_alloc_vm_arena_alloc(data, size);
+	if (out) memcpy(out, ptr, old_size);
+	AIL_ALLOC_LOG_REALLOC("vm_arena", out, ptr, size);
+	return out;
+}
+
+void ail_alloc_vm_arena_free(void *data, void *ptr)
+{
+	AIL_Alloc_VM_Arena *arena = (AIL_Alloc_VM_Arena *)data;
+	if (AIL_UNLIKELY(!ptr)) return;
+	u64 header_size = ail_alloc_align_size(sizeof(AIL_Alloc_Arena_Header));
+	u64 size = AIL_ALLOC_GET_HEADER(ptr, AIL_Alloc_Arena_Header)->size;
+	// Free element, if it was the last one allocated
+	if ((u8 *)ptr + size == arena->vm.base + arena->idx) arena->idx -= size + header_size;
+	AIL_ALLOC_LOG_FREE("vm_arena", ptr, size);
+}
+
+void ail_alloc_vm_arena_free_all(void *data)
+{
+	AIL_Alloc_VM_Arena *arena = (AIL_Alloc_VM_Arena *)data;
+	AIL_ALLOC_LOG_FREE_ALL("vm_arena", arena->idx - arena->start_idx);
+	// Committed memory is kept for reuse, ail_alloc_vm_decommit can be used to return it to the OS
+	arena->idx = arena->start_idx;
+}
+
+void ail_alloc_vm_arena_release(AIL_Allocator *allocator)
+{
+	AIL_Alloc_VM_Arena *arena = (AIL_Alloc_VM_Arena *)allocator->data;
+	AIL_Alloc_VM vm = arena->vm; // Copied, since the arena itself lives in the released range
+	ail_alloc_vm_release(&vm);
+	allocator->data = NULL;
+}
+
+
 ////////////
 // Buffer //
 ////////////
@@ -576,6 +902,8 @@ AIL_Allocator ail_alloc_pool_new(u64 bucket_amount, u64 el_size, AIL_Allocator *
 	pool->buf            = (u8 *)backing_allocator->alloc(backing_allocator->data, bucket_amount * bucket_size);
 	pool->bucket_size    = bucket_size;
 	pool->bucket_amount  = bucket_amount;
+	pool->total_bucket_amount = bucket_amount;
+	pool->regions        = NULL;
 	// pool->head           = NULL; Automatically done when calling free_all
 	pool->backing_allocator = backing_allocator;
 	AIL_ASSERT(pool->buf != NULL);
@@ -590,21 +918,42 @@ AIL_Allocator ail_alloc_pool_new(u64 bucket_amount, u64 el_size, AIL_Allocator *
 	};
 }
 
+static inline void ail_alloc_pool_push_buckets(AIL_Alloc_Pool *pool, u8 *buf, u64 bucket_amount)
+{
+	for (u64 i = 0; i < bucket_amount; i++) {
+		AIL_Allloc_Pool_Free_Node *node = (AIL_Allloc_Pool_Free_Node *)&buf[i * pool->bucket_size];
+		node->next = pool->head;
+		pool->head = node;
+	}
+}
+
+// Adds a new region with as many buckets as the pool already has, so that the amount of regions only grows logarithmically
+static inline bool ail_alloc_pool_grow(AIL_Alloc_Pool *pool)
+{
+	u64 bucket_amount = AIL_MAX(pool->total_bucket_amount, 1);
+	u64 header_size   = ail_alloc_align_size(sizeof(AIL_Alloc_Pool_Region));
+	AIL_Alloc_Pool_Region *region = (AIL_Alloc_Pool_Region *)pool->backing_allocator->alloc(pool->backing_allocator->data, header_size + bucket_amount*pool->bucket_size);
+	if (!region) return false;
+	region->bucket_amount = bucket_amount;
+	region->next  = pool->regions;
+	pool->regions = region;
+	pool->total_bucket_amount += bucket_amount;
+	ail_alloc_pool_push_buckets(pool, (u8 *)region + header_size, bucket_amount);
+	return true;
+}
+
 void *ail_alloc_pool_alloc(void *data, size_t size)
 {
 	AIL_Alloc_Pool *pool = (AIL_Alloc_Pool *)data;
 	AIL_ASSERT(size <= pool->bucket_size);
-	AIL_Allloc_Pool_Free_Node *node = pool->head;
-	if (AIL_LIKELY(node)) {
-		pool->head = pool->head->next;
-		AIL_ALLOC_LOG_ALLOC("pool", (void *)node, size);
-		return (void *)node;
-	} else {
-		// Pool has no free memory left
-		AIL_TODO(); // @TODO: Extend Pool using the backing allocator
-		AIL_ASSERT(false);
+	if (AIL_UNLIKELY(!pool->head) && !ail_alloc_pool_grow(pool)) {
+		AIL_ALLOC_LOG_ALLOC("pool", NULL, size);
 		return NULL;
 	}
+	AIL_Allloc_Pool_Free_Node *node = pool->head;
+	pool->head = node->next;
+	AIL_ALLOC_LOG_ALLOC("pool", (void *)node, size);
+	return (void *)node;
 }
 
 void *ail_alloc_pool_calloc(void *data, size_t nelem, size_t elsize)
@@ -629,7 +978,16 @@ void ail_alloc_pool_free(void *data, void *ptr)
 {
 	if (AIL_UNLIKELY(ptr == NULL)) return;
 	AIL_Alloc_Pool *pool = (AIL_Alloc_Pool *)data;
-	AIL_ASSERT(pool->buf <= (u8 *)ptr && &pool->buf[pool->bucket_amount*pool->bucket_size] >= (u8 *)ptr); // Bounds checking
+#ifndef AIL_ALLOC_POOL_NO_BOUNDS_CHECK
+	// Bounds checking
+	bool in_bounds = pool->buf <= (u8 *)ptr && &pool->buf[pool->bucket_amount*pool->bucket_size] > (u8 *)ptr;
+	u64 header_size = ail_alloc_align_size(sizeof(AIL_Alloc_Pool_Region));
+	for (AIL_Alloc_Pool_Region *region = pool->regions; region && !in_bounds; region = region->next) {
+		u8 *buf   = (u8 *)region + header_size;
+		in_bounds = buf <= (u8 *)ptr && &buf[region->bucket_amount*pool->bucket_size] > (u8 *)ptr;
+	}
+	AIL_ASSERT(in_bounds);
+#endif
 	AIL_Allloc_Pool_Free_Node *node = (AIL_Allloc_Pool_Free_Node *)ptr;
 	node->next = pool->head;
 	pool->head = node;
@@ -639,13 +997,283 @@ void ail_alloc_pool_free(void *data, void *ptr)
 void ail_alloc_pool_free_all(void *data)
 {
 	AIL_Alloc_Pool *pool = (AIL_Alloc_Pool *)data;
+	u64 header_size = ail_alloc_align_size(sizeof(AIL_Alloc_Pool_Region));
 	pool->head = NULL;
-	for (u64 i = 0; i < pool->bucket_amount; i++) {
-		AIL_Allloc_Pool_Free_Node *node = (AIL_Allloc_Pool_Free_Node *)&pool->buf[i * pool->bucket_size];
+	// Regions are kept, so that they don't need to be allocated again
+	for (AIL_Alloc_Pool_Region *region = pool->regions; region; region = region->next) {
+		ail_alloc_pool_push_buckets(pool, (u8 *)region + header_size, region->bucket_amount);
+	}
+	ail_alloc_pool_push_buckets(pool, pool->buf, pool->bucket_amount);
+	AIL_ALLOC_LOG_FREE_ALL("pool", pool->total_bucket_amount * pool->bucket_size);
+}
+
+
+//////////
+// Slab //
+//////////
+
+AIL_Allocator ail_alloc_slab_new(AIL_Allocator *backing_allocator)
+{
+	AIL_Alloc_Slab *slab = (AIL_Alloc_Slab *)backing_allocator->zero_alloc(backing_allocator->data, 1, sizeof(AIL_Alloc_Slab));
+	AIL_ASSERT(slab != NULL);
+	slab->backing_allocator = backing_allocator;
+	return (AIL_Allocator) {
+		.data       = slab,
+		.alloc      = &ail_alloc_slab_alloc,
+		.zero_alloc = &ail_alloc_slab_calloc,
+		.re_alloc   = &ail_alloc_slab_realloc,
+		.free_one   = &ail_alloc_slab_free,
+		.free_all   = &ail_alloc_slab_free_all,
+	};
+}
+
+u32 ail_alloc_slab_class(size_t size)
+{
+	if (size <= 8)  return 0;
+	if (size <= 16) return 1;
+	// For 2^p < size <= 2^(p+1) the two classes are 1.5*2^p and 2^(p+1)
+#if defined(__GNUC__) || defined(__clang__)
+	u32 p = 63 - (u32)__builtin_clzll((u64)size - 1);
+#else
+	u32 p = 0;
+	for (size_t x = (size - 1) >> 1; x; x >>= 1) p++;
+#endif
+	return 2 + 2*(p - 4) + (size > ((size_t)3 << (p - 1)));
+}
+
+u64 ail_alloc_slab_class_size(u32 class_idx)
+{
+	if (class_idx < 2) return 8*(class_idx + 1);
+	u32 p = 4 + (class_idx - 2)/2;
+	return (class_idx & 1) ? (1ULL << (p + 1)) : (3ULL << (p - 1));
+}
+
+// The header of each allocation is placed in the space that the pool reserves for its free-list node
+static inline void *ail_alloc_slab_alloc_small(AIL_Alloc_Slab *slab, u32 class_idx)
+{
+	AIL_Allocator *pool = &slab->pools[class_idx];
+	u64 class_size = ail_alloc_slab_class_size(class_idx);
+	if (AIL_UNLIKELY(!pool->data)) {
+		u64 bucket_amount = AIL_MAX(AIL_ALLOC_SLAB_REGION_SIZE / (class_size + sizeof(AIL_Alloc_Slab_Header)), 4);
+		*pool = ail_alloc_pool_new(bucket_amount, class_size, slab->backing_allocator);
+	}
+	AIL_Alloc_Slab_Header *header = (AIL_Alloc_Slab_Header *)ail_alloc_pool_alloc(pool->data, class_size);
+	if (!header) return NULL;
+	header->size = class_size;
+	return &header[1];
+}
+
+static inline void *ail_alloc_slab_alloc_large(AIL_Alloc_Slab *slab, size_t size)
+{
+	AIL_Alloc_Slab_Large *large = (AIL_Alloc_Slab_Large *)ail_alloc_page_alloc(NULL, sizeof(AIL_Alloc_Slab_Large) + sizeof(AIL_Alloc_Slab_Header) + size);
+	if (!large) return NULL;
+	large->prev = NULL;
+	large->next = slab->large;
+	if (slab->large) slab->large->prev = large;
+	slab->large = large;
+	AIL_Alloc_Slab_Header *header = (AIL_Alloc_Slab_Header *)&large[1];
+	header->size = size;
+	return &header[1];
+}
+
+void *ail_alloc_slab_alloc(void *data, size_t size)
+{
+	AIL_Alloc_Slab *slab = (AIL_Alloc_Slab *)data;
+	void *ptr;
+	if (AIL_LIKELY(size <= AIL_ALLOC_SLAB_MAX_SIZE)) ptr = ail_alloc_slab_alloc_small(slab, ail_alloc_slab_class(size));
+	else                                             ptr = ail_alloc_slab_alloc_large(slab, size);
+	AIL_ALLOC_LOG_ALLOC("slab", ptr, size);
+	return ptr;
+}
+
+void *ail_alloc_slab_calloc(void *data, size_t nelem, size_t elsize)
+{
+	size_t size = nelem*elsize;
+	void *ptr   = ail_alloc_slab_alloc(data, size);
+	if (ptr) memset(ptr, 0, size);
+	AIL_ALLOC_LOG_CALLOC("slab", ptr, nelem, elsize);
+	return ptr;
+}
+
+void *ail_alloc_slab_realloc(void *data, void *ptr, size_t size)
+{
+	if (!ptr) return ail_alloc_slab_alloc(data, size);
+	u64 old_size = AIL_ALLOC_GET_HEADER(ptr, AIL_Alloc_Slab_Header)->size;
+	// Small allocations can stay where they are, as long as they would not fit into a smaller class. Large allocations can always shrink in place
+	bool keep;
+	if (old_size <= AIL_ALLOC_SLAB_MAX_SIZE) keep = size <= old_size && ail_alloc_slab_class(size) == ail_alloc_slab_class(old_size);
+	else                                     keep = size <= old_size && size > AIL_ALLOC_SLAB_MAX_SIZE;
+	if (keep) {
+		AIL_ALLOC_LOG_REALLOC("slab", ptr, ptr, size);
+		return ptr;
+	}
+	void *out = ail_alloc_slab_alloc(data, size);
+	if (out) {
+		memcpy(out, ptr, AIL_MIN(old_size, size));
+		ail_alloc_slab_free(data, ptr);
+	}
+	AIL_ALLOC_LOG_REALLOC("slab", out, ptr, size);
+	return out;
+}
+
+void ail_alloc_slab_free(void *data, void *ptr)
+{
+	if (AIL_UNLIKELY(ptr == NULL)) return;
+	AIL_Alloc_Slab *slab = (AIL_Alloc_Slab *)data;
+	AIL_Alloc_Slab_Header *header = AIL_ALLOC_GET_HEADER(ptr, AIL_Alloc_Slab_Header);
+	u64 size = header->size;
+	AIL_ALLOC_LOG_FREE("slab", ptr, size);
+	if (AIL_LIKELY(size <= AIL_ALLOC_SLAB_MAX_SIZE)) {
+		// The header proves that the bucket belongs to the pool, so the pool's bounds check can be skipped
+		AIL_Alloc_Pool *pool = (AIL_Alloc_Pool *)slab->pools[ail_alloc_slab_class(size)].data;
+		AIL_Allloc_Pool_Free_Node *node = (AIL_Allloc_Pool_Free_Node *)header;
 		node->next = pool->head;
 		pool->head = node;
+	} else {
+		AIL_Alloc_Slab_Large *large = AIL_ALLOC_GET_HEADER(header, AIL_Alloc_Slab_Large);
+		if (large->prev) large->prev->next = large->next;
+		else             slab->large       = large->next;
+		if (large->next) large->next->prev = large->prev;
+		ail_alloc_page_free(NULL, large);
 	}
-	AIL_ALLOC_LOG_FREE_ALL("pool", pool->bucket_amount * pool->bucket_size);
+}
+
+void ail_alloc_slab_free_all(void *data)
+{
+	AIL_Alloc_Slab *slab = (AIL_Alloc_Slab *)data;
+	for (u32 i = 0; i < AIL_ALLOC_SLAB_CLASSES; i++) {
+		if (slab->pools[i].data) ail_alloc_pool_free_all(slab->pools[i].data);
+	}
+	while (slab->large) {
+		AIL_Alloc_Slab_Large *next = slab->large->next;
+		ail_alloc_page_free(NULL, slab->large);
+		slab->large = next;
+	}
+	AIL_ALLOC_LOG_FREE_ALL("slab", (size_t)0);
+}
+
+
+///////////
+// Stats //
+///////////
+
+#define AIL_ALLOC_STATS_HEADER_SIZE ail_alloc_align_size(sizeof(AIL_Alloc_Stats_Header))
+
+AIL_Allocator ail_alloc_stats_new(AIL_Allocator *inner)
+{
+	// The counters must not live in memory of `inner`, since they have to survive inner->free_all
+	AIL_Alloc_Stats *stats = (AIL_Alloc_Stats *)ail_default_allocator.zero_alloc(ail_default_allocator.data, 1, sizeof(AIL_Alloc_Stats));
+	AIL_ASSERT(stats != NULL);
+	stats->inner = inner;
+	return (AIL_Allocator) {
+		.data       = stats,
+		.alloc      = &ail_alloc_stats_alloc,
+		.zero_alloc = &ail_alloc_stats_calloc,
+		.re_alloc   = &ail_alloc_stats_realloc,
+		.free_one   = &ail_alloc_stats_free,
+		.free_all   = &ail_alloc_stats_free_all,
+	};
+}
+
+AIL_Alloc_Stats_Snapshot ail_alloc_stats_snapshot(AIL_Allocator *allocator)
+{
+	AIL_Alloc_Stats_Snapshot *c = &((AIL_Alloc_Stats *)allocator->data)->counters;
+	AIL_Alloc_Stats_Snapshot out;
+	out.live_bytes     = AIL_ATOMIC_LOAD(&c->live_bytes);
+	out.peak_bytes     = AIL_ATOMIC_LOAD(&c->peak_bytes);
+	out.allocs         = AIL_ATOMIC_LOAD(&c->allocs);
+	out.zero_allocs    = AIL_ATOMIC_LOAD(&c->zero_allocs);
+	out.re_allocs      = AIL_ATOMIC_LOAD(&c->re_allocs);
+	out.re_alloc_moves = AIL_ATOMIC_LOAD(&c->re_alloc_moves);
+	out.frees          = AIL_ATOMIC_LOAD(&c->frees);
+	out.free_alls      = AIL_ATOMIC_LOAD(&c->free_alls);
+	for (u32 i = 0; i < AIL_ALLOC_STATS_BUCKETS; i++) out.size_histogram[i] = AIL_ATOMIC_LOAD(&c->size_histogram[i]);
+	return out;
+}
+
+static inline u32 ail_alloc_stats_bucket(u64 size)
+{
+	u32 bits = 0;
+#if defined(__GNUC__) || defined(__clang__)
+	if (size) bits = 64 - (u32)__builtin_clzll(size);
+#else
+	while (size) { bits++; size >>= 1; }
+#endif
+	return AIL_MIN(bits, AIL_ALLOC_STATS_BUCKETS - 1);
+}
+
+static inline void ail_alloc_stats_add_live(AIL_Alloc_Stats_Snapshot *c, u64 size)
+{
+	u64 live = AIL_ATOMIC_ADD(&c->live_bytes, size) + size;
+	u64 peak = AIL_ATOMIC_LOAD(&c->peak_bytes);
+	while (live > peak && !AIL_ATOMIC_CAS(&c->peak_bytes, &peak, live)) {}
+}
+
+void *ail_alloc_stats_alloc(void *data, size_t size)
+{
+	AIL_Alloc_Stats *stats = (AIL_Alloc_Stats *)data;
+	u8 *mem = (u8 *)stats->inner->alloc(stats->inner->data, size + AIL_ALLOC_STATS_HEADER_SIZE);
+	AIL_ATOMIC_ADD(&stats->counters.allocs, 1);
+	AIL_ATOMIC_ADD(&stats->counters.size_histogram[ail_alloc_stats_bucket(size)], 1);
+	if (AIL_UNLIKELY(!mem)) return NULL;
+	void *ptr = mem + AIL_ALLOC_STATS_HEADER_SIZE;
+	AIL_ALLOC_GET_HEADER(ptr, AIL_Alloc_Stats_Header)->size = size;
+	ail_alloc_stats_add_live(&stats->counters, size);
+	AIL_ALLOC_LOG_ALLOC("stats", ptr, size);
+	return ptr;
+}
+
+void *ail_alloc_stats_calloc(void *data, size_t nelem, size_t elsize)
+{
+	AIL_Alloc_Stats *stats = (AIL_Alloc_Stats *)data;
+	u64 size = nelem * elsize;
+	u8 *mem  = (u8 *)stats->inner->zero_alloc(stats->inner->data, 1, size + AIL_ALLOC_STATS_HEADER_SIZE);
+	AIL_ATOMIC_ADD(&stats->counters.zero_allocs, 1);
+	AIL_ATOMIC_ADD(&stats->counters.size_histogram[ail_alloc_stats_bucket(size)], 1);
+	if (AIL_UNLIKELY(!mem)) return NULL;
+	void *ptr = mem + AIL_ALLOC_STATS_HEADER_SIZE;
+	AIL_ALLOC_GET_HEADER(ptr, AIL_Alloc_Stats_Header)->size = size;
+	ail_alloc_stats_add_live(&stats->counters, size);
+	AIL_ALLOC_LOG_CALLOC("stats", ptr, nelem, elsize);
+	return ptr;
+}
+
+void *ail_alloc_stats_realloc(void *data, void *ptr, size_t size)
+{
+	AIL_Alloc_Stats *stats = (AIL_Alloc_Stats *)data;
+	if (!ptr) return ail_alloc_stats_alloc(data, size);
+	u64 old_size = AIL_ALLOC_GET_HEADER(ptr, AIL_Alloc_Stats_Header)->size;
+	u8 *mem = (u8 *)stats->inner->re_alloc(stats->inner->data, (u8 *)ptr - AIL_ALLOC_STATS_HEADER_SIZE, size + AIL_ALLOC_STATS_HEADER_SIZE);
+	AIL_ATOMIC_ADD(&stats->counters.re_allocs, 1);
+	AIL_ATOMIC_ADD(&stats->counters.size_histogram[ail_alloc_stats_bucket(size)], 1);
+	if (AIL_UNLIKELY(!mem)) return NULL;
+	void *out = mem + AIL_ALLOC_STATS_HEADER_SIZE;
+	if (out != ptr) AIL_ATOMIC_ADD(&stats->counters.re_alloc_moves, 1);
+	AIL_ALLOC_GET_HEADER(out, AIL_Alloc_Stats_Header)->size = size;
+	if (size >= old_size) ail_alloc_stats_add_live(&stats->counters, size - old_size);
+	else AIL_ATOMIC_SUB(&stats->counters.live_bytes, old_size - size);
+	AIL_ALLOC_LOG_REALLOC("stats", out, ptr, size);
+	return out;
+}
+
+void ail_alloc_stats_free(void *data, void *ptr)
+{
+	if (AIL_UNLIKELY(ptr == NULL)) return;
+	AIL_Alloc_Stats *stats = (AIL_Alloc_Stats *)data;
+	u64 size = AIL_ALLOC_GET_HEADER(ptr, AIL_Alloc_Stats_Header)->size;
+	AIL_ATOMIC_ADD(&stats->counters.frees, 1);
+	AIL_ATOMIC_SUB(&stats->counters.live_bytes, size);
+	AIL_ALLOC_LOG_FREE("stats", ptr, size);
+	stats->inner->free_one(stats->inner->data, (u8 *)ptr - AIL_ALLOC_STATS_HEADER_SIZE);
+}
+
+void ail_alloc_stats_free_all(void *data)
+{
+	AIL_Alloc_Stats *stats = (AIL_Alloc_Stats *)data;
+	AIL_ATOMIC_ADD(&stats->counters.free_alls, 1);
+	AIL_ALLOC_LOG_FREE_ALL("stats", AIL_ATOMIC_LOAD(&stats->counters.live_bytes));
+	AIL_ATOMIC_STORE(&stats->counters.live_bytes, 0);
+	stats->inner->free_all(stats->inner->data);
 }
 
 
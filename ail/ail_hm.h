@@ -58,6 +58,11 @@ SOFTWARE.
 #define AIL_HM_INIT_CAP 256
 #endif // AIL_HM_INIT_CAP
 
+// Amount of keys that ail_hm_get_many hashes and prefetches ahead, before probing for them
+#ifndef AIL_HM_BATCH_SIZE
+#define AIL_HM_BATCH_SIZE 16
+#endif // AIL_HM_BATCH_SIZE
+
 // @Note: Load factor should be specified per Hashmap maybe?
 // @Note: Load factor is given in percent from 0 to 100
 #ifndef AIL_HM_LOAD_FACTOR
@@ -73,6 +78,40 @@ typedef enum {
 
 AIL_HM_DEF u32 ail_hm_next_u32_2power(u32 x);
 
+// The hash and equality functions the ail_hm_* macros call
+// By default, these are the function pointers stored in the hashmap, which costs an indirect call per hash and comparison
+// Define them to call a function directly instead, so that it can be inlined, e.g.:
+//   #define AIL_HM_HASH(hmPtr, k)    ail_hm_hash_str(k)
+//   #define AIL_HM_EQ(hmPtr, a, b)   ail_hm_eq_str(a, b)
+// Since the ail_hm_* macros only expand these at their use, they can also be redefined between functions using different key types
+#ifndef AIL_HM_HASH
+#define AIL_HM_HASH(hmPtr, k) (hmPtr)->hash(k)
+#endif // AIL_HM_HASH
+#ifndef AIL_HM_EQ
+#define AIL_HM_EQ(hmPtr, a, b) (hmPtr)->eq(a, b)
+#endif // AIL_HM_EQ
+
+// Seed for the built-in hash functions
+#ifndef AIL_HM_SEED
+#define AIL_HM_SEED 0
+#endif // AIL_HM_SEED
+
+// Built-in hash & equality functions
+// The integer hashes are bijective mixers, so distinct keys never collide before the hash is reduced to the capacity
+// The byte hashes follow wyhash's construction and are not meant to be cryptographically secure
+AIL_HM_DEF_INLINE u32  ail_hm_hash_u32  (u32 x);
+AIL_HM_DEF_INLINE u32  ail_hm_hash_u64  (u64 x);
+AIL_HM_DEF_INLINE u32  ail_hm_hash_ptr  (const void *p);
+AIL_HM_DEF        u32  ail_hm_hash_bytes(const void *data, u64 len);
+AIL_HM_DEF_INLINE u32  ail_hm_hash_str  (str s);
+AIL_HM_DEF_INLINE bool ail_hm_eq_u32    (u32 a, u32 b);
+AIL_HM_DEF_INLINE bool ail_hm_eq_u64    (u64 a, u64 b);
+AIL_HM_DEF_INLINE bool ail_hm_eq_str    (str a, str b);
+#ifdef AIL_SV_H_
+AIL_HM_DEF_INLINE u32  ail_hm_hash_sv   (AIL_SV sv);
+AIL_HM_DEF_INLINE bool ail_hm_eq_sv     (AIL_SV a, AIL_SV b);
+#endif // AIL_SV_H_
+
 // @Note on Terminology: Box refers to an individual element in the list of elements in the hashmap
 #define AIL_HM_KEY_VAL(K, V) AIL_HM_KEY_VAL_##K##_##V
 #define AIL_HM_BOX(K, V) AIL_HM_BOX_##K##_##V
@@ -98,8 +137,8 @@ AIL_HM_DEF u32 ail_hm_next_u32_2power(u32 x);
     } AIL_HM(K, V)
 
 #define ail_hm_from_parts(K, V, data, len, once_filled, cap, hashf, eqf, alPtr) (AIL_HM(K, V)) { (data), (len), (once_filled), (cap), (hashf), (eqf), (alPtr) }
-#define ail_hm_new_with_alloc(K, V, c, hashf, eqf, alPtr) (AIL_HM(K, V)) { .data = (alPtr)->zero_alloc((alPtr)->data, ail_hm_next_u32_2power(c), sizeof(AIL_HM(K, V))), .len = 0, .once_filled = 0, .cap = (c), .hash = (hashf), .eq = (eqf), .allocator = (alPtr) }
-#define ail_hm_new_with_cap(K, V, c, hashf, eqf) (AIL_HM(K, V)) { .data = ail_default_allocator.zero_alloc(ail_default_allocator.data, ail_hm_next_u32_2power(c), sizeof(AIL_HM(K, V))), .len = 0, .cap = (c), .hash = (hashf), .eq = (eqf), .allocator = &ail_default_allocator }
+#define ail_hm_new_with_alloc(K, V, c, hashf, eqf, alPtr) (AIL_HM(K, V)) { .data = (alPtr)->zero_alloc((alPtr)->data, ail_hm_next_u32_2power(c), sizeof(AIL_HM_BOX(K, V))), .len = 0, .once_filled = 0, .cap = ail_hm_next_u32_2power(c), .hash = (hashf), .eq = (eqf), .allocator = (alPtr) }
+#define ail_hm_new_with_cap(K, V, c, hashf, eqf) (AIL_HM(K, V)) { .data = ail_default_allocator.zero_alloc(ail_default_allocator.data, ail_hm_next_u32_2power(c), sizeof(AIL_HM_BOX(K, V))), .len = 0, .once_filled = 0, .cap = ail_hm_next_u32_2power(c), .hash = (hashf), .eq = (eqf), .allocator = &ail_default_allocator }
 #define ail_hm_new(K, V, hashf, eqf) ail_hm_new_with_cap(K, V, AIL_HM_INIT_CAP, hashf, eqf)
 #define ail_hm_new_empty(K, V, hashf, eqf) (AIL_HM(K, V)) { .data = NULL, .len = 0, .once_filled = 0, .cap = 0, .hash = (hashf), .eq = (eqf), .allocator = &ail_default_allocator }
 #define ail_hm_free(hmPtr) do { (hmPtr)->allocator->free_one((hmPtr)->allocator->data, (hmPtr)->data); (hmPtr)->data = NULL; (hmPtr)->len = 0; (hmPtr)->cap = 0; } while(0)
@@ -114,12 +153,11 @@ AIL_HM_DEF u32 ail_hm_next_u32_2power(u32 x);
 // @Decide: Should we round the capacity up to the next power of 2? Alternatively we might get issues with our probing-strategy...
 #define ail_hm_grow(hmPtr, newCap) do {                                                                                                           \
         u32 _ail_hm_grow_new_cap_    =  (newCap); /* ail_hm_next_u32_2power(newCap); */                                                           \
-        printf("\033[33mGrowing: %d -> %d\033[0m\n", (hmPtr)->cap, (newCap)); \
         u32 _ail_hm_grow_occ_offset_ = AIL_OFFSETOF(&(hmPtr)->data[0], occupied);                                                                 \
         void *_ail_hm_grow_new_ptr_  = (hmPtr)->allocator->zero_alloc((hmPtr)->allocator->data, _ail_hm_grow_new_cap_, sizeof(*((hmPtr)->data))); \
         for (u32 _ail_hm_grow_i_ = 0; _ail_hm_grow_i_ < (hmPtr)->cap; _ail_hm_grow_i_++) {                                                        \
             if ((hmPtr)->data[_ail_hm_grow_i_].occupied == AIL_HM_CUR_OCCUPIED) {                                                                 \
-                u32 _ail_hm_grow_hash_ = (hmPtr)->hash((hmPtr)->data[_ail_hm_grow_i_].key);                                                       \
+                u32 _ail_hm_grow_hash_ = AIL_HM_HASH(hmPtr, (hmPtr)->data[_ail_hm_grow_i_].key);                                                  \
                 u32 _ail_hm_grow_j_    = _ail_hm_grow_hash_ % _ail_hm_grow_new_cap_;                                                              \
                 char *_ail_hm_grow_tmp_ptr_ = &(((char *)_ail_hm_grow_new_ptr_)[_ail_hm_grow_j_ * sizeof(*((hmPtr)->data))]);                     \
                 AIL_HM_OCCUPATION _ail_hm_grow_occ_ = *((AIL_HM_OCCUPATION *)&(_ail_hm_grow_tmp_ptr_[_ail_hm_grow_occ_offset_]));                 \
@@ -132,8 +170,9 @@ AIL_HM_DEF u32 ail_hm_next_u32_2power(u32 x);
             }                                                                                                                                     \
         }                                                                                                                                         \
         if ((hmPtr)->data) (hmPtr)->allocator->free_one((hmPtr)->allocator->data, (hmPtr)->data);                                                 \
-        (hmPtr)->cap  = _ail_hm_grow_new_cap_;                                                                                                    \
-        (hmPtr)->data = _ail_hm_grow_new_ptr_;                                                                                                    \
+        (hmPtr)->cap         = _ail_hm_grow_new_cap_;                                                                                             \
+        (hmPtr)->data        = _ail_hm_grow_new_ptr_;                                                                                             \
+        (hmPtr)->once_filled = (hmPtr)->len;                                                                                                      \
     } while(0)
 
 #define ail_hm_maybe_grow(hmPtr, toAdd) do {                                               \
@@ -143,20 +182,20 @@ AIL_HM_DEF u32 ail_hm_next_u32_2power(u32 x);
         }                                                                                  \
     } while(0)
 
-#define ail_hm_get_idx(hmPtr, k, outIdx, outFound) do {                                               \
-            (outFound)         = false;                                                               \
-        if ((hmPtr)->cap == 0) break; /* Necessary, bc mod 0 is undefined */                          \
-        u32 _ail_hm_get_hash_  = (hmPtr)->hash((k));                                                  \
-        u32 _ail_hm_get_idx_   = _ail_hm_get_hash_ % (hmPtr)->cap;                                    \
-        for (u32 _ail_hm_get_count_ = 0; _ail_hm_get_count_ < (hmPtr)->len; _ail_hm_get_count_++) {   \
-            if (((hmPtr)->data[_ail_hm_get_idx_].occupied & AIL_HM_OCCUPIED) == 0) break;             \
-            if (((hmPtr))->eq(((hmPtr))->data[_ail_hm_get_idx_].key, (k))) {                          \
-                (outIdx)   = _ail_hm_get_idx_;                                                        \
-                (outFound) = true;                                                                    \
-                break;                                                                                \
-            }                                                                                         \
-            ail_hm_probe_incr(_ail_hm_get_idx_, _ail_hm_get_hash_, (hmPtr)->cap);                     \
-        }                                                                                             \
+#define ail_hm_get_idx(hmPtr, k, outIdx, outFound) do {                                             \
+            (outFound)         = false;                                                             \
+        if ((hmPtr)->cap == 0) break; /* Necessary, bc mod 0 is undefined */                        \
+        u32 _ail_hm_get_hash_  = AIL_HM_HASH(hmPtr, (k));                                           \
+        u32 _ail_hm_get_idx_   = _ail_hm_get_hash_ % (hmPtr)->cap;                                  \
+        for (u32 _ail_hm_get_count_ = 0; _ail_hm_get_count_ < (hmPtr)->len; _ail_hm_get_count_++) { \
+            if (((hmPtr)->data[_ail_hm_get_idx_].occupied & AIL_HM_OCCUPIED) == 0) break;           \
+            if (AIL_HM_EQ(hmPtr, (hmPtr)->data[_ail_hm_get_idx_].key, (k))) {                       \
+                (outIdx)   = _ail_hm_get_idx_;                                                      \
+                (outFound) = true;                                                                  \
+                break;                                                                              \
+            }                                                                                       \
+            ail_hm_probe_incr(_ail_hm_get_idx_, _ail_hm_get_hash_, (hmPtr)->cap);                   \
+        }                                                                                           \
     } while(0)
 
 #define ail_hm_get_ptr(hmPtr, k, outPtr) do {                                            \
@@ -175,13 +214,13 @@ AIL_HM_DEF u32 ail_hm_next_u32_2power(u32 x);
 
 #define ail_hm_put(hmPtr, k, v) do {                                                                                                     \
         ail_hm_maybe_grow(hmPtr, 1);                                                                                                     \
-        u32 _ail_hm_put_hash_ = (hmPtr)->hash((k));                                                                                      \
+        u32 _ail_hm_put_hash_ = AIL_HM_HASH(hmPtr, (k));                                                                                 \
         u32 _ail_hm_put_idx_  = _ail_hm_put_hash_ % (hmPtr)->cap;                                                                        \
         u32 _ail_hm_put_once_filled_idx_;                                                                                                \
         u32 _ail_hm_put_found_once_filled_idx_ = false;                                                                                  \
         for (u32 _ail_hm_put_count_ = 0; _ail_hm_put_count_ < (hmPtr)->len &&                                                            \
             ((hmPtr)->data[_ail_hm_put_idx_].occupied & AIL_HM_OCCUPIED) > 0; _ail_hm_put_count_++) {                                    \
-            if ((hmPtr)->eq((hmPtr)->data[_ail_hm_put_idx_].key, (k))) goto _ail_hm_put_set_val_;                                        \
+            if (AIL_HM_EQ(hmPtr, (hmPtr)->data[_ail_hm_put_idx_].key, (k))) goto _ail_hm_put_set_val_;                                   \
             if (AIL_UNLIKELY(!_ail_hm_put_found_once_filled_idx_ && (hmPtr)->data[_ail_hm_put_idx_].occupied == AIL_HM_ONCE_OCCUPIED)) { \
                 _ail_hm_put_once_filled_idx_       = _ail_hm_put_idx_;                                                                   \
                 _ail_hm_put_found_once_filled_idx_ = true;                                                                               \
@@ -199,10 +238,219 @@ AIL_HM_DEF u32 ail_hm_next_u32_2power(u32 x);
         (hmPtr)->data[_ail_hm_put_idx_].occupied = AIL_HM_CUR_OCCUPIED;                                                                  \
     } while(0)
 
+// Makes sure, that `n` elements fit into the hashmap without it having to grow again
+#define ail_hm_reserve(hmPtr, n) do {                                                               \
+        if ((u64)(n)*100 >= (u64)(hmPtr)->cap*AIL_HM_LOAD_FACTOR) {                                 \
+            ail_hm_grow(hmPtr, ail_hm_next_u32_2power((u32)((u64)(n)*100/AIL_HM_LOAD_FACTOR + 1))); \
+        }                                                                                           \
+    } while(0)
+
+// Finds the value for `k` or inserts `k` with a zeroed value if it isn't in the hashmap yet
+// Only a single hash and probe sequence is needed in both cases, unlike with ail_hm_get_ptr followed by ail_hm_put
+// `outPtr` is set to the value's slot, which stays valid until the hashmap grows
+#define ail_hm_get_or_insert(hmPtr, k, outPtr, outFound) do {                                             \
+        ail_hm_maybe_grow(hmPtr, 1);                                                                      \
+        u32  _ail_hm_goi_hash_     = AIL_HM_HASH(hmPtr, (k));                                             \
+        u32  _ail_hm_goi_idx_      = _ail_hm_goi_hash_ % (hmPtr)->cap;                                    \
+        u32  _ail_hm_goi_free_idx_ = (hmPtr)->cap;                                                        \
+        (outFound) = false;                                                                               \
+        for (u32 _ail_hm_goi_count_ = 0; _ail_hm_goi_count_ < (hmPtr)->cap; _ail_hm_goi_count_++) {       \
+            AIL_HM_OCCUPATION _ail_hm_goi_occ_ = (hmPtr)->data[_ail_hm_goi_idx_].occupied;                \
+            if (_ail_hm_goi_occ_ == AIL_HM_EMPTY) {                                                       \
+                if (_ail_hm_goi_free_idx_ == (hmPtr)->cap) _ail_hm_goi_free_idx_ = _ail_hm_goi_idx_;      \
+                break;                                                                                    \
+            }                                                                                             \
+            if (_ail_hm_goi_occ_ == AIL_HM_CUR_OCCUPIED) {                                                \
+                if (AIL_HM_EQ(hmPtr, (hmPtr)->data[_ail_hm_goi_idx_].key, (k))) {                         \
+                    (outFound) = true;                                                                    \
+                    break;                                                                                \
+                }                                                                                         \
+            } else if (_ail_hm_goi_free_idx_ == (hmPtr)->cap) {                                           \
+                _ail_hm_goi_free_idx_ = _ail_hm_goi_idx_;                                                 \
+            }                                                                                             \
+            ail_hm_probe_incr(_ail_hm_goi_idx_, _ail_hm_goi_hash_, (hmPtr)->cap);                         \
+        }                                                                                                 \
+        if (!(outFound)) {                                                                                \
+            AIL_ASSERT(_ail_hm_goi_free_idx_ < (hmPtr)->cap);                                             \
+            _ail_hm_goi_idx_ = _ail_hm_goi_free_idx_;                                                     \
+            if ((hmPtr)->data[_ail_hm_goi_idx_].occupied == AIL_HM_EMPTY) (hmPtr)->once_filled++;         \
+            (hmPtr)->len++;                                                                               \
+            memset(&(hmPtr)->data[_ail_hm_goi_idx_].val, 0, sizeof((hmPtr)->data[_ail_hm_goi_idx_].val)); \
+            (hmPtr)->data[_ail_hm_goi_idx_].key      = (k);                                               \
+            (hmPtr)->data[_ail_hm_goi_idx_].occupied = AIL_HM_CUR_OCCUPIED;                               \
+        }                                                                                                 \
+        (outPtr) = &(hmPtr)->data[_ail_hm_goi_idx_].val;                                                  \
+    } while(0)
+
+// Looks up `n` keys at once and writes a pointer to each key's value (or NULL if the key wasn't found) into `outPtrs`
+// Keys are hashed and their first slot is prefetched in batches of AIL_HM_BATCH_SIZE,
+// so that the cache misses of all lookups in a batch overlap instead of stalling one after another
+#define ail_hm_get_many(hmPtr, keys, n, outPtrs) do {                                                                                            \
+        u32 _ail_hm_gm_hash_[AIL_HM_BATCH_SIZE];                                                                                                 \
+        for (u32 _ail_hm_gm_start_ = 0; _ail_hm_gm_start_ < (n); _ail_hm_gm_start_ += AIL_HM_BATCH_SIZE) {                                       \
+            u32 _ail_hm_gm_n_ = AIL_MIN((u32)(n) - _ail_hm_gm_start_, AIL_HM_BATCH_SIZE);                                                        \
+            if ((hmPtr)->cap == 0) {                                                                                                             \
+                for (u32 _ail_hm_gm_i_ = 0; _ail_hm_gm_i_ < _ail_hm_gm_n_; _ail_hm_gm_i_++) (outPtrs)[_ail_hm_gm_start_ + _ail_hm_gm_i_] = NULL; \
+                continue;                                                                                                                        \
+            }                                                                                                                                    \
+            for (u32 _ail_hm_gm_i_ = 0; _ail_hm_gm_i_ < _ail_hm_gm_n_; _ail_hm_gm_i_++) {                                                        \
+                _ail_hm_gm_hash_[_ail_hm_gm_i_] = AIL_HM_HASH(hmPtr, (keys)[_ail_hm_gm_start_ + _ail_hm_gm_i_]);                                 \
+                AIL_PREFETCH(&(hmPtr)->data[_ail_hm_gm_hash_[_ail_hm_gm_i_] % (hmPtr)->cap]);                                                    \
+            }                                                                                                                                    \
+            for (u32 _ail_hm_gm_i_ = 0; _ail_hm_gm_i_ < _ail_hm_gm_n_; _ail_hm_gm_i_++) {                                                        \
+                u32 _ail_hm_gm_idx_ = _ail_hm_gm_hash_[_ail_hm_gm_i_] % (hmPtr)->cap;                                                            \
+                (outPtrs)[_ail_hm_gm_start_ + _ail_hm_gm_i_] = NULL;                                                                             \
+                for (u32 _ail_hm_gm_count_ = 0; _ail_hm_gm_count_ < (hmPtr)->cap; _ail_hm_gm_count_++) {                                         \
+                    if ((hmPtr)->data[_ail_hm_gm_idx_].occupied == AIL_HM_EMPTY) break;                                                          \
+                    if ((hmPtr)->data[_ail_hm_gm_idx_].occupied == AIL_HM_CUR_OCCUPIED &&                                                        \
+                        AIL_HM_EQ(hmPtr, (hmPtr)->data[_ail_hm_gm_idx_].key, (keys)[_ail_hm_gm_start_ + _ail_hm_gm_i_])) {                       \
+                        (outPtrs)[_ail_hm_gm_start_ + _ail_hm_gm_i_] = &(hmPtr)->data[_ail_hm_gm_idx_].val;                                      \
+                        break;                                                                                                                   \
+                    }                                                                                                                            \
+                    ail_hm_probe_incr(_ail_hm_gm_idx_, _ail_hm_gm_hash_[_ail_hm_gm_i_], (hmPtr)->cap);                                           \
+                }                                                                                                                                \
+            }                                                                                                                                    \
+        }                                                                                                                                        \
+    } while(0)
+
 // @TODO
 #define ail_hm_rm(hmPtr, k) do { \
     } while(0)
 
+/////////////////////////
+// Hash Set
+// Unlike AIL_HM, the set marks empty slots with a reserved sentinel key instead of an occupancy field,
+// so each slot is exactly as big as a key. The sentinel key can never be added to the set.
+// The capacity is always 0 or a power of 2, collisions are resolved with linear probing
+// and removed keys are backward-shifted, so no tombstones are needed.
+// Hashing and comparing goes through AIL_HM_HASH and AIL_HM_EQ just like for AIL_HM.
+/////////////////////////
+#define AIL_HSET(K) AIL_HSET_##K
+#define AIL_HSET_INIT(K)                  \
+    typedef struct AIL_HSET(K) {          \
+        K *data;                          \
+        u32 len;                          \
+        u32 cap;                          \
+        K empty; /* Sentinel key */       \
+        u32(*hash)(K);                    \
+        bool(*eq)(K, K);                  \
+        AIL_Allocator *allocator;         \
+    } AIL_HSET(K)
+
+#define ail_hset_new_with_alloc(K, emptyKey, hashf, eqf, alPtr) (AIL_HSET(K)) { .data = NULL, .len = 0, .cap = 0, .empty = (emptyKey), .hash = (hashf), .eq = (eqf), .allocator = (alPtr) }
+#define ail_hset_new(K, emptyKey, hashf, eqf) ail_hset_new_with_alloc(K, emptyKey, hashf, eqf, &ail_default_allocator)
+#define ail_hset_free(setPtr) do { (setPtr)->allocator->free_one((setPtr)->allocator->data, (setPtr)->data); (setPtr)->data = NULL; (setPtr)->len = 0; (setPtr)->cap = 0; } while(0)
+#define ail_hset_is_empty_slot(setPtr, idx) AIL_HM_EQ(setPtr, (setPtr)->data[(idx)], (setPtr)->empty)
+
+// The new table is only written through bytes, since no variable of type K can be declared here
+// Slots in it are compared bytewise to the sentinel, which is fine, because they are all exact copies of it or of a key unequal to it
+#define ail_hset_grow(setPtr, newCap) do {                                                                                                         \
+        u32   _ail_hset_grow_cap_  = ail_hm_next_u32_2power(newCap);                                                                               \
+        u32   _ail_hset_grow_size_ = sizeof(*((setPtr)->data));                                                                                    \
+        char *_ail_hset_grow_ptr_  = (char *)(setPtr)->allocator->alloc((setPtr)->allocator->data, _ail_hset_grow_cap_*_ail_hset_grow_size_);      \
+        AIL_ASSERT(_ail_hset_grow_ptr_ != NULL);                                                                                                   \
+        for (u32 _ail_hset_grow_i_ = 0; _ail_hset_grow_i_ < _ail_hset_grow_cap_; _ail_hset_grow_i_++) {                                            \
+            AIL_HM_MEMCPY(&_ail_hset_grow_ptr_[_ail_hset_grow_i_*_ail_hset_grow_size_], &(setPtr)->empty, _ail_hset_grow_size_);                   \
+        }                                                                                                                                          \
+        for (u32 _ail_hset_grow_i_ = 0; _ail_hset_grow_i_ < (setPtr)->cap; _ail_hset_grow_i_++) {                                                  \
+            if (ail_hset_is_empty_slot(setPtr, _ail_hset_grow_i_)) continue;                                                                       \
+            u32 _ail_hset_grow_j_ = AIL_HM_HASH(setPtr, (setPtr)->data[_ail_hset_grow_i_]) & (_ail_hset_grow_cap_ - 1);                            \
+            while (memcmp(&_ail_hset_grow_ptr_[_ail_hset_grow_j_*_ail_hset_grow_size_], &(setPtr)->empty, _ail_hset_grow_size_)) {                 \
+                _ail_hset_grow_j_ = (_ail_hset_grow_j_ + 1) & (_ail_hset_grow_cap_ - 1);                                                           \
+            }                                                                                                                                      \
+            AIL_HM_MEMCPY(&_ail_hset_grow_ptr_[_ail_hset_grow_j_*_ail_hset_grow_size_], &(setPtr)->data[_ail_hset_grow_i_], _ail_hset_grow_size_); \
+        }                                                                                                                                          \
+        if ((setPtr)->data) (setPtr)->allocator->free_one((setPtr)->allocator->data, (setPtr)->data);                                              \
+        (setPtr)->data = (void *)_ail_hset_grow_ptr_;                                                                                              \
+        (setPtr)->cap  = _ail_hset_grow_cap_;                                                                                                      \
+    } while(0)
+
+#define ail_hset_reserve(setPtr, n) do {                                       \
+        if ((u64)(n)*100 >= (u64)(setPtr)->cap*AIL_HM_LOAD_FACTOR) {           \
+            ail_hset_grow(setPtr, (u32)((u64)(n)*100/AIL_HM_LOAD_FACTOR + 1)); \
+        }                                                                      \
+    } while(0)
+
+// Sets `outIdx` to the slot of `k` if it is in the set, or to the empty slot where it would be added otherwise
+#define ail_hset_find_idx(setPtr, k, outIdx, outFound) do {         \
+        (outFound) = false;                                         \
+        if ((setPtr)->cap == 0) break;                              \
+        (outIdx) = AIL_HM_HASH(setPtr, (k)) & ((setPtr)->cap - 1);  \
+        while (!ail_hset_is_empty_slot(setPtr, (outIdx))) {         \
+            if (AIL_HM_EQ(setPtr, (setPtr)->data[(outIdx)], (k))) { \
+                (outFound) = true;                                  \
+                break;                                              \
+            }                                                       \
+            (outIdx) = ((outIdx) + 1) & ((setPtr)->cap - 1);        \
+        }                                                           \
+    } while(0)
+
+#define ail_hset_has(setPtr, k, outFound) do {                      \
+        u32 _ail_hset_has_idx_;                                     \
+        ail_hset_find_idx(setPtr, k, _ail_hset_has_idx_, outFound); \
+    } while(0)
+
+#define ail_hset_add(setPtr, k) do {                                            \
+        u32  _ail_hset_add_idx_;                                                \
+        bool _ail_hset_add_found_;                                              \
+        AIL_ASSERT(!AIL_HM_EQ(setPtr, (k), (setPtr)->empty));                   \
+        ail_hset_reserve(setPtr, (setPtr)->len + 1);                            \
+        ail_hset_find_idx(setPtr, k, _ail_hset_add_idx_, _ail_hset_add_found_); \
+        if (!_ail_hset_add_found_) {                                            \
+            (setPtr)->data[_ail_hset_add_idx_] = (k);                           \
+            (setPtr)->len++;                                                    \
+        }                                                                       \
+    } while(0)
+
+// Following keys are shifted back into the freed slot, unless that would move them before their home slot
+#define ail_hset_rm(setPtr, k) do {                                                                                                            \
+        u32  _ail_hset_rm_i_;                                                                                                                  \
+        bool _ail_hset_rm_found_;                                                                                                              \
+        ail_hset_find_idx(setPtr, k, _ail_hset_rm_i_, _ail_hset_rm_found_);                                                                    \
+        if (!_ail_hset_rm_found_) break;                                                                                                       \
+        u32 _ail_hset_rm_mask_ = (setPtr)->cap - 1;                                                                                            \
+        u32 _ail_hset_rm_j_    = _ail_hset_rm_i_;                                                                                              \
+        for (;;) {                                                                                                                             \
+            _ail_hset_rm_j_ = (_ail_hset_rm_j_ + 1) & _ail_hset_rm_mask_;                                                                      \
+            if (ail_hset_is_empty_slot(setPtr, _ail_hset_rm_j_)) break;                                                                        \
+            u32 _ail_hset_rm_home_ = AIL_HM_HASH(setPtr, (setPtr)->data[_ail_hset_rm_j_]) & _ail_hset_rm_mask_;                                \
+            if (((_ail_hset_rm_j_ - _ail_hset_rm_home_) & _ail_hset_rm_mask_) >= ((_ail_hset_rm_j_ - _ail_hset_rm_i_) & _ail_hset_rm_mask_)) { \
+                (setPtr)->data[_ail_hset_rm_i_] = (setPtr)->data[_ail_hset_rm_j_];                                                             \
+                _ail_hset_rm_i_ = _ail_hset_rm_j_;                                                                                             \
+            }                                                                                                                                  \
+        }                                                                                                                                      \
+        (setPtr)->data[_ail_hset_rm_i_] = (setPtr)->empty;                                                                                     \
+        (setPtr)->len--;                                                                                                                       \
+    } while(0)
+
+/////////////////////////
+// Compact u32 -> u32 Hashmap
+// Entries are only 8 bytes big, as empty slots are marked by the reserved key AIL_HM_U32_EMPTY instead of an occupancy field
+// Keys are hashed with ail_hm_hash_u32, which is called directly, so no function pointers are involved
+/////////////////////////
+#define AIL_HM_U32_EMPTY 0xffffffffU
+
+typedef struct AIL_HM_U32_Entry {
+    u32 key;
+    u32 val;
+} AIL_HM_U32_Entry;
+
+typedef struct AIL_HM_U32 {
+    AIL_HM_U32_Entry *data;
+    u32 len;
+    u32 cap; // Always 0 or a power of 2
+    AIL_Allocator *allocator;
+} AIL_HM_U32;
+
+AIL_HM_DEF        AIL_HM_U32 ail_hm_u32_new          (u32 cap, AIL_Allocator *allocator);
+AIL_HM_DEF        void       ail_hm_u32_free         (AIL_HM_U32 *hm);
+AIL_HM_DEF        void       ail_hm_u32_reserve      (AIL_HM_U32 *hm, u32 n);
+AIL_HM_DEF_INLINE u32*       ail_hm_u32_get_ptr      (const AIL_HM_U32 *hm, u32 key);
+AIL_HM_DEF_INLINE u32*       ail_hm_u32_get_or_insert(AIL_HM_U32 *hm, u32 key, bool *found);
+AIL_HM_DEF_INLINE void       ail_hm_u32_put          (AIL_HM_U32 *hm, u32 key, u32 val);
+AIL_HM_DEF        bool       ail_hm_u32_rm           (AIL_HM_U32 *hm, u32 key);
+
+
 #endif // AIL_HM_H_
 
 #ifdef AIL_HM_IMPL
@@ -215,5 +463,220 @@ AIL_HM_DEF u32 ail_hm_next_u32_2power(u32 x)
     return x;
 }
 
+// "lowbias32" from https://nullprogram.com/blog/2018/07/31/
+AIL_HM_DEF_INLINE u32 ail_hm_hash_u32(u32 x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+// Finalizer of splitmix64
+AIL_HM_DEF_INLINE u32 ail_hm_hash_u64(u64 x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return (u32)x;
+}
+
+AIL_HM_DEF_INLINE u32 ail_hm_hash_ptr(const void *p)
+{
+    return ail_hm_hash_u64((u64)(size_t)p);
+}
+
+// Multiplies a and b to a 128-bit product and folds its halves
+static inline u64 ail_hm_internal_mix(u64 a, u64 b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)a*b;
+    return (u64)r ^ (u64)(r >> 64);
+#else
+    u64 ha = a >> 32, hb = b >> 32, la = (u32)a, lb = (u32)b;
+    u64 rh = ha*hb, rm0 = ha*lb, rm1 = hb*la, rl = la*lb;
+    u64 t  = rl + (rm0 << 32);
+    u64 c  = t < rl;
+    u64 lo = t + (rm1 << 32);
+    c += lo < t;
+    u64 hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    return lo ^ hi;
+#endif
+}
+
+// Unaligned reads in native byte order, so hashes differ between little- and big-endian machines
+static inline u64 ail_hm_internal_read8(const u8 *p) { u64 x; AIL_HM_MEMCPY(&x, p, 8); return x; }
+static inline u64 ail_hm_internal_read4(const u8 *p) { u32 x; AIL_HM_MEMCPY(&x, p, 4); return x; }
+
+AIL_HM_DEF u32 ail_hm_hash_bytes(const void *data, u64 len)
+{
+    static const u64 secret[4] = { 0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL, 0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL };
+    const u8 *p = (const u8 *)data;
+    u64 seed = (u64)AIL_HM_SEED ^ ail_hm_internal_mix((u64)AIL_HM_SEED ^ secret[0], secret[1]);
+    u64 a, b;
+    if (AIL_LIKELY(len <= 16)) {
+        if (len >= 4) {
+            u64 off = (len >> 3) << 2;
+            a = (ail_hm_internal_read4(p) << 32) | ail_hm_internal_read4(p + off);
+            b = (ail_hm_internal_read4(p + len - 4) << 32) | ail_hm_internal_read4(p + len - 4 - off);
+        } else if (len > 0) {
+            a = ((u64)p[0] << 16) | ((u64)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        u64 i = len;
+        if (AIL_UNLIKELY(i > 48)) {
+            u64 see1 = seed, see2 = seed;
+            do {
+                seed = ail_hm_internal_mix(ail_hm_internal_read8(p)      ^ secret[1], ail_hm_internal_read8(p + 8)  ^ seed);
+                see1 = ail_hm_internal_mix(ail_hm_internal_read8(p + 16) ^ secret[2], ail_hm_internal_read8(p + 24) ^ see1);
+                see2 = ail_hm_internal_mix(ail_hm_internal_read8(p + 32) ^ secret[3], ail_hm_internal_read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = ail_hm_internal_mix(ail_hm_internal_read8(p) ^ secret[1], ail_hm_internal_read8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = ail_hm_internal_read8(p + i - 16);
+        b = ail_hm_internal_read8(p + i - 8);
+    }
+    return (u32)ail_hm_internal_mix(secret[1] ^ len, ail_hm_internal_mix(a ^ secret[1], b ^ seed));
+}
+
+AIL_HM_DEF_INLINE u32 ail_hm_hash_str(str s)
+{
+    return ail_hm_hash_bytes(s, strlen(s));
+}
+
+AIL_HM_DEF_INLINE bool ail_hm_eq_u32(u32 a, u32 b)
+{
+    return a == b;
+}
+
+AIL_HM_DEF_INLINE bool ail_hm_eq_u64(u64 a, u64 b)
+{
+    return a == b;
+}
+
+AIL_HM_DEF_INLINE bool ail_hm_eq_str(str a, str b)
+{
+    return strcmp(a, b) == 0;
+}
+
+#ifdef AIL_SV_H_
+AIL_HM_DEF_INLINE u32 ail_hm_hash_sv(AIL_SV sv)
+{
+    return ail_hm_hash_bytes(sv.str, sv.len);
+}
+
+AIL_HM_DEF_INLINE bool ail_hm_eq_sv(AIL_SV a, AIL_SV b)
+{
+    return a.len == b.len && memcmp(a.str, b.str, a.len) == 0;
+}
+#endif // AIL_SV_H_
+
+AIL_HM_U32 ail_hm_u32_new(u32 cap, AIL_Allocator *allocator)
+{
+    AIL_HM_U32 hm = { NULL, 0, 0, allocator };
+    if (cap) ail_hm_u32_reserve(&hm, cap);
+    return hm;
+}
+
+void ail_hm_u32_free(AIL_HM_U32 *hm)
+{
+    if (hm->data) hm->allocator->free_one(hm->allocator->data, hm->data);
+    hm->data = NULL;
+    hm->len  = 0;
+    hm->cap  = 0;
+}
+
+static void ail_hm_u32_internal_grow(AIL_HM_U32 *hm, u32 new_cap)
+{
+    AIL_HM_U32_Entry *old     = hm->data;
+    u32               old_cap = hm->cap;
+    hm->cap  = ail_hm_next_u32_2power(new_cap);
+    hm->data = (AIL_HM_U32_Entry *)hm->allocator->alloc(hm->allocator->data, hm->cap*sizeof(AIL_HM_U32_Entry));
+    AIL_ASSERT(hm->data != NULL);
+    memset(hm->data, 0xff, hm->cap*sizeof(AIL_HM_U32_Entry)); // Sets all keys to AIL_HM_U32_EMPTY
+    u32 mask = hm->cap - 1;
+    for (u32 i = 0; i < old_cap; i++) {
+        if (old[i].key == AIL_HM_U32_EMPTY) continue;
+        u32 j = ail_hm_hash_u32(old[i].key) & mask;
+        while (hm->data[j].key != AIL_HM_U32_EMPTY) j = (j + 1) & mask;
+        hm->data[j] = old[i];
+    }
+    if (old) hm->allocator->free_one(hm->allocator->data, old);
+}
+
+void ail_hm_u32_reserve(AIL_HM_U32 *hm, u32 n)
+{
+    if ((u64)n*100 >= (u64)hm->cap*AIL_HM_LOAD_FACTOR) ail_hm_u32_internal_grow(hm, (u32)((u64)n*100/AIL_HM_LOAD_FACTOR + 1));
+}
+
+AIL_HM_DEF_INLINE u32 *ail_hm_u32_get_ptr(const AIL_HM_U32 *hm, u32 key)
+{
+    // The sentinel would match the first empty slot of its probe sequence
+    if (AIL_UNLIKELY(hm->cap == 0 || key == AIL_HM_U32_EMPTY)) return NULL;
+    u32 mask = hm->cap - 1;
+    for (u32 i = ail_hm_hash_u32(key) & mask;; i = (i + 1) & mask) {
+        if (hm->data[i].key == key)              return &hm->data[i].val;
+        if (hm->data[i].key == AIL_HM_U32_EMPTY) return NULL;
+    }
+}
+
+AIL_HM_DEF_INLINE u32 *ail_hm_u32_get_or_insert(AIL_HM_U32 *hm, u32 key, bool *found)
+{
+    AIL_ASSERT(key != AIL_HM_U32_EMPTY);
+    ail_hm_u32_reserve(hm, hm->len + 1);
+    u32 mask = hm->cap - 1;
+    u32 i    = ail_hm_hash_u32(key) & mask;
+    while (hm->data[i].key != key && hm->data[i].key != AIL_HM_U32_EMPTY) i = (i + 1) & mask;
+    *found = hm->data[i].key == key;
+    if (!*found) {
+        hm->data[i].key = key;
+        hm->data[i].val = 0;
+        hm->len++;
+    }
+    return &hm->data[i].val;
+}
+
+AIL_HM_DEF_INLINE void ail_hm_u32_put(AIL_HM_U32 *hm, u32 key, u32 val)
+{
+    bool found;
+    *ail_hm_u32_get_or_insert(hm, key, &found) = val;
+}
+
+bool ail_hm_u32_rm(AIL_HM_U32 *hm, u32 key)
+{
+    if (AIL_UNLIKELY(hm->cap == 0 || key == AIL_HM_U32_EMPTY)) return false;
+    u32 mask = hm->cap - 1;
+    u32 i    = ail_hm_hash_u32(key) & mask;
+    while (hm->data[i].key != key) {
+        if (hm->data[i].key == AIL_HM_U32_EMPTY) return false;
+        i = (i + 1) & mask;
+    }
+    // Shift following entries back into the freed slot, unless that would move them before their home slot
+    for (u32 j = (i + 1) & mask; hm->data[j].key != AIL_HM_U32_EMPTY; j = (j + 1) & mask) {
+        u32 home = ail_hm_hash_u32(hm->data[j].key) & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            hm->data[i] = hm->data[j];
+            i = j;
+        }
+    }
+    hm->data[i].key = AIL_HM_U32_EMPTY;
+    hm->len--;
+    return true;
+}
+
 #endif // AIL_HM_IMPL_GUARD
 #endif // AIL_HM_IMPL
\ No newline at end of file
@@ -6,6 +6,21 @@
 // and allows the system to keppt track of and report where memory is beeing allocated, how much and if the memory is beeing freed.
 // This is very useful for finding memory leaks in large applications.
 // The system can also over allocate memory and fill it with a magic number and can therfor detect if the application writes outside of the allocated memory.
+// The bounds of an allocation are checked whenever it is freed or reallocated. Define AIL_MD_CHECK_ALL_ON_ALLOC to check the bounds of all allocations on every allocation as well.
+// This is much slower, but will find overshoots sooner.
+//
+// The debugger is thread-safe and designed to have a small enough overhead to be left on during development:
+// - Live allocations are stored in a hash table that is sharded by the pointer's address, where each shard has its own spin-lock.
+// - Allocation sites are interned by the pointer to their file name and their line number in a lock-free table, with atomic counters per site.
+//   Only the first allocation from each (pointer, line) pair reads the file name, to merge the copies of a header's name from different translation units.
+// - Each thread additionally keeps its own statistics, which can be queried with ail_md_thread_stats().
+//
+// If AIL_MD_SAMPLE is enabled instead, malloc, calloc, realloc and free are replaced with a sampling heap profiler, which is cheap enough to be used in production.
+// Like tcmalloc's heap profiler, it records on average one allocation per AIL_MD_SAMPLE_RATE allocated bytes (with Poisson-distributed gaps between the samples),
+// together with a short backtrace (only available with glibc and on macOS, otherwise only the allocating file & line are recorded).
+// Each sample is weighted by the amount of memory it represents, so that the profile estimates the real live heap.
+// The profile of all live samples can be written at any time in the collapsed-stack format (for flamegraph.pl and similar tools)
+// or in gperftools' legacy heap profile format, which can be read by pprof. That format holds the raw sampled sizes, since pprof does the unsampling itself.
 //
 // If AIL_MD_EXIT is defined, then exit(); will be replaced with a funtion that writes to NULL.
 // This will make it trivial to find out where an application exits using any debugger.
@@ -89,20 +104,55 @@ SOFTWARE.
 #include <stdlib.h>
 #include <stdio.h>
 
-AIL_MD_DEF void ail_md_mem_init(void (*lock)(void *mutex), void (*unlock)(void *mutex), void *mutex); // Required for memory debugger to be thread safe
+#ifndef AIL_MD_SHARDS_LOG2
+#define AIL_MD_SHARDS_LOG2 6 // The hash table of allocations is split into 2^AIL_MD_SHARDS_LOG2 independently locked shards
+#endif
+#ifndef AIL_MD_MAX_SITES
+#define AIL_MD_MAX_SITES 4096 // Maximum amount of distinct allocation sites, must be a power of 2. Any further sites are collected into a single overflow site
+#endif
+#ifndef AIL_MD_OVER_ALLOC
+#define AIL_MD_OVER_ALLOC 256 // Amount of bytes after each allocation that are used to detect overshoots
+#endif
+
+#ifndef AIL_MD_SAMPLE_RATE
+#define AIL_MD_SAMPLE_RATE (512*1024) // Average amount of bytes allocated between two samples in sampling mode
+#endif
+#ifndef AIL_MD_SAMPLE_DEPTH
+#define AIL_MD_SAMPLE_DEPTH 16 // Maximum amount of stack frames recorded per sample
+#endif
+
+typedef struct AIL_MD_Stats {
+	u64 allocs;          // Amount of calls to malloc & calloc
+	u64 reallocs;
+	u64 frees;
+	u64 bytes_allocated; // Sum of all requested bytes (including the new sizes given to realloc)
+	u64 bytes_freed;     // Sum of all freed bytes (including the old sizes of reallocated memory)
+} AIL_MD_Stats;
+
+AIL_MD_DEF void ail_md_mem_init(void (*lock)(void *mutex), void (*unlock)(void *mutex), void *mutex); // No longer required for thread-safety, only kept for compatibility
 AIL_MD_DEF void *ail_md_malloc(u64 size, char *file, u32 line); // Replaces malloc and records the c file and line where it was called
 AIL_MD_DEF void *ail_md_calloc(u64 nelem, u64 elsize, char *file, u32 line); // Replaces calloc and records the c file and line where it was called
 AIL_MD_DEF void *ail_md_realloc(void *pointer, u64 size, char *file, u32 line); // Replaces realloc and records the c file and line where it was called
 AIL_MD_DEF void ail_md_free(void *buf, char *file, u32 line); // Replaces free and records the c file and line where it was called
 AIL_MD_DEF bool ail_md_comment(void *buf, char *comment); // add a comment to an allocation that can help identyfy its use.
 AIL_MD_DEF void ail_md_print(u32 min_allocs); // Prints out a list of all allocations made, their location, how much memorey each has allocated, freed, and how many allocations have been made. The min_allocs parameter can be set to avoid printing any allocations that have been made fewer times then min_allocs
-AIL_MD_DEF void ail_md_reset(void); // ail_md_reset allows you to clear all memory stored in the debugging system if you only want to record allocations after a specific point in your code
+AIL_MD_DEF void ail_md_reset(void); // ail_md_reset allows you to clear all memory stored in the debugging system if you only want to record allocations after a specific point in your code. Must not be called while other threads are allocating
 AIL_MD_DEF u64 ail_md_consumption(void); // add up all memory consumed by mallocsd and reallocs coverd by the memory debugger .
+AIL_MD_DEF AIL_MD_Stats ail_md_thread_stats(void); // Statistics about all allocations made by the calling thread
 AIL_MD_DEF bool ail_md_query(void *pointer, u32 *line, char **file, u64 *size); // query the size and place of allocation of a pointer
 AIL_MD_DEF bool ail_md_test(void *pointer, u64 size, bool ignore_not_found); // query if a bit of memory is safe to access.
-AIL_MD_DEF bool ail_md_mem(); //ail_md_mem checks if any of the bounds of any allocation has been over written and reports where to standard out. The function returns true if any error was found
+AIL_MD_DEF bool ail_md_mem(void); //ail_md_mem checks if any of the bounds of any allocation has been over written and reports where to standard out. The function returns true if any error was found
 AIL_MD_DEF void exit_crash(u32 i); // finction guaranteed to crash (Writes to NULL).
 
+AIL_MD_DEF void  ail_md_sample_set_rate(u64 bytes); // Changes the average amount of bytes between two samples
+AIL_MD_DEF void *ail_md_sample_malloc(u64 size, char *file, u32 line);
+AIL_MD_DEF void *ail_md_sample_calloc(u64 nelem, u64 elsize, char *file, u32 line);
+AIL_MD_DEF void *ail_md_sample_realloc(void *pointer, u64 size, char *file, u32 line);
+AIL_MD_DEF void  ail_md_sample_free(void *pointer);
+AIL_MD_DEF u64   ail_md_sample_live(void); // Estimated amount of live bytes, based on the sampled allocations
+AIL_MD_DEF void  ail_md_sample_dump_collapsed(FILE *f); // Writes one line `frame;frame;...;file:line bytes` per live sample, starting at the outermost frame
+AIL_MD_DEF void  ail_md_sample_dump_pprof(FILE *f);     // Writes all live samples per stack in the legacy heap profile format of gperftools
+
 AIL_MD_DEF void *ail_md_mem_fopen(const char *file_name, const char *mode, char *file, u32 line);
 AIL_MD_DEF void ail_md_mem_fclose(void *f, char *file, u32 line);
 
@@ -118,55 +168,64 @@ AIL_MD_DEF void ail_md_mem_fclose(void *f, char *file, u32 line);
 #define AIL_MD_MEM_INTERNAL
 #define AIL_MD_NO_AIL_MD
 
-AIL_MD_DEF void ail_md_print(u32 min_allocs);
-
-#define AIL_MD_OVER_ALLOC 256
 #define AIL_MD_MAGIC_NUM 132
+#define AIL_MD_SHARDS (1 << AIL_MD_SHARDS_LOG2)
+#define AIL_MD_FREED_PER_SHARD 32 // Size of the ring buffer of recently freed pointers per shard, used for reporting double frees
+#define AIL_MD_SITE_OVERFLOW AIL_MD_MAX_SITES
+#define AIL_MD_SITE_REFS (2*AIL_MD_MAX_SITES) // Size of the table from (file pointer, line) to site, each site can be reached from several copies of its file name
+
 typedef struct{
-	u32 size;
-	void *buf;
+	void *buf; // NULL for empty slots
+	u64 size;
+	u32 site;
 	char *comment;
 }STMemAllocBuf;
 
 typedef struct{
+	char *file;
 	u32 line;
-	char file[256];
-	STMemAllocBuf *allocs;
-	u32 alloc_count;
-	u64 alloc_alocated;
-	u64 size;
-	u64 alocated;
-	u64 freed;
+	u32 state;    // 0 = empty, 1 = being written, 2 = ready
+	u64 size;     // Bytes currently allocated from this site
+	u64 alocated; // Amount of allocations made from this site
+	u64 freed;    // Amount of allocations from this site that were freed again
 }STMemAllocLine;
 
-STMemAllocLine ail_md_alloc_lines[1024];
-u32 ail_md_alloc_line_count = 0;
-
-#define AIL_MD_FREE_POINTER_BUFFER_SIZE 1024
+typedef struct{
+	char *file;
+	u32 line;
+	u32 state; // Same as in STMemAllocLine
+	u32 site;
+}STMemSiteRef;
 
 typedef struct {
-	u32 alloc_line;
-	char alloc_file[256];
+	u32 alloc_site;
 	u32 free_line;
-	char free_file[256];
+	char *free_file;
 	u64 size;
 	void *pointer;
 	bool realloc;
 } STMemFreeBuf;
 
-STMemFreeBuf ail_md_freed_memory[AIL_MD_FREE_POINTER_BUFFER_SIZE];
-u32 ail_md_freed_memory_current = 0;
-u32 ail_md_freed_memory_count = 0;
+typedef struct {
+	u32 lock;
+	u32 count;
+	u32 cap; // Always a power of 2 (or 0)
+	u32 freed_current;
+	u32 freed_count;
+	STMemAllocBuf *allocs;
+	STMemFreeBuf freed[AIL_MD_FREED_PER_SHARD];
+} STMemShard;
 
-void *ail_md_alloc_mutex = NULL;
-void (*ail_md_alloc_mutex_lock)(void *mutex) = NULL;
-void (*ail_md_alloc_mutex_unlock)(void *mutex) = NULL;
+STMemAllocLine ail_md_alloc_lines[AIL_MD_MAX_SITES + 1];
+STMemSiteRef   ail_md_site_refs[AIL_MD_SITE_REFS];
+STMemShard     ail_md_shards[AIL_MD_SHARDS];
+static AIL_THREAD_LOCAL AIL_MD_Stats ail_md_stats;
 
 void ail_md_mem_init(void (*lock)(void *mutex), void (*unlock)(void *mutex), void *mutex)
 {
-	ail_md_alloc_mutex = mutex;
-	ail_md_alloc_mutex_lock = lock;
-	ail_md_alloc_mutex_unlock = unlock;
+	AIL_UNUSED(lock);
+	AIL_UNUSED(unlock);
+	AIL_UNUSED(mutex);
 }
 
 
@@ -183,231 +242,340 @@ void ail_md_mem_fclose(void *f, char *file, u32 line)
 {
 	(void)file;
 	(void)line;
-	fclose(f);
+	fclose((FILE *)f);
+}
+
+static u64 ail_md_hash_ptr(void *pointer)
+{
+	// Finalizer of MurmurHash3, which mixes all bits of the address into all bits of the hash
+	u64 h = (u64)(uintptr_t)pointer;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
 }
 
+// FNV-1a over the characters of the string, so that copies of the same file name in different translation units get the same hash
+static u64 ail_md_hash_str(const char *str)
+{
+	u64 h = 0xcbf29ce484222325ULL;
+	for(; *str; str++)
+		h = (h ^ (u8)*str) * 0x100000001b3ULL;
+	return h;
+}
 
-bool ail_md_mem()
+static STMemShard *ail_md_shard(void *pointer)
 {
-	bool output = false;
-	u32 i, j, k;
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_lock(ail_md_alloc_mutex);
-	for(i = 0; i < ail_md_alloc_line_count; i++)
+	return &ail_md_shards[ail_md_hash_ptr(pointer) & (AIL_MD_SHARDS - 1)];
+}
+
+static u32 ail_md_slot(STMemShard *shard, void *pointer)
+{
+	return (u32)(ail_md_hash_ptr(pointer) >> AIL_MD_SHARDS_LOG2) & (shard->cap - 1);
+}
+
+// Finds the site for the given file and line or creates it, if it doesn't exist yet
+// Sites are never removed (except in ail_md_reset), so lookups don't need any locks. Creating a site only needs a single CAS
+// The slot is chosen by the contents of `file` rather than its address, so that every copy of a file name probes the same slots
+// This walks the whole file name, so it is only called by ail_md_site for pointers that weren't seen before
+static u32 ail_md_site_intern(char *file, u32 line)
+{
+	u32 mask = AIL_MD_MAX_SITES - 1;
+	u32 i = (u32)(ail_md_hash_str(file) ^ (line * 0x9e3779b9u)) & mask;
+	for(u32 probes = 0; probes < AIL_MD_MAX_SITES; probes++, i = (i + 1) & mask)
 	{
-		for(j = 0; j < ail_md_alloc_lines[i].alloc_count; j++)
+		STMemAllocLine *site = &ail_md_alloc_lines[i];
+		u32 state = AIL_ATOMIC_LOAD_ACQUIRE(&site->state);
+		if(state == 0)
 		{
-			u8 *buf;
-			u64 size;
-			buf = ail_md_alloc_lines[i].allocs[j].buf;
-			size = ail_md_alloc_lines[i].allocs[j].size;
-			for(k = 0; k < AIL_MD_OVER_ALLOC; k++)
-				if(buf[size + k] != AIL_MD_MAGIC_NUM)
-					break;
-			if(k < AIL_MD_OVER_ALLOC)
+			u32 expected = 0;
+			if(AIL_ATOMIC_CAS(&site->state, &expected, 1))
 			{
-				if(ail_md_alloc_lines[i].allocs[j].comment == NULL)
-					printf("MEM ERROR: Overshoot at line %u in file %s\n", ail_md_alloc_lines[i].line, ail_md_alloc_lines[i].file);
-				else
-					printf("MEM ERROR: Overshoot at line %u in file %s /* %s */\n", ail_md_alloc_lines[i].line, ail_md_alloc_lines[i].file, ail_md_alloc_lines[i].allocs[j].comment);
-				{
-					u32 *X = NULL;
-					X[0] = 0;
-				}
-				output = true;
+				site->file = file;
+				site->line = line;
+				AIL_ATOMIC_STORE_RELEASE(&site->state, 2);
+				return i;
 			}
+			state = expected;
 		}
-		// if(output)
-		// 	exit(0);
+		while(state == 1)
+		{
+			AIL_CPU_RELAX();
+			state = AIL_ATOMIC_LOAD_ACQUIRE(&site->state);
+		}
+		// The same header can be included in several translation units, which each have their own copy of the file's name
+		if(site->line == line && (site->file == file || strcmp(site->file, file) == 0))
+			return i;
 	}
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_unlock(ail_md_alloc_mutex);
-	return output;
+	// Every thread writes the same values here, so no synchronization is needed
+	ail_md_alloc_lines[AIL_MD_SITE_OVERFLOW].file = (char *)"(too many allocation sites)";
+	AIL_ATOMIC_STORE_RELEASE(&ail_md_alloc_lines[AIL_MD_SITE_OVERFLOW].state, 2);
+	return AIL_MD_SITE_OVERFLOW;
 }
 
-void ail_md_add(void *pointer, u64 size, char *file, u32 line)
+// Finds the site for the given file and line by the address of `file`, which is the same for every call from the same place
+// Only pointers that weren't seen before are looked up by their contents with ail_md_site_intern, the result is then remembered the same lock-free way
+static u32 ail_md_site(char *file, u32 line)
 {
-	u32 i, j;
-	for(i = 0; i < AIL_MD_OVER_ALLOC; i++)
-		((u8 *)pointer)[size + i] = AIL_MD_MAGIC_NUM;
-
-	for(i = 0; i < ail_md_alloc_line_count; i++)
+	u32 mask = AIL_MD_SITE_REFS - 1;
+	u32 i = (u32)(ail_md_hash_ptr(file) ^ (line * 0x9e3779b9u)) & mask;
+	u32 site = AIL_MD_SITE_OVERFLOW + 1; // Not interned yet
+	for(u32 probes = 0; probes < AIL_MD_SITE_REFS; probes++, i = (i + 1) & mask)
 	{
-		if(line == ail_md_alloc_lines[i].line)
+		STMemSiteRef *ref = &ail_md_site_refs[i];
+		u32 state = AIL_ATOMIC_LOAD_ACQUIRE(&ref->state);
+		if(state == 0)
 		{
-			for(j = 0; file[j] != 0 && file[j] == ail_md_alloc_lines[i].file[j] ; j++);
-			if(file[j] == ail_md_alloc_lines[i].file[j])
-				break;
+			if(site > AIL_MD_SITE_OVERFLOW)
+				site = ail_md_site_intern(file, line);
+			u32 expected = 0;
+			if(AIL_ATOMIC_CAS(&ref->state, &expected, 1))
+			{
+				ref->file = file;
+				ref->line = line;
+				ref->site = site;
+				AIL_ATOMIC_STORE_RELEASE(&ref->state, 2);
+				return site;
+			}
+			state = expected;
 		}
+		while(state == 1)
+		{
+			AIL_CPU_RELAX();
+			state = AIL_ATOMIC_LOAD_ACQUIRE(&ref->state);
+		}
+		if(ref->file == file && ref->line == line)
+			return ref->site;
 	}
-	if(i < ail_md_alloc_line_count)
+	return site > AIL_MD_SITE_OVERFLOW ? ail_md_site_intern(file, line) : site;
+}
+
+// Returns the index of pointer in the shard or shard->cap if it could not be found
+// The shard needs to be locked
+static u32 ail_md_shard_find(STMemShard *shard, void *pointer)
+{
+	if(shard->cap == 0)
+		return 0;
+	u32 mask = shard->cap - 1;
+	for(u32 i = ail_md_slot(shard, pointer); shard->allocs[i].buf != NULL; i = (i + 1) & mask)
+		if(shard->allocs[i].buf == pointer)
+			return i;
+	return shard->cap;
+}
+
+// The shard needs to be locked
+static void ail_md_shard_insert(STMemShard *shard, STMemAllocBuf rec)
+{
+	if((shard->count + 1) * 4 > shard->cap * 3)
 	{
-		if(ail_md_alloc_lines[i].alloc_alocated == ail_md_alloc_lines[i].alloc_count)
+		STMemAllocBuf *old = shard->allocs;
+		u32 old_cap = shard->cap;
+		shard->cap = old_cap ? 2*old_cap : 256;
+		shard->allocs = (STMemAllocBuf *)calloc(shard->cap, sizeof(*shard->allocs));
+		if(shard->allocs == NULL)
 		{
-			ail_md_alloc_lines[i].alloc_alocated += 1024;
-			ail_md_alloc_lines[i].allocs = realloc(ail_md_alloc_lines[i].allocs, (sizeof *ail_md_alloc_lines[i].allocs) * ail_md_alloc_lines[i].alloc_alocated);
-			if(ail_md_alloc_lines[i].allocs == NULL)
-			{
-				printf("MEM ERROR: Realloc returns NULL when trying to allocate %llu bytes at line %u in file %s\n", size, line, file);
-				exit(0);
-			}
+			printf("MEM ERROR: The memory debugger failed to allocate memory for its own bookkeeping\n");
+			exit(0);
 		}
-		ail_md_alloc_lines[i].allocs[ail_md_alloc_lines[i].alloc_count].size = size;
-		ail_md_alloc_lines[i].allocs[ail_md_alloc_lines[i].alloc_count].comment = NULL;
-		ail_md_alloc_lines[i].allocs[ail_md_alloc_lines[i].alloc_count++].buf = pointer;
-		ail_md_alloc_lines[i].size += size;
-		ail_md_alloc_lines[i].alocated++;
-	}else
+		shard->count = 0;
+		for(u32 i = 0; i < old_cap; i++)
+			if(old[i].buf != NULL)
+				ail_md_shard_insert(shard, old[i]);
+		free(old);
+	}
+	u32 i, mask = shard->cap - 1;
+	for(i = ail_md_slot(shard, rec.buf); shard->allocs[i].buf != NULL; i = (i + 1) & mask);
+	shard->allocs[i] = rec;
+	shard->count++;
+}
+
+// Removes the slot at index i, by shifting back all following entries that would otherwise not be found anymore
+// The shard needs to be locked
+static void ail_md_shard_remove_at(STMemShard *shard, u32 i)
+{
+	u32 mask = shard->cap - 1;
+	for(u32 j = (i + 1) & mask; shard->allocs[j].buf != NULL; j = (j + 1) & mask)
 	{
-		if(i < 1024)
+		u32 home = ail_md_slot(shard, shard->allocs[j].buf);
+		// Move entry j into the hole at i, if its home slot does not lie cyclically in (i, j]
+		if(((j - home) & mask) >= ((j - i) & mask))
 		{
-			ail_md_alloc_lines[i].line = line;
-			for(j = 0; j < 255 && file[j] != 0; j++)
-				ail_md_alloc_lines[i].file[j] = file[j];
-			ail_md_alloc_lines[i].file[j] = 0;
-			ail_md_alloc_lines[i].alloc_alocated = 256;
-			ail_md_alloc_lines[i].allocs = malloc((sizeof *ail_md_alloc_lines[i].allocs) * ail_md_alloc_lines[i].alloc_alocated);
-			ail_md_alloc_lines[i].allocs[0].size = size;
-			ail_md_alloc_lines[i].allocs[0].buf = pointer;
-			ail_md_alloc_lines[i].allocs[0].comment = NULL;
-			ail_md_alloc_lines[i].alloc_count = 1;
-			ail_md_alloc_lines[i].size = size;
-			ail_md_alloc_lines[i].freed = 0;
-			ail_md_alloc_lines[i].alocated++;
-			ail_md_alloc_line_count++;
+			shard->allocs[i] = shard->allocs[j];
+			i = j;
 		}
 	}
-	for(i = 0; i < ail_md_freed_memory_count; i++)
+	shard->allocs[i].buf = NULL;
+	shard->allocs[i].comment = NULL;
+	shard->count--;
+}
+
+static bool ail_md_overshot(STMemAllocBuf *rec)
+{
+	u32 k;
+	for(k = 0; k < AIL_MD_OVER_ALLOC; k++)
+		if(((u8 *)rec->buf)[rec->size + k] != AIL_MD_MAGIC_NUM)
+			return true;
+	return false;
+}
+
+bool ail_md_mem(void)
+{
+	bool output = false;
+	u32 s, i;
+	for(s = 0; s < AIL_MD_SHARDS; s++)
 	{
-		if(pointer == ail_md_freed_memory[i].pointer)
+		STMemShard *shard = &ail_md_shards[s];
+		AIL_SPIN_LOCK(&shard->lock);
+		for(i = 0; i < shard->cap; i++)
 		{
-			ail_md_freed_memory[i] = ail_md_freed_memory[--ail_md_freed_memory_count];
-			break;
+			STMemAllocBuf *rec = &shard->allocs[i];
+			if(rec->buf != NULL && ail_md_overshot(rec))
+			{
+				STMemAllocLine *site = &ail_md_alloc_lines[rec->site];
+				if(rec->comment == NULL)
+					printf("MEM ERROR: Overshoot at line %u in file %s\n", site->line, site->file);
+				else
+					printf("MEM ERROR: Overshoot at line %u in file %s /* %s */\n", site->line, site->file, rec->comment);
+				{
+					u32 *X = NULL;
+					X[0] = 0;
+				}
+				output = true;
+			}
 		}
+		AIL_SPIN_UNLOCK(&shard->lock);
 	}
+	return output;
+}
+
+void ail_md_add(void *pointer, u64 size, char *file, u32 line)
+{
+	STMemAllocBuf rec;
+	STMemShard *shard;
+	STMemAllocLine *site;
+	memset((u8 *)pointer + size, AIL_MD_MAGIC_NUM, AIL_MD_OVER_ALLOC);
+
+	rec.buf = pointer;
+	rec.size = size;
+	rec.site = ail_md_site(file, line);
+	rec.comment = NULL;
+	site = &ail_md_alloc_lines[rec.site];
+	AIL_ATOMIC_ADD(&site->size, size);
+	AIL_ATOMIC_ADD(&site->alocated, 1);
+	ail_md_stats.bytes_allocated += size;
+
+	shard = ail_md_shard(pointer);
+	AIL_SPIN_LOCK(&shard->lock);
+	ail_md_shard_insert(shard, rec);
+	AIL_SPIN_UNLOCK(&shard->lock);
 }
 
 void *ail_md_malloc(u64 size, char *file, u32 line)
 {
 	void *pointer;
-	u32 i;
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_lock(ail_md_alloc_mutex);
+#ifdef AIL_MD_CHECK_ALL_ON_ALLOC
 	ail_md_mem();
+#endif
 	pointer = malloc(size + AIL_MD_OVER_ALLOC);
 
 #ifdef AIL_MD_MEM_PRINT
-	printf("Malloc %6llu bytes at pointer %p at %s line %u\n", size, pointer, file, line);
+	printf("Malloc %6llu bytes at pointer %p at %s line %u\n", (unsigned long long)size, pointer, file, line);
 #endif
 	if(pointer == NULL)
 	{
-		printf("MEM ERROR: Malloc returns NULL when trying to allocate %llu bytes at line %u in file %s\n", size, line, file);
-		if(ail_md_alloc_mutex != NULL)
-			ail_md_alloc_mutex_unlock(ail_md_alloc_mutex);
+		printf("MEM ERROR: Malloc returns NULL when trying to allocate %llu bytes at line %u in file %s\n", (unsigned long long)size, line, file);
 		ail_md_print(0);
 		exit(0);
 	}
-	for(i = 0; i < size + AIL_MD_OVER_ALLOC; i++)
- 		((u8 *)pointer)[i] = AIL_MD_MAGIC_NUM + 1;
+	memset(pointer, AIL_MD_MAGIC_NUM + 1, size);
 	ail_md_add(pointer, size, file, line);
-
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_unlock(ail_md_alloc_mutex);
+	ail_md_stats.allocs++;
 	return pointer;
 }
 
 void *ail_md_calloc(u64 nelem, u64 elsize, char *file, u32 line)
 {
 	void *pointer;
-	u32 i;
 	u64 size = nelem * elsize;
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_lock(ail_md_alloc_mutex);
+#ifdef AIL_MD_CHECK_ALL_ON_ALLOC
 	ail_md_mem();
+#endif
 	pointer = malloc(size + AIL_MD_OVER_ALLOC);
 
 #ifdef AIL_MD_MEM_PRINT
-	printf("Calloc %llu bytes at pointer %p at %s line %u\n", size, pointer, file, line);
+	printf("Calloc %llu bytes at pointer %p at %s line %u\n", (unsigned long long)size, pointer, file, line);
 #endif
 	if(pointer == NULL)
 	{
-		printf("MEM ERROR: Calloc returns NULL when trying to allocate %llu bytes at line %u in file %s\n", size, line, file);
-		if(ail_md_alloc_mutex != NULL)
-			ail_md_alloc_mutex_unlock(ail_md_alloc_mutex);
+		printf("MEM ERROR: Calloc returns NULL when trying to allocate %llu bytes at line %u in file %s\n", (unsigned long long)size, line, file);
 		ail_md_print(0);
 		exit(0);
 	}
-	for(i = 0; i < size; i++)
- 		((u8 *)pointer)[i] = 0;
-	for(i = size; i < size + AIL_MD_OVER_ALLOC; i++)
-		((u8 *)pointer)[i] = AIL_MD_MAGIC_NUM + 1;
+	memset(pointer, 0, size);
 	ail_md_add(pointer, size, file, line);
-
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_unlock(ail_md_alloc_mutex);
+	ail_md_stats.allocs++;
 	return pointer;
 }
 
 
 bool ail_md_remove(void *buf, char *file, u32 line, bool realloc, u64 *size)
 {
-	STMemFreeBuf  *f;
-	u32 i, j, k;
-
-	f = &ail_md_freed_memory[ail_md_freed_memory_current];
-	ail_md_freed_memory_current = (ail_md_freed_memory_current + 1) % AIL_MD_FREE_POINTER_BUFFER_SIZE;
-	if(ail_md_freed_memory_current > ail_md_freed_memory_count)
-		ail_md_freed_memory_count = ail_md_freed_memory_current;
-	for(i = 0; i < 255 && file[i] != 0; i++)
-		f->free_file[i] = file[i];
-	f->free_file[i] = 0;
-	f->free_line = line;
-	f->realloc = realloc;
-	f->pointer = buf;
-
-	for(i = 0; i < ail_md_alloc_line_count; i++)
+	STMemShard *shard = ail_md_shard(buf);
+	STMemFreeBuf *f;
+	u32 i;
+
+	AIL_SPIN_LOCK(&shard->lock);
+	i = ail_md_shard_find(shard, buf);
+	if(i < shard->cap)
 	{
-		for(j = 0; j < ail_md_alloc_lines[i].alloc_count; j++)
+		STMemAllocBuf *rec = &shard->allocs[i];
+		STMemAllocLine *site = &ail_md_alloc_lines[rec->site];
+		if(ail_md_overshot(rec))
 		{
-			if(ail_md_alloc_lines[i].allocs[j].buf == buf)
-			{
-				for(k = 0; k < AIL_MD_OVER_ALLOC; k++)
-					if(((u8 *)buf)[ail_md_alloc_lines[i].allocs[j].size + k] != AIL_MD_MAGIC_NUM)
-						break;
-				if(k < AIL_MD_OVER_ALLOC)
-				{
-					u32 *a = NULL;
-					printf("MEM ERROR: Overshoot at line %u in file %s\n", ail_md_alloc_lines[i].line, ail_md_alloc_lines[i].file);
-					exit(0);
-					a[0] = 0;
-				}
-				for(k = 0; k < ail_md_alloc_lines[i].allocs[j].size; k++)
-					((u8 *)buf)[k] = 255;
-				f->alloc_line = ail_md_alloc_lines[i].line;
-				for(k = 0; k < 255 && ail_md_alloc_lines[i].file[k] != 0; k++)
-					f->alloc_file[k] = ail_md_alloc_lines[i].file[k];
-				f->alloc_file[k] = 0;
-				f->size = ail_md_alloc_lines[i].allocs[j].size;
-				*size = ail_md_alloc_lines[i].allocs[j].size;
-				ail_md_alloc_lines[i].size -= ail_md_alloc_lines[i].allocs[j].size;
-				ail_md_alloc_lines[i].allocs[j] = ail_md_alloc_lines[i].allocs[--ail_md_alloc_lines[i].alloc_count];
-				ail_md_alloc_lines[i].freed++;
-				return true;
-			}
+			u32 *a = NULL;
+			printf("MEM ERROR: Overshoot at line %u in file %s\n", site->line, site->file);
+			exit(0);
+			a[0] = 0;
 		}
+		memset(buf, 255, rec->size);
+
+		f = &shard->freed[shard->freed_current];
+		shard->freed_current = (shard->freed_current + 1) % AIL_MD_FREED_PER_SHARD;
+		if(shard->freed_current > shard->freed_count)
+			shard->freed_count = shard->freed_current;
+		f->free_file = file;
+		f->free_line = line;
+		f->realloc = realloc;
+		f->pointer = buf;
+		f->alloc_site = rec->site;
+		f->size = rec->size;
+
+		*size = rec->size;
+		AIL_ATOMIC_SUB(&site->size, rec->size);
+		AIL_ATOMIC_ADD(&site->freed, 1);
+		ail_md_stats.bytes_freed += rec->size;
+		ail_md_shard_remove_at(shard, i);
+		AIL_SPIN_UNLOCK(&shard->lock);
+		return true;
 	}
-	for(i = 0; i < ail_md_freed_memory_count; i++)
+	// Search through the most recently freed pointers (most recent first), to give a more helpful error message for double frees
+	for(i = 0; i < shard->freed_count; i++)
 	{
-		if(f != &ail_md_freed_memory[i] && buf == ail_md_freed_memory[i].pointer)
+		f = &shard->freed[(shard->freed_current + AIL_MD_FREED_PER_SHARD - 1 - i) % AIL_MD_FREED_PER_SHARD];
+		if(buf == f->pointer)
 		{
+			STMemAllocLine *site = &ail_md_alloc_lines[f->alloc_site];
 			if(f->realloc)
-				printf("MEM ERROR: Pointer %p in file is freed twice! if was freed one line %u in %s, was reallocated to %llu bytes long one line %u in file %s\n", f->pointer, f->free_line, f->free_file, f->size, f->alloc_line, f->alloc_file);
+				printf("MEM ERROR: Pointer %p in file is freed twice! if was freed one line %u in %s, was reallocated to %llu bytes long one line %u in file %s\n", f->pointer, f->free_line, f->free_file, (unsigned long long)f->size, site->line, site->file);
 			else
-				printf("MEM ERROR: Pointer %p in file is freed twice! if was freed one line %u in %s, was allocated to %llu bytes long one line %u in file %s\n", f->pointer, f->free_line, f->free_file, f->size, f->alloc_line, f->alloc_file);
-
+				printf("MEM ERROR: Pointer %p in file is freed twice! if was freed one line %u in %s, was allocated to %llu bytes long one line %u in file %s\n", f->pointer, f->free_line, f->free_file, (unsigned long long)f->size, site->line, site->file);
+			AIL_SPIN_UNLOCK(&shard->lock);
 			return false;
 		}
 	}
+	AIL_SPIN_UNLOCK(&shard->lock);
 	return true;
 }
 
@@ -415,87 +583,70 @@ bool ail_md_remove(void *buf, char *file, u32 line, bool realloc, u64 *size)
 
 void ail_md_free(void *buf, char *file, u32 line)
 {
-	// STMemFreeBuf b;
 	u64 size = 0;
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_lock(ail_md_alloc_mutex);
 	if(!ail_md_remove(buf, file, line, false, &size))
 	{
 		u32 *X = NULL;
 		X[0] = 0;
 	}
+	ail_md_stats.frees++;
 
 
 #ifdef AIL_MD_MEM_PRINT
-	printf("Free   %6llu bytes at pointer %p at %s line %u\n", size, buf, file, line);
+	printf("Free   %6llu bytes at pointer %p at %s line %u\n", (unsigned long long)size, buf, file, line);
 #endif
 
 	free(buf);
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_unlock(ail_md_alloc_mutex);
 }
 
 bool ail_md_comment(void *buf, char *comment)
 {
-	u32 i, j;
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_lock(ail_md_alloc_mutex);
-	for(i = 0; i < ail_md_alloc_line_count; i++)
-	{
-		for(j = 0; j < ail_md_alloc_lines[i].alloc_count; j++)
-		{
-			if(ail_md_alloc_lines[i].allocs[j].buf == buf)
-			{
-				ail_md_alloc_lines[i].allocs[j].comment = comment;
-				return true;
-			}
-		}
-	}
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_unlock(ail_md_alloc_mutex);
-	return false;
+	STMemShard *shard = ail_md_shard(buf);
+	u32 i;
+	AIL_SPIN_LOCK(&shard->lock);
+	i = ail_md_shard_find(shard, buf);
+	if(i < shard->cap)
+		shard->allocs[i].comment = comment;
+	AIL_SPIN_UNLOCK(&shard->lock);
+	return i < shard->cap;
 }
 
 
 void *ail_md_realloc(void *pointer, u64 size, char *file, u32 line)
 {
-	u64 i, j = 0, k, move;
+	u64 move;
+	u32 s, i;
 	void *pointer2;
+	STMemShard *shard;
 
 	if(pointer == NULL)
 		return ail_md_malloc(size, file, line);
 
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_lock(ail_md_alloc_mutex);
-	for(i = 0; i < ail_md_alloc_line_count; i++)
-	{
-		for(j = 0; j < ail_md_alloc_lines[i].alloc_count; j++)
-			if(ail_md_alloc_lines[i].allocs[j].buf == pointer)
-				break;
-		if(j < ail_md_alloc_lines[i].alloc_count)
-			break;
-	}
-	if(i == ail_md_alloc_line_count)
+	shard = ail_md_shard(pointer);
+	AIL_SPIN_LOCK(&shard->lock);
+	i = ail_md_shard_find(shard, pointer);
+	move = i < shard->cap ? shard->allocs[i].size : 0;
+	AIL_SPIN_UNLOCK(&shard->lock);
+	if(i == shard->cap)
 	{
 		printf("AIL memory debugger error. Trying to reallocate pointer %p in %s line %u. Pointer is not allocated\n", pointer, file, line);
-		for(i = 0; i < ail_md_alloc_line_count; i++)
+		for(s = 0; s < AIL_MD_SHARDS; s++)
 		{
-			for(j = 0; j < ail_md_alloc_lines[i].alloc_count; j++)
+			STMemShard *other = &ail_md_shards[s];
+			AIL_SPIN_LOCK(&other->lock);
+			for(i = 0; i < other->cap; i++)
 			{
-				u32 *buf;
-				buf = ail_md_alloc_lines[i].allocs[j].buf;
-				for(k = 0; k < ail_md_alloc_lines[i].allocs[j].size; k++)
+				STMemAllocBuf *rec = &other->allocs[i];
+				if(rec->buf != NULL && (u8 *)rec->buf <= (u8 *)pointer && (u8 *)pointer < (u8 *)rec->buf + rec->size)
 				{
-					if(&buf[k] == pointer)
-					{
-						printf("Trying to reallocate pointer %llu bytes (out of %u) in to allocation made in %s on line %u.\n", k, ail_md_alloc_lines[i].allocs[j].size, ail_md_alloc_lines[i].file, ail_md_alloc_lines[i].line);
-					}
+					STMemAllocLine *site = &ail_md_alloc_lines[rec->site];
+					printf("Trying to reallocate pointer %llu bytes (out of %llu) in to allocation made in %s on line %u.\n", (unsigned long long)((u8 *)pointer - (u8 *)rec->buf), (unsigned long long)rec->size, site->file, site->line);
 				}
 			}
+			AIL_SPIN_UNLOCK(&other->lock);
 		}
 		exit(0);
 	}
-	move = ail_md_alloc_lines[i].allocs[j].size;
 
 	if(move > size)
 		move = size;
@@ -503,131 +654,117 @@ void *ail_md_realloc(void *pointer, u64 size, char *file, u32 line)
 	pointer2 = malloc(size + AIL_MD_OVER_ALLOC);
 	if(pointer2 == NULL)
 	{
-		printf("MEM ERROR: Realloc returns NULL when trying to allocate %llu bytes at line %u in file %s\n", size, line, file);
-		if(ail_md_alloc_mutex != NULL)
-			ail_md_alloc_mutex_unlock(ail_md_alloc_mutex);
+		printf("MEM ERROR: Realloc returns NULL when trying to allocate %llu bytes at line %u in file %s\n", (unsigned long long)size, line, file);
 		ail_md_print(0);
 		exit(0);
 	}
-	for(i = 0; i < size + AIL_MD_OVER_ALLOC; i++)
- 		((u8 *)pointer2)[i] = AIL_MD_MAGIC_NUM;
+	memset(pointer2, AIL_MD_MAGIC_NUM, size);
 	memcpy(pointer2, pointer, move);
 
 	ail_md_add(pointer2, size, file, line);
 	move = 0;
 	ail_md_remove(pointer, file, line, true, &move);
+	ail_md_stats.reallocs++;
 #ifdef AIL_MD_MEM_PRINT
-	printf("Relloc %6llu bytes at pointer %p to %llu bytes at pointer %p at %s line %u\n", move, pointer, size, pointer2, file, line);
+	printf("Relloc %6llu bytes at pointer %p to %llu bytes at pointer %p at %s line %u\n", (unsigned long long)move, pointer, (unsigned long long)size, pointer2, file, line);
 #endif
 	free(pointer);
-
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_unlock(ail_md_alloc_mutex);
 	return pointer2;
 }
 
 void ail_md_print(u32 min_allocs)
 {
-	u32 i, j;
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_lock(ail_md_alloc_mutex);
+	u32 i, s, j;
 	printf("Memory repport:\n----------------------------------------------\n");
-	for(i = 0; i < ail_md_alloc_line_count; i++)
+	for(i = 0; i <= AIL_MD_MAX_SITES; i++)
 	{
-		if(min_allocs < ail_md_alloc_lines[i].alocated - ail_md_alloc_lines[i].freed)
+		STMemAllocLine *site = &ail_md_alloc_lines[i];
+		u64 alocated = AIL_ATOMIC_LOAD(&site->alocated);
+		u64 freed    = AIL_ATOMIC_LOAD(&site->freed);
+		if(AIL_ATOMIC_LOAD_ACQUIRE(&site->state) == 2 && min_allocs < alocated - freed)
 		{
-			printf("%s line: %u\n",ail_md_alloc_lines[i].file, ail_md_alloc_lines[i].line);
-			printf(" - Bytes allocated: %llu\n - Allocations: %llu\n - Frees: %llu\n\n", ail_md_alloc_lines[i].size, ail_md_alloc_lines[i].alocated, ail_md_alloc_lines[i].freed);
-			for(j = 0; j < ail_md_alloc_lines[i].alloc_count; j++)
-				if(ail_md_alloc_lines[i].allocs[j].comment != NULL)
-					printf("\t\t comment %p : %s\n", ail_md_alloc_lines[i].allocs[j].buf, ail_md_alloc_lines[i].allocs[j].comment);
+			printf("%s line: %u\n", site->file, site->line);
+			printf(" - Bytes allocated: %llu\n - Allocations: %llu\n - Frees: %llu\n\n", (unsigned long long)AIL_ATOMIC_LOAD(&site->size), (unsigned long long)alocated, (unsigned long long)freed);
+			for(s = 0; s < AIL_MD_SHARDS; s++)
+			{
+				STMemShard *shard = &ail_md_shards[s];
+				AIL_SPIN_LOCK(&shard->lock);
+				for(j = 0; j < shard->cap; j++)
+					if(shard->allocs[j].buf != NULL && shard->allocs[j].site == i && shard->allocs[j].comment != NULL)
+						printf("\t\t comment %p : %s\n", shard->allocs[j].buf, shard->allocs[j].comment);
+				AIL_SPIN_UNLOCK(&shard->lock);
+			}
 		}
 	}
 	printf("----------------------------------------------\n");
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_unlock(ail_md_alloc_mutex);
 }
 
 
 u64 ail_md_footprint(u32 min_allocs)
 {
 	(void)min_allocs;
-	u32 i;
-	u64 size = 0;
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_lock(ail_md_alloc_mutex);
-	for(i = 0; i < ail_md_alloc_line_count; i++)
-		size += ail_md_alloc_lines[i].size;
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_unlock(ail_md_alloc_mutex);
-	return size;
+	return ail_md_consumption();
 }
 
 bool ail_md_query(void *pointer, u32 *line, char **file, u64 *size)
 {
-	u32 i, j;
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_lock(ail_md_alloc_mutex);
-	for(i = 0; i < ail_md_alloc_line_count; i++)
+	STMemShard *shard = ail_md_shard(pointer);
+	u32 i;
+	AIL_SPIN_LOCK(&shard->lock);
+	i = ail_md_shard_find(shard, pointer);
+	if(i < shard->cap)
 	{
-		for(j = 0; j < ail_md_alloc_lines[i].alloc_count; j++)
-		{
-			if(ail_md_alloc_lines[i].allocs[j].buf == pointer)
-			{
-				if(line != NULL)
-					*line = ail_md_alloc_lines[i].line;
-				if(file != NULL)
-					*file = ail_md_alloc_lines[i].file;
-				if(size != NULL)
-					*size = ail_md_alloc_lines[i].allocs[j].size;
-				if(ail_md_alloc_mutex != NULL)
-					ail_md_alloc_mutex_unlock(ail_md_alloc_mutex);
-				return true;
-			}
-		}
+		STMemAllocLine *site = &ail_md_alloc_lines[shard->allocs[i].site];
+		if(line != NULL)
+			*line = site->line;
+		if(file != NULL)
+			*file = site->file;
+		if(size != NULL)
+			*size = shard->allocs[i].size;
 	}
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_unlock(ail_md_alloc_mutex);
-	return false;
+	AIL_SPIN_UNLOCK(&shard->lock);
+	return i < shard->cap;
 }
 
 bool ail_md_test(void *pointer, u64 size, bool ignore_not_found)
 {
-	u32 i, j;
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_lock(ail_md_alloc_mutex);
-	for(i = 0; i < ail_md_alloc_line_count; i++)
+	u32 s, i;
+	// The pointer might point into the middle of an allocation, so all shards need to be searched
+	for(s = 0; s < AIL_MD_SHARDS; s++)
 	{
-		for(j = 0; j < ail_md_alloc_lines[i].alloc_count; j++)
+		STMemShard *shard = &ail_md_shards[s];
+		AIL_SPIN_LOCK(&shard->lock);
+		for(i = 0; i < shard->cap; i++)
 		{
-			if(ail_md_alloc_lines[i].allocs[j].buf >= pointer && ((u8 *)ail_md_alloc_lines[i].allocs[j].buf) + ail_md_alloc_lines[i].allocs[j].size <= (u8*)pointer)
+			u8 *buf = (u8 *)shard->allocs[i].buf;
+			u8 *end = buf + shard->allocs[i].size;
+			if(buf != NULL && buf <= (u8 *)pointer && (u8 *)pointer < end)
 			{
-				if(((u8 *)ail_md_alloc_lines[i].allocs[j].buf) + ail_md_alloc_lines[i].allocs[j].size < ((u8 *)pointer) + size)
+				AIL_SPIN_UNLOCK(&shard->lock);
+				if(end < (u8 *)pointer + size)
 				{
-					printf("MEM ERROR: Not enough memory to access pointer %p, %llu bytes missing\n", pointer, (u64)(((u8 *)ail_md_alloc_lines[i].allocs[j].buf) + ail_md_alloc_lines[i].allocs[j].size) - (u64)(((u8 *)pointer) + size));
-					if(ail_md_alloc_mutex != NULL)
-						ail_md_alloc_mutex_unlock(ail_md_alloc_mutex);
+					printf("MEM ERROR: Not enough memory to access pointer %p, %llu bytes missing\n", pointer, (unsigned long long)((u8 *)pointer + size - end));
 					return true;
-				}else
-				{
-					if(ail_md_alloc_mutex != NULL)
-						ail_md_alloc_mutex_unlock(ail_md_alloc_mutex);
-					return false;
 				}
+				return false;
 			}
 		}
+		AIL_SPIN_UNLOCK(&shard->lock);
 	}
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_unlock(ail_md_alloc_mutex);
 	if(ignore_not_found)
 		return false;
 
-	for(i = 0; i < ail_md_freed_memory_count; i++)
+	for(s = 0; s < AIL_MD_SHARDS; s++)
 	{
-		if(pointer >= ail_md_freed_memory[i].pointer && ((u8 *)ail_md_freed_memory[i].pointer) + ail_md_freed_memory[i].size >= ((u8 *)pointer) + size)
+		STMemShard *shard = &ail_md_shards[s];
+		AIL_SPIN_LOCK(&shard->lock);
+		for(i = 0; i < shard->freed_count; i++)
 		{
-			printf("MEM ERROR: Pointer %p was freed on line %u in file %s\n", pointer, ail_md_freed_memory[i].free_line, ail_md_freed_memory[i].free_file);
+			STMemFreeBuf *f = &shard->freed[i];
+			if((u8 *)f->pointer <= (u8 *)pointer && (u8 *)pointer + size <= (u8 *)f->pointer + f->size)
+				printf("MEM ERROR: Pointer %p was freed on line %u in file %s\n", pointer, f->free_line, f->free_file);
 		}
+		AIL_SPIN_UNLOCK(&shard->lock);
 	}
 
 	printf("MEM ERROR: No matching memory for pointer %p found!\n", pointer);
@@ -635,32 +772,364 @@ bool ail_md_test(void *pointer, u64 size, bool ignore_not_found)
 }
 
 
-u64 ail_md_consumption()
+u64 ail_md_consumption(void)
 {
 	u32 i;
 	u64 sum = 0;
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_lock(ail_md_alloc_mutex);
-	for(i = 0; i < ail_md_alloc_line_count; i++)
-		sum += ail_md_alloc_lines[i].size;
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_unlock(ail_md_alloc_mutex);
+	for(i = 0; i <= AIL_MD_MAX_SITES; i++)
+		sum += AIL_ATOMIC_LOAD(&ail_md_alloc_lines[i].size);
+	return sum;
+}
+
+AIL_MD_Stats ail_md_thread_stats(void)
+{
+	return ail_md_stats;
+}
+
+/////////////////////////
+// Sampling Heap Profiler
+/////////////////////////
+
+#if defined(__GLIBC__) || (defined(__APPLE__) && defined(__MACH__))
+#include <execinfo.h>
+#define AIL_MD_HAS_BACKTRACE
+#endif
+
+#define AIL_MD_SAMPLE_BITS_LOG2 16
+// The recorded stacks start with the frames of ail_md_sample_account and ail_md_sample_(m|c|re)alloc, which are skipped when dumping.
+// For this to work, neither of them may be inlined
+#define AIL_MD_SAMPLE_SKIP 2
+#if defined(__GNUC__) || defined(__clang__)
+#define AIL_MD_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define AIL_MD_NOINLINE __declspec(noinline)
+#else
+#define AIL_MD_NOINLINE
+#endif
+
+typedef struct {
+	void *buf; // NULL for empty slots
+	u64 size;
+	u64 weight; // Amount of bytes this sample represents
+	char *file;
+	u32 line;
+	u32 depth;
+	void *stack[AIL_MD_SAMPLE_DEPTH];
+} STMemSample;
+
+u64 ail_md_sample_rate = AIL_MD_SAMPLE_RATE;
+u32 ail_md_sample_lock;
+u32 ail_md_sample_count;
+u32 ail_md_sample_cap;
+STMemSample *ail_md_samples;
+// Filter for sampled pointers, so that free only needs to take the lock if the pointer might have been sampled
+// Bits are only cleared by ail_md_reset, since several sampled pointers can share the same bit
+u64 ail_md_sample_bits[(1 << AIL_MD_SAMPLE_BITS_LOG2)/64];
+static AIL_THREAD_LOCAL i64 ail_md_sample_countdown;
+static AIL_THREAD_LOCAL u64 ail_md_sample_rng;
+
+static u32 ail_md_sample_bit(void *pointer)
+{
+	return (u32)(ail_md_hash_ptr(pointer) >> (64 - AIL_MD_SAMPLE_BITS_LOG2));
+}
+
+// Approximation of -ln(x) for x in (0, 1], which avoids a dependency on libm
+// The error of a few percent does not matter for choosing the distance to the next sample
+static f64 ail_md_neg_ln(f64 x)
+{
+	u64 bits;
+	memcpy(&bits, &x, sizeof(bits));
+	i64 e = (i64)((bits >> 52) & 0x7ff) - 1023;
+	bits  = (bits & 0xfffffffffffffULL) | 0x3ff0000000000000ULL;
+	f64 m;
+	memcpy(&m, &bits, sizeof(m));
+	f64 log2 = (f64)e + (m - 1)*(1.4425 - 0.4425*(m - 1));
+	return -log2*0.6931471805599453;
+}
+
+static i64 ail_md_sample_next(void)
+{
+	if(ail_md_sample_rng == 0)
+		ail_md_sample_rng = ail_md_hash_ptr(&ail_md_sample_rng) | 1;
+	// xorshift64
+	ail_md_sample_rng ^= ail_md_sample_rng << 13;
+	ail_md_sample_rng ^= ail_md_sample_rng >> 7;
+	ail_md_sample_rng ^= ail_md_sample_rng << 17;
+	f64 u = (f64)((ail_md_sample_rng >> 11) + 1) / (f64)(1ULL << 53);
+	return (i64)(ail_md_neg_ln(u) * (f64)AIL_ATOMIC_LOAD(&ail_md_sample_rate)) + 1;
+}
+
+static u32 ail_md_sample_slot(void *pointer)
+{
+	return (u32)ail_md_hash_ptr(pointer) & (ail_md_sample_cap - 1);
+}
+
+// Returns the index of the pointer's sample or ail_md_sample_cap if it wasn't sampled
+// ail_md_sample_lock needs to be held
+static u32 ail_md_sample_find(void *pointer)
+{
+	if(ail_md_sample_cap == 0)
+		return 0;
+	u32 mask = ail_md_sample_cap - 1;
+	for(u32 i = ail_md_sample_slot(pointer); ail_md_samples[i].buf != NULL; i = (i + 1) & mask)
+		if(ail_md_samples[i].buf == pointer)
+			return i;
+	return ail_md_sample_cap;
+}
+
+// ail_md_sample_lock needs to be held
+static void ail_md_sample_insert(STMemSample *sample)
+{
+	if((ail_md_sample_count + 1) * 4 > ail_md_sample_cap * 3)
+	{
+		STMemSample *old = ail_md_samples;
+		u32 old_cap = ail_md_sample_cap;
+		ail_md_sample_cap = old_cap ? 2*old_cap : 64;
+		ail_md_samples = (STMemSample *)calloc(ail_md_sample_cap, sizeof(*ail_md_samples));
+		if(ail_md_samples == NULL)
+		{
+			printf("MEM ERROR: The memory debugger failed to allocate memory for its own bookkeeping\n");
+			exit(0);
+		}
+		ail_md_sample_count = 0;
+		for(u32 i = 0; i < old_cap; i++)
+			if(old[i].buf != NULL)
+				ail_md_sample_insert(&old[i]);
+		free(old);
+	}
+	u32 i, mask = ail_md_sample_cap - 1;
+	for(i = ail_md_sample_slot(sample->buf); ail_md_samples[i].buf != NULL; i = (i + 1) & mask);
+	ail_md_samples[i] = *sample;
+	ail_md_sample_count++;
+}
+
+// Same as ail_md_shard_remove_at
+// ail_md_sample_lock needs to be held
+static void ail_md_sample_remove_at(u32 i)
+{
+	u32 mask = ail_md_sample_cap - 1;
+	for(u32 j = (i + 1) & mask; ail_md_samples[j].buf != NULL; j = (j + 1) & mask)
+	{
+		u32 home = ail_md_sample_slot(ail_md_samples[j].buf);
+		if(((j - home) & mask) >= ((j - i) & mask))
+		{
+			ail_md_samples[i] = ail_md_samples[j];
+			i = j;
+		}
+	}
+	ail_md_samples[i].buf = NULL;
+	ail_md_sample_count--;
+}
+
+static void ail_md_sample_record(STMemSample *sample, u64 size)
+{
+	u64 rate = AIL_ATOMIC_LOAD(&ail_md_sample_rate);
+	// The probability of sampling an allocation of s bytes is 1 - e^(-s/rate), which would make its weight s/(1 - e^(-s/rate)).
+	// This is approximated with a maximum error of about 5% by the following
+	sample->size   = size;
+	sample->weight = AIL_MAX(size, rate) + AIL_MIN(size, rate)/2;
+	u32 bit = ail_md_sample_bit(sample->buf);
+	AIL_ATOMIC_OR(&ail_md_sample_bits[bit / 64], 1ULL << (bit % 64));
+	AIL_SPIN_LOCK(&ail_md_sample_lock);
+	ail_md_sample_insert(sample);
+	AIL_SPIN_UNLOCK(&ail_md_sample_lock);
+}
+
+AIL_MD_NOINLINE static void ail_md_sample_account(void *pointer, u64 size, char *file, u32 line)
+{
+	ail_md_sample_countdown -= (i64)size;
+	if(AIL_LIKELY(ail_md_sample_countdown > 0) || pointer == NULL)
+		return;
+	// The first allocation of each thread only initializes its countdown, since it starts at 0
+	bool first = ail_md_sample_rng == 0;
+	ail_md_sample_countdown = ail_md_sample_next();
+	if(!first)
+	{
+		// The backtrace is taken here rather than in ail_md_sample_record, since tail-calls would make the amount of frames to skip unpredictable
+		STMemSample sample;
+		sample.buf   = pointer;
+		sample.file  = file;
+		sample.line  = line;
+#ifdef AIL_MD_HAS_BACKTRACE
+		sample.depth = (u32)backtrace(sample.stack, AIL_MD_SAMPLE_DEPTH);
+#else
+		sample.depth = 0;
+#endif
+		ail_md_sample_record(&sample, size);
+	}
+}
+
+static void ail_md_sample_forget(void *pointer)
+{
+	u32 bit = ail_md_sample_bit(pointer);
+	if(AIL_LIKELY(!(AIL_ATOMIC_LOAD(&ail_md_sample_bits[bit / 64]) & (1ULL << (bit % 64)))))
+		return;
+	AIL_SPIN_LOCK(&ail_md_sample_lock);
+	u32 i = ail_md_sample_find(pointer);
+	if(i < ail_md_sample_cap)
+		ail_md_sample_remove_at(i);
+	AIL_SPIN_UNLOCK(&ail_md_sample_lock);
+}
+
+void ail_md_sample_set_rate(u64 bytes)
+{
+	AIL_ATOMIC_STORE(&ail_md_sample_rate, AIL_MAX(bytes, 1));
+	ail_md_sample_countdown = ail_md_sample_next();
+}
+
+AIL_MD_NOINLINE void *ail_md_sample_malloc(u64 size, char *file, u32 line)
+{
+	void *pointer = malloc(size);
+	ail_md_sample_account(pointer, size, file, line);
+	return pointer;
+}
+
+AIL_MD_NOINLINE void *ail_md_sample_calloc(u64 nelem, u64 elsize, char *file, u32 line)
+{
+	void *pointer = calloc(nelem, elsize);
+	ail_md_sample_account(pointer, nelem*elsize, file, line);
+	return pointer;
+}
+
+AIL_MD_NOINLINE void *ail_md_sample_realloc(void *pointer, u64 size, char *file, u32 line)
+{
+	if(pointer != NULL)
+		ail_md_sample_forget(pointer);
+	pointer = realloc(pointer, size);
+	ail_md_sample_account(pointer, size, file, line);
+	return pointer;
+}
+
+void ail_md_sample_free(void *pointer)
+{
+	if(pointer != NULL)
+		ail_md_sample_forget(pointer);
+	free(pointer);
+}
+
+u64 ail_md_sample_live(void)
+{
+	u64 sum = 0;
+	AIL_SPIN_LOCK(&ail_md_sample_lock);
+	for(u32 i = 0; i < ail_md_sample_cap; i++)
+		if(ail_md_samples[i].buf != NULL)
+			sum += ail_md_samples[i].weight;
+	AIL_SPIN_UNLOCK(&ail_md_sample_lock);
 	return sum;
 }
 
-void ail_md_reset()
+void ail_md_sample_dump_collapsed(FILE *f)
+{
+	AIL_SPIN_LOCK(&ail_md_sample_lock);
+	for(u32 i = 0; i < ail_md_sample_cap; i++)
+	{
+		STMemSample *sample = &ail_md_samples[i];
+		if(sample->buf == NULL)
+			continue;
+#ifdef AIL_MD_HAS_BACKTRACE
+		char **symbols = backtrace_symbols(sample->stack, (int)sample->depth);
+		for(u32 j = sample->depth; symbols != NULL && j-- > AIL_MD_SAMPLE_SKIP;)
+		{
+			// Symbols look like "binary(function+0x12) [0xaddress]", offset and address are dropped to merge frames of the same function
+			u32 len = 0;
+			while(symbols[j][len] && symbols[j][len] != ' ' && symbols[j][len] != ';' && symbols[j][len] != '+')
+				len++;
+			fprintf(f, "%.*s%s;", (int)len, symbols[j], symbols[j][len] == '+' ? ")" : "");
+		}
+		free(symbols);
+#endif
+		fprintf(f, "%s:%u %llu\n", sample->file, sample->line, (unsigned long long)sample->weight);
+	}
+	AIL_SPIN_UNLOCK(&ail_md_sample_lock);
+}
+
+// Orders samples by their backtrace, so that samples with the same stack end up next to each other
+static int ail_md_sample_stack_cmp(const void *a, const void *b)
+{
+	const STMemSample *x = *(const STMemSample **)a, *y = *(const STMemSample **)b;
+	if(x->depth != y->depth)
+		return x->depth < y->depth ? -1 : 1;
+	return memcmp(x->stack, y->stack, sizeof(x->stack[0]) * x->depth);
+}
+
+// pprof unsamples heap_v2 profiles itself, so the raw sampled counts and sizes are written rather than the weights
+void ail_md_sample_dump_pprof(FILE *f)
+{
+	u64 count = 0, bytes = 0;
+	AIL_SPIN_LOCK(&ail_md_sample_lock);
+	STMemSample **live = (STMemSample **)malloc(sizeof(STMemSample *) * AIL_MAX(ail_md_sample_count, 1));
+	if(live == NULL)
+	{
+		AIL_SPIN_UNLOCK(&ail_md_sample_lock);
+		return;
+	}
+	for(u32 i = 0; i < ail_md_sample_cap; i++)
+	{
+		if(ail_md_samples[i].buf != NULL)
+		{
+			live[count++] = &ail_md_samples[i];
+			bytes += ail_md_samples[i].size;
+		}
+	}
+	qsort(live, count, sizeof(live[0]), ail_md_sample_stack_cmp);
+	fprintf(f, "heap profile: %llu: %llu [ %llu: %llu] @ heap_v2/%llu\n", (unsigned long long)count, (unsigned long long)bytes,
+			(unsigned long long)count, (unsigned long long)bytes, (unsigned long long)ail_md_sample_rate);
+	for(u64 i = 0, j; i < count; i = j)
+	{
+		u64 n = 0, size = 0;
+		for(j = i; j < count && ail_md_sample_stack_cmp(&live[i], &live[j]) == 0; j++)
+		{
+			n++;
+			size += live[j]->size;
+		}
+		fprintf(f, "%llu: %llu [ %llu: %llu] @", (unsigned long long)n, (unsigned long long)size, (unsigned long long)n, (unsigned long long)size);
+		for(u32 k = AIL_MD_SAMPLE_SKIP; k < live[i]->depth; k++)
+			fprintf(f, " %p", live[i]->stack[k]);
+		fprintf(f, "\n");
+	}
+	free(live);
+	AIL_SPIN_UNLOCK(&ail_md_sample_lock);
+	// pprof needs the memory mappings to symbolize the addresses
+	fprintf(f, "\nMAPPED_LIBRARIES:\n");
+	FILE *maps = fopen("/proc/self/maps", "r");
+	if(maps != NULL)
+	{
+		char buf[4096];
+		size_t n;
+		while((n = fread(buf, 1, sizeof(buf), maps)) > 0)
+			fwrite(buf, 1, n, f);
+		fclose(maps);
+	}
+}
+
+void ail_md_reset(void)
 {
 	u32 i;
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_lock(ail_md_alloc_mutex);
 #ifdef AIL_MD_MEM_PRINT
 	printf("Memmory reset --------------------------------------------------------------------------------------------------------------------------------------------------------------\n");
 #endif
-	for(i = 0; i < ail_md_alloc_line_count; i++)
-		free(ail_md_alloc_lines[i].allocs);
-	ail_md_alloc_line_count = 0;
-	if(ail_md_alloc_mutex != NULL)
-		ail_md_alloc_mutex_unlock(ail_md_alloc_mutex);
+	for(i = 0; i < AIL_MD_SHARDS; i++)
+	{
+		STMemShard *shard = &ail_md_shards[i];
+		AIL_SPIN_LOCK(&shard->lock);
+		free(shard->allocs);
+		shard->allocs = NULL;
+		shard->cap = 0;
+		shard->count = 0;
+		shard->freed_count = 0;
+		shard->freed_current = 0;
+		AIL_SPIN_UNLOCK(&shard->lock);
+	}
+	memset(ail_md_alloc_lines, 0, sizeof(ail_md_alloc_lines));
+	memset(ail_md_site_refs, 0, sizeof(ail_md_site_refs));
+
+	AIL_SPIN_LOCK(&ail_md_sample_lock);
+	free(ail_md_samples);
+	ail_md_samples = NULL;
+	ail_md_sample_cap = 0;
+	ail_md_sample_count = 0;
+	memset(ail_md_sample_bits, 0, sizeof(ail_md_sample_bits));
+	AIL_SPIN_UNLOCK(&ail_md_sample_lock);
 }
 
 void exit_crash(u32 i)
@@ -682,6 +1151,13 @@ void exit_crash(u32 i)
 #define fclose(n)     ail_md_mem_fclose(n, __FILE__, __LINE__)
 #endif
 
+#ifdef AIL_MD_SAMPLE
+#define malloc(n)     ail_md_sample_malloc(n, __FILE__, __LINE__)     // Replaces malloc
+#define calloc(n, m)  ail_md_sample_calloc(n, m, __FILE__, __LINE__)  // Replaces calloc
+#define realloc(n, m) ail_md_sample_realloc(n, m, __FILE__, __LINE__) // Replaces realloc
+#define free(n)       ail_md_sample_free(n)                           // Replaces free
+#endif
+
 #ifdef AIL_MD_EXIT
 #define exit(n) exit_crash(n) // overwriting exit(n) with a function guarantueed to crash
-#endif
\ No newline at end of file
+#endif
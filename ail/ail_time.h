@@ -1,5 +1,13 @@
 // Time-related functions
 //
+// Besides sleeping, this provides monotonic clocks with nanosecond resolution and a cycle counter,
+// as well as a minimal instrumenting profiler:
+// Zones are enabled by defining `AIL_PROFILE` and are marked either via `AIL_PROFILE_ZONE("name")` at the
+// start of a scope (requires GCC, Clang or C++) or via `AIL_PROFILE_BEGIN(zone, "name")` and `AIL_PROFILE_END(zone)`.
+// Every thread records its zones into its own ring buffer (see `AIL_PROFILE_RING_SIZE`), so only the most recent
+// zones are kept. They can be exported with `ail_profile_dump_chrome_trace` and viewed in chrome://tracing or Perfetto.
+// The names of zones must be string literals (or otherwise outlive the profiler).
+//
 // LICENSE
 /*
 Copyright (c) 2024 Val Richter
@@ -29,7 +37,8 @@ SOFTWARE.
 #define AIL_TYPES_IMPL
 #include "ail.h"
 
-#include <time.h> // For clock
+#include <time.h>  // For clock_gettime
+#include <stdio.h> // For FILE
 
 #ifndef AIL_TIME_DEF
 #ifdef  AIL_DEF
@@ -53,6 +62,105 @@ AIL_TIME_DEF void ail_time_sleep(u64 msecs);
 AIL_TIME_DEF_INLINE f64 ail_time_clock_start(void);
 AIL_TIME_DEF_INLINE f64 ail_time_clock_elapsed(f64 start);
 
+// Monotonic time in nanoseconds since an unspecified starting point
+AIL_TIME_DEF u64 ail_time_now_ns(void);
+
+// Raw value of the CPU's timestamp counter (rdtsc on x86, cntvct_el0 on arm64 and ail_time_now_ns otherwise)
+// Reading it is much cheaper than ail_time_now_ns, but it needs to be calibrated to be converted to real time
+AIL_TIME_DEF_INLINE u64 ail_time_cycles(void);
+// Counter ticks per nanosecond, measured once during the first call (which takes about 10ms)
+AIL_TIME_DEF f64 ail_time_cycles_per_ns(void);
+AIL_TIME_DEF u64 ail_time_cycles_to_ns(u64 cycles);
+
+#ifndef AIL_PROFILE_RING_SIZE
+#define AIL_PROFILE_RING_SIZE 4096 // Amount of zones kept per thread, must be a power of 2
+#endif
+
+typedef struct AIL_Profile_Zone {
+    const char *name;
+    u64 start; // In counter ticks from ail_time_cycles
+} AIL_Profile_Zone;
+
+typedef struct AIL_Profile_Event {
+    const char *name;
+    u64 start;
+    u64 end;
+} AIL_Profile_Event;
+
+// Each thread's ring buffer of finished zones
+typedef struct AIL_Profile_Thread {
+    AIL_Profile_Event events[AIL_PROFILE_RING_SIZE];
+    u64 count; // Total amount of zones ever recorded, the ring contains the last AIL_PROFILE_RING_SIZE of them
+    u32 tid;
+    struct AIL_Profile_Thread *next;
+} AIL_Profile_Thread;
+
+AIL_TIME_DEF_INLINE AIL_Profile_Zone ail_profile_begin(const char *name);
+AIL_TIME_DEF_INLINE void ail_profile_end(AIL_Profile_Zone *zone);
+AIL_TIME_DEF        AIL_Profile_Thread *ail_profile_thread(void);
+// Should only be called, while no other thread records zones
+AIL_TIME_DEF        void ail_profile_dump_chrome_trace(FILE *f);
+AIL_TIME_DEF        void ail_profile_reset(void);
+
+#define AIL_PROFILE_CONCAT_(a, b) a##b
+#define AIL_PROFILE_CONCAT(a, b)  AIL_PROFILE_CONCAT_(a, b)
+
+#ifdef AIL_PROFILE
+    #define AIL_PROFILE_BEGIN(zone, name) AIL_Profile_Zone zone = ail_profile_begin(name)
+    #define AIL_PROFILE_END(zone) ail_profile_end(&(zone))
+    #if defined(__cplusplus)
+        struct AIL_Profile_Scope {
+            AIL_Profile_Zone zone;
+            AIL_Profile_Scope(const char *name) : zone(ail_profile_begin(name)) {}
+            ~AIL_Profile_Scope() { ail_profile_end(&zone); }
+        };
+        #define AIL_PROFILE_ZONE(name) AIL_Profile_Scope AIL_PROFILE_CONCAT(_ail_profile_zone_, __LINE__)(name)
+    #elif defined(__GNUC__) || defined(__clang__)
+        #define AIL_PROFILE_ZONE(name) AIL_Profile_Zone AIL_PROFILE_CONCAT(_ail_profile_zone_, __LINE__) __attribute__((cleanup(ail_profile_end))) = ail_profile_begin(name)
+    #else
+        // Use AIL_PROFILE_BEGIN and AIL_PROFILE_END instead
+        #define AIL_PROFILE_ZONE(name) AIL_STATIC_ASSERT(AIL_PROFILE_ZONE_requires_GCC_Clang_or_CPP == 0)
+    #endif
+#else
+    #define AIL_PROFILE_BEGIN(zone, name)
+    #define AIL_PROFILE_END(zone)
+    #define AIL_PROFILE_ZONE(name)
+#endif
+
+AIL_TIME_DEF_INLINE u64 ail_time_cycles(void)
+{
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_ia32_rdtsc();
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    return __rdtsc();
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__aarch64__)
+    u64 x;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(x));
+    return x;
+#else
+    return ail_time_now_ns();
+#endif
+}
+
+AIL_TIME_DEF_INLINE AIL_Profile_Zone ail_profile_begin(const char *name)
+{
+    AIL_Profile_Zone zone;
+    zone.name  = name;
+    zone.start = ail_time_cycles();
+    return zone;
+}
+
+AIL_TIME_DEF_INLINE void ail_profile_end(AIL_Profile_Zone *zone)
+{
+    u64 end = ail_time_cycles();
+    AIL_Profile_Thread *t = ail_profile_thread();
+    AIL_Profile_Event  *e = &t->events[t->count & (AIL_PROFILE_RING_SIZE - 1)];
+    e->name  = zone->name;
+    e->start = zone->start;
+    e->end   = end;
+    AIL_ATOMIC_STORE_RELEASE(&t->count, t->count + 1);
+}
+
 #endif // AIL_TIME_H_
 
 
@@ -60,8 +168,8 @@ AIL_TIME_DEF_INLINE f64 ail_time_clock_elapsed(f64 start);
 #ifndef _AIL_TIME_GUARD_
 #define _AIL_TIME_GUARD_
 
-#ifdef WIN32
-#include <windows.h> // For Sleep
+#ifdef _WIN32
+#include <windows.h> // For Sleep and QueryPerformanceCounter
 #define AIL_TIME_FLAG_WINSLEEP
 #elif _POSIX_C_SOURCE >= 199309L
 #define AIL_TIME_FLAG_NANOSLEEP
@@ -88,25 +196,125 @@ void ail_time_sleep(u64 msecs)
 #endif
 }
 
-f64 ail_time_clock_start(void)
+#if !defined(_WIN32) && !defined(CLOCK_MONOTONIC)
+#error "CLOCK_MONOTONIC is not available, define _POSIX_C_SOURCE to at least 199309L before including any headers"
+#endif
+
+u64 ail_time_now_ns(void)
 {
 #ifdef _WIN32
-    return (f64)timeGetTime() / 1000;
-#elif __posix
+    static LARGE_INTEGER freq = {0};
+    LARGE_INTEGER now;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    // Split up to avoid overflowing when multiplying with 1e9
+    u64 secs = (u64)now.QuadPart / (u64)freq.QuadPart;
+    u64 rem  = (u64)now.QuadPart % (u64)freq.QuadPart;
+    return secs*1000000000ULL + rem*1000000000ULL/(u64)freq.QuadPart;
+#else
     struct timespec ts = {0};
     int ret = clock_gettime(CLOCK_MONOTONIC, &ts);
     AIL_ASSERT(ret == 0);
-    return (f64)ts.tv_sec + ts.tv_nsec*1e-9;
-#else
-    return (f64)clock() / CLOCKS_PER_SEC;
+    return (u64)ts.tv_sec*1000000000ULL + (u64)ts.tv_nsec;
 #endif
 }
 
+f64 ail_time_clock_start(void)
+{
+    return (f64)ail_time_now_ns()*1e-9;
+}
+
 f64 ail_time_clock_elapsed(f64 start)
 {
     return ail_time_clock_start() - start;
 }
 
+f64 ail_time_cycles_per_ns(void)
+{
+    static f64 cycles_per_ns = 0;
+    if (AIL_LIKELY(cycles_per_ns > 0)) return cycles_per_ns;
+    u64 ns_start = ail_time_now_ns();
+    u64 c_start  = ail_time_cycles();
+    u64 ns_end;
+    do { ns_end = ail_time_now_ns(); } while (ns_end - ns_start < 10000000); // Busy-wait for 10ms
+    u64 c_end = ail_time_cycles();
+    cycles_per_ns = (f64)(c_end - c_start) / (f64)(ns_end - ns_start);
+    return cycles_per_ns;
+}
+
+u64 ail_time_cycles_to_ns(u64 cycles)
+{
+    return (u64)((f64)cycles / ail_time_cycles_per_ns());
+}
+
+/////////////////////////
+// Profiler
+/////////////////////////
+
+static AIL_THREAD_LOCAL AIL_Profile_Thread *ail_profile_cur_thread;
+static AIL_Profile_Thread *ail_profile_threads;
+static u32                 ail_profile_threads_lock;
+static u32                 ail_profile_thread_count;
+static u64                 ail_profile_epoch; // Counter value that timestamps are exported relative to
+
+AIL_Profile_Thread *ail_profile_thread(void)
+{
+    AIL_Profile_Thread *t = ail_profile_cur_thread;
+    if (AIL_LIKELY(t != NULL)) return t;
+    t = (AIL_Profile_Thread *)AIL_CALLOC(1, sizeof(AIL_Profile_Thread));
+    AIL_ASSERT(t != NULL);
+    AIL_SPIN_LOCK(&ail_profile_threads_lock);
+    if (!ail_profile_epoch) ail_profile_epoch = ail_time_cycles();
+    t->tid  = ++ail_profile_thread_count;
+    t->next = ail_profile_threads;
+    ail_profile_threads = t;
+    AIL_SPIN_UNLOCK(&ail_profile_threads_lock);
+    ail_profile_cur_thread = t;
+    return t;
+}
+
+void ail_profile_reset(void)
+{
+    AIL_SPIN_LOCK(&ail_profile_threads_lock);
+    for (AIL_Profile_Thread *t = ail_profile_threads; t; t = t->next) AIL_ATOMIC_STORE(&t->count, 0);
+    ail_profile_epoch = ail_time_cycles();
+    AIL_SPIN_UNLOCK(&ail_profile_threads_lock);
+}
+
+static void ail_profile_internal_write_str(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', f);
+        if ((u8)*s >= 0x20) fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+// Events are written as "complete" events in the Trace Event Format, with timestamps in microseconds
+void ail_profile_dump_chrome_trace(FILE *f)
+{
+    f64  us_per_cycle = 1.0 / (ail_time_cycles_per_ns() * 1000.0);
+    bool first        = true;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    AIL_SPIN_LOCK(&ail_profile_threads_lock);
+    for (AIL_Profile_Thread *t = ail_profile_threads; t; t = t->next) {
+        u64 count = AIL_ATOMIC_LOAD_ACQUIRE(&t->count);
+        u64 i     = count > AIL_PROFILE_RING_SIZE ? count - AIL_PROFILE_RING_SIZE : 0;
+        for (; i < count; i++) {
+            AIL_Profile_Event *e = &t->events[i & (AIL_PROFILE_RING_SIZE - 1)];
+            if (e->start < ail_profile_epoch) continue; // Recorded before the last reset
+            fprintf(f, "%s\n{\"name\":", first ? "" : ",");
+            ail_profile_internal_write_str(f, e->name);
+            fprintf(f, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", t->tid,
+                    (f64)(e->start - ail_profile_epoch)*us_per_cycle, (f64)(e->end - e->start)*us_per_cycle);
+            first = false;
+        }
+    }
+    AIL_SPIN_UNLOCK(&ail_profile_threads_lock);
+    fprintf(f, "\n]}\n");
+}
+
 
 #endif // _AIL_TIME_GUARD_
 #endif // AIL_TIME_IMPL
\ No newline at end of file
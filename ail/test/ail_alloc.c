@@ -0,0 +1,188 @@
+#define _GNU_SOURCE // For MAP_ANON and mremap
+#define AIL_ALLOC_IMPL
+#include "../ail_alloc.h"
+#include "test_assert.h"
+
+bool statsTest(void)
+{
+    AIL_Allocator a = ail_alloc_stats_new(&ail_default_allocator);
+    u8 *x = a.alloc(a.data, 100);
+    u8 *y = a.zero_alloc(a.data, 10, 10);
+    for (u32 i = 0; i < 100; i++) {
+        ASSERT(y[i] == 0);
+        x[i] = (u8)i;
+    }
+    AIL_Alloc_Stats_Snapshot s = ail_alloc_stats_snapshot(&a);
+    ASSERT(s.live_bytes == 200);
+    ASSERT(s.allocs == 1 && s.zero_allocs == 1);
+    ASSERT(s.size_histogram[7] == 2); // 100 is in [64, 128)
+
+    x = a.re_alloc(a.data, x, 1000);
+    for (u32 i = 0; i < 100; i++) ASSERT(x[i] == i);
+    x = a.re_alloc(a.data, x, 10);
+    s = ail_alloc_stats_snapshot(&a);
+    ASSERT(s.live_bytes == 110);
+    ASSERT(s.peak_bytes == 1100);
+    ASSERT(s.re_allocs == 2 && s.re_alloc_moves <= 2);
+    ASSERT(s.size_histogram[10] == 1 && s.size_histogram[4] == 1);
+
+    a.free_one(a.data, x);
+    a.free_one(a.data, y);
+    a.free_one(a.data, NULL);
+    s = ail_alloc_stats_snapshot(&a);
+    ASSERT(s.live_bytes == 0 && s.frees == 2);
+
+    // Wrapping an arena
+    AIL_Allocator arena = ail_alloc_arena_new(1024, &ail_default_allocator);
+    AIL_Allocator b     = ail_alloc_stats_new(&arena);
+    for (u32 i = 0; i < 10; i++) ASSERT(b.alloc(b.data, 16) != NULL);
+    ASSERT(ail_alloc_stats_snapshot(&b).live_bytes == 160);
+    b.free_all(b.data);
+    s = ail_alloc_stats_snapshot(&b);
+    ASSERT(s.live_bytes == 0 && s.peak_bytes == 160 && s.free_alls == 1);
+    // The arena reuses its memory after free_all, which must not overwrite the counters
+    for (u32 i = 0; i < 10; i++) {
+        u8 *p = b.alloc(b.data, 16);
+        ASSERT(p != NULL);
+        memset(p, 0xab, 16);
+    }
+    s = ail_alloc_stats_snapshot(&b);
+    ASSERT(s.live_bytes == 160 && s.peak_bytes == 160);
+    ASSERT(s.allocs == 20 && s.frees == 0 && s.free_alls == 1);
+    return true;
+}
+
+bool poolGrowTest(void)
+{
+    AIL_Allocator pool = ail_alloc_pool_new(4, sizeof(u64), &ail_default_allocator);
+    u64 *ptrs[100];
+    for (u32 i = 0; i < 100; i++) {
+        ptrs[i] = pool.alloc(pool.data, sizeof(u64));
+        ASSERT(ptrs[i] != NULL);
+        *ptrs[i] = i;
+    }
+    for (u32 i = 0; i < 100; i++) ASSERT(*ptrs[i] == i);
+    for (u32 i = 0; i < 100; i += 2) pool.free_one(pool.data, ptrs[i]);
+    for (u32 i = 0; i < 50; i++) ASSERT(pool.alloc(pool.data, sizeof(u64)) != NULL);
+    pool.free_all(pool.data);
+    for (u32 i = 0; i < 100; i++) ASSERT(pool.alloc(pool.data, sizeof(u64)) != NULL);
+    return true;
+}
+
+bool slabTest(void)
+{
+    u64 expected[] = { 8, 16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096 };
+    ASSERT(AIL_ALLOC_SLAB_CLASSES == sizeof(expected)/sizeof(expected[0]));
+    for (u32 i = 0; i < AIL_ALLOC_SLAB_CLASSES; i++) {
+        ASSERT(ail_alloc_slab_class_size(i) == expected[i]);
+        ASSERT(ail_alloc_slab_class(expected[i]) == i);
+        ASSERT(ail_alloc_slab_class(expected[i] + 1) == i + 1 || i + 1 == AIL_ALLOC_SLAB_CLASSES);
+    }
+    ASSERT(ail_alloc_slab_class(0) == 0 && ail_alloc_slab_class(1) == 0);
+
+    AIL_Allocator slab = ail_alloc_slab_new(&ail_default_allocator);
+    static u8 *ptrs[2000];
+    for (u32 i = 0; i < 2000; i++) {
+        u32 size = (i*37) % 6000;
+        ptrs[i]  = slab.alloc(slab.data, size);
+        ASSERT(ptrs[i] != NULL);
+        memset(ptrs[i], (u8)i, size);
+    }
+    for (u32 i = 0; i < 2000; i++) {
+        u32 size = (i*37) % 6000;
+        for (u32 j = 0; j < size; j++) ASSERT(ptrs[i][j] == (u8)i);
+    }
+    // Growing and shrinking keeps the contents
+    for (u32 i = 0; i < 2000; i += 3) {
+        u32 size = (i*37) % 6000;
+        ptrs[i]  = slab.re_alloc(slab.data, ptrs[i], size*2 + 1);
+        for (u32 j = 0; j < size; j++) ASSERT(ptrs[i][j] == (u8)i);
+        ptrs[i]  = slab.re_alloc(slab.data, ptrs[i], size/2);
+        for (u32 j = 0; j < size/2; j++) ASSERT(ptrs[i][j] == (u8)i);
+    }
+    u8 *p = slab.alloc(slab.data, 20);
+    ASSERT(slab.re_alloc(slab.data, p, 24) == p); // Same class
+    for (u32 i = 0; i < 2000; i += 2) slab.free_one(slab.data, ptrs[i]);
+    u64 *z = slab.zero_alloc(slab.data, 100, sizeof(u64));
+    for (u32 i = 0; i < 100; i++) ASSERT(z[i] == 0);
+    slab.free_all(slab.data);
+    ASSERT(((AIL_Alloc_Slab *)slab.data)->large == NULL);
+    return true;
+}
+
+bool pageTest(void)
+{
+    AIL_Allocator page = ail_alloc_pager;
+    u8 *p = page.alloc(page.data, 100);
+    ASSERT(p != NULL);
+    for (u32 i = 0; i < 100; i++) p[i] = (u8)i;
+    p = page.re_alloc(page.data, p, 5*AIL_ALLOC_PAGE_SIZE);
+    ASSERT(p != NULL);
+    for (u32 i = 0; i < 100; i++) ASSERT(p[i] == i);
+    p[5*AIL_ALLOC_PAGE_SIZE - 1] = 1;
+    u8 *q = page.re_alloc(page.data, p, 50);
+    ASSERT(q == p);
+    for (u32 i = 0; i < 50; i++) ASSERT(q[i] == i);
+    page.free_one(page.data, q);
+    page.free_one(page.data, NULL);
+#ifdef __linux__
+    // This file defines _GNU_SOURCE, so growing must not copy
+    ASSERT(AIL_ALLOC_PAGE_REMAP);
+#endif
+    u8 *z = page.zero_alloc(page.data, 10, 1000);
+    for (u32 i = 0; i < 10000; i++) ASSERT(z[i] == 0);
+    page.free_one(page.data, z);
+    return true;
+}
+
+bool vmArenaTest(void)
+{
+    AIL_Alloc_VM vm = ail_alloc_vm_reserve(1 << 30, false);
+    ASSERT(vm.base != NULL && vm.reserved == 1 << 30 && vm.committed == 0);
+    ASSERT(ail_alloc_vm_commit(&vm, 100));
+    ASSERT(vm.committed >= 100);
+    vm.base[99] = 1;
+    ASSERT(!ail_alloc_vm_commit(&vm, vm.reserved + 1));
+    ail_alloc_vm_decommit(&vm, 0);
+    ASSERT(vm.committed == 0);
+    ail_alloc_vm_release(&vm);
+    ASSERT(vm.base == NULL);
+
+    AIL_Allocator arena = ail_alloc_vm_arena_new(64 << 20, false);
+    u8 *a = arena.alloc(arena.data, 16);
+    u8 *b = arena.alloc(arena.data, 16);
+    ASSERT(a != NULL && b != NULL && a != b);
+    for (u32 i = 0; i < 16; i++) b[i] = (u8)i;
+    // The last allocation grows in place, even past the initially committed range
+    u8 *c = arena.re_alloc(arena.data, b, 1 << 20);
+    ASSERT(c == b);
+    for (u32 i = 0; i < 16; i++) ASSERT(c[i] == i);
+    c[(1 << 20) - 1] = 1;
+    // Any other allocation has to move
+    u8 *d = arena.re_alloc(arena.data, a, 32);
+    ASSERT(d != a && d > c);
+    u8 *z = arena.zero_alloc(arena.data, 1, 4096);
+    for (u32 i = 0; i < 4096; i++) ASSERT(z[i] == 0);
+    arena.free_one(arena.data, z);
+    ASSERT(arena.alloc(arena.data, 8) == z);
+    arena.free_all(arena.data);
+    ASSERT(arena.alloc(arena.data, 16) == a);
+    ail_alloc_vm_arena_release(&arena);
+    ASSERT(arena.data == NULL);
+    return true;
+}
+
+int main(void)
+{
+    if (statsTest()) printf("\033[32mStats Allocator Test successful :)\033[0m\n");
+    else             printf("\033[31mStats Allocator Test failed     :(\033[0m\n");
+    if (poolGrowTest()) printf("\033[32mPool Growth Test successful     :)\033[0m\n");
+    else                printf("\033[31mPool Growth Test failed         :(\033[0m\n");
+    if (slabTest())     printf("\033[32mSlab Allocator Test successful  :)\033[0m\n");
+    else                printf("\033[31mSlab Allocator Test failed      :(\033[0m\n");
+    if (pageTest())     printf("\033[32mPage Allocator Test successful  :)\033[0m\n");
+    else                printf("\033[31mPage Allocator Test failed      :(\033[0m\n");
+    if (vmArenaTest())  printf("\033[32mVM Arena Test successful        :)\033[0m\n");
+    else                printf("\033[31mVM Arena Test failed            :(\033[0m\n");
+    return 0;
+}
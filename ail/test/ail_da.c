@@ -4,6 +4,7 @@
 #include "../ail.h"
 #include <stdio.h>
 #include <stdbool.h>
+#include "test_assert.h"
 
 #define LEN 10
 #define EL_TO_INSERT 19
@@ -13,6 +14,7 @@ typedef struct Vec2 {
     u32 y;
 } Vec2;
 AIL_DA_INIT(Vec2);
+AIL_SDA_INIT(u32, 4);
 
 bool intTest(void)
 {
@@ -50,11 +52,97 @@ bool structTest(void)
     return sum.x == expected.x && sum.y == expected.y;
 }
 
+bool growthTest(void)
+{
+    AIL_DA(u32) da = ail_da_new_empty(u32);
+    ail_da_push(&da, 0);
+    ASSERT(da.cap == AIL_DA_MIN_CAP);
+    for (u32 i = 1; i <= AIL_DA_MIN_CAP; i++) ail_da_push(&da, i);
+    ASSERT(da.cap == AIL_DA_MIN_CAP*AIL_DA_GROWTH_NUM/AIL_DA_GROWTH_DEN);
+
+    ail_da_reserve(&da, 1000);
+    ASSERT(da.cap == 1000);
+    ail_da_reserve(&da, 10);
+    ASSERT(da.cap == 1000);
+    for (u32 i = 0; i < da.len; i++) ASSERT(da.data[i] == i);
+
+    ail_da_maybe_shrink(&da);
+    ASSERT(da.cap == 2*da.len);
+    ail_da_shrink(&da);
+    ASSERT(da.cap == da.len && da.len == AIL_DA_MIN_CAP + 1);
+
+    AIL_DA(u32) other = ail_da_new_with_cap(u32, 100);
+    for (u32 i = 0; i < 100; i++) ail_da_push(&other, da.len + i);
+    ail_da_extend_from(&da, &other);
+    ASSERT(da.len == AIL_DA_MIN_CAP + 101);
+    for (u32 i = 0; i < da.len; i++) ASSERT(da.data[i] == i);
+
+    // Inserting and removing keeps the order of all other elements
+    u32 buf[3] = { 1000, 1001, 1002 };
+    ail_da_insertn(&da, 5, buf, 3);
+    ail_da_insert(&da, 0, 999);
+    ASSERT(da.data[0] == 999 && da.data[6] == 1000 && da.data[8] == 1002 && da.data[9] == 5);
+    ail_da_rm(&da, 0);
+    ail_da_rm(&da, 5);
+    ail_da_rm(&da, 5);
+    ail_da_rm(&da, 5);
+    for (u32 i = 0; i < da.len; i++) ASSERT(da.data[i] == i);
+
+    da.len = 0;
+    ail_da_shrink(&da);
+    ASSERT(da.data == NULL && da.cap == 0);
+    ail_da_push(&da, 1);
+    ASSERT(da.len == 1 && da.data[0] == 1);
+    ail_da_free(&da);
+    ail_da_free(&other);
+    return true;
+}
+
+static AIL_SDA(u32, 4) sdaCopy(AIL_SDA(u32, 4) sda)
+{
+    u32 next = sda.len;
+    ail_sda_push(&sda, next);
+    return sda;
+}
+
+bool smallTest(void)
+{
+    AIL_SDA(u32, 4) sda = ail_sda_new(u32, 4);
+    ail_sda_push(&sda, 0);
+    ail_sda_push(&sda, 1);
+    ASSERT(ail_sda_is_inline(&sda) && sda.data == sda.buf);
+    sda = sdaCopy(sda); // Copying the array while inline must not keep pointing at the old copy's buffer
+    ail_sda_push(&sda, 4);
+    ASSERT(sda.data == sda.buf && sda.len == 4);
+    ail_sda_insert(&sda, 3, 3);
+    ASSERT(!ail_sda_is_inline(&sda) && sda.cap > 4);
+    for (u32 i = 0; i < sda.len; i++) ASSERT(sda.data[i] == i);
+
+    u32 buf[8] = { 5, 6, 7, 8, 9, 10, 11, 12 };
+    ail_sda_pushn(&sda, buf, 8);
+    ail_sda_rm(&sda, 0);
+    for (u32 i = 0; i < sda.len; i++) ASSERT(sda.data[i] == i + 1);
+    sda.len = 3;
+    ail_sda_shrink(&sda);
+    ASSERT(ail_sda_is_inline(&sda) && sda.data == sda.buf);
+    for (u32 i = 0; i < sda.len; i++) ASSERT(sda.data[i] == i + 1);
+
+    ail_sda_reserve(&sda, 100);
+    ASSERT(sda.cap == 100 && sda.data[2] == 3);
+    ail_sda_free(&sda);
+    ASSERT(sda.len == 0 && ail_sda_is_inline(&sda));
+    return true;
+}
+
 int main(void)
 {
     if (intTest())    printf("\033[32mTest with ints succesfull :)\033[0m\n");
     else              printf("\033[31mTest with ints failed     :(\033[0m\n");
     if (structTest()) printf("\033[32mTest with vec2 succesfull :)\033[0m\n");
     else              printf("\033[31mTest with vec2 failed     ;(\033[0m\n");
+    if (growthTest()) printf("\033[32mGrowth test successful    :)\033[0m\n");
+    else              printf("\033[31mGrowth test failed        :(\033[0m\n");
+    if (smallTest())  printf("\033[32mSmall array test successful :)\033[0m\n");
+    else              printf("\033[31mSmall array test failed     :(\033[0m\n");
     return 0;
 }
\ No newline at end of file
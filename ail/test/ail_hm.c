@@ -101,6 +101,149 @@ bool miniTest(void)
     return true;
 }
 
+bool batchTest(void)
+{
+#define BATCH_KEYS 1000
+    static char keys[2*BATCH_KEYS][8];
+    static str  keyPtrs[2*BATCH_KEYS];
+    static u32 *vals[2*BATCH_KEYS];
+    AIL_HM(str, u32) hm = ail_hm_new_empty(str, u32, &miniTestHash, &miniTestEq);
+    ail_hm_reserve(&hm, BATCH_KEYS);
+    u32 cap = hm.cap;
+    ASSERT(cap*AIL_HM_LOAD_FACTOR > BATCH_KEYS*100);
+    for (u32 i = 0; i < 2*BATCH_KEYS; i++) {
+        sprintf(keys[i], "k-%u", i);
+        keyPtrs[i] = keys[i];
+    }
+    for (u32 n = 0; n < 3; n++) {
+        for (u32 i = 0; i < BATCH_KEYS; i++) {
+            u32 *val;
+            bool found;
+            ail_hm_get_or_insert(&hm, keyPtrs[i], val, found);
+            ASSERT(found == (n > 0));
+            ASSERT(*val == n);
+            (*val)++;
+        }
+    }
+    ASSERT(hm.len == BATCH_KEYS && hm.cap == cap); // Reserving made growing unnecessary
+
+    ail_hm_get_many(&hm, keyPtrs, 2*BATCH_KEYS, vals);
+    for (u32 i = 0; i < 2*BATCH_KEYS; i++) {
+        if (i < BATCH_KEYS) { ASSERT(vals[i] && *vals[i] == 3); }
+        else                { ASSERT(vals[i] == NULL); }
+    }
+    ail_hm_free(&hm);
+    ail_hm_get_many(&hm, keyPtrs, 3, vals);
+    ASSERT(vals[0] == NULL && vals[2] == NULL);
+    return true;
+}
+
+AIL_HM_INIT(u32, u32);
+
+// Use the built-in hashes directly instead of through the hashmap's function pointers
+#undef  AIL_HM_HASH
+#undef  AIL_HM_EQ
+#define AIL_HM_HASH(hmPtr, k)  ail_hm_hash_u32(k)
+#define AIL_HM_EQ(hmPtr, a, b) ail_hm_eq_u32(a, b)
+bool builtinHashTest(void)
+{
+    // Similar inputs should spread out over all buckets
+    u32 buckets[64] = {0};
+    char buf[32];
+    for (u32 i = 0; i < 64*64; i++) {
+        u32 n = (u32)sprintf(buf, "key-%u", i);
+        buckets[ail_hm_hash_bytes(buf, n) & 63]++;
+        ASSERT(ail_hm_hash_bytes(buf, n) == ail_hm_hash_str(buf));
+    }
+    for (u32 i = 0; i < 64; i++) ASSERT(buckets[i] > 32 && buckets[i] < 96);
+    ASSERT(ail_hm_hash_bytes("abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopqrstuvwxyz", 62) != ail_hm_hash_bytes("abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopqrstuvwxyZ", 62));
+    ASSERT(ail_hm_hash_bytes("", 0) != ail_hm_hash_bytes("a", 1));
+
+    AIL_HM(u32, u32) hm = ail_hm_new_empty(u32, u32, NULL, NULL); // No function pointers are needed anymore
+    for (u32 i = 0; i < 10000; i++) ail_hm_put(&hm, i*64, i);
+    for (u32 i = 0; i < 10000; i++) {
+        u32 *val;
+        ail_hm_get_ptr(&hm, i*64, val);
+        ASSERT(val && *val == i);
+    }
+    ASSERT(hm.len == 10000);
+    ail_hm_free(&hm);
+    return true;
+}
+#undef  AIL_HM_HASH
+#undef  AIL_HM_EQ
+#define AIL_HM_HASH(hmPtr, k)  (hmPtr)->hash(k)
+#define AIL_HM_EQ(hmPtr, a, b) (hmPtr)->eq(a, b)
+
+AIL_HSET_INIT(u32);
+
+bool hsetTest(void)
+{
+    AIL_HSET(u32) set = ail_hset_new(u32, 0, &ail_hm_hash_u32, &ail_hm_eq_u32);
+    bool found;
+    ail_hset_has(&set, 5, found);
+    ASSERT(!found);
+    for (u32 i = 1; i <= 1000; i++) ail_hset_add(&set, i*3);
+    for (u32 i = 1; i <= 1000; i++) ail_hset_add(&set, i*3);
+    ASSERT(set.len == 1000);
+    ASSERT((set.cap & (set.cap - 1)) == 0 && set.cap*AIL_HM_LOAD_FACTOR > 1000*100);
+    for (u32 i = 1; i <= 3000; i++) {
+        ail_hset_has(&set, i, found);
+        ASSERT(found == (i == (i/3)*3));
+    }
+    // Removing every second key has to keep all others reachable
+    for (u32 i = 2; i <= 1000; i += 2) ail_hset_rm(&set, i*3);
+    ail_hset_rm(&set, 1);
+    ASSERT(set.len == 500);
+    for (u32 i = 1; i <= 1000; i++) {
+        ail_hset_has(&set, i*3, found);
+        ASSERT(found == (i & 1));
+    }
+    ail_hset_free(&set);
+    return true;
+}
+
+bool compactMapTest(void)
+{
+    ASSERT(sizeof(AIL_HM_U32_Entry) == 8 && sizeof(AIL_HM_U32_Entry) < sizeof(AIL_HM_BOX(u32, u32)));
+    AIL_HM_U32 hm = ail_hm_u32_new(0, &ail_default_allocator);
+    ASSERT(ail_hm_u32_get_ptr(&hm, 1) == NULL);
+    ASSERT(!ail_hm_u32_rm(&hm, 1));
+    static u32 counts[4096];
+    u32 state = 1;
+    for (u32 i = 0; i < 20000; i++) {
+        state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+        u32 key = state & 4095; // Plenty of repeated keys
+        bool found;
+        u32 *val = ail_hm_u32_get_or_insert(&hm, key, &found);
+        ASSERT(found == (counts[key] > 0));
+        (*val)++;
+        counts[key]++;
+    }
+    u32 total = 0;
+    for (u32 i = 0; i < hm.cap; i++) {
+        if (hm.data[i].key != AIL_HM_U32_EMPTY) total += hm.data[i].val;
+    }
+    ASSERT(total == 20000);
+    for (u32 k = 0; k < 4096; k += 2) ail_hm_u32_rm(&hm, k);
+    for (u32 k = 0; k < 4096; k++) {
+        u32 *val = ail_hm_u32_get_ptr(&hm, k);
+        if ((k & 1) && counts[k]) { ASSERT(val && *val == counts[k]); }
+        else                      { ASSERT(val == NULL); }
+    }
+    ail_hm_u32_put(&hm, 0, 42);
+    ASSERT(*ail_hm_u32_get_ptr(&hm, 0) == 42);
+
+    // The sentinel key is never in the map, even though empty slots contain it
+    u32 len = hm.len;
+    ASSERT(ail_hm_u32_get_ptr(&hm, AIL_HM_U32_EMPTY) == NULL);
+    ASSERT(!ail_hm_u32_rm(&hm, AIL_HM_U32_EMPTY));
+    ASSERT(hm.len == len);
+    ASSERT(*ail_hm_u32_get_ptr(&hm, 0) == 42);
+    ail_hm_u32_free(&hm);
+    return true;
+}
+
 int main(void)
 {
     if (miniTest())   printf("\033[32mMini-Test succesful         :)\033[0m\n");
@@ -109,5 +252,13 @@ int main(void)
     else              printf("\033[31mTest with strings failed    :(\033[0m\n");
     if (structTest()) printf("\033[32mTest with Vec3 succesful    :)\033[0m\n");
     else              printf("\033[31mTest with Vec3 failed       :(\033[0m\n");
+    if (batchTest())  printf("\033[32mBatch-Test succesful        :)\033[0m\n");
+    else              printf("\033[31mBatch-Test failed           :(\033[0m\n");
+    if (builtinHashTest()) printf("\033[32mBuilt-in Hash Test succesful :)\033[0m\n");
+    else                   printf("\033[31mBuilt-in Hash Test failed    :(\033[0m\n");
+    if (hsetTest())        printf("\033[32mHash Set Test succesful     :)\033[0m\n");
+    else                   printf("\033[31mHash Set Test failed        :(\033[0m\n");
+    if (compactMapTest())  printf("\033[32mCompact Map Test succesful  :)\033[0m\n");
+    else                   printf("\033[31mCompact Map Test failed     :(\033[0m\n");
     return 0;
 }
\ No newline at end of file
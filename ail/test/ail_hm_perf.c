@@ -1,34 +1,20 @@
+#define _POSIX_C_SOURCE 200809L // For clock_gettime
 #define AIL_FS_IMPL
+#define AIL_TIME_IMPL
 #define AIL_HM_IMPL
 #include "test_assert.h"
 #include "../ail_hm.h"
 #include "../ail_fs.h"
+#include "../ail_time.h"
 #include <stdlib.h>
 #include <stdio.h>
-#include <time.h>
 #include <ctype.h>
 
-#ifdef _WIN32
-#include <windows.h>
-#endif
-
 typedef char* String;
 AIL_HM_INIT(String, u32);
 
 static AIL_HM(String, u32) hm;
 
-double clockGetSecs(void)
-{
-#ifdef _WIN32
-    return (double)timeGetTime() / 1000;
-#else
-    struct timespec ts = {0};
-    int ret = clock_gettime(CLOCK_MONOTONIC, &ts);
-    ASSERT(ret == 0);
-    return (double)ts.tv_sec + ts.tv_nsec*1e-9;
-#endif
-}
-
 bool ignoreChar(char c)
 {
     return c == ' ' || c == '\t' || c == '\n'; // || c == ',' || c == '.' || c == '?' || c == '!' || c == '(' || c == ')' || c == '-' || c == '_';
@@ -61,15 +47,86 @@ i32 keyValCompRev(const void *a, const void *b)
     return bkv->val - akv->val;
 }
 
+typedef enum {
+    BUILD_GET_PUT,       // ail_hm_get_ptr followed by ail_hm_put for new keys
+    BUILD_GET_OR_INSERT, // ail_hm_get_or_insert
+    BUILD_RESERVED,      // ail_hm_reserve followed by ail_hm_get_or_insert
+} BuildMode;
+
+static const char *buildModeNames[] = { "get_ptr + put", "get_or_insert", "reserve + get_or_insert" };
+
+// Counts all tokens in the hashmap and returns the time it took
+// `uniqueCount` is the amount of distinct tokens, which is reserved up front with BUILD_RESERVED
+double buildCounts(String *tokens, u32 tokenCount, u32 uniqueCount, BuildMode mode)
+{
+    hm = ail_hm_new_with_cap(String, u32, 64, &djb2, &strEq);
+    double start = ail_time_clock_start();
+    if (mode == BUILD_RESERVED) ail_hm_reserve(&hm, uniqueCount);
+    for (u32 i = 0; i < tokenCount; i++) {
+        String s = tokens[i];
+        u32 *val;
+        if (mode == BUILD_GET_PUT) {
+            ail_hm_get_ptr(&hm, s, val);
+            if (val) (*val)++;
+            else ail_hm_put(&hm, s, 1);
+        } else {
+            bool found;
+            ail_hm_get_or_insert(&hm, s, val, found);
+            (*val)++;
+        }
+    }
+    return ail_time_clock_elapsed(start);
+}
+
+// Same as buildCounts with BUILD_RESERVED, but the built-in string hash and comparison are inlined
+#undef  AIL_HM_HASH
+#undef  AIL_HM_EQ
+#define AIL_HM_HASH(hmPtr, k)  ail_hm_hash_str(k)
+#define AIL_HM_EQ(hmPtr, a, b) ail_hm_eq_str(a, b)
+double buildCountsInlined(String *tokens, u32 tokenCount, u32 uniqueCount)
+{
+    hm = ail_hm_new_with_cap(String, u32, 64, &ail_hm_hash_str, &ail_hm_eq_str);
+    double start = ail_time_clock_start();
+    ail_hm_reserve(&hm, uniqueCount);
+    for (u32 i = 0; i < tokenCount; i++) {
+        u32 *val;
+        bool found;
+        ail_hm_get_or_insert(&hm, tokens[i], val, found);
+        (*val)++;
+    }
+    return ail_time_clock_elapsed(start);
+}
+#undef  AIL_HM_HASH
+#undef  AIL_HM_EQ
+#define AIL_HM_HASH(hmPtr, k)  (hmPtr)->hash(k)
+#define AIL_HM_EQ(hmPtr, a, b) (hmPtr)->eq(a, b)
+
+// Looks every token up again and returns the time it took
+double lookupCounts(String *tokens, u32 tokenCount, bool batched, u64 *checksum)
+{
+    u32 **vals = malloc(sizeof(u32 *) * tokenCount);
+    double start = ail_time_clock_start();
+    if (batched) {
+        ail_hm_get_many(&hm, tokens, tokenCount, vals);
+    } else {
+        for (u32 i = 0; i < tokenCount; i++) ail_hm_get_ptr(&hm, tokens[i], vals[i]);
+    }
+    double end = ail_time_clock_start();
+    *checksum = 0;
+    for (u32 i = 0; i < tokenCount; i++) *checksum += vals[i] ? *vals[i] : 0;
+    free(vals);
+    return end - start;
+}
+
 void txtFileTest(const char *fpath)
 {
     u64 fsize;
     char *text = ail_fs_read_entire_file(fpath, &fsize);
-    hm = ail_hm_new_with_cap(String, u32, 64, &djb2, &strEq);
-
-    double start = clockGetSecs();
 
+    // Tokens are split up front, so that only the hashmap operations are measured
     u32 tokenCount = 0;
+    u32 tokenCap   = 1024;
+    String *tokens = malloc(sizeof(String) * tokenCap);
     u32 i = 0;
     while (i < fsize) {
         while (i < fsize && ignoreChar(text[i])) i++;
@@ -78,13 +135,35 @@ void txtFileTest(const char *fpath)
         char *s = malloc((i - j + 1) * sizeof(char));
         memcpy(s, &text[j], i - j);
         s[i - j] = 0;
-        tokenCount++;
-        u32 *val;
-        ail_hm_get_ptr(&hm, s, val);
-        if (val) (*val)++;
-        else ail_hm_put(&hm, s, 1);
+        if (tokenCount == tokenCap) {
+            tokenCap *= 2;
+            tokens    = realloc(tokens, sizeof(String) * tokenCap);
+        }
+        tokens[tokenCount++] = s;
     }
 
+    printf("Textfile: %s (size: %llu)\n", fpath, (unsigned long long)fsize);
+
+    if (tokenCount == 901326) printf("\033[32m");
+    else printf("\033[31m");
+    printf("  Tokens: %d\033[0m\n", tokenCount);
+
+    u32 uniqueCount = 0;
+    for (BuildMode mode = BUILD_GET_PUT; mode <= BUILD_RESERVED; mode++) {
+        double buildTime = buildCounts(tokens, tokenCount, uniqueCount, mode);
+        printf("  Counting with %-24s %.03lfs\n", buildModeNames[mode], buildTime);
+        uniqueCount = hm.len;
+        ail_hm_free(&hm);
+    }
+    printf("  Counting with %-24s %.03lfs\n", "inlined built-in hash", buildCountsInlined(tokens, tokenCount, uniqueCount));
+
+    u64 sequentialSum, batchedSum;
+    double sequentialTime = lookupCounts(tokens, tokenCount, false, &sequentialSum);
+    double batchedTime    = lookupCounts(tokens, tokenCount, true,  &batchedSum);
+    if (sequentialSum == batchedSum) printf("\033[32m");
+    else printf("\033[31m");
+    printf("  Looking up with get_ptr  %.03lfs, get_many %.03lfs\033[0m\n", sequentialTime, batchedTime);
+
     u32 arrlen = hm.len;
     AIL_HM_KEY_VAL(String, u32) *arr = malloc(sizeof(AIL_HM_KEY_VAL(String, u32)) * arrlen);
     for (u32 i = 0, j = 0; i < hm.cap; i++) {
@@ -96,17 +175,9 @@ void txtFileTest(const char *fpath)
     }
     qsort(arr, arrlen, sizeof(AIL_HM_KEY_VAL(String, u32)), keyValCompRev);
 
-    double end = clockGetSecs();
-
     char *expTopTenKeys[] = { "the",  "I",  "and", "to",   "of", "a",   "my", "in", "you", "is" };
     u32   expTopTenVals[] = { 23242, 19540, 18297, 15623, 15544, 12532, 10824, 9576, 9081, 7851 };
 
-    printf("Textfile: %s (size: %llu)\n", fpath, fsize);
-
-    if (tokenCount == 901326) printf("\033[32m");
-    else printf("\033[31m");
-    printf("  Tokens: %d\033[0m\n", tokenCount);
-
     if (arrlen == 67506) printf("\033[32m");
     else printf("\033[31m");
     printf("  Unique Tokens: %d\033[0m\n", arrlen);
@@ -117,12 +188,11 @@ void txtFileTest(const char *fpath)
         else printf("\033[31m");
         printf("    %2d: %6s (%d)\033[0m\n", i, arr[i].key, arr[i].val);
     }
-    printf("  Total time %.03lfs\n", end - start);
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
-    txtFileTest("shakespeare.txt");
+    txtFileTest(argc > 1 ? argv[1] : "shakespeare.txt");
     // Expected result:
     // Tokens: 901326
     // Unique Tokens: 67506
@@ -137,4 +207,4 @@ int main(void)
     //    7:     in (9576)
     //    8:    you (9081)
     //    9:     is (7851)
-}
\ No newline at end of file
+}
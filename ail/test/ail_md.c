@@ -0,0 +1,172 @@
+#define AIL_MD_IMPL
+#include "../ail_md.h"
+#include "test_assert.h"
+
+#define ALLOCS 10000
+
+bool recordTest(void)
+{
+    static void *ptrs[ALLOCS];
+    u64 consumption = ail_md_consumption();
+    AIL_MD_Stats before = ail_md_thread_stats();
+
+    // Many live allocations from the same two sites force the shards to grow and shift entries back on removal
+    for (u32 i = 0; i < ALLOCS; i++) {
+        if (i & 1) ptrs[i] = ail_md_malloc((i & 63) + 1, __FILE__, 100);
+        else       ptrs[i] = ail_md_calloc(1, (i & 63) + 1, __FILE__, 200);
+    }
+    u64 expected = 0;
+    for (u32 i = 0; i < ALLOCS; i++) expected += (i & 63) + 1;
+    ASSERT(ail_md_consumption() - consumption == expected);
+
+    for (u32 i = 0; i < ALLOCS; i++) {
+        u32 line; char *file; u64 size;
+        ASSERT(ail_md_query(ptrs[i], &line, &file, &size));
+        u32 expected_line = (i & 1) ? 100 : 200;
+        ASSERT(line == expected_line);
+        ASSERT(size == (i & 63) + 1);
+    }
+    ASSERT(ail_md_comment(ptrs[7], "seven"));
+    ASSERT(!ail_md_test(ptrs[7], 8, false));
+    printf("Expecting an out-of-bounds error: ");
+    ASSERT(ail_md_test((u8 *)ptrs[7] + 4, 8, false));
+
+    // Free every third allocation and check that all others can still be found
+    for (u32 i = 0; i < ALLOCS; i += 3) ail_md_free(ptrs[i], __FILE__, __LINE__);
+    for (u32 i = 0; i < ALLOCS; i++) {
+        bool freed = i % 3 == 0;
+        ASSERT(ail_md_query(ptrs[i], NULL, NULL, NULL) != freed);
+    }
+
+    // Reallocating keeps the contents and moves the pointer to the new site
+    u8 *p = (u8 *)ail_md_realloc(ptrs[1], 256, __FILE__, 300);
+    ASSERT(p[0] == AIL_MD_MAGIC_NUM + 1);
+    ptrs[1] = p;
+    u32 line;
+    ASSERT(ail_md_query(p, &line, NULL, NULL) && line == 300);
+    ASSERT(!ail_md_mem());
+
+    for (u32 i = 0; i < ALLOCS; i++) if (i % 3) ail_md_free(ptrs[i], __FILE__, __LINE__);
+    ASSERT(ail_md_consumption() == consumption);
+
+    AIL_MD_Stats after = ail_md_thread_stats();
+    ASSERT(after.allocs   - before.allocs   == ALLOCS);
+    ASSERT(after.frees    - before.frees    == ALLOCS);
+    ASSERT(after.reallocs - before.reallocs == 1);
+    ASSERT(after.bytes_allocated - before.bytes_allocated == after.bytes_freed - before.bytes_freed);
+    return true;
+}
+
+// Every translation unit has its own copy of a header's name, all of which should share the same site
+bool siteTest(void)
+{
+    static char file_a[] = "shared_header.h";
+    static char file_b[] = "shared_header.h";
+    u32 line; char *file; u64 size;
+    void *a = ail_md_malloc(8, file_a, 300);
+    void *b = ail_md_malloc(8, file_b, 300);
+    ASSERT(ail_md_query(a, &line, &file, &size));
+    ASSERT(file == file_a);
+    ASSERT(ail_md_query(b, &line, &file, &size));
+    ASSERT(file == file_a && line == 300);
+    // Known pointers are found without reading the file name, so changing it afterwards doesn't change the site
+    u32 site = ail_md_site(file_a, 300);
+    file_a[0] = 'X';
+    ASSERT(ail_md_site(file_a, 300) == site);
+    ASSERT(ail_md_site(file_b, 300) == site);
+    file_a[0] = 's';
+    ail_md_free(a, __FILE__, __LINE__);
+    ail_md_free(b, __FILE__, __LINE__);
+    return true;
+}
+
+bool doubleFreeTest(void)
+{
+    u64 size;
+    void *p = ail_md_malloc(16, __FILE__, __LINE__);
+    ASSERT(ail_md_remove(p, __FILE__, __LINE__, false, &size));
+    ASSERT(size == 16);
+    printf("Expecting a double free error: ");
+    ASSERT(!ail_md_remove(p, __FILE__, __LINE__, false, &size));
+    free(p);
+    return true;
+}
+
+bool sampleTest(void)
+{
+    static void *ptrs[ALLOCS];
+    u64 expected = 0;
+    ail_md_sample_set_rate(4096);
+    for (u32 i = 0; i < ALLOCS; i++) {
+        u64 size = 64 + (i & 255);
+        ptrs[i]  = ail_md_sample_malloc(size, __FILE__, 400);
+        expected += size;
+    }
+    // With about 200 samples, the estimate should easily be within 25% of the real amount of live memory
+    u64 live = ail_md_sample_live();
+    ASSERT(live > expected - expected/4 && live < expected + expected/4);
+
+    FILE *f = tmpfile();
+    ail_md_sample_dump_collapsed(f);
+    ASSERT(ftell(f) > 0);
+    rewind(f);
+    char line[1024];
+    ASSERT(fgets(line, sizeof(line), f) != NULL);
+    ASSERT(strstr(line, "ail_md.c:400 ") != NULL);
+    fclose(f);
+
+    f = tmpfile();
+    ail_md_sample_dump_pprof(f);
+    rewind(f);
+    ASSERT(fgets(line, sizeof(line), f) != NULL);
+    ASSERT(strncmp(line, "heap profile: ", 14) == 0);
+    fclose(f);
+
+    for (u32 i = 0; i < ALLOCS; i++) ptrs[i] = ail_md_sample_realloc(ptrs[i], 32, __FILE__, 500);
+    for (u32 i = 0; i < ALLOCS; i++) ail_md_sample_free(ptrs[i]);
+    ASSERT(ail_md_sample_live() == 0);
+    return true;
+}
+
+// With a sampling rate of 1 byte, every allocation is sampled and the profile has to contain exactly the raw sizes
+bool pprofTest(void)
+{
+    void *ptrs[10];
+    ail_md_sample_set_rate(1);
+    for (u32 i = 0; i < 10; i++) ptrs[i] = ail_md_sample_malloc(100, __FILE__, 600);
+    FILE *f = tmpfile();
+    ail_md_sample_dump_pprof(f);
+    rewind(f);
+    char line[1024];
+    unsigned long long count, bytes, count2, bytes2, rate;
+    ASSERT(fgets(line, sizeof(line), f) != NULL);
+    int parsed = sscanf(line, "heap profile: %llu: %llu [ %llu: %llu] @ heap_v2/%llu", &count, &bytes, &count2, &bytes2, &rate);
+    ASSERT(parsed == 5);
+    ASSERT(count == 10 && bytes == 1000 && rate == 1);
+    // All allocations come from the same stack, so they are aggregated into a single line
+    ASSERT(fgets(line, sizeof(line), f) != NULL);
+    parsed = sscanf(line, "%llu: %llu [ %llu: %llu] @", &count, &bytes, &count2, &bytes2);
+    ASSERT(parsed == 4);
+    ASSERT(count == 10 && bytes == 1000 && count2 == 10 && bytes2 == 1000);
+    ASSERT(fgets(line, sizeof(line), f) != NULL);
+    ASSERT(line[0] == '\n');
+    fclose(f);
+    for (u32 i = 0; i < 10; i++) ail_md_sample_free(ptrs[i]);
+    ail_md_sample_set_rate(AIL_MD_SAMPLE_RATE);
+    return true;
+}
+
+int main(void)
+{
+    if (recordTest())     printf("\033[32mRecord Test successful      :)\033[0m\n");
+    else                  printf("\033[31mRecord Test failed          :(\033[0m\n");
+    if (siteTest())       printf("\033[32mSite Test successful        :)\033[0m\n");
+    else                  printf("\033[31mSite Test failed            :(\033[0m\n");
+    if (doubleFreeTest()) printf("\033[32mDouble Free Test successful :)\033[0m\n");
+    else                  printf("\033[31mDouble Free Test failed     :(\033[0m\n");
+    if (sampleTest())     printf("\033[32mSample Test successful      :)\033[0m\n");
+    else                  printf("\033[31mSample Test failed          :(\033[0m\n");
+    if (pprofTest())      printf("\033[32mPprof Test successful       :)\033[0m\n");
+    else                  printf("\033[31mPprof Test failed           :(\033[0m\n");
+    return 0;
+}
@@ -0,0 +1,91 @@
+#define _POSIX_C_SOURCE 200809L // For clock_gettime and nanosleep
+#define AIL_PROFILE
+#define AIL_TIME_IMPL
+#include "../ail_time.h"
+#include "test_assert.h"
+#include <string.h>
+
+bool clockTest(void)
+{
+    u64 start = ail_time_now_ns();
+    ail_time_sleep(20);
+    u64 elapsed = ail_time_now_ns() - start;
+    ASSERT(elapsed >= 20000000 && elapsed < 500000000);
+
+    f64 cpns = ail_time_cycles_per_ns();
+    ASSERT(cpns > 0);
+    ASSERT(ail_time_cycles_per_ns() == cpns); // Only calibrated once
+    u64 c = ail_time_cycles();
+    start = ail_time_now_ns();
+    ail_time_sleep(10);
+    u64 ns     = ail_time_now_ns() - start;
+    u64 cyc_ns = ail_time_cycles_to_ns(ail_time_cycles() - c);
+    ASSERT(cyc_ns > ns*9/10 && cyc_ns < ns*11/10);
+
+    f64 secs = ail_time_clock_start();
+    ail_time_sleep(10);
+    ASSERT(ail_time_clock_elapsed(secs) >= 0.01);
+    return true;
+}
+
+static void profiledWork(u32 depth)
+{
+    AIL_PROFILE_ZONE("work");
+    if (depth) profiledWork(depth - 1);
+}
+
+static u32 countOccurences(const char *s, const char *sub)
+{
+    u32 n = 0;
+    while ((s = strstr(s, sub))) {
+        n++;
+        s++;
+    }
+    return n;
+}
+
+bool profileTest(void)
+{
+    ail_profile_reset();
+    {
+        AIL_PROFILE_ZONE("outer \"quoted\"");
+        profiledWork(2);
+        AIL_PROFILE_BEGIN(inner, "inner");
+        ail_time_sleep(1);
+        AIL_PROFILE_END(inner);
+    }
+    AIL_Profile_Thread *t = ail_profile_thread();
+    ASSERT(t->count == 5);
+    // Inner zones end first
+    ASSERT(strcmp(t->events[0].name, "work") == 0 && strcmp(t->events[4].name, "outer \"quoted\"") == 0);
+    ASSERT(t->events[4].start <= t->events[0].start && t->events[4].end >= t->events[3].end);
+
+    char buf[4096] = {0};
+    FILE *f = tmpfile();
+    ail_profile_dump_chrome_trace(f);
+    rewind(f);
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    ASSERT(n > 0);
+    ASSERT(countOccurences(buf, "\"ph\":\"X\"") == 5);
+    ASSERT(countOccurences(buf, "\"name\":\"work\"") == 3);
+    ASSERT(strstr(buf, "\"name\":\"outer \\\"quoted\\\"\""));
+
+    // Only the most recent zones are kept
+    for (u32 i = 0; i < AIL_PROFILE_RING_SIZE + 10; i++) {
+        AIL_PROFILE_ZONE("many");
+    }
+    ASSERT(t->count == AIL_PROFILE_RING_SIZE + 15);
+    ail_profile_reset();
+    ASSERT(t->count == 0);
+    return true;
+}
+
+int main(void)
+{
+    if (clockTest())   printf("\033[32mClock Test successful   :)\033[0m\n");
+    else               printf("\033[31mClock Test failed       :(\033[0m\n");
+    if (profileTest()) printf("\033[32mProfile Test successful :)\033[0m\n");
+    else               printf("\033[31mProfile Test failed     :(\033[0m\n");
+    return 0;
+}
@@ -44,6 +44,8 @@ typedef struct PidiCmd {
 } PidiCmd;
 AIL_DA_INIT(PidiCmd);
 #define MAX_VELOCITY (1<<4)
+#define MAX_DT  ((1<<12) - 1) // Maximum delta time in ms that fits into a PidiCmd
+#define MAX_LEN ((1<<8)  - 1) // Maximum length in cs that fits into a PidiCmd
 #define LEN_FACTOR 10 // Factor by which to multiply a PidiCmd's `len` with, to get the length in ms
 #define ENCODED_CMD_LEN 4
 AIL_STATIC_ASSERT(ENCODED_CMD_LEN == sizeof(PidiCmd));
@@ -75,34 +77,94 @@ static inline PianoKey pidi_key(PidiCmd cmd)
     return (PianoKey)cmd.key;
 }
 
+// Bit-layout of an encoded PidiCmd (see Protocols.md), starting at the least significant bit
+// The layout of the bitfield struct itself is implementation-defined, so commands must only ever be encoded via pidi_pack
+#define PIDI_DT_SHIFT        0
+#define PIDI_VELOCITY_SHIFT 12
+#define PIDI_LEN_SHIFT      16
+#define PIDI_OCTAVE_SHIFT   24
+#define PIDI_KEY_SHIFT      28
+#define PIDI_DT_MASK       0xfffUL
+#define PIDI_VELOCITY_MASK   0xfUL
+#define PIDI_LEN_MASK       0xffUL
+#define PIDI_OCTAVE_MASK     0xfUL
+#define PIDI_KEY_MASK        0xfUL
+AIL_STATIC_ASSERT(PIDI_DT_MASK       == MAX_DT);
+AIL_STATIC_ASSERT(PIDI_VELOCITY_MASK == MAX_VELOCITY - 1);
+AIL_STATIC_ASSERT(PIDI_LEN_MASK      == MAX_LEN);
+AIL_STATIC_ASSERT(((PIDI_DT_MASK << PIDI_DT_SHIFT) ^ (PIDI_VELOCITY_MASK << PIDI_VELOCITY_SHIFT) ^ (PIDI_LEN_MASK << PIDI_LEN_SHIFT) ^
+                   (PIDI_OCTAVE_MASK << PIDI_OCTAVE_SHIFT) ^ (PIDI_KEY_MASK << PIDI_KEY_SHIFT)) == 0xffffffffUL); // Fields cover all bits without overlapping
+AIL_STATIC_ASSERT(ENCODED_CMD_LEN == 4);
+
+static inline u32 pidi_pack(PidiCmd cmd)
+{
+    return ((u32)cmd.dt       << PIDI_DT_SHIFT)       |
+           ((u32)cmd.velocity << PIDI_VELOCITY_SHIFT) |
+           ((u32)cmd.len      << PIDI_LEN_SHIFT)      |
+           ((u32)cmd.octave   << PIDI_OCTAVE_SHIFT)   |
+           ((u32)cmd.key      << PIDI_KEY_SHIFT);
+}
+
+static inline PidiCmd pidi_unpack(u32 x)
+{
+    PidiCmd cmd;
+    cmd.dt       = (x >> PIDI_DT_SHIFT)       & PIDI_DT_MASK;
+    cmd.velocity = (x >> PIDI_VELOCITY_SHIFT) & PIDI_VELOCITY_MASK;
+    cmd.len      = (x >> PIDI_LEN_SHIFT)      & PIDI_LEN_MASK;
+    cmd.octave   = (x >> PIDI_OCTAVE_SHIFT)   & PIDI_OCTAVE_MASK;
+    cmd.key      = (x >> PIDI_KEY_SHIFT)      & PIDI_KEY_MASK;
+    return cmd;
+}
+
 static inline void encode_cmd(AIL_Buffer *buf, PidiCmd cmd) {
-    AIL_STATIC_ASSERT(ENCODED_CMD_LEN == 4);
-    AIL_STATIC_ASSERT(sizeof(PidiCmd) == 4);
-    ail_buf_write4lsb(buf, *(u32 *)&cmd);
+    ail_buf_write4lsb(buf, pidi_pack(cmd));
 }
 
 static inline void encode_cmd_simple(u8 *buf, PidiCmd cmd) {
-    AIL_STATIC_ASSERT(ENCODED_CMD_LEN == 4);
-    AIL_STATIC_ASSERT(sizeof(PidiCmd) == 4);
-    u32 c = *(u32 *)&cmd;
-    buf[0]  = (c >> 0*8) && 0xff;
-    buf[1]  = (c >> 1*8) && 0xff;
-    buf[2]  = (c >> 2*8) && 0xff;
-    buf[3]  = (c >> 3*8) && 0xff;
+    u32 c = pidi_pack(cmd);
+    buf[0]  = (c >> 0*8) & 0xff;
+    buf[1]  = (c >> 1*8) & 0xff;
+    buf[2]  = (c >> 2*8) & 0xff;
+    buf[3]  = (c >> 3*8) & 0xff;
 }
 
 static inline PidiCmd decode_cmd(AIL_Buffer *buf) {
-    AIL_STATIC_ASSERT(ENCODED_CMD_LEN == 4);
-    AIL_STATIC_ASSERT(sizeof(PidiCmd) == 4);
-    u32 cmd = ail_buf_read4lsb(buf);
-    return *(PidiCmd *)&cmd;
+    return pidi_unpack(ail_buf_read4lsb(buf));
+}
+
+static inline PidiCmd decode_cmd_simple(u8 *buf) {
+    u32 cmd = ((u32)buf[3] << 3*8) | ((u32)buf[2] << 2*8) | ((u32)buf[1] << 1*8) | ((u32)buf[0] << 0*8);
+    return pidi_unpack(cmd);
 }
 
-PidiCmd decode_cmd_simple(u8 *buf) {
-    AIL_STATIC_ASSERT(ENCODED_CMD_LEN == 4);
-    AIL_STATIC_ASSERT(sizeof(PidiCmd) == 4);
-    u32 cmd = ((u64)buf[3] << 3*8) | ((u64)buf[2] << 2*8) | ((u64)buf[1] << 1* 8) | ((u64)buf[0] <<  0*8);
-    return *(PidiCmd *)&cmd;
+// Streams commands into a PIDI file in `buf`
+// The commands count is only known once all commands were written, so it is patched into the header by `pidi_writer_end`
+typedef struct PidiWriter {
+    AIL_Buffer *buf;
+    u64 count_idx; // Index of the commands count in `buf`
+    u32 count;
+} PidiWriter;
+
+static inline PidiWriter pidi_writer_begin(AIL_Buffer *buf)
+{
+    ail_buf_write4msb(buf, PIDI_MAGIC);
+    PidiWriter w = { buf, buf->idx, 0 };
+    ail_buf_write4lsb(buf, 0);
+    return w;
+}
+
+static inline void pidi_writer_push(PidiWriter *w, PidiCmd cmd)
+{
+    encode_cmd(w->buf, cmd);
+    w->count++;
+}
+
+static inline void pidi_writer_end(PidiWriter *w)
+{
+    u64 idx = w->buf->idx;
+    w->buf->idx = w->count_idx;
+    ail_buf_write4lsb(w->buf, w->count);
+    w->buf->idx = idx;
 }
 
 typedef struct {
@@ -113,12 +175,327 @@ typedef struct {
 AIL_DA_INIT(Song);
 
 
+///////////////////////////
+//   PIDI Normalisation  //
+///////////////////////////
+
+// Rests longer than MAX_DT and notes longer than MAX_LEN can't be represented by a single PidiCmd.
+// Normalisation thus splits rests by inserting filler commands with a velocity of 0
+// and splits long notes into several segments, that are inserted at the right time between the other commands.
+
+// A PidiCmd, whose times are not limited by the bit-widths of the PIDI format
+typedef struct PidiCmdWide {
+    u32 dt;       // Time in ms since previous command
+    u32 len;      // Length in ms for which the note should be played
+    u8  velocity;
+    i8  octave;
+    u8  key;
+} PidiCmdWide;
+
+typedef enum PidiLongNoteMode {
+    PIDI_LONG_NOTE_RESTRIKE, // Every segment of a long note strikes the key again, right after the previous segment ended
+    PIDI_LONG_NOTE_CONTINUE, // Every segment starts one centisecond before the previous one ends, so the key is never released in between
+} PidiLongNoteMode;
+
+typedef struct PidiSink {
+    void *data;
+    void (*emit)(void *data, PidiCmd cmd);
+} PidiSink;
+
+typedef struct PidiSegment {
+    u64 start; // Absolute time in ms
+    u32 len;   // Remaining length in ms
+    u8  velocity;
+    i8  octave;
+    u8  key;
+} PidiSegment;
+AIL_SDA_INIT(PidiSegment, 16);
+
+typedef struct PidiNormalizer {
+    PidiSink sink;
+    PidiLongNoteMode mode;
+    u64 now;  // Absolute time of the last pushed command
+    u64 last; // Absolute time of the last emitted command
+    AIL_SDA(PidiSegment, 16) pending; // Remaining segments of long notes, sorted from latest to earliest start
+} PidiNormalizer;
+
+static inline PidiCmdWide pidi_widen(PidiCmd cmd)
+{
+    PidiCmdWide w;
+    w.dt       = pidi_dt(cmd);
+    w.len      = (u32)pidi_len(cmd)*LEN_FACTOR;
+    w.velocity = pidi_velocity(cmd);
+    w.octave   = pidi_octave(cmd);
+    w.key      = (u8)pidi_key(cmd);
+    return w;
+}
+
+static inline PidiNormalizer pidi_normalizer_new(PidiSink sink, PidiLongNoteMode mode)
+{
+    PidiNormalizer n;
+    n.sink    = sink;
+    n.mode    = mode;
+    n.now     = 0;
+    n.last    = 0;
+    n.pending = ail_sda_new(PidiSegment, 16); // Rarely more than a few notes overlap, so this doesn't allocate in most cases
+    return n;
+}
+
+static inline void pidi_normalizer_emit_at(PidiNormalizer *n, u64 t, u8 velocity, u8 len, i8 octave, u8 key)
+{
+    PidiCmd cmd = {0};
+    u64 gap = t - n->last;
+    cmd.dt  = MAX_DT;
+    while (gap > MAX_DT) {
+        n->sink.emit(n->sink.data, cmd);
+        gap -= MAX_DT;
+    }
+    cmd.dt       = (u32)gap;
+    cmd.velocity = velocity;
+    cmd.len      = len;
+    cmd.octave   = (u32)octave;
+    cmd.key      = key;
+    n->sink.emit(n->sink.data, cmd);
+    n->last = t;
+}
+
+static inline void pidi_normalizer_emit_segment(PidiNormalizer *n, PidiSegment seg)
+{
+    const u32 max_len = MAX_LEN*LEN_FACTOR;
+    u32 len = AIL_MIN(seg.len, max_len);
+    u32 cs  = (len + LEN_FACTOR/2)/LEN_FACTOR;
+    if (cs == 0 && len > 0) cs = 1;
+    pidi_normalizer_emit_at(n, seg.start, seg.velocity, (u8)cs, seg.octave, seg.key);
+    if (seg.len <= max_len) return;
+
+    // Queue the rest of the note, unless it is too short to be played at all
+    u32 next = max_len - (n->mode == PIDI_LONG_NOTE_CONTINUE)*LEN_FACTOR;
+    if (seg.len - next < LEN_FACTOR) return;
+    seg.start += next;
+    seg.len   -= next;
+    ail_sda_fix(&n->pending);
+    u32 i = n->pending.len;
+    while (i > 0 && n->pending.data[i - 1].start <= seg.start) i--;
+    ail_sda_insert(&n->pending, i, seg);
+}
+
+// Emits all queued segments that start at or before `t`
+static inline void pidi_normalizer_flush_until(PidiNormalizer *n, u64 t)
+{
+    ail_sda_fix(&n->pending);
+    while (n->pending.len > 0 && n->pending.data[n->pending.len - 1].start <= t) {
+        PidiSegment seg = n->pending.data[--n->pending.len];
+        pidi_normalizer_emit_segment(n, seg);
+    }
+}
+
+static inline void pidi_normalizer_push(PidiNormalizer *n, PidiCmdWide cmd)
+{
+    PidiSegment seg;
+    n->now += cmd.dt;
+    pidi_normalizer_flush_until(n, n->now);
+    seg.start    = n->now;
+    seg.len      = cmd.len;
+    seg.velocity = cmd.velocity;
+    seg.octave   = cmd.octave;
+    seg.key      = cmd.key;
+    pidi_normalizer_emit_segment(n, seg);
+}
+
+// Emits the remaining segments of all long notes and frees the normalizer's memory
+static inline void pidi_normalizer_finish(PidiNormalizer *n)
+{
+    pidi_normalizer_flush_until(n, UINT64_MAX);
+    ail_sda_free(&n->pending);
+}
+
+static inline void pidi_normalize_emit_da(void *data, PidiCmd cmd)
+{
+    AIL_DA(PidiCmd) *da = (AIL_DA(PidiCmd) *)data;
+    AIL_ASSERT(da->len < da->cap); // Enough capacity should have been reserved by pidi_normalize
+    da->data[da->len++] = cmd;
+}
+
+// Appends the normalized commands for `src` to `out`
+static inline void pidi_normalize(const PidiCmdWide *src, u32 count, PidiLongNoteMode mode, AIL_DA(PidiCmd) *out)
+{
+    // The following loop has no dependencies between iterations, so it is easily vectorized by the compiler
+    // It gives an upper bound for the amount of commands to be emitted, which allows reserving memory only once
+    u64 sum_dt = 0, sum_len = 0;
+    u32 max_dt = 0, max_len = 0;
+    for (u32 i = 0; i < count; i++) {
+        sum_dt  += src[i].dt;
+        sum_len += src[i].len;
+        max_dt   = AIL_MAX(max_dt,  src[i].dt);
+        max_len  = AIL_MAX(max_len, src[i].len);
+    }
+    // Segments of long notes may still be played after the last command, which is why max_len is added to the total time
+    u64 bound = count + (sum_dt + max_len)/MAX_DT + sum_len/((MAX_LEN - 1)*LEN_FACTOR) + 1;
+    ail_da_maybe_grow(out, bound);
+
+    if (max_dt <= MAX_DT && max_len <= MAX_LEN*LEN_FACTOR) {
+        // Fast path: Nothing needs to be split
+        for (u32 i = 0; i < count; i++) {
+            PidiCmd cmd  = {0};
+            u32 cs       = (src[i].len + LEN_FACTOR/2)/LEN_FACTOR;
+            cmd.dt       = src[i].dt;
+            cmd.velocity = src[i].velocity;
+            cmd.len      = cs + (cs == 0 && src[i].len > 0);
+            cmd.octave   = (u32)src[i].octave;
+            cmd.key      = src[i].key;
+            out->data[out->len++] = cmd;
+        }
+        return;
+    }
+
+    PidiSink sink = { out, &pidi_normalize_emit_da };
+    PidiNormalizer n = pidi_normalizer_new(sink, mode);
+    for (u32 i = 0; i < count; i++) pidi_normalizer_push(&n, src[i]);
+    pidi_normalizer_finish(&n);
+}
+
+
+//////////////////////
+//   PIDI Timeline  //
+//////////////////////
+
+// A PidiTimeline stores the absolute times of all commands of a song in a structure-of-arrays layout.
+// The i-th entry always belongs to the i-th command, so a timeline can also be used to find the command from which to continue playing after seeking.
+// Commands with a velocity of 0 are kept as well, but they are never considered active.
+
+// Notes are numbered consecutively from the lowest possible octave upwards, so that they fit into a single byte
+#define PIDI_NOTE(octave, key) ((u8)(((octave) + 8)*PIANO_KEY_AMOUNT + (key)))
+#define PIDI_NOTE_AMOUNT (16*PIANO_KEY_AMOUNT)
+#define PIDI_MAX_DUR_MS  (MAX_LEN*LEN_FACTOR)
+
+typedef struct PidiTimeline {
+    u32 *start_ms; // Absolute start time of each command
+    u16 *dur_ms;   // Length of each command in milliseconds
+    u8  *note;     // See PIDI_NOTE
+    u8  *vel;
+    u32  len;      // Amount of commands
+    u32  end_ms;   // Time at which the last note is released, i.e. the song's length
+    AIL_Allocator *allocator;
+} PidiTimeline;
+
+static inline i8 pidi_note_octave(u8 note)
+{
+    return (i8)(note/PIANO_KEY_AMOUNT) - 8;
+}
+
+static inline PianoKey pidi_note_key(u8 note)
+{
+    return (PianoKey)(note%PIANO_KEY_AMOUNT);
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PIDI_TIMELINE_SSE2
+#endif
+
+// Inclusive prefix-sum of `xs` in place
+static inline void pidi_prefix_sum_u32(u32 *xs, u32 n)
+{
+    u32 i = 0, carry = 0;
+#ifdef PIDI_TIMELINE_SSE2
+    // Computes the prefix-sum of 4 elements at once in log2(4) steps and adds the sum of all previous elements on top
+    __m128i vcarry = _mm_setzero_si128();
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((__m128i *)&xs[i]);
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi32(x, vcarry);
+        _mm_storeu_si128((__m128i *)&xs[i], x);
+        vcarry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    carry = (u32)_mm_cvtsi128_si32(vcarry);
+#endif
+    for (; i < n; i++) {
+        carry += xs[i];
+        xs[i]  = carry;
+    }
+}
+
+static inline PidiTimeline pidi_timeline_new(const PidiCmd *cmds, u32 count, AIL_Allocator *allocator)
+{
+    PidiTimeline tl;
+    // All arrays are put into the same allocation, ordered by decreasing alignment requirements
+    u8 *mem     = (u8 *)allocator->alloc(allocator->data, (u64)count*(sizeof(u32) + sizeof(u16) + 2*sizeof(u8)) + 1);
+    tl.start_ms = (u32 *)mem;
+    tl.dur_ms   = (u16 *)&tl.start_ms[count];
+    tl.note     = (u8  *)&tl.dur_ms[count];
+    tl.vel      = &tl.note[count];
+    tl.len      = count;
+    tl.end_ms   = 0;
+    tl.allocator = allocator;
+    AIL_ASSERT(mem != NULL);
+
+    for (u32 i = 0; i < count; i++) {
+        u32 x = pidi_pack(cmds[i]);
+        tl.start_ms[i] = (x >> PIDI_DT_SHIFT) & PIDI_DT_MASK;
+        tl.dur_ms[i]   = (u16)(((x >> PIDI_LEN_SHIFT) & PIDI_LEN_MASK)*LEN_FACTOR);
+        tl.vel[i]      = (u8)((x >> PIDI_VELOCITY_SHIFT) & PIDI_VELOCITY_MASK);
+        tl.note[i]     = PIDI_NOTE(pidi_octave(cmds[i]), (x >> PIDI_KEY_SHIFT) & PIDI_KEY_MASK);
+    }
+    pidi_prefix_sum_u32(tl.start_ms, count);
+    for (u32 i = 0; i < count; i++) {
+        u32 end = tl.start_ms[i] + tl.dur_ms[i];
+        tl.end_ms = AIL_MAX(tl.end_ms, end);
+    }
+    return tl;
+}
+
+static inline void pidi_timeline_free(PidiTimeline *tl)
+{
+    tl->allocator->free_one(tl->allocator->data, tl->start_ms);
+    tl->start_ms = NULL;
+    tl->dur_ms   = NULL;
+    tl->note     = NULL;
+    tl->vel      = NULL;
+    tl->len      = 0;
+}
+
+// Index of the first command that starts at or after `t` (or tl.len if there is none)
+static inline u32 pidi_timeline_lower_bound(const PidiTimeline *tl, u32 t)
+{
+    u32 lo = 0, hi = tl->len;
+    while (lo < hi) {
+        u32 mid = lo + (hi - lo)/2;
+        if (tl->start_ms[mid] < t) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Gives the range [*lo, *hi) of commands that start in the window [a, b)
+static inline void pidi_timeline_window(const PidiTimeline *tl, u32 a, u32 b, u32 *lo, u32 *hi)
+{
+    *lo = pidi_timeline_lower_bound(tl, a);
+    *hi = AIL_MAX(*lo, pidi_timeline_lower_bound(tl, b));
+}
+
+// Writes the indices of up to `max` notes that are sounding at time `t` into `out` and returns how many were found
+// Since no note can be longer than PIDI_MAX_DUR_MS, only the commands that started within that time before `t` need to be checked
+static inline u32 pidi_timeline_active(const PidiTimeline *tl, u32 t, u32 *out, u32 max)
+{
+    u32 n = 0;
+    u32 i = pidi_timeline_lower_bound(tl, t >= PIDI_MAX_DUR_MS ? t - PIDI_MAX_DUR_MS + 1 : 0);
+    for (; i < tl->len && tl->start_ms[i] <= t && n < max; i++) {
+        if (tl->vel[i] && t < tl->start_ms[i] + tl->dur_ms[i]) out[n++] = i;
+    }
+    return n;
+}
+
+
 //////////////
 //   SPPP   //
 //////////////
 
-#define BAUD_RATE 9600UL // 230400UL
+#define BAUD_RATE 9600UL // Rate at which every connection starts, higher rates are negotiated with a Baud message
 #define MSG_TIMEOUT 3000 // timeout for reading messages in milliseconds
+#define SPPP_BAUD_SWITCH_DELAY    10  // Time in ms that the UI waits after receiving the Success for a Baud message, before using the new rate
+#define SPPP_BAUD_CONFIRM_TIMEOUT 500 // Time in ms after switching, within which the MC has to receive a Ping at the new rate
+#define SPPP_FRAME_GAP 20             // Time in ms after which a frame that stopped arriving is considered incomplete
 
 static const CONST_VAR u32 SPPP_MAGIC = (((u32)'S') << 24) | (((u32)'P') << 16) | (((u32)'P') << 8);
 
@@ -130,6 +507,8 @@ typedef enum ClientMsgType {
     CMSG_VOLUME    = 'V',
     CMSG_MUSIC     = 'M',
     CMSG_NEW_MUSIC = 'N',
+    CMSG_BAUD      = 'B',
+    CMSG_MUSIC_DELTA = 'D',
 } ClientMsgType;
 
 typedef enum ServerMsgType {
@@ -137,6 +516,7 @@ typedef enum ServerMsgType {
     SMSG_PONG    = 'p',
     SMSG_SUCCESS = 's',
     SMSG_REQUEST = 'r',
+    SMSG_NAK     = 'n',
 } ServerMsgType;
 
 typedef struct PlayedKeySPPP {
@@ -146,6 +526,7 @@ typedef struct PlayedKeySPPP {
     velocity : 4;
 } PlayedKeySPPP;
 #define SPPP_PK_ENCODED_SIZE 3
+AIL_SDA_INIT(PlayedKeySPPP, 16); // Rarely more than a few keys are held at once, so building a CMSG_NEW_MUSIC message doesn't allocate in most cases
 
 typedef struct ClientMsgPidiData {
     u8 pks_count;
@@ -210,4 +591,880 @@ static inline PlayedKeySPPP decode_played_key(AIL_RingBuffer *rb)
     return pk;
 }
 
+#define SPPP_HEADER_SIZE 4
+#define SPPP_MUSIC_MSG_SIZE(cmds_count) (SPPP_HEADER_SIZE + 2 + (cmds_count)*ENCODED_CMD_LEN)
+
+static inline void sppp_write_header(AIL_Buffer *buf, u8 type)
+{
+    ail_buf_write4msb(buf, SPPP_MAGIC | type);
+}
+
+// Checksums that can be appended to frames, the UI offers a bitmask of them in its Ping and the MC chooses one in its Pong
+typedef enum SpppChecksum {
+    SPPP_CHECKSUM_NONE  = 0,
+    SPPP_CHECKSUM_CRC16 = 1 << 0, // CRC-16/CCITT-FALSE
+    SPPP_CHECKSUM_CRC32 = 1 << 1, // CRC-32 as used by Ethernet and zlib
+} SpppChecksum;
+#define SPPP_CHECKSUMS_ALL (SPPP_CHECKSUM_CRC16 | SPPP_CHECKSUM_CRC32)
+#define SPPP_CRC16_INIT 0xffff
+#define SPPP_CRC32_INIT 0
+
+// The checksums are computed with lookup tables, that are filled the first time they are used (512 bytes for CRC-16 and 8KB for CRC-32)
+// MCs with little RAM should define SPPP_CRC_BITWISE, to compute them bit by bit instead
+#ifndef SPPP_CRC_BITWISE
+static inline const u16 *sppp_crc16_table(void)
+{
+    static u16  table[256];
+    static bool filled = false;
+    if (!filled) {
+        for (u16 i = 0; i < 256; i++) {
+            u16 crc = (u16)(i << 8);
+            for (u8 j = 0; j < 8; j++) crc = (crc & 0x8000) ? (u16)((crc << 1) ^ 0x1021) : (u16)(crc << 1);
+            table[i] = crc;
+        }
+        filled = true;
+    }
+    return table;
+}
+
+// Tables for slice-by-8: table[0] is the common bytewise table, table[k][i] is the CRC of byte i followed by k zero bytes
+static inline const u32 (*sppp_crc32_tables(void))[256]
+{
+    static u32  tables[8][256];
+    static bool filled = false;
+    if (!filled) {
+        for (u32 i = 0; i < 256; i++) {
+            u32 crc = i;
+            for (u8 j = 0; j < 8; j++) crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+            tables[0][i] = crc;
+        }
+        for (u32 i = 0; i < 256; i++) {
+            for (u8 k = 1; k < 8; k++) tables[k][i] = (tables[k - 1][i] >> 8) ^ tables[0][tables[k - 1][i] & 0xff];
+        }
+        filled = true;
+    }
+    return (const u32 (*)[256])tables;
+}
+#endif // SPPP_CRC_BITWISE
+
+// Continues the CRC-16 `crc` (SPPP_CRC16_INIT for new checksums) with `len` more bytes
+static inline u16 sppp_crc16(u16 crc, const u8 *data, u64 len)
+{
+#ifdef SPPP_CRC_BITWISE
+    for (u64 i = 0; i < len; i++) {
+        crc ^= (u16)(data[i] << 8);
+        for (u8 j = 0; j < 8; j++) crc = (crc & 0x8000) ? (u16)((crc << 1) ^ 0x1021) : (u16)(crc << 1);
+    }
+#else
+    const u16 *table = sppp_crc16_table();
+    for (u64 i = 0; i < len; i++) crc = (u16)((crc << 8) ^ table[((crc >> 8) ^ data[i]) & 0xff]);
+#endif
+    return crc;
+}
+
+// Continues the CRC-32 `crc` (SPPP_CRC32_INIT for new checksums) with `len` more bytes
+static inline u32 sppp_crc32(u32 crc, const u8 *data, u64 len)
+{
+    crc = ~crc;
+#ifdef SPPP_CRC_BITWISE
+    for (u64 i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (u8 j = 0; j < 8; j++) crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+    }
+#else
+    const u32 (*t)[256] = sppp_crc32_tables();
+    for (; len >= 8; data += 8, len -= 8) {
+        u32 lo = crc ^ ((u32)data[0] | ((u32)data[1] << 8) | ((u32)data[2] << 16) | ((u32)data[3] << 24));
+        u32 hi = (u32)data[4] | ((u32)data[5] << 8) | ((u32)data[6] << 16) | ((u32)data[7] << 24);
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+    }
+    for (u64 i = 0; i < len; i++) crc = (crc >> 8) ^ t[0][(crc ^ data[i]) & 0xff];
+#endif
+    return ~crc;
+}
+
+static inline u8 sppp_checksum_size(SpppChecksum cs)
+{
+    switch (cs) {
+        case SPPP_CHECKSUM_CRC16: return 2;
+        case SPPP_CHECKSUM_CRC32: return 4;
+        default:                  return 0;
+    }
+}
+
+// Strongest checksum that both nodes support
+static inline SpppChecksum sppp_checksum_choose(u8 offered, u8 supported)
+{
+    if (offered & supported & SPPP_CHECKSUM_CRC32) return SPPP_CHECKSUM_CRC32;
+    if (offered & supported & SPPP_CHECKSUM_CRC16) return SPPP_CHECKSUM_CRC16;
+    return SPPP_CHECKSUM_NONE;
+}
+
+// Checksum of a frame with the message type `type`, that covers the header and the payload
+static inline u32 sppp_frame_checksum(SpppChecksum cs, u8 type, const u8 *payload, u64 len)
+{
+    u8 header[SPPP_HEADER_SIZE] = { (u8)(SPPP_MAGIC >> 24), (u8)(SPPP_MAGIC >> 16), (u8)(SPPP_MAGIC >> 8), type };
+    switch (cs) {
+        case SPPP_CHECKSUM_CRC16: return sppp_crc16(sppp_crc16(SPPP_CRC16_INIT, header, SPPP_HEADER_SIZE), payload, len);
+        case SPPP_CHECKSUM_CRC32: return sppp_crc32(sppp_crc32(SPPP_CRC32_INIT, header, SPPP_HEADER_SIZE), payload, len);
+        default:                  return 0;
+    }
+}
+
+// Encodes the trailer of a frame with the checksum `crc` into `trailer` and returns its size
+static inline u8 sppp_encode_checksum(SpppChecksum cs, u32 crc, u8 *trailer)
+{
+    u8 size = sppp_checksum_size(cs);
+    for (u8 i = 0; i < size; i++) trailer[i] = (u8)(crc >> (8*i));
+    return size;
+}
+
+static inline u32 sppp_decode_checksum(SpppChecksum cs, const u8 *trailer)
+{
+    u32 crc = 0;
+    for (u8 i = 0; i < sppp_checksum_size(cs); i++) crc |= (u32)trailer[i] << (8*i);
+    return crc;
+}
+
+// Appends the checksum of the frame, that starts at `frame_start` and ends at the end of `buf`
+static inline void sppp_write_checksum(AIL_Buffer *buf, u64 frame_start, SpppChecksum cs)
+{
+    const u8 *frame = &buf->data[frame_start];
+    u8 trailer[4];
+    u8 size = sppp_encode_checksum(cs, sppp_frame_checksum(cs, frame[SPPP_HEADER_SIZE - 1], frame + SPPP_HEADER_SIZE, buf->len - frame_start - SPPP_HEADER_SIZE), trailer);
+    for (u8 i = 0; i < size; i++) ail_buf_write1(buf, trailer[i]);
+}
+
+static inline void sppp_write_ping(AIL_Buffer *buf, u8 checksums)
+{
+    sppp_write_header(buf, CMSG_PING);
+    ail_buf_write1(buf, checksums);
+}
+
+// Bits of the encodings in a Pong, that the MC can decode besides the plain Music message
+#define SPPP_ENCODING_DELTA (1 << 0) // Music-Delta messages
+
+static inline void sppp_write_pong(AIL_Buffer *buf, u16 max_cmds, u16 baud_mask, SpppChecksum checksum, u8 encodings)
+{
+    sppp_write_header(buf, SMSG_PONG);
+    ail_buf_write2lsb(buf, max_cmds);
+    ail_buf_write2lsb(buf, baud_mask);
+    ail_buf_write1(buf, (u8)checksum);
+    ail_buf_write1(buf, encodings);
+}
+
+static inline void sppp_write_baud(AIL_Buffer *buf, u32 baud_rate)
+{
+    sppp_write_header(buf, CMSG_BAUD);
+    ail_buf_write4lsb(buf, baud_rate);
+}
+
+static inline void sppp_write_music(AIL_Buffer *buf, const PidiCmd *cmds, u16 count)
+{
+    sppp_write_header(buf, CMSG_MUSIC);
+    ail_buf_write2lsb(buf, count);
+    for (u16 i = 0; i < count; i++) encode_cmd(buf, cmds[i]);
+}
+
+static inline void sppp_write_new_music(AIL_Buffer *buf, PlayedKeySPPP *pks, u8 pks_count, const PidiCmd *cmds, u16 count)
+{
+    sppp_write_header(buf, CMSG_NEW_MUSIC);
+    ail_buf_write1(buf, pks_count);
+    for (u8 i = 0; i < pks_count; i++) {
+        u8 pk[SPPP_PK_ENCODED_SIZE];
+        encode_played_key(pks[i], pk);
+        for (u8 j = 0; j < SPPP_PK_ENCODED_SIZE; j++) ail_buf_write1(buf, pk[j]);
+    }
+    ail_buf_write2lsb(buf, count);
+    for (u16 i = 0; i < count; i++) encode_cmd(buf, cmds[i]);
+}
+
+// Music-Delta messages
+// Instead of 4 bytes per command, every command is encoded relative to the previous command in the same message. The commands
+// are written as one stream of bits (most significant bit first), each command consisting of the following fields:
+// - dt:       A symbol for 0, for the last dt that wasn't 0 or for the bit length k of dt, followed by the lower k-1 bits of dt
+// - note:     A symbol for "same as before" or for the bit length k of the interval in semitones to the previous note, followed
+//             by the sign (1 for downwards) and the lower k-1 bits of the interval. Keys that aren't a semitone (i.e. above B)
+//             are written after an escape symbol as the raw octave and key (4 bits each)
+// - velocity: A 0 bit if it didn't change, otherwise a 1 bit and the raw velocity
+// - len:      A 0 bit if it didn't change, otherwise a 1 bit and the raw length
+// The symbols for dt and note are written with static canonical prefix codes, whose lengths were chosen for piano music:
+// Chords and repeated rhythms make 0 and the last non-zero dt the most common delta times, while most intervals are below an octave.
+// Every message starts with dt, velocity and len being 0 and the note being the middle C.
+#define SPPP_DELTA_DT_SYMBOLS    14 // Same, 0 and the bit lengths 1 to 12
+#define SPPP_DELTA_NOTE_SYMBOLS  10 // Same, the bit lengths 1 to 8 and escape
+#define SPPP_DELTA_DT_SAME        0
+#define SPPP_DELTA_DT_ZERO        1
+#define SPPP_DELTA_NOTE_SAME      0
+#define SPPP_DELTA_NOTE_ESCAPE    9
+#define SPPP_DELTA_MAX_CODE_LEN   7
+#define SPPP_DELTA_MAX_CMD_BITS  46 // dt: 6 + 11, note: 7 + 1 + 7, velocity: 1 + 4, len: 1 + 8
+#define SPPP_DELTA_MSG_MAX_SIZE(cmds_count) (SPPP_HEADER_SIZE + 2 + 2 + ((cmds_count)*SPPP_DELTA_MAX_CMD_BITS + 7)/8)
+
+// Symbol k + 1 stands for a dt with k significant bits
+static inline u8 sppp_delta_dt_code_len(u8 sym)
+{
+    switch (sym) {
+        case SPPP_DELTA_DT_SAME: return 2;
+        case SPPP_DELTA_DT_ZERO: return 2;
+        case  7: return 3; // 32-63ms
+        case  6: return 4; // 16-31ms
+        case  8: return 4; // 64-127ms
+        case  9: return 4; // 128-255ms
+        case 10: return 4; // 256-511ms
+        case 11: return 5; // 512-1023ms
+        default: return 6;
+    }
+}
+
+static inline u8 sppp_delta_note_code_len(u8 sym)
+{
+    switch (sym) {
+        case 2:  return 2; // 2-3 semitones
+        case 3:  return 2; // 4-7 semitones
+        case SPPP_DELTA_NOTE_SAME: return 3;
+        case 1:  return 3; // 1 semitone
+        case 4:  return 3; // 8-15 semitones
+        case 5:  return 4;
+        case 6:  return 5;
+        case 7:  return 6;
+        default: return 7;
+    }
+}
+
+typedef struct SpppDeltaCode {
+    u8 count[SPPP_DELTA_MAX_CODE_LEN + 1]; // Amount of codes per length
+    u8 sorted[SPPP_DELTA_DT_SYMBOLS];      // Symbols in the order of their codes
+    u8 code[SPPP_DELTA_DT_SYMBOLS];
+    u8 len[SPPP_DELTA_DT_SYMBOLS];
+} SpppDeltaCode;
+
+typedef struct SpppDeltaCodes {
+    SpppDeltaCode dt;
+    SpppDeltaCode note;
+} SpppDeltaCodes;
+
+static inline void sppp_delta_code_build(SpppDeltaCode *c, u8 symbols, u8 (*code_len)(u8))
+{
+    u8 n = 0, code = 0;
+    for (u8 l = 1; l <= SPPP_DELTA_MAX_CODE_LEN; l++) {
+        c->count[l] = 0;
+        for (u8 sym = 0; sym < symbols; sym++) {
+            if (code_len(sym) != l) continue;
+            c->sorted[n++] = sym;
+            c->code[sym]   = code++;
+            c->len[sym]    = l;
+            c->count[l]++;
+        }
+        code <<= 1;
+    }
+}
+
+// The codes are built the first time they are used
+static inline const SpppDeltaCodes *sppp_delta_codes(void)
+{
+    static SpppDeltaCodes codes;
+    static bool built = false;
+    if (!built) {
+        sppp_delta_code_build(&codes.dt,   SPPP_DELTA_DT_SYMBOLS,   sppp_delta_dt_code_len);
+        sppp_delta_code_build(&codes.note, SPPP_DELTA_NOTE_SYMBOLS, sppp_delta_note_code_len);
+        built = true;
+    }
+    return &codes;
+}
+
+static inline u8 sppp_delta_bit_len(u16 x)
+{
+    u8 k = 0;
+    while (x) {
+        k++;
+        x >>= 1;
+    }
+    return k;
+}
+
+// Semitones above the lowest note (like PIDI_NOTE, but also defined for keys above B)
+static inline u8 sppp_delta_note(PidiCmd cmd)
+{
+    return (u8)((pidi_octave(cmd) + 8)*PIANO_KEY_AMOUNT + cmd.key);
+}
+
+typedef struct SpppDeltaState {
+    u16 dt; // Last dt that wasn't 0
+    u8  note;
+    u8  velocity;
+    u8  len;
+} SpppDeltaState;
+
+static inline SpppDeltaState sppp_delta_state_new(void)
+{
+    SpppDeltaState s = { 0, PIDI_NOTE(0, PIANO_KEY_C), 0, 0 };
+    return s;
+}
+
+typedef struct SpppBitWriter {
+    AIL_Buffer *buf; // May be NULL to only count the bits
+    u64 bits_written;
+    u32 acc;
+    u8  n;
+} SpppBitWriter;
+
+static inline void sppp_bits_write(SpppBitWriter *w, u32 val, u8 n)
+{
+    w->bits_written += n;
+    if (!w->buf) return;
+    w->acc = (w->acc << n) | (val & ((1u << n) - 1));
+    w->n  += n;
+    while (w->n >= 8) {
+        w->n -= 8;
+        ail_buf_write1(w->buf, (u8)(w->acc >> w->n));
+    }
+}
+
+static inline void sppp_bits_flush(SpppBitWriter *w)
+{
+    if (w->n) sppp_bits_write(w, 0, 8 - w->n);
+}
+
+static inline void sppp_delta_encode_cmd(SpppBitWriter *w, SpppDeltaState *s, PidiCmd cmd)
+{
+    const SpppDeltaCodes *codes = sppp_delta_codes();
+    u16 dt = pidi_dt(cmd);
+    if (!dt) {
+        sppp_bits_write(w, codes->dt.code[SPPP_DELTA_DT_ZERO], codes->dt.len[SPPP_DELTA_DT_ZERO]);
+    } else if (dt == s->dt) {
+        sppp_bits_write(w, codes->dt.code[SPPP_DELTA_DT_SAME], codes->dt.len[SPPP_DELTA_DT_SAME]);
+    } else {
+        u8 k = sppp_delta_bit_len(dt);
+        sppp_bits_write(w, codes->dt.code[k + 1], codes->dt.len[k + 1]);
+        sppp_bits_write(w, dt, k - 1);
+    }
+
+    u8 note = sppp_delta_note(cmd);
+    if (cmd.key >= PIANO_KEY_AMOUNT) {
+        sppp_bits_write(w, codes->note.code[SPPP_DELTA_NOTE_ESCAPE], codes->note.len[SPPP_DELTA_NOTE_ESCAPE]);
+        sppp_bits_write(w, cmd.octave, 4);
+        sppp_bits_write(w, cmd.key, 4);
+    } else if (note == s->note) {
+        sppp_bits_write(w, codes->note.code[SPPP_DELTA_NOTE_SAME], codes->note.len[SPPP_DELTA_NOTE_SAME]);
+    } else {
+        bool down = note < s->note;
+        u8   diff = down ? s->note - note : note - s->note;
+        u8   k    = sppp_delta_bit_len(diff);
+        sppp_bits_write(w, codes->note.code[k], codes->note.len[k]);
+        sppp_bits_write(w, down, 1);
+        sppp_bits_write(w, diff, k - 1);
+    }
+
+    if (cmd.velocity == s->velocity) sppp_bits_write(w, 0, 1);
+    else sppp_bits_write(w, (1u << 4) | cmd.velocity, 1 + 4);
+    if (cmd.len == s->len) sppp_bits_write(w, 0, 1);
+    else sppp_bits_write(w, (1u << 8) | cmd.len, 1 + 8);
+
+    if (dt) s->dt = dt;
+    s->note     = note;
+    s->velocity = (u8)cmd.velocity;
+    s->len      = (u8)cmd.len;
+}
+
+// Amount of bytes that the commands take up in a Music-Delta message
+static inline u16 sppp_delta_size(const PidiCmd *cmds, u16 count)
+{
+    SpppBitWriter  w = {0};
+    SpppDeltaState s = sppp_delta_state_new();
+    for (u16 i = 0; i < count; i++) sppp_delta_encode_cmd(&w, &s, cmds[i]);
+    return (u16)((w.bits_written + 7)/8);
+}
+
+static inline void sppp_write_music_delta(AIL_Buffer *buf, const PidiCmd *cmds, u16 count)
+{
+    sppp_write_header(buf, CMSG_MUSIC_DELTA);
+    ail_buf_write2lsb(buf, count);
+    u64 size_idx = buf->idx;
+    ail_buf_write2lsb(buf, 0);
+    SpppBitWriter  w = { buf, 0, 0, 0 };
+    SpppDeltaState s = sppp_delta_state_new();
+    for (u16 i = 0; i < count; i++) sppp_delta_encode_cmd(&w, &s, cmds[i]);
+    sppp_bits_flush(&w);
+    u64 end = buf->idx;
+    buf->idx = size_idx;
+    ail_buf_write2lsb(buf, (u16)(w.bits_written/8));
+    buf->idx = end;
+}
+
+// Writes the commands as a Music or Music-Delta message, whichever is smaller and supported by the MC (see SPPP_ENCODING_DELTA)
+static inline void sppp_write_music_smallest(AIL_Buffer *buf, const PidiCmd *cmds, u16 count, u8 encodings)
+{
+    if ((encodings & SPPP_ENCODING_DELTA) && 2 + sppp_delta_size(cmds, count) < count*ENCODED_CMD_LEN) sppp_write_music_delta(buf, cmds, count);
+    else sppp_write_music(buf, cmds, count);
+}
+
+// Decodes the payload of a Music-Delta message while it arrives
+// Bytes can be pushed whenever sppp_delta_decoder_wants returns true and commands can be taken out with sppp_delta_decoder_next.
+// At most 8 bytes are buffered, so the MC doesn't need to keep the whole message in memory.
+typedef struct SpppDeltaDecoder {
+    u64  bits;       // Bits that were received but not decoded yet (the lowest `nbits` bits, the oldest one being the highest)
+    u8   nbits;
+    bool failed;     // Whether the message turned out to be malformed
+    u16  bytes_left; // Bytes of the message that weren't pushed yet
+    u16  cmds_left;  // Commands of the message that weren't decoded yet
+    SpppDeltaState state;
+} SpppDeltaDecoder;
+
+static inline SpppDeltaDecoder sppp_delta_decoder_new(u16 cmds_count, u16 bytes_count)
+{
+    SpppDeltaDecoder d = {0};
+    d.bytes_left = bytes_count;
+    d.cmds_left  = cmds_count;
+    d.state      = sppp_delta_state_new();
+    return d;
+}
+
+static inline bool sppp_delta_decoder_wants(const SpppDeltaDecoder *d)
+{
+    return d->bytes_left && d->nbits <= 64 - 8;
+}
+
+static inline void sppp_delta_decoder_push(SpppDeltaDecoder *d, u8 byte)
+{
+    AIL_ASSERT(sppp_delta_decoder_wants(d));
+    d->bits   = (d->bits << 8) | byte;
+    d->nbits += 8;
+    d->bytes_left--;
+}
+
+// Whether all commands were decoded
+static inline bool sppp_delta_decoder_done(const SpppDeltaDecoder *d)
+{
+    return !d->cmds_left && !d->bytes_left && !d->failed;
+}
+
+static inline u16 sppp_delta_read_bits(SpppDeltaDecoder *d, u8 n)
+{
+    if (n > d->nbits) {
+        d->failed = true;
+        return 0;
+    }
+    d->nbits -= n;
+    return (u16)((d->bits >> d->nbits) & ((1u << n) - 1));
+}
+
+static inline u8 sppp_delta_read_sym(SpppDeltaDecoder *d, const SpppDeltaCode *c)
+{
+    u8 code = 0, first = 0, idx = 0;
+    for (u8 l = 1; l <= SPPP_DELTA_MAX_CODE_LEN; l++) {
+        code |= (u8)sppp_delta_read_bits(d, 1);
+        if (code - first < c->count[l]) return c->sorted[idx + code - first];
+        idx   += c->count[l];
+        first  = (u8)((first + c->count[l]) << 1);
+        code <<= 1;
+    }
+    d->failed = true;
+    return 0;
+}
+
+// Decodes the next command into `cmd`, returns false if more bytes need to be pushed first (or if the message is malformed)
+static inline bool sppp_delta_decoder_next(SpppDeltaDecoder *d, PidiCmd *cmd)
+{
+    if (d->failed || !d->cmds_left || (d->nbits < SPPP_DELTA_MAX_CMD_BITS && d->bytes_left)) return false;
+    const SpppDeltaCodes *codes = sppp_delta_codes();
+    SpppDeltaState *s = &d->state;
+
+    u16 dt  = s->dt;
+    u8  sym = sppp_delta_read_sym(d, &codes->dt);
+    if (sym == SPPP_DELTA_DT_ZERO) dt = 0;
+    else if (sym != SPPP_DELTA_DT_SAME) dt = s->dt = (u16)((1u << (sym - 2)) | sppp_delta_read_bits(d, sym - 2));
+
+    u8 octave, key;
+    sym = sppp_delta_read_sym(d, &codes->note);
+    if (sym == SPPP_DELTA_NOTE_ESCAPE) {
+        octave  = (u8)sppp_delta_read_bits(d, 4);
+        key     = (u8)sppp_delta_read_bits(d, 4);
+        s->note = (u8)((((octave ^ 8) - 8) + 8)*PIANO_KEY_AMOUNT + key);
+    } else {
+        if (sym != SPPP_DELTA_NOTE_SAME) {
+            bool down = sppp_delta_read_bits(d, 1);
+            i16  diff = (i16)((1u << (sym - 1)) | sppp_delta_read_bits(d, sym - 1));
+            i16  note = (i16)s->note + (down ? -diff : diff);
+            if (note < 0 || note >= PIDI_NOTE_AMOUNT) d->failed = true;
+            s->note = (u8)note;
+        }
+        octave = (u8)((s->note/PIANO_KEY_AMOUNT - 8) & 0xf);
+        key    = s->note % PIANO_KEY_AMOUNT;
+    }
+
+    if (sppp_delta_read_bits(d, 1)) s->velocity = (u8)sppp_delta_read_bits(d, 4);
+    if (sppp_delta_read_bits(d, 1)) s->len      = (u8)sppp_delta_read_bits(d, 8);
+    if (d->failed) return false;
+
+    cmd->dt       = dt;
+    cmd->velocity = s->velocity;
+    cmd->len      = s->len;
+    cmd->octave   = octave;
+    cmd->key      = key;
+    d->cmds_left--;
+    // Padding after the last command must be less than a byte
+    if (!d->cmds_left && (d->bytes_left || d->nbits >= 8)) d->failed = true;
+    return !d->failed;
+}
+
+// Decodes an entire Music-Delta payload (without the counts) into `out`, which must have room for `cmds_count` commands
+static inline bool sppp_delta_decode(const u8 *data, u16 bytes_count, PidiCmd *out, u16 cmds_count)
+{
+    SpppDeltaDecoder d = sppp_delta_decoder_new(cmds_count, bytes_count);
+    u16 i = 0;
+    while (!d.failed && d.cmds_left) {
+        while (sppp_delta_decoder_wants(&d)) sppp_delta_decoder_push(&d, *data++);
+        if (!sppp_delta_decoder_next(&d, &out[i++])) return false;
+    }
+    return sppp_delta_decoder_done(&d);
+}
+
+// Baud rates that can be negotiated, the i-th rate is represented by the i-th bit in the bitmask of the Pong message
+#define SPPP_BAUD_RATES_COUNT 8
+
+static inline u32 sppp_baud_rate(u8 idx)
+{
+    switch (idx) {
+        case 0:  return 9600;
+        case 1:  return 19200;
+        case 2:  return 38400;
+        case 3:  return 57600;
+        case 4:  return 115200;
+        case 5:  return 230400;
+        case 6:  return 460800;
+        case 7:  return 921600;
+        default: return 0;
+    }
+}
+
+// Bit of `rate` in a bitmask of baud rates (0 if the rate can't be negotiated)
+static inline u16 sppp_baud_bit(u32 rate)
+{
+    for (u8 i = 0; i < SPPP_BAUD_RATES_COUNT; i++) {
+        if (sppp_baud_rate(i) == rate) return (u16)(1u << i);
+    }
+    return 0;
+}
+
+// Highest rate in `mask` (0 if there is none)
+static inline u32 sppp_baud_highest(u16 mask)
+{
+    for (u8 i = SPPP_BAUD_RATES_COUNT; i > 0; i--) {
+        if (mask & (1u << (i - 1))) return sppp_baud_rate(i - 1);
+    }
+    return 0;
+}
+
+// Tracks the MC's side of switching to a negotiated baud rate:
+// After the Success for a Baud message was sent completely, the MC switches to the new rate. If it does not receive a Ping
+// at the new rate within SPPP_BAUD_CONFIRM_TIMEOUT, the switch is considered to have failed and it falls back to BAUD_RATE.
+typedef struct SpppBaudSwitch {
+    u32  rate;         // Rate that is currently used
+    bool confirming;   // Whether the switch to `rate` still needs to be confirmed with a Ping
+    u32  switched_at;  // Time in ms at which the switch happened
+} SpppBaudSwitch;
+
+static inline SpppBaudSwitch sppp_baud_switch_new(void)
+{
+    SpppBaudSwitch s = { BAUD_RATE, false, 0 };
+    return s;
+}
+
+static inline void sppp_baud_switch_begin(SpppBaudSwitch *s, u32 rate, u32 now_ms)
+{
+    s->rate        = rate;
+    s->confirming  = rate != BAUD_RATE;
+    s->switched_at = now_ms;
+}
+
+// Should be called whenever a Ping was received
+static inline void sppp_baud_switch_confirm(SpppBaudSwitch *s)
+{
+    s->confirming = false;
+}
+
+// Returns true if the switch timed out, in which case the port has to be set to `s->rate` (i.e. BAUD_RATE) again
+static inline bool sppp_baud_switch_expired(SpppBaudSwitch *s, u32 now_ms)
+{
+    if (!s->confirming || now_ms - s->switched_at < SPPP_BAUD_CONFIRM_TIMEOUT) return false;
+    s->rate       = BAUD_RATE;
+    s->confirming = false;
+    return true;
+}
+
+// Sizes the chunks of a song, that the UI sends in response to Request messages
+// The chunker estimates how much playback time is still buffered on the MC from the song position that was sent already and
+// the song position that was played. Like the PidiScheduler, it anchors that position whenever the speed changes or the song
+// is paused, so a new speed only applies to the time after it was sent. A chunk is then made just large enough, that after sending it and waiting another round trip
+// for the next Request, at least `target_lead_ms` of playback are still buffered.
+// Since the playback time that each byte buys differs a lot between calm and dense passages, the upcoming commands are scanned
+// as well: Whenever streaming them would take longer than playing them (including the round trips between the chunks), the
+// missing time has to be buffered in advance and is added to the target.
+// Dense passages thus get large chunks ahead of time, while the song starts quickly and calm passages keep the line free for
+// other messages. If the target can't be reached, the largest allowed chunk is sent.
+#define SPPP_BITS_PER_BYTE 10 // 8N1: Start bit, 8 data bits and stop bit
+
+#ifndef SPPP_CHUNKER_MIN_CMDS
+#define SPPP_CHUNKER_MIN_CMDS 8
+#endif // SPPP_CHUNKER_MIN_CMDS
+#ifndef SPPP_CHUNKER_TARGET_LEAD_MS
+#define SPPP_CHUNKER_TARGET_LEAD_MS 250
+#endif // SPPP_CHUNKER_TARGET_LEAD_MS
+#ifndef SPPP_CHUNKER_LOOKAHEAD
+#define SPPP_CHUNKER_LOOKAHEAD 1024 // Amount of upcoming commands that are scanned for dense passages
+#endif // SPPP_CHUNKER_LOOKAHEAD
+
+typedef struct SpppChunker {
+    u32  baud_rate;
+    u16  min_cmds;
+    u16  max_cmds;       // Maximum amount of commands per message, as given by the Pong message
+    u32  target_lead_ms; // Playback time that should still be buffered on the MC, when the next chunk starts arriving
+    f32  speed;          // The speed that was last sent to the MC
+    u32  rtt_us;         // Smoothed time between sending the last byte of a message and receiving the response
+    bool started;
+    bool paused;         // Whether the last Continue message paused the song
+    u64  start_us;       // Time at which the MC was at `anchor_ms`, i.e. the start of the song or the last speed change or continue
+    u64  anchor_ms;      // Position in the song that was played at `start_us`
+    u64  sent_ms;        // Position in the song after the last command that was sent already
+} SpppChunker;
+
+static inline SpppChunker sppp_chunker_new(u32 baud_rate, u16 max_cmds)
+{
+    SpppChunker c = {0};
+    c.baud_rate      = baud_rate;
+    c.max_cmds       = max_cmds;
+    c.min_cmds       = SPPP_CHUNKER_MIN_CMDS < max_cmds ? SPPP_CHUNKER_MIN_CMDS : max_cmds;
+    c.target_lead_ms = SPPP_CHUNKER_TARGET_LEAD_MS;
+    c.speed          = 1.0f;
+    return c;
+}
+
+// Time in microseconds that sending `bytes` takes
+static inline u64 sppp_wire_us(u32 baud_rate, u64 bytes)
+{
+    return (bytes*SPPP_BITS_PER_BYTE*1000000 + baud_rate - 1)/baud_rate;
+}
+
+// Should be called with the time at which the last byte of the New-Music message was sent
+static inline void sppp_chunker_start(SpppChunker *c, u64 start_us)
+{
+    c->started   = true;
+    c->start_us  = start_us;
+    c->anchor_ms = 0;
+}
+
+// Song position in ms that is estimated to be played on the MC at `now_us`
+static inline u64 sppp_chunker_played_ms(const SpppChunker *c, u64 now_us)
+{
+    if (!c->started) return 0;
+    if (c->paused || now_us <= c->start_us) return c->anchor_ms;
+    return c->anchor_ms + (u64)((f64)(now_us - c->start_us)*c->speed/1000);
+}
+
+// Should be called with the time at which the last byte of a Speed message was sent
+// The position played so far is kept, so that only the time after `now_us` is played at the new speed
+static inline void sppp_chunker_set_speed(SpppChunker *c, u64 now_us, f32 speed)
+{
+    if (c->started && now_us > c->start_us) {
+        c->anchor_ms = sppp_chunker_played_ms(c, now_us);
+        c->start_us  = now_us;
+    }
+    c->speed = speed;
+}
+
+// Should be called with the time at which the last byte of a Continue message was sent, `play` being its payload
+static inline void sppp_chunker_continue(SpppChunker *c, u64 now_us, bool play)
+{
+    if (play == !c->paused) return;
+    if (c->started && now_us > c->start_us) {
+        c->anchor_ms = sppp_chunker_played_ms(c, now_us);
+        c->start_us  = now_us;
+    }
+    c->paused = !play;
+}
+
+// Exponentially weighted moving average with a weight of 1/8 for new samples (same as TCP's SRTT)
+static inline void sppp_chunker_observe_rtt(SpppChunker *c, u32 rtt_us)
+{
+    if (!c->rtt_us) c->rtt_us = rtt_us;
+    else c->rtt_us = (u32)(((u64)c->rtt_us*7 + rtt_us)/8);
+}
+
+// Song time in ms that is estimated to still be buffered on the MC at `now_us`
+// Underruns on the MC delay the playback, which only ever makes this estimate too low
+static inline u64 sppp_chunker_buffered_ms(const SpppChunker *c, u64 now_us)
+{
+    u64 played_ms = sppp_chunker_played_ms(c, now_us);
+    return played_ms < c->sent_ms ? c->sent_ms - played_ms : 0;
+}
+
+// Largest amount of time in microseconds, by which streaming a prefix of `cmds` falls behind playing it
+static inline u64 sppp_chunker_deficit_us(const SpppChunker *c, const PidiCmd *cmds, u32 count)
+{
+    // The overhead of each message (its header, the Success and Request messages and a round trip) is spread over its commands
+    u64 overhead_us = c->rtt_us + sppp_wire_us(c->baud_rate, SPPP_MUSIC_MSG_SIZE(0) + 2*SPPP_HEADER_SIZE);
+    f64 cmd_us      = (f64)sppp_wire_us(c->baud_rate, ENCODED_CMD_LEN) + (f64)overhead_us/c->max_cmds;
+    f64 stream_us = 0, play_us = 0, deficit_us = 0;
+    if (count > SPPP_CHUNKER_LOOKAHEAD) count = SPPP_CHUNKER_LOOKAHEAD;
+    for (u32 i = 0; i < count; i++) {
+        stream_us += cmd_us;
+        play_us   += (f64)pidi_dt(cmds[i])*1000/c->speed;
+        if (stream_us - play_us > deficit_us) deficit_us = stream_us - play_us;
+    }
+    return (u64)deficit_us;
+}
+
+// Returns the amount of commands from `cmds` (of which `remaining` are left) to send in the next Music or New-Music message
+static inline u16 sppp_chunker_next(SpppChunker *c, u64 now_us, const PidiCmd *cmds, u32 remaining)
+{
+    u32 max = remaining < c->max_cmds ? remaining : c->max_cmds;
+    u64 buffered_ms = sppp_chunker_buffered_ms(c, now_us);
+    u64 target_us   = (u64)c->target_lead_ms*1000 + c->rtt_us + sppp_wire_us(c->baud_rate, SPPP_HEADER_SIZE); // Lead, plus waiting for the next Request
+    target_us      += sppp_chunker_deficit_us(c, cmds, remaining);
+    u64 cover_ms    = 0;
+    u32 n = 0;
+    while (n < max) {
+        cover_ms += pidi_dt(cmds[n++]);
+        if (n < c->min_cmds) continue;
+        u64 lead_us = (u64)((f64)(buffered_ms + cover_ms)*1000/c->speed);
+        if (lead_us >= target_us + sppp_wire_us(c->baud_rate, SPPP_MUSIC_MSG_SIZE(n))) break;
+    }
+    c->sent_ms += cover_ms;
+    return (u16)n;
+}
+
+
+/////////////////////////////
+//   PIDI Interval Index   //
+/////////////////////////////
+
+// An implicit augmented interval tree over a PidiTimeline, used to find all notes that are still sounding at some time without replaying the song.
+// Since the timeline is already sorted by start time, its entries are interpreted as the in-order layout of a binary search tree:
+// Entry i is a node on the level that equals the amount of trailing 1-bits of i, leafs are at even indices.
+// For each node, we only need to store the maximum end time of its subtree, which allows skipping subtrees in which no note could still be sounding.
+// Queries take O(log n + k) time, where k is the amount of reported notes.
+// The layout follows Heng Li's cgranges (https://github.com/lh3/cgranges).
+
+typedef struct PidiIntervalIndex {
+    const PidiTimeline *tl;
+    u32 *max_end;
+    i32  max_level;
+} PidiIntervalIndex;
+
+static inline u32 pidi_interval_end(const PidiTimeline *tl, u32 i)
+{
+    // Notes that are not played are treated as empty intervals
+    return tl->vel[i] ? tl->start_ms[i] + tl->dur_ms[i] : tl->start_ms[i];
+}
+
+static inline PidiIntervalIndex pidi_interval_index_new(const PidiTimeline *tl)
+{
+    PidiIntervalIndex idx;
+    u32 n = tl->len;
+    idx.tl        = tl;
+    idx.max_end   = (u32 *)tl->allocator->alloc(tl->allocator->data, sizeof(u32)*n + 1);
+    idx.max_level = -1;
+    if (!n) return idx;
+
+    // `last` is the maximum end of the rightmost (possibly incomplete) subtree at the current level.
+    // It is used in place of right children that lie outside of the array
+    u32 i, last_i = 0, last = 0;
+    for (i = 0; i < n; i += 2) {
+        last_i = i;
+        last   = idx.max_end[i] = pidi_interval_end(tl, i);
+    }
+    i32 k;
+    for (k = 1; ((u64)1 << k) <= n; k++) {
+        u64 x = (u64)1 << (k - 1), i0 = (x << 1) - 1, step = x << 2;
+        for (u64 j = i0; j < n; j += step) {
+            u32 el = idx.max_end[j - x];
+            u32 er = j + x < n ? idx.max_end[j + x] : last;
+            u32 e  = pidi_interval_end(tl, (u32)j);
+            idx.max_end[j] = AIL_MAX(e, AIL_MAX(el, er));
+        }
+        last_i = (last_i >> k) & 1 ? last_i - (u32)x : last_i + (u32)x;
+        if (last_i < n && idx.max_end[last_i] > last) last = idx.max_end[last_i];
+    }
+    idx.max_level = k - 1;
+    return idx;
+}
+
+static inline void pidi_interval_index_free(PidiIntervalIndex *idx)
+{
+    idx->tl->allocator->free_one(idx->tl->allocator->data, idx->max_end);
+    idx->max_end   = NULL;
+    idx->max_level = -1;
+}
+
+// Writes the timeline-indices of up to `max` notes that are sounding at time `t` into `out` in ascending order and returns how many were written
+static inline u32 pidi_interval_index_stab(const PidiIntervalIndex *idx, u32 t, u32 *out, u32 max)
+{
+    typedef struct { i32 k; u32 w; u64 x; } PidiIntervalFrame;
+    PidiIntervalFrame stack[64];
+    const PidiTimeline *tl = idx->tl;
+    u64 n = tl->len;
+    u32 count = 0, top = 0;
+    if (idx->max_level < 0) return 0;
+    stack[top].k = idx->max_level;
+    stack[top].x = ((u64)1 << idx->max_level) - 1;
+    stack[top].w = 0;
+    top++;
+    while (top && count < max) {
+        PidiIntervalFrame z = stack[--top];
+        if (z.k <= 3) {
+            // Small subtrees are scanned linearly
+            u64 i  = z.x >> z.k << z.k;
+            u64 i1 = AIL_MIN(n, i + ((u64)1 << (z.k + 1)) - 1);
+            for (; i < i1 && tl->start_ms[i] <= t && count < max; i++) {
+                if (t < pidi_interval_end(tl, (u32)i)) out[count++] = (u32)i;
+            }
+        } else if (z.w == 0) {
+            // Visit the left subtree first, then come back to this node
+            u64 y = z.x - ((u64)1 << (z.k - 1));
+            stack[top].k = z.k; stack[top].x = z.x; stack[top].w = 1; top++;
+            if (y >= n || idx->max_end[y] > t) {
+                stack[top].k = z.k - 1; stack[top].x = y; stack[top].w = 0; top++;
+            }
+        } else if (z.x < n && tl->start_ms[z.x] <= t) {
+            if (t < pidi_interval_end(tl, (u32)z.x)) out[count++] = (u32)z.x;
+            stack[top].k = z.k - 1; stack[top].x = z.x + ((u64)1 << (z.k - 1)); stack[top].w = 0; top++;
+        }
+    }
+    return count;
+}
+
+// Fills `pks` with the keys that are still being played at time `t`, as needed for CMSG_NEW_MUSIC when starting playback in the middle of a song
+// The length of each key is the time remaining after `t`, rounded up to the next centisecond
+// At most 255 keys are returned, since the message can't hold more
+static inline u8 pidi_played_keys_at(const PidiIntervalIndex *idx, u32 t, AIL_SDA(PlayedKeySPPP, 16) *pks)
+{
+    u32 found[255];
+    u32 count = pidi_interval_index_stab(idx, t, found, 255);
+    pks->len  = 0;
+    ail_sda_reserve(pks, count);
+    for (u32 i = 0; i < count; i++) {
+        u32 j = found[i];
+        u32 remaining = pidi_interval_end(idx->tl, j) - t;
+        PlayedKeySPPP pk;
+        pk.len      = (u8)AIL_MIN(MAX_LEN, (remaining + LEN_FACTOR - 1)/LEN_FACTOR);
+        pk.octave   = (u8)pidi_note_octave(idx->tl->note[j]) & 0xf;
+        pk.key      = pidi_note_key(idx->tl->note[j]);
+        pk.velocity = idx->tl->vel[j];
+        ail_sda_push(pks, pk);
+    }
+    return (u8)count;
+}
+
+// Writes a CMSG_NEW_MUSIC message that starts playback at time `t` of the song indexed by `idx`, continuing with `cmds`
+static inline void sppp_write_new_music_at(AIL_Buffer *buf, const PidiIntervalIndex *idx, u32 t, const PidiCmd *cmds, u16 count)
+{
+    AIL_SDA(PlayedKeySPPP, 16) pks = ail_sda_new(PlayedKeySPPP, 16);
+    u8 pks_count = pidi_played_keys_at(idx, t, &pks);
+    ail_sda_fix(&pks);
+    sppp_write_new_music(buf, pks.data, pks_count, cmds, count);
+    ail_sda_free(&pks);
+}
+
 #endif // COMMON_H_
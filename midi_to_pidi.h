@@ -0,0 +1,391 @@
+// Converter from Standard MIDI Files (SMF) to PIDI
+//
+// Define MIDI_TO_PIDI_IMPL in some file, to include the function bodies
+//
+// The converter never builds a list of all events in the file. Instead every track is read lazily through a cursor,
+// the cursors are k-way merged by their absolute tick in a min-heap and each note is kept only until its note-off was seen.
+// Apart from the SMF's bytes themselves, memory usage is thus bounded by the amount of tracks and the amount of notes
+// that are sounding at the same time.
+//
+// Commands are handed to a `PidiSink` in the order of their starting time, which allows streaming them straight
+// into a PIDI file (see `midi_to_pidi_file`) or into a Song (see `midi_to_pidi_cmds`).
+// Long rests and long notes are split by a `PidiNormalizer` (see common.h) on the way out, so no timing is lost.
+//
+// Notes are mapped such that MIDI's middle C (60) is octave 0, key C.
+// Velocities are scaled from MIDI's 7 bits to the 4 bits of PIDI. Notes are never scaled down to a velocity of 0.
+
+#ifndef MIDI_TO_PIDI_H_
+#define MIDI_TO_PIDI_H_
+
+#include "common.h"
+
+#ifndef MIDI_TO_PIDI_DEF
+#ifdef  AIL_DEF
+#define MIDI_TO_PIDI_DEF AIL_DEF
+#else
+#define MIDI_TO_PIDI_DEF
+#endif // AIL_DEF
+#endif // MIDI_TO_PIDI_DEF
+
+#define MIDI_CHANNELS 16
+#define MIDI_NOTES    128
+#define MIDI_PERCUSSION_CHANNEL 9   // Channel 10 when counting from 1
+#define MIDI_DEFAULT_TEMPO 500000   // Microseconds per quarter note (i.e. 120bpm)
+#define MIDI_MIDDLE_C 60
+
+// Notes that are held for longer than this are cut off, which keeps the amount of buffered notes bounded
+#ifndef MIDI_TO_PIDI_MAX_NOTE_MS
+#define MIDI_TO_PIDI_MAX_NOTE_MS 60000
+#endif // MIDI_TO_PIDI_MAX_NOTE_MS
+
+typedef struct MidiToPidiOpts {
+    bool keep_percussion;        // Channel 10 is ignored unless this is set, since drums can't be played on a piano
+    i8   transpose;              // Amount of half-tones by which every note is shifted
+    PidiLongNoteMode long_notes; // How notes longer than MAX_LEN are split
+} MidiToPidiOpts;
+
+typedef struct MidiToPidiStats {
+    u32 tracks;
+    u64 events;
+    u32 notes;       // Amount of converted notes
+    u32 max_pending; // Highest amount of notes that had to be buffered at once
+    u32 cut_notes;   // Amount of notes that were cut off after MIDI_TO_PIDI_MAX_NOTE_MS
+    u64 len;         // Length of the song in milliseconds
+} MidiToPidiStats;
+
+// Both `opts` and `stats` may be NULL
+MIDI_TO_PIDI_DEF bool midi_to_pidi(const u8 *smf, u64 smf_len, PidiSink sink, const MidiToPidiOpts *opts, MidiToPidiStats *stats);
+// Writes an entire PIDI file into `buf`. If the conversion fails, the commands count in its header stays 0
+MIDI_TO_PIDI_DEF bool midi_to_pidi_file(const u8 *smf, u64 smf_len, AIL_Buffer *buf, const MidiToPidiOpts *opts, MidiToPidiStats *stats);
+// Appends all commands to `cmds`
+MIDI_TO_PIDI_DEF bool midi_to_pidi_cmds(const u8 *smf, u64 smf_len, AIL_DA(PidiCmd) *cmds, const MidiToPidiOpts *opts, MidiToPidiStats *stats);
+
+#endif // MIDI_TO_PIDI_H_
+
+
+#ifdef MIDI_TO_PIDI_IMPL
+#ifndef _MIDI_TO_PIDI_IMPL_GUARD_
+#define _MIDI_TO_PIDI_IMPL_GUARD_
+
+typedef struct MidiEvent {
+    u8 status;
+    u8 d1;
+    u8 d2;
+    u8 meta;        // Type of meta event, if status is 0xff
+    const u8 *data; // Data of meta and sysex events
+    u32 data_len;
+} MidiEvent;
+
+typedef struct MidiTrackCursor {
+    const u8 *data;
+    u32  len;
+    u32  idx;
+    u64  tick;           // Absolute tick of `ev`
+    u8   running_status;
+    bool done;
+    MidiEvent ev;        // Next event of this track
+} MidiTrackCursor;
+
+typedef struct MidiPendingNote {
+    u64 start_ms;
+    u64 end_ms;
+    bool closed;
+    u8 velocity;
+    i8 octave;
+    u8 key;
+} MidiPendingNote;
+AIL_DA_INIT(MidiPendingNote);
+AIL_DA_INIT(MidiTrackCursor);
+
+typedef struct MidiToPidiState {
+    PidiNormalizer out;
+    MidiToPidiStats stats;
+    AIL_DA(MidiPendingNote) queue; // Notes in order of their start, that were not emitted yet
+    u32 queue_head;                // Index of the first note in `queue` that was not emitted yet
+    u32 queue_base;                // Sequence number of `queue.data[0]`
+    u32 open[MIDI_CHANNELS][MIDI_NOTES]; // Sequence number + 1 of the note that is currently pressed (or 0 if none is)
+    u64 last_ms;                   // Start of the last emitted command
+} MidiToPidiState;
+
+static bool midi_read_varlen(MidiTrackCursor *c, u32 *out)
+{
+    u32 x = 0;
+    for (u8 i = 0; i < 4; i++) {
+        if (c->idx >= c->len) return false;
+        u8 b = c->data[c->idx++];
+        x = (x << 7) | (b & 0x7f);
+        if (!(b & 0x80)) {
+            *out = x;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Reads the next event into `c->ev` or marks the cursor as done
+static bool midi_cursor_next(MidiTrackCursor *c)
+{
+    u32 delta;
+    if (c->idx >= c->len) {
+        c->done = true;
+        return true;
+    }
+    if (!midi_read_varlen(c, &delta)) return false;
+    c->tick += delta;
+    if (c->idx >= c->len) return false;
+
+    MidiEvent *ev = &c->ev;
+    u8 b = c->data[c->idx];
+    if (b & 0x80) {
+        c->idx++;
+        ev->status = b;
+        if (b < 0xf0) c->running_status = b;
+        else if (b < 0xf8) c->running_status = 0; // System common messages cancel running status
+    } else {
+        if (!c->running_status) return false;
+        ev->status = c->running_status;
+    }
+
+    if (ev->status == 0xff) {
+        if (c->idx >= c->len) return false;
+        ev->meta = c->data[c->idx++];
+        if (!midi_read_varlen(c, &ev->data_len) || c->idx + ev->data_len > c->len) return false;
+        ev->data = &c->data[c->idx];
+        c->idx  += ev->data_len;
+        if (ev->meta == 0x2f) c->idx = c->len; // End of Track
+    } else if (ev->status == 0xf0 || ev->status == 0xf7) {
+        if (!midi_read_varlen(c, &ev->data_len) || c->idx + ev->data_len > c->len) return false;
+        ev->data = &c->data[c->idx];
+        c->idx  += ev->data_len;
+    } else {
+        u8 n = ((ev->status & 0xe0) == 0xc0) ? 1 : 2; // Program change & channel pressure only have one data byte
+        if (ev->status >= 0xf0) n = ev->status == 0xf2 ? 2 : (ev->status == 0xf1 || ev->status == 0xf3) ? 1 : 0;
+        if (c->idx + n > c->len) return false;
+        ev->d1 = n > 0 ? c->data[c->idx]     : 0;
+        ev->d2 = n > 1 ? c->data[c->idx + 1] : 0;
+        c->idx += n;
+    }
+    return true;
+}
+
+// Min-heap of track indices, ordered by tick first and track index second (to keep simultaneous events in file order)
+static inline bool midi_heap_less(MidiTrackCursor *cs, u32 a, u32 b)
+{
+    return cs[a].tick < cs[b].tick || (cs[a].tick == cs[b].tick && a < b);
+}
+
+static void midi_heap_sift_down(MidiTrackCursor *cs, u32 *heap, u32 n, u32 i)
+{
+    for (;;) {
+        u32 l = 2*i + 1, r = l + 1, m = i;
+        if (l < n && midi_heap_less(cs, heap[l], heap[m])) m = l;
+        if (r < n && midi_heap_less(cs, heap[r], heap[m])) m = r;
+        if (m == i) return;
+        AIL_SWAP_PORTABLE(u32, heap[i], heap[m]);
+        i = m;
+    }
+}
+
+static void midi_to_pidi_emit(MidiToPidiState *s, MidiPendingNote *n)
+{
+    PidiCmdWide cmd;
+    cmd.dt       = (u32)(n->start_ms - s->last_ms);
+    cmd.len      = (u32)AIL_MAX(n->end_ms - n->start_ms, 1);
+    cmd.velocity = n->velocity;
+    cmd.octave   = n->octave;
+    cmd.key      = n->key;
+    pidi_normalizer_push(&s->out, cmd);
+    s->last_ms = n->start_ms;
+    s->stats.notes++;
+    if (n->end_ms > s->stats.len) s->stats.len = n->end_ms;
+}
+
+// Emits all notes at the front of the queue, whose length is known
+// Notes that have been sounding for longer than MIDI_TO_PIDI_MAX_NOTE_MS are closed early, which bounds the queue's size
+static void midi_to_pidi_flush(MidiToPidiState *s, u64 now_ms, bool force)
+{
+    const u64 max_len_ms = MIDI_TO_PIDI_MAX_NOTE_MS;
+    while (s->queue_head < s->queue.len) {
+        MidiPendingNote *n = &s->queue.data[s->queue_head];
+        if (!n->closed) {
+            if (!force && now_ms < n->start_ms + max_len_ms) break;
+            n->closed = true;
+            n->end_ms = AIL_MIN(now_ms, n->start_ms + max_len_ms);
+            if (!force) s->stats.cut_notes++;
+        }
+        midi_to_pidi_emit(s, n);
+        s->queue_head++;
+    }
+    // Compact the queue once more than half of it was already emitted
+    if (s->queue_head > 0 && s->queue_head >= s->queue.len/2) {
+        u32 rem = s->queue.len - s->queue_head;
+        memmove(s->queue.data, &s->queue.data[s->queue_head], rem*sizeof(MidiPendingNote));
+        s->queue_base += s->queue_head;
+        s->queue.len   = rem;
+        s->queue_head  = 0;
+    }
+}
+
+static void midi_to_pidi_note_off(MidiToPidiState *s, u8 channel, u8 note, u64 now_ms)
+{
+    u32 seq = s->open[channel][note];
+    if (!seq) return;
+    s->open[channel][note] = 0;
+    // The note might have been closed early already, in which case it might not be in the queue anymore
+    if (seq - 1 < s->queue_base) return;
+    MidiPendingNote *n = &s->queue.data[seq - 1 - s->queue_base];
+    if (n->closed) return;
+    n->closed = true;
+    n->end_ms = now_ms;
+}
+
+static void midi_to_pidi_note_on(MidiToPidiState *s, const MidiToPidiOpts *opts, u8 channel, u8 note, u8 velocity, u64 now_ms)
+{
+    i32 n = (i32)note + opts->transpose;
+    if (n < 0 || n >= MIDI_NOTES) return;
+    midi_to_pidi_note_off(s, channel, note, now_ms); // Striking a pressed note again releases it first
+    MidiPendingNote p = {0};
+    p.start_ms = now_ms;
+    p.velocity = (u8)AIL_MAX(1, (velocity*(MAX_VELOCITY - 1) + 63)/127);
+    p.octave   = (i8)(n/PIANO_KEY_AMOUNT - MIDI_MIDDLE_C/PIANO_KEY_AMOUNT);
+    p.key      = (u8)(n%PIANO_KEY_AMOUNT);
+    ail_da_push(&s->queue, p);
+    s->open[channel][note] = s->queue_base + s->queue.len; // Sequence number + 1
+    if (s->queue.len - s->queue_head > s->stats.max_pending) s->stats.max_pending = s->queue.len - s->queue_head;
+}
+
+bool midi_to_pidi(const u8 *smf, u64 smf_len, PidiSink sink, const MidiToPidiOpts *opts, MidiToPidiStats *stats)
+{
+    static const MidiToPidiOpts default_opts = {0};
+    if (!opts) opts = &default_opts;
+    bool res = false;
+    u32 *heap = NULL;
+    MidiToPidiState *s = ail_default_allocator.zero_alloc(ail_default_allocator.data, 1, sizeof(MidiToPidiState));
+    AIL_DA(MidiTrackCursor) cursors = ail_da_new_empty(MidiTrackCursor);
+    if (!s) return false;
+    s->out   = pidi_normalizer_new(sink, opts->long_notes);
+    s->queue = ail_da_new_with_cap(MidiPendingNote, 64);
+
+    // Header chunk
+    AIL_Buffer buf = ail_buf_from_data((u8 *)smf, smf_len, 0);
+    if (smf_len < 14 || ail_buf_read4msb(&buf) != 0x4d546864) goto done; // "MThd"
+    u32 header_len = ail_buf_read4msb(&buf);
+    if (header_len < 6 || 8 + (u64)header_len > smf_len) goto done;
+    u16 format   = ail_buf_read2msb(&buf);
+    u16 ntracks  = ail_buf_read2msb(&buf);
+    u16 division = ail_buf_read2msb(&buf);
+    buf.idx = 8 + header_len;
+    if (format > 2 || division == 0) goto done;
+
+    // Timing: microseconds = anchor_us + (tick - anchor_tick)*tempo/ticks_per_beat
+    u64 ticks_per_beat = division;
+    u64 tempo          = MIDI_DEFAULT_TEMPO;
+    if (division & 0x8000) {
+        // SMPTE timing: the "tempo" is simply the length of a frame
+        u8 fps = (u8)(-(i8)(division >> 8));
+        ticks_per_beat = division & 0xff;
+        tempo = fps == 29 ? 1000000*1001/30000 : 1000000/AIL_MAX(fps, 1);
+        if (!ticks_per_beat) goto done;
+    }
+    u64 anchor_tick = 0, anchor_us = 0;
+
+    // Track chunks - unknown chunk types are skipped as required by the standard
+    while (buf.idx + 8 <= smf_len && s->stats.tracks < ntracks) {
+        u32 type = ail_buf_read4msb(&buf);
+        u32 len  = ail_buf_read4msb(&buf);
+        if (buf.idx + len > smf_len) goto done;
+        if (type == 0x4d54726b) { // "MTrk"
+            MidiTrackCursor c = {0};
+            c.data = &smf[buf.idx];
+            c.len  = len;
+            if (!midi_cursor_next(&c)) goto done;
+            if (!c.done) ail_da_push(&cursors, c);
+            s->stats.tracks++;
+        }
+        buf.idx += len;
+    }
+
+    u32 n = cursors.len;
+    heap = ail_default_allocator.alloc(ail_default_allocator.data, sizeof(u32)*AIL_MAX(n, 1));
+    for (u32 i = 0; i < n; i++) heap[i] = i;
+    for (u32 i = n/2; i-- > 0;) midi_heap_sift_down(cursors.data, heap, n, i);
+
+    u64 now_ms = 0;
+    while (n > 0) {
+        MidiTrackCursor *c = &cursors.data[heap[0]];
+        u64 now_us = anchor_us + (c->tick - anchor_tick)*tempo/ticks_per_beat;
+        now_ms = now_us/1000;
+        midi_to_pidi_flush(s, now_ms, false);
+
+        MidiEvent ev = c->ev;
+        u8 channel = ev.status & 0x0f;
+        s->stats.events++;
+        switch (ev.status & 0xf0) {
+            case 0x90:
+                if (channel == MIDI_PERCUSSION_CHANNEL && !opts->keep_percussion) break;
+                if (ev.d2) {
+                    midi_to_pidi_note_on(s, opts, channel, ev.d1 & 0x7f, ev.d2 & 0x7f, now_ms);
+                    break;
+                }
+                AIL_FALL_THROUGH(); // Note-on with velocity 0 is a note-off
+            case 0x80:
+                midi_to_pidi_note_off(s, channel, ev.d1 & 0x7f, now_ms);
+                break;
+            case 0xf0:
+                if (ev.status == 0xff && ev.meta == 0x51 && ev.data_len == 3 && !(division & 0x8000)) {
+                    anchor_tick = c->tick;
+                    anchor_us   = now_us;
+                    tempo       = ((u64)ev.data[0] << 16) | ((u64)ev.data[1] << 8) | (u64)ev.data[2];
+                }
+                break;
+            default:
+                break;
+        }
+
+        if (!midi_cursor_next(c)) goto done;
+        if (c->done) heap[0] = heap[--n];
+        midi_heap_sift_down(cursors.data, heap, n, 0);
+    }
+
+    // Release all notes that are still pressed at the end of the song
+    midi_to_pidi_flush(s, now_ms, true);
+    pidi_normalizer_finish(&s->out);
+    res = true;
+
+done:
+    if (stats) *stats = s->stats;
+    if (heap) ail_default_allocator.free_one(ail_default_allocator.data, heap);
+    ail_da_free(&cursors);
+    ail_da_free(&s->queue);
+    ail_sda_free(&s->out.pending);
+    ail_default_allocator.free_one(ail_default_allocator.data, s);
+    return res;
+}
+
+static void midi_to_pidi_emit_writer(void *data, PidiCmd cmd)
+{
+    pidi_writer_push((PidiWriter *)data, cmd);
+}
+
+static void midi_to_pidi_emit_da(void *data, PidiCmd cmd)
+{
+    ail_da_push((AIL_DA(PidiCmd) *)data, cmd);
+}
+
+bool midi_to_pidi_file(const u8 *smf, u64 smf_len, AIL_Buffer *buf, const MidiToPidiOpts *opts, MidiToPidiStats *stats)
+{
+    PidiWriter w = pidi_writer_begin(buf);
+    PidiSink sink = { &w, &midi_to_pidi_emit_writer };
+    bool res = midi_to_pidi(smf, smf_len, sink, opts, stats);
+    if (res) pidi_writer_end(&w);
+    return res;
+}
+
+bool midi_to_pidi_cmds(const u8 *smf, u64 smf_len, AIL_DA(PidiCmd) *cmds, const MidiToPidiOpts *opts, MidiToPidiStats *stats)
+{
+    PidiSink sink = { cmds, &midi_to_pidi_emit_da };
+    return midi_to_pidi(smf, smf_len, sink, opts, stats);
+}
+
+#endif // _MIDI_TO_PIDI_IMPL_GUARD_
+#endif // MIDI_TO_PIDI_IMPL
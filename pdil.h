@@ -0,0 +1,822 @@
+// Reading and writing PDIL files (see Protocols.md) and loading the songs of a library
+//
+// Define PDIL_IMPL in some file, to include the function bodies
+// Files are read with ail_fs.h and songs are deduplicated with ail_hm.h, so AIL_FS_IMPL and AIL_HM_IMPL have to be defined in
+// some file as well
+//
+// Libraries often contain the same song several times under different names. Every entry thus stores a fingerprint of its
+// song's commands (see pidi_fingerprint) and `pdil_load` maps all entries with the same fingerprint to a single Song.
+// Duplicates whose fingerprint is already known are not even read, so each distinct song only takes up memory and indexing
+// time once. Entries without a fingerprint (0) are read to compute it, after which the library can be written again with
+// `pdil_write` to skip that work the next time.
+//
+// Changes to a library are not written by rewriting the whole file. Instead, `pdil_add`, `pdil_remove` and `pdil_rename`
+// append a single record to the journal after the file's Song Infos, which is replayed whenever the file is parsed.
+// Every record has its own checksum, so a record that was only partially written when the UI crashed is simply ignored.
+// Once the journal grew long enough (see `pdil_needs_compaction`), `pdil_compact` writes a new file without a journal next to
+// the old one and renames it over the old one afterwards, so a crash leaves either the old or the new file behind.
+//
+// The entries of a library are kept sorted by name and by length in a `SongIndex`. Instead of sorting the songs again whenever
+// the search changes, the entries whose name starts with the search text are found by binary search in O(log n) and are then
+// listed in order. Adding an entry inserts it into the sorted arrays with a single binary search each. Entries are indexed
+// rather than songs, so every duplicate of a song can be found under its own name.
+//
+// Files written before fingerprints were added have the magic `PDIL`, Song Infos without a fingerprint and no journal.
+// They are still read (with all fingerprints unknown), but the first change to such a library compacts the file into the
+// current format before recording the change, since the old format can't have a journal.
+
+#ifndef PDIL_H_
+#define PDIL_H_
+
+#include "common.h"
+#include "ail/ail_fs.h"
+#include "ail/ail_hm.h"
+
+#ifndef PDIL_DEF
+#ifdef  AIL_DEF
+#define PDIL_DEF AIL_DEF
+#else
+#define PDIL_DEF
+#endif // AIL_DEF
+#endif // PDIL_DEF
+
+static const CONST_VAR u32 PDIL_MAGIC    = (((u32)'P') << 24) | (((u32)'D') << 16) | (((u32)'L') << 8) | (((u32)'2') << 0);
+static const CONST_VAR u32 PDIL_MAGIC_V1 = (((u32)'P') << 24) | (((u32)'D') << 16) | (((u32)'I') << 8) | (((u32)'L') << 0);
+#define PDIL_HEADER_SIZE 8
+#define PDIL_ENTRY_HEADER_SIZE    20 // Size of a song info without its name
+#define PDIL_ENTRY_HEADER_SIZE_V1 12 // Size of a song info without its name in files with PDIL_MAGIC_V1
+#define PDIL_NO_SONG 0xffffffffU  // Song of entries whose PIDI file couldn't be read
+
+// The commands are hashed in stripes of 8 packed commands, the last stripe is padded with zeros
+#define PIDI_FINGERPRINT_STRIPE 8
+#define PIDI_FINGERPRINT_NONE   0 // Fingerprint of entries for which it isn't known, pidi_fingerprint never returns it
+
+#ifdef PIDI_TIMELINE_SSE2
+#define PIDI_FINGERPRINT_SSE2
+#endif
+
+// Operations that can be recorded in the journal of a PDIL file
+typedef enum PdilOp {
+    PDIL_OP_ADD    = 'A', // Payload: A Song Info
+    PDIL_OP_REMOVE = 'R', // Payload: The name of the removed entry
+    PDIL_OP_RENAME = 'N', // Payload: The old and the new name of the entry
+} PdilOp;
+#define PDIL_RECORD_OVERHEAD 9 // Size of a journal record without its payload
+
+// The journal should be compacted once it contains this many records
+// Names are looked up linearly when replaying the journal, so this also bounds the time that parsing spends on it
+#ifndef PDIL_JOURNAL_MAX_RECORDS
+#define PDIL_JOURNAL_MAX_RECORDS 256
+#endif // PDIL_JOURNAL_MAX_RECORDS
+
+// Flushes a file that was written to, must evaluate to 0 on success
+// Define it as e.g. `(fflush(f) || fsync(fileno(f)))` to wait until the data reached the disk as well, which makes journal
+// records and compactions survive power losses and not only crashes of the UI
+#ifndef PDIL_SYNC
+#define PDIL_SYNC(f) fflush(f)
+#endif // PDIL_SYNC
+
+// Suffix of the temporary file that pdil_compact writes, before renaming it
+#define PDIL_TMP_SUFFIX ".tmp"
+
+typedef struct PdilEntry {
+    char *name;        // Filename of the PIDI file, relative to the folder of the PDIL file
+    u64   len;         // Length in milliseconds of the song
+    u64   fingerprint; // pidi_fingerprint of the song's commands (or PIDI_FINGERPRINT_NONE)
+    u32   song;        // Index of the song in PdilLibrary.songs (or PDIL_NO_SONG, if it wasn't loaded)
+} PdilEntry;
+AIL_DA_INIT(PdilEntry);
+
+AIL_HM_INIT(u64, u32);
+
+// Indices into an array of entries, sorted by name and by length
+// Names are compared without regard to (ASCII) case, so that all names starting with some text are next to each other.
+// Entries with the same name or length are sorted by their index and entries without a song (PDIL_NO_SONG) are left out.
+typedef struct SongIndex {
+    AIL_DA(u32) by_name;
+    AIL_DA(u32) by_len;
+} SongIndex;
+
+// Songs are shared by all entries with the same fingerprint and are named after the first of them
+// A Song's name thus belongs to that entry and must not be freed separately
+// Songs that no entry refers to anymore are freed, but keep their slot with a NULL name, so that the indices of all other
+// songs stay the same
+typedef struct PdilLibrary {
+    AIL_DA(PdilEntry) entries;
+    AIL_DA(Song)      songs;
+    AIL_HM(u64, u32)  by_fingerprint;  // Index of the song with the given fingerprint
+    u64               body_len;        // Size of the PDIL file without its journal
+    u64               file_len;        // Size of the PDIL file up to the end of the last valid journal record
+    u32               journal_records; // Amount of valid records in the journal
+    bool              v1;              // Whether the file has the format of PDIL_MAGIC_V1, which is replaced on the first change
+    SongIndex         index;           // Sorted views over `entries`
+} PdilLibrary;
+
+typedef struct PdilLoadStats {
+    u32 files_read; // Amount of PIDI files that were read
+    u32 duplicates; // Amount of entries that share their song with an earlier entry
+    u32 stale;      // Amount of entries whose stored fingerprint didn't match their PIDI file (and was replaced)
+    u32 missing;    // Amount of entries whose PIDI file couldn't be read
+} PdilLoadStats;
+
+// 64-bit hash of the packed commands (see Protocols.md for the exact algorithm)
+PDIL_DEF u64  pidi_fingerprint(const PidiCmd *cmds, u64 count);
+// Empty library without any entries
+PDIL_DEF PdilLibrary pdil_new(void);
+// Parses the entries of a PDIL file into `lib` and replays its journal, without loading their songs
+// The journal ends at the first record that is incomplete or has a wrong checksum
+// Files with PDIL_MAGIC_V1 are read as well, all their entries get PIDI_FINGERPRINT_NONE
+PDIL_DEF bool pdil_parse(const u8 *data, u64 len, PdilLibrary *lib);
+// Writes a PDIL file with all entries of `lib` and without a journal into `buf`, always in the current format
+PDIL_DEF void pdil_write(AIL_Buffer *buf, const PdilLibrary *lib);
+// Reads the PDIL file at `fpath` and loads the songs of all its entries, `stats` may be NULL
+// Returns false if the PDIL file itself couldn't be read, entries whose PIDI file is missing don't get a song
+PDIL_DEF bool pdil_load(const char *fpath, PdilLibrary *lib, PdilLoadStats *stats);
+// Each of the following appends a record to the journal of the PDIL file at `fpath`, from which `lib` was loaded,
+// and applies it to `lib`. They return false if the record couldn't be written (or the entry doesn't exist), in which case
+// the operation isn't applied to `lib` either. Entries are identified by their name, if several have the same name, the first one is used.
+// Adding an entry loads its song as well. If the file still has the format of PDIL_MAGIC_V1, it is compacted first
+PDIL_DEF bool pdil_add   (const char *fpath, PdilLibrary *lib, const char *name, u64 len);
+PDIL_DEF bool pdil_remove(const char *fpath, PdilLibrary *lib, const char *name);
+PDIL_DEF bool pdil_rename(const char *fpath, PdilLibrary *lib, const char *old_name, const char *new_name);
+// Whether the journal grew long enough, that the file should be compacted
+PDIL_DEF bool pdil_needs_compaction(const PdilLibrary *lib);
+// Replaces the PDIL file at `fpath` with one that contains all entries of `lib` and no journal
+// Only the file is written, so this can be done whenever the UI is idle
+PDIL_DEF bool pdil_compact(const char *fpath, PdilLibrary *lib);
+PDIL_DEF void pdil_free(PdilLibrary *lib);
+
+// Sorts the indices of all entries in O(n log n)
+PDIL_DEF SongIndex song_index_new(const PdilEntry *entries, u32 count);
+// Adds entries[i] to the index, which it must not be in yet
+PDIL_DEF void song_index_insert(SongIndex *idx, const PdilEntry *entries, u32 i);
+// Removes entries[i] from the index, which has to be done before the entry's name, length or song change
+PDIL_DEF void song_index_remove(SongIndex *idx, const PdilEntry *entries, u32 i);
+// Gives the range [*lo, *hi) of idx->by_name, whose names start with `prefix` (ignoring case)
+PDIL_DEF void song_index_prefix(const SongIndex *idx, const PdilEntry *entries, const char *prefix, u32 *lo, u32 *hi);
+// Gives the range [*lo, *hi) of idx->by_len, whose lengths are in [min_len, max_len]
+PDIL_DEF void song_index_len_range(const SongIndex *idx, const PdilEntry *entries, u64 min_len, u64 max_len, u32 *lo, u32 *hi);
+PDIL_DEF void song_index_free(SongIndex *idx);
+
+#endif // PDIL_H_
+
+
+#ifdef PDIL_IMPL
+#ifndef _PDIL_IMPL_GUARD_
+#define _PDIL_IMPL_GUARD_
+
+#include <stdio.h>  // For appending to and renaming files
+#include <string.h> // For memcpy and strlen
+
+#define PIDI_FINGERPRINT_P1 0x9E3779B185EBCA87ULL
+#define PIDI_FINGERPRINT_P2 0xC2B2AE3D27D4EB4FULL
+#define PIDI_FINGERPRINT_P3 0x165667B19E3779F9ULL
+#define PIDI_FINGERPRINT_P4 0x85EBCA77C2B2AE63ULL
+#define PIDI_FINGERPRINT_P5 0x27D4EB2F165667C5ULL
+#define PIDI_FINGERPRINT_ROT 29
+
+static const u32 pidi_fingerprint_keys[PIDI_FINGERPRINT_STRIPE] = {
+    0xbe4ba423, 0x396cfeb8, 0x1cad21f7, 0x2c81017c, 0xdb979083, 0xe96dd4de, 0x1f67b3b7, 0xa4a44072,
+};
+
+static inline u64 pidi_fingerprint_avalanche(u64 h)
+{
+    h ^= h >> 33;
+    h *= PIDI_FINGERPRINT_P2;
+    h ^= h >> 29;
+    h *= PIDI_FINGERPRINT_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Each of the 4 lanes consumes 2 words per stripe: acc = rotl(acc) + (a^ka)*(b^kb) + (b<<32 | a)
+// The rotation makes the hash depend on the order of the stripes, while the multiplication mixes the bits of both words
+static void pidi_fingerprint_stripes_scalar(u64 acc[4], const u32 *words, u64 stripes)
+{
+    for (u64 s = 0; s < stripes; s++, words += PIDI_FINGERPRINT_STRIPE) {
+        for (u32 j = 0; j < 4; j++) {
+            u32 a = words[2*j], b = words[2*j + 1];
+            u64 x = (acc[j] << PIDI_FINGERPRINT_ROT) | (acc[j] >> (64 - PIDI_FINGERPRINT_ROT));
+            x += (u64)(a ^ pidi_fingerprint_keys[2*j]) * (u64)(b ^ pidi_fingerprint_keys[2*j + 1]);
+            acc[j] = x + (((u64)b << 32) | a);
+        }
+    }
+}
+
+#ifdef PIDI_FINGERPRINT_SSE2
+// Same as pidi_fingerprint_stripes_scalar, but with 2 lanes per register
+// _mm_mul_epu32 multiplies the lower words of both 64-bit lanes, so the upper words just have to be shifted down first
+static void pidi_fingerprint_stripes_sse2(u64 acc[4], const u32 *words, u64 stripes)
+{
+    __m128i acc01 = _mm_loadu_si128((__m128i *)&acc[0]);
+    __m128i acc23 = _mm_loadu_si128((__m128i *)&acc[2]);
+    __m128i key01 = _mm_loadu_si128((__m128i *)&pidi_fingerprint_keys[0]);
+    __m128i key23 = _mm_loadu_si128((__m128i *)&pidi_fingerprint_keys[4]);
+    for (u64 s = 0; s < stripes; s++, words += PIDI_FINGERPRINT_STRIPE) {
+        __m128i d01  = _mm_loadu_si128((__m128i *)&words[0]);
+        __m128i d23  = _mm_loadu_si128((__m128i *)&words[4]);
+        __m128i dk01 = _mm_xor_si128(d01, key01);
+        __m128i dk23 = _mm_xor_si128(d23, key23);
+        __m128i p01  = _mm_mul_epu32(dk01, _mm_srli_epi64(dk01, 32));
+        __m128i p23  = _mm_mul_epu32(dk23, _mm_srli_epi64(dk23, 32));
+        acc01 = _mm_or_si128(_mm_slli_epi64(acc01, PIDI_FINGERPRINT_ROT), _mm_srli_epi64(acc01, 64 - PIDI_FINGERPRINT_ROT));
+        acc23 = _mm_or_si128(_mm_slli_epi64(acc23, PIDI_FINGERPRINT_ROT), _mm_srli_epi64(acc23, 64 - PIDI_FINGERPRINT_ROT));
+        acc01 = _mm_add_epi64(_mm_add_epi64(acc01, p01), d01);
+        acc23 = _mm_add_epi64(_mm_add_epi64(acc23, p23), d23);
+    }
+    _mm_storeu_si128((__m128i *)&acc[0], acc01);
+    _mm_storeu_si128((__m128i *)&acc[2], acc23);
+}
+#endif // PIDI_FINGERPRINT_SSE2
+
+u64 pidi_fingerprint(const PidiCmd *cmds, u64 count)
+{
+    // Commands are packed block-wise into `words`, since the layout of PidiCmd itself is implementation-defined
+    u32 words[32*PIDI_FINGERPRINT_STRIPE];
+    u64 acc[4] = { PIDI_FINGERPRINT_P1, PIDI_FINGERPRINT_P2, PIDI_FINGERPRINT_P3, PIDI_FINGERPRINT_P4 };
+    for (u64 i = 0; i < count;) {
+        u64 n = AIL_MIN(count - i, (u64)(sizeof(words)/sizeof(words[0])));
+        for (u64 j = 0; j < n; j++) words[j] = pidi_pack(cmds[i + j]);
+        for (u64 j = n; j % PIDI_FINGERPRINT_STRIPE; j++) words[j] = 0;
+#ifdef PIDI_FINGERPRINT_SSE2
+        pidi_fingerprint_stripes_sse2(acc, words, (n + PIDI_FINGERPRINT_STRIPE - 1)/PIDI_FINGERPRINT_STRIPE);
+#else
+        pidi_fingerprint_stripes_scalar(acc, words, (n + PIDI_FINGERPRINT_STRIPE - 1)/PIDI_FINGERPRINT_STRIPE);
+#endif
+        i += n;
+    }
+
+    u64 h = count*PIDI_FINGERPRINT_P5;
+    for (u32 j = 0; j < 4; j++) h = (h ^ pidi_fingerprint_avalanche(acc[j]))*PIDI_FINGERPRINT_P1 + PIDI_FINGERPRINT_P4;
+    h = pidi_fingerprint_avalanche(h);
+    return h == PIDI_FINGERPRINT_NONE ? 1 : h;
+}
+
+static bool pdil_read_song_info(AIL_Buffer *buf, PdilEntry *e, bool v1)
+{
+    if (buf->len - buf->idx < (v1 ? PDIL_ENTRY_HEADER_SIZE_V1 : PDIL_ENTRY_HEADER_SIZE)) return false;
+    u32 name_len   = ail_buf_read4lsb(buf);
+    e->len         = ail_buf_read8lsb(buf);
+    e->fingerprint = v1 ? PIDI_FINGERPRINT_NONE : ail_buf_read8lsb(buf);
+    e->song        = PDIL_NO_SONG;
+    if (buf->len - buf->idx < name_len) return false;
+    e->name        = ail_buf_readstr(buf, name_len);
+    return true;
+}
+
+static void pdil_write_song_info(AIL_Buffer *buf, PdilEntry e)
+{
+    u32 name_len = (u32)strlen(e.name);
+    ail_buf_write4lsb(buf, name_len);
+    ail_buf_write8lsb(buf, e.len);
+    ail_buf_write8lsb(buf, e.fingerprint);
+    ail_buf_ensure_size(buf, name_len); // ail_buf_writestr doesn't grow the buffer itself
+    ail_buf_writestr(buf, e.name, name_len);
+}
+
+// Returns NULL if `buf` ends before the name does
+static char *pdil_read_name(AIL_Buffer *buf)
+{
+    if (buf->len - buf->idx < 4) return NULL;
+    u32 name_len = ail_buf_read4lsb(buf);
+    if (buf->len - buf->idx < name_len) return NULL;
+    return ail_buf_readstr(buf, name_len);
+}
+
+static void pdil_write_name(AIL_Buffer *buf, const char *name)
+{
+    u32 name_len = (u32)strlen(name);
+    ail_buf_write4lsb(buf, name_len);
+    ail_buf_ensure_size(buf, name_len);
+    ail_buf_writestr(buf, (char *)name, name_len);
+}
+
+static char *pdil_copy_name(const char *name)
+{
+    u64   len = strlen(name);
+    char *out = AIL_BUF_MALLOC(len + 1);
+    memcpy(out, name, len + 1);
+    return out;
+}
+
+// Index of the first entry called `name` (or lib->entries.len if there is none)
+static u32 pdil_find(const PdilLibrary *lib, const char *name)
+{
+    u32 i = 0;
+    while (i < lib->entries.len && strcmp(lib->entries.data[i].name, name) != 0) i++;
+    return i;
+}
+
+// Moves all indices after the removed entry `i` down by one
+// The order of the remaining entries doesn't change, so the arrays stay sorted
+static void song_index_close_gap(SongIndex *idx, u32 i)
+{
+    for (u32 j = 0; j < idx->by_name.len; j++) idx->by_name.data[j] -= idx->by_name.data[j] > i;
+    for (u32 j = 0; j < idx->by_len.len;  j++) idx->by_len.data[j]  -= idx->by_len.data[j]  > i;
+}
+
+// Removes the entry `idx` and frees its song, if no other entry refers to it
+// Removing the entry already moves all later entries, so updating their indices doesn't change the complexity
+static void pdil_remove_entry(PdilLibrary *lib, u32 idx)
+{
+    PdilEntry e = lib->entries.data[idx];
+    song_index_remove(&lib->index, lib->entries.data, idx);
+    ail_da_rm(&lib->entries, idx);
+    song_index_close_gap(&lib->index, idx);
+    if (e.song != PDIL_NO_SONG) {
+        Song *song  = &lib->songs.data[e.song];
+        u32   other = 0;
+        while (other < lib->entries.len && lib->entries.data[other].song != e.song) other++;
+        if (other == lib->entries.len) {
+            ail_da_free(&song->cmds);
+            song->name = NULL;
+            song->len  = 0;
+        } else if (song->name == e.name) {
+            song->name = lib->entries.data[other].name;
+        }
+    }
+    AIL_BUF_FREE(e.name);
+}
+
+// Gives the entry `idx` the name `name`, which is then owned by the entry
+static void pdil_rename_entry(PdilLibrary *lib, u32 idx, char *name)
+{
+    PdilEntry *e = &lib->entries.data[idx];
+    song_index_remove(&lib->index, lib->entries.data, idx);
+    if (e->song != PDIL_NO_SONG && lib->songs.data[e->song].name == e->name) lib->songs.data[e->song].name = name;
+    AIL_BUF_FREE(e->name);
+    e->name = name;
+    song_index_insert(&lib->index, lib->entries.data, idx);
+}
+
+// Applies a journal record to `lib`, returns false if its payload is malformed
+// Records for entries that don't exist are ignored, just like records with unknown operations
+static bool pdil_replay(PdilLibrary *lib, u8 op, AIL_Buffer payload)
+{
+    switch (op) {
+        case PDIL_OP_ADD: {
+            PdilEntry e;
+            if (!pdil_read_song_info(&payload, &e, false)) return false;
+            ail_da_push(&lib->entries, e);
+        } break;
+        case PDIL_OP_REMOVE: {
+            char *name = pdil_read_name(&payload);
+            if (!name) return false;
+            u32 idx = pdil_find(lib, name);
+            if (idx < lib->entries.len) pdil_remove_entry(lib, idx);
+            AIL_BUF_FREE(name);
+        } break;
+        case PDIL_OP_RENAME: {
+            char *old_name = pdil_read_name(&payload);
+            char *new_name = old_name ? pdil_read_name(&payload) : NULL;
+            if (!new_name) {
+                if (old_name) AIL_BUF_FREE(old_name);
+                return false;
+            }
+            u32 idx = pdil_find(lib, old_name);
+            if (idx < lib->entries.len) pdil_rename_entry(lib, idx, new_name);
+            else AIL_BUF_FREE(new_name);
+            AIL_BUF_FREE(old_name);
+        } break;
+        default: break;
+    }
+    return true;
+}
+
+PdilLibrary pdil_new(void)
+{
+    PdilLibrary lib;
+    lib.entries         = ail_da_new_empty(PdilEntry);
+    lib.songs           = ail_da_new_empty(Song);
+    lib.by_fingerprint  = ail_hm_new_empty(u64, u32, &ail_hm_hash_u64, &ail_hm_eq_u64);
+    lib.body_len        = 0;
+    lib.file_len        = 0;
+    lib.journal_records = 0;
+    lib.v1              = false;
+    lib.index           = song_index_new(NULL, 0);
+    return lib;
+}
+
+bool pdil_parse(const u8 *data, u64 len, PdilLibrary *lib)
+{
+    AIL_Buffer buf = ail_buf_from_data((u8 *)data, len, 0);
+    *lib = pdil_new();
+    if (len < PDIL_HEADER_SIZE) return false;
+    u32 magic = ail_buf_read4msb(&buf);
+    if (magic != PDIL_MAGIC && magic != PDIL_MAGIC_V1) return false;
+    lib->v1    = magic == PDIL_MAGIC_V1;
+    u32 amount = ail_buf_read4lsb(&buf);
+    ail_da_reserve(&lib->entries, AIL_MIN(amount, (len - PDIL_HEADER_SIZE)/(lib->v1 ? PDIL_ENTRY_HEADER_SIZE_V1 : PDIL_ENTRY_HEADER_SIZE)));
+    for (u32 i = 0; i < amount; i++) {
+        PdilEntry e;
+        if (!pdil_read_song_info(&buf, &e, lib->v1)) return false;
+        ail_da_push(&lib->entries, e);
+    }
+    lib->body_len = buf.idx;
+    lib->file_len = buf.idx;
+    if (lib->v1) return true; // Files in the old format have no journal
+
+    while (buf.len - buf.idx >= PDIL_RECORD_OVERHEAD) {
+        u64 start       = buf.idx;
+        u8  op          = ail_buf_read1(&buf);
+        u32 payload_len = ail_buf_read4lsb(&buf);
+        if (buf.len - buf.idx < (u64)payload_len + 4) break;
+        u32 crc = sppp_crc32(SPPP_CRC32_INIT, &buf.data[start], 5 + (u64)payload_len);
+        AIL_Buffer payload = ail_buf_from_data(&buf.data[buf.idx], payload_len, 0);
+        buf.idx += payload_len;
+        if (ail_buf_read4lsb(&buf) != crc || !pdil_replay(lib, op, payload)) break;
+        lib->file_len = buf.idx;
+        lib->journal_records++;
+    }
+    return true;
+}
+
+void pdil_write(AIL_Buffer *buf, const PdilLibrary *lib)
+{
+    ail_buf_write4msb(buf, PDIL_MAGIC);
+    ail_buf_write4lsb(buf, lib->entries.len);
+    for (u32 i = 0; i < lib->entries.len; i++) pdil_write_song_info(buf, lib->entries.data[i]);
+}
+
+// Length of the folder part of `fpath`, including the trailing separator
+static u64 pdil_dir_len(const char *fpath)
+{
+    u64 len = strlen(fpath);
+    while (len > 0 && fpath[len - 1] != '/' && fpath[len - 1] != '\\') len--;
+    return len;
+}
+
+// Reads the PIDI file `name` from the folder, that `fpath` is in
+static bool pdil_read_pidi(const char *fpath, const char *name, AIL_DA(PidiCmd) *cmds)
+{
+    u64   dir_len  = pdil_dir_len(fpath);
+    u64   name_len = strlen(name);
+    char *path     = AIL_MALLOC(dir_len + name_len + 1);
+    memcpy(path, fpath, dir_len);
+    memcpy(&path[dir_len], name, name_len + 1);
+    u64 len;
+    u8 *data = (u8 *)ail_fs_read_entire_file(path, &len);
+    AIL_FREE(path);
+    if (!data) return false;
+
+    AIL_Buffer buf = ail_buf_from_data(data, len, 0);
+    bool res = len >= 8 && ail_buf_read4msb(&buf) == PIDI_MAGIC;
+    if (res) {
+        u32 count = ail_buf_read4lsb(&buf);
+        res = (len - 8)/ENCODED_CMD_LEN >= count;
+        if (res) {
+            *cmds = ail_da_new_with_cap(PidiCmd, AIL_MAX(count, 1));
+            for (u32 i = 0; i < count; i++) cmds->data[i] = decode_cmd(&buf);
+            cmds->len = count;
+        }
+    }
+    AIL_FREE(data);
+    return res;
+}
+
+static bool pdil_cmds_eq(AIL_DA(PidiCmd) a, AIL_DA(PidiCmd) b)
+{
+    if (a.len != b.len) return false;
+    for (u32 i = 0; i < a.len; i++) {
+        if (pidi_pack(a.data[i]) != pidi_pack(b.data[i])) return false;
+    }
+    return true;
+}
+
+// Index of the song with the given fingerprint, if it wasn't freed yet
+static bool pdil_find_song(PdilLibrary *lib, u64 fingerprint, u32 *song)
+{
+    bool found;
+    ail_hm_get_val(&lib->by_fingerprint, fingerprint, *song, found);
+    return found && lib->songs.data[*song].name != NULL;
+}
+
+// Gives the entry `idx` a song, either by sharing one with the same fingerprint or by reading its PIDI file
+static void pdil_load_entry(const char *fpath, PdilLibrary *lib, u32 idx, PdilLoadStats *s)
+{
+    PdilEntry *e = &lib->entries.data[idx];
+    u32 song;
+    if (e->fingerprint != PIDI_FINGERPRINT_NONE && pdil_find_song(lib, e->fingerprint, &song)) {
+        // Fingerprints are 64 bits wide, so matching ones are trusted without reading the file
+        e->song = song;
+        s->duplicates++;
+        return;
+    }
+
+    AIL_DA(PidiCmd) cmds;
+    if (!pdil_read_pidi(fpath, e->name, &cmds)) {
+        s->missing++;
+        return;
+    }
+    s->files_read++;
+    u64 fingerprint = pidi_fingerprint(cmds.data, cmds.len);
+    if (e->fingerprint != PIDI_FINGERPRINT_NONE && e->fingerprint != fingerprint) s->stale++;
+    e->fingerprint = fingerprint;
+
+    bool found = pdil_find_song(lib, fingerprint, &song);
+    if (found && pdil_cmds_eq(lib->songs.data[song].cmds, cmds)) {
+        // The file was read anyway, so an actual hash collision can be ruled out here
+        e->song = song;
+        s->duplicates++;
+        ail_da_free(&cmds);
+    } else {
+        Song sng = { e->name, e->len, cmds };
+        e->song  = lib->songs.len;
+        ail_da_push(&lib->songs, sng);
+        if (!found) ail_hm_put(&lib->by_fingerprint, fingerprint, e->song);
+    }
+}
+
+bool pdil_load(const char *fpath, PdilLibrary *lib, PdilLoadStats *stats)
+{
+    PdilLoadStats s = {0};
+    u64 len;
+    u8 *data = (u8 *)ail_fs_read_entire_file(fpath, &len);
+    if (!data) {
+        *lib = pdil_new();
+        return false;
+    }
+    bool res = pdil_parse(data, len, lib);
+    AIL_FREE(data);
+    if (!res) {
+        pdil_free(lib);
+        return false;
+    }
+
+    ail_hm_reserve(&lib->by_fingerprint, lib->entries.len);
+    for (u32 i = 0; i < lib->entries.len; i++) pdil_load_entry(fpath, lib, i, &s);
+    song_index_free(&lib->index);
+    lib->index = song_index_new(lib->entries.data, lib->entries.len);
+    if (stats) *stats = s;
+    return true;
+}
+
+// Appends a journal record at the end of the last valid one
+// If the file ends with a partially written record, it is overwritten. Any bytes of it that remain after the new record
+// just end the journal again.
+static bool pdil_append_record(const char *fpath, PdilLibrary *lib, PdilOp op, const AIL_Buffer *payload)
+{
+    AIL_Buffer rec = ail_buf_new(PDIL_RECORD_OVERHEAD + payload->len);
+    ail_buf_write1(&rec, (u8)op);
+    ail_buf_write4lsb(&rec, (u32)payload->len);
+    ail_buf_writestr(&rec, (char *)payload->data, payload->len);
+    ail_buf_write4lsb(&rec, sppp_crc32(SPPP_CRC32_INIT, rec.data, rec.len));
+
+    FILE *f  = fopen(fpath, "r+b");
+    bool res = f && fseek(f, (long)lib->file_len, SEEK_SET) == 0 && fwrite(rec.data, 1, rec.len, f) == rec.len && PDIL_SYNC(f) == 0;
+    if (f) res = fclose(f) == 0 && res;
+    if (res) {
+        lib->file_len += rec.len;
+        lib->journal_records++;
+    }
+    ail_buf_free(rec);
+    return res;
+}
+
+bool pdil_add(const char *fpath, PdilLibrary *lib, const char *name, u64 len)
+{
+    if (lib->v1 && !pdil_compact(fpath, lib)) return false;
+    PdilEntry e = { pdil_copy_name(name), len, PIDI_FINGERPRINT_NONE, PDIL_NO_SONG };
+    PdilLoadStats s = {0};
+    ail_da_push(&lib->entries, e);
+    pdil_load_entry(fpath, lib, lib->entries.len - 1, &s);
+    song_index_insert(&lib->index, lib->entries.data, lib->entries.len - 1);
+
+    AIL_Buffer payload = ail_buf_new(PDIL_ENTRY_HEADER_SIZE + strlen(name));
+    pdil_write_song_info(&payload, lib->entries.data[lib->entries.len - 1]);
+    bool res = pdil_append_record(fpath, lib, PDIL_OP_ADD, &payload);
+    ail_buf_free(payload);
+    if (!res) pdil_remove_entry(lib, lib->entries.len - 1);
+    return res;
+}
+
+bool pdil_remove(const char *fpath, PdilLibrary *lib, const char *name)
+{
+    u32 idx = pdil_find(lib, name);
+    if (idx == lib->entries.len) return false;
+    if (lib->v1 && !pdil_compact(fpath, lib)) return false;
+    AIL_Buffer payload = ail_buf_new(4 + strlen(name));
+    pdil_write_name(&payload, name);
+    bool res = pdil_append_record(fpath, lib, PDIL_OP_REMOVE, &payload);
+    ail_buf_free(payload);
+    if (res) pdil_remove_entry(lib, idx);
+    return res;
+}
+
+bool pdil_rename(const char *fpath, PdilLibrary *lib, const char *old_name, const char *new_name)
+{
+    u32 idx = pdil_find(lib, old_name);
+    if (idx == lib->entries.len) return false;
+    if (lib->v1 && !pdil_compact(fpath, lib)) return false;
+    AIL_Buffer payload = ail_buf_new(8 + strlen(old_name) + strlen(new_name));
+    pdil_write_name(&payload, old_name);
+    pdil_write_name(&payload, new_name);
+    bool res = pdil_append_record(fpath, lib, PDIL_OP_RENAME, &payload);
+    ail_buf_free(payload);
+    if (res) pdil_rename_entry(lib, idx, pdil_copy_name(new_name));
+    return res;
+}
+
+bool pdil_needs_compaction(const PdilLibrary *lib)
+{
+    return lib->journal_records >= PDIL_JOURNAL_MAX_RECORDS;
+}
+
+// Atomically replaces the file `dst` with `src`
+static bool pdil_replace_file(const char *src, const char *dst)
+{
+#ifdef _WIN32
+    return MoveFileExA(src, dst, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(src, dst) == 0;
+#endif
+}
+
+bool pdil_compact(const char *fpath, PdilLibrary *lib)
+{
+    AIL_Buffer buf = ail_buf_new(PDIL_HEADER_SIZE + (u64)lib->entries.len*(PDIL_ENTRY_HEADER_SIZE + 32));
+    pdil_write(&buf, lib);
+    u64   path_len = strlen(fpath);
+    char *tmp      = AIL_MALLOC(path_len + sizeof(PDIL_TMP_SUFFIX));
+    memcpy(tmp, fpath, path_len);
+    memcpy(&tmp[path_len], PDIL_TMP_SUFFIX, sizeof(PDIL_TMP_SUFFIX));
+
+    FILE *f  = fopen(tmp, "wb");
+    bool res = f && fwrite(buf.data, 1, buf.len, f) == buf.len && PDIL_SYNC(f) == 0;
+    if (f) res = fclose(f) == 0 && res;
+    res = res && pdil_replace_file(tmp, fpath);
+    if (res) {
+        lib->body_len        = buf.len;
+        lib->file_len        = buf.len;
+        lib->journal_records = 0;
+        lib->v1              = false;
+    } else {
+        remove(tmp);
+    }
+    AIL_FREE(tmp);
+    ail_buf_free(buf);
+    return res;
+}
+
+void pdil_free(PdilLibrary *lib)
+{
+    for (u32 i = 0; i < lib->songs.len; i++)   ail_da_free(&lib->songs.data[i].cmds);
+    for (u32 i = 0; i < lib->entries.len; i++) AIL_BUF_FREE(lib->entries.data[i].name);
+    ail_da_free(&lib->songs);
+    ail_da_free(&lib->entries);
+    ail_hm_free(&lib->by_fingerprint);
+    song_index_free(&lib->index);
+}
+
+static inline u8 song_index_fold(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? (u8)(c - 'A' + 'a') : (u8)c;
+}
+
+typedef int (*SongIndexCmp)(const PdilEntry *entries, u32 a, u32 b);
+
+static int song_index_name_cmp(const PdilEntry *entries, u32 a, u32 b)
+{
+    const char *x = entries[a].name, *y = entries[b].name;
+    u64 i = 0;
+    while (x[i] && song_index_fold(x[i]) == song_index_fold(y[i])) i++;
+    int c = (int)song_index_fold(x[i]) - (int)song_index_fold(y[i]);
+    if (!c) c = strcmp(x, y);
+    if (!c) c = (a > b) - (a < b);
+    return c;
+}
+
+static int song_index_len_cmp(const PdilEntry *entries, u32 a, u32 b)
+{
+    if (entries[a].len != entries[b].len) return entries[a].len < entries[b].len ? -1 : 1;
+    return (a > b) - (a < b);
+}
+
+// Compares only the first strlen(prefix) characters of `name` with `prefix`
+static int song_index_prefix_cmp(const char *name, const char *prefix)
+{
+    for (u64 i = 0; prefix[i]; i++) {
+        int c = (int)song_index_fold(name[i]) - (int)song_index_fold(prefix[i]);
+        if (c || !name[i]) return c;
+    }
+    return 0;
+}
+
+// Stable bottom-up merge sort, since qsort can't pass `entries` to the comparison
+static void song_index_sort(AIL_DA(u32) *xs, const PdilEntry *entries, SongIndexCmp cmp)
+{
+    u32  n   = xs->len;
+    u32 *src = xs->data;
+    u32 *dst = AIL_MALLOC(sizeof(u32)*AIL_MAX(n, 1));
+    for (u32 width = 1; width < n; width *= 2) {
+        for (u32 lo = 0; lo < n; lo += 2*width) {
+            u32 mid = AIL_MIN(lo + width, n), hi = AIL_MIN(lo + 2*width, n);
+            u32 i = lo, j = mid, k = lo;
+            while (i < mid && j < hi) dst[k++] = cmp(entries, src[j], src[i]) < 0 ? src[j++] : src[i++];
+            while (i < mid) dst[k++] = src[i++];
+            while (j < hi)  dst[k++] = src[j++];
+        }
+        u32 *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    if (src != xs->data) {
+        memcpy(xs->data, src, sizeof(u32)*n);
+        dst = src;
+    }
+    AIL_FREE(dst);
+}
+
+// Index of the first element in `xs`, that isn't sorted before entries[i]
+static u32 song_index_lower_bound(const AIL_DA(u32) *xs, const PdilEntry *entries, u32 i, SongIndexCmp cmp)
+{
+    u32 lo = 0, hi = xs->len;
+    while (lo < hi) {
+        u32 mid = lo + (hi - lo)/2;
+        if (cmp(entries, xs->data[mid], i) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+SongIndex song_index_new(const PdilEntry *entries, u32 count)
+{
+    SongIndex idx;
+    idx.by_name = ail_da_new_with_cap(u32, AIL_MAX(count, 1));
+    idx.by_len  = ail_da_new_with_cap(u32, AIL_MAX(count, 1));
+    for (u32 i = 0; i < count; i++) {
+        if (entries[i].song == PDIL_NO_SONG) continue;
+        ail_da_push(&idx.by_name, i);
+        ail_da_push(&idx.by_len,  i);
+    }
+    song_index_sort(&idx.by_name, entries, song_index_name_cmp);
+    song_index_sort(&idx.by_len,  entries, song_index_len_cmp);
+    return idx;
+}
+
+void song_index_insert(SongIndex *idx, const PdilEntry *entries, u32 i)
+{
+    if (entries[i].song == PDIL_NO_SONG) return;
+    // ail_da_insert evaluates the position more than once, so it needs to be computed beforehand
+    u32 pos = song_index_lower_bound(&idx->by_name, entries, i, song_index_name_cmp);
+    ail_da_insert(&idx->by_name, pos, i);
+    pos = song_index_lower_bound(&idx->by_len, entries, i, song_index_len_cmp);
+    ail_da_insert(&idx->by_len, pos, i);
+}
+
+void song_index_remove(SongIndex *idx, const PdilEntry *entries, u32 i)
+{
+    if (entries[i].song == PDIL_NO_SONG) return;
+    // Ties are broken by the index, so the lower bound of entries[i] is exactly where it is
+    u32 pos = song_index_lower_bound(&idx->by_name, entries, i, song_index_name_cmp);
+    AIL_ASSERT(pos < idx->by_name.len && idx->by_name.data[pos] == i);
+    ail_da_rm(&idx->by_name, pos);
+    pos = song_index_lower_bound(&idx->by_len, entries, i, song_index_len_cmp);
+    AIL_ASSERT(pos < idx->by_len.len && idx->by_len.data[pos] == i);
+    ail_da_rm(&idx->by_len, pos);
+}
+
+void song_index_prefix(const SongIndex *idx, const PdilEntry *entries, const char *prefix, u32 *lo, u32 *hi)
+{
+    u32 l = 0, h = idx->by_name.len;
+    while (l < h) {
+        u32 mid = l + (h - l)/2;
+        if (song_index_prefix_cmp(entries[idx->by_name.data[mid]].name, prefix) < 0) l = mid + 1;
+        else h = mid;
+    }
+    *lo = l;
+    h   = idx->by_name.len;
+    while (l < h) {
+        u32 mid = l + (h - l)/2;
+        if (song_index_prefix_cmp(entries[idx->by_name.data[mid]].name, prefix) <= 0) l = mid + 1;
+        else h = mid;
+    }
+    *hi = l;
+}
+
+void song_index_len_range(const SongIndex *idx, const PdilEntry *entries, u64 min_len, u64 max_len, u32 *lo, u32 *hi)
+{
+    u32 l = 0, h = idx->by_len.len;
+    while (l < h) {
+        u32 mid = l + (h - l)/2;
+        if (entries[idx->by_len.data[mid]].len < min_len) l = mid + 1;
+        else h = mid;
+    }
+    *lo = l;
+    h   = idx->by_len.len;
+    while (l < h) {
+        u32 mid = l + (h - l)/2;
+        if (entries[idx->by_len.data[mid]].len <= max_len) l = mid + 1;
+        else h = mid;
+    }
+    *hi = l;
+}
+
+void song_index_free(SongIndex *idx)
+{
+    ail_da_free(&idx->by_name);
+    ail_da_free(&idx->by_len);
+}
+
+#endif // _PDIL_IMPL_GUARD_
+#endif // PDIL_IMPL
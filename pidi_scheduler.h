@@ -0,0 +1,212 @@
+// Playback scheduler for PIDI commands
+//
+// Define PIDI_SCHEDULER_IMPL in some file, to include the function bodies
+// The monotonic clock uses ail_time_now_ns, so AIL_TIME_IMPL has to be defined in some file as well
+//
+// Sleeping for each command's `dt` lets every oversleep and every rounding error add up over the course of a song.
+// Instead, the scheduler keeps track of the song's absolute position and derives each command's deadline from it:
+//     deadline = anchor_ns + (position_ns - anchor_position_ns) / speed
+// The anchor is only moved when the speed changes, so the conversion is rounded once per speed change instead of
+// once per command and a late command never delays the following ones.
+//
+// Waiting sleeps on an absolute deadline (clock_nanosleep with TIMER_ABSTIME where available) until shortly before
+// the deadline and spins for the remaining `spin_ns`, since waking up from a sleep usually takes longer than that.
+//
+// All time is read through a `PidiClock`, which allows running the scheduler against a simulated clock.
+
+#ifndef PIDI_SCHEDULER_H_
+#define PIDI_SCHEDULER_H_
+
+#include "common.h"
+#include "ail/ail_time.h"
+
+#ifndef PIDI_SCHEDULER_DEF
+#ifdef  AIL_DEF
+#define PIDI_SCHEDULER_DEF AIL_DEF
+#else
+#define PIDI_SCHEDULER_DEF
+#endif // AIL_DEF
+#endif // PIDI_SCHEDULER_DEF
+
+// Time before a deadline, from which on the scheduler spins instead of sleeping
+#ifndef PIDI_SCHEDULER_SPIN_NS
+#define PIDI_SCHEDULER_SPIN_NS 100000
+#endif // PIDI_SCHEDULER_SPIN_NS
+
+typedef struct PidiClock {
+    void *data;
+    u64  (*now_ns)(void *data);
+    // Should return no earlier than `deadline_ns`, unless `spin` is false, in which case it may also return early
+    void (*wait_until_ns)(void *data, u64 deadline_ns, bool spin);
+} PidiClock;
+
+typedef struct PidiSchedulerStats {
+    u64 waits;
+    u64 late;            // Amount of deadlines that were missed by more than PIDI_SCHEDULER_SPIN_NS
+    i64 min_lateness_ns; // Lateness is the difference between the time a wait returned and its deadline
+    i64 max_lateness_ns;
+    f64 sum_lateness_ns;
+    f64 sum_sq_lateness_ns;
+} PidiSchedulerStats;
+
+typedef struct PidiScheduler {
+    PidiClock clock;
+    f32 speed;
+    u64 spin_ns;
+    u64 anchor_ns;          // Clock time at which the song was at `anchor_position_ns`
+    u64 anchor_position_ns; // Position in the song (unaffected by speed) at the last speed change
+    u64 position_ms;        // Position in the song of the next command, i.e. the sum of all dts so far
+    PidiSchedulerStats stats;
+} PidiScheduler;
+
+PIDI_SCHEDULER_DEF PidiClock     pidi_clock_monotonic(void);
+// The song starts playing at the current time of `clock`
+PIDI_SCHEDULER_DEF PidiScheduler pidi_scheduler_new(PidiClock clock);
+PIDI_SCHEDULER_DEF void          pidi_scheduler_set_speed(PidiScheduler *s, f32 speed);
+// Clock time at which the song reaches `position_ms`
+PIDI_SCHEDULER_DEF u64           pidi_scheduler_deadline(const PidiScheduler *s, u64 position_ms);
+// Advances the song by `dt_ms` and waits until it reaches that position. Returns the lateness in nanoseconds
+PIDI_SCHEDULER_DEF i64           pidi_scheduler_wait_ms(PidiScheduler *s, u32 dt_ms);
+PIDI_SCHEDULER_DEF i64           pidi_scheduler_wait(PidiScheduler *s, PidiCmd cmd);
+PIDI_SCHEDULER_DEF f64           pidi_scheduler_mean_lateness_ns(const PidiSchedulerStats *stats);
+PIDI_SCHEDULER_DEF f64           pidi_scheduler_jitter_ns(const PidiSchedulerStats *stats); // Standard deviation of the lateness
+PIDI_SCHEDULER_DEF void          pidi_scheduler_reset_stats(PidiScheduler *s);
+
+#endif // PIDI_SCHEDULER_H_
+
+
+#ifdef PIDI_SCHEDULER_IMPL
+#ifndef _PIDI_SCHEDULER_IMPL_GUARD_
+#define _PIDI_SCHEDULER_IMPL_GUARD_
+
+#include <math.h>  // For sqrt
+#include <errno.h> // For EINTR
+
+#ifdef _WIN32
+#include <windows.h> // For Sleep
+#endif
+
+static u64 pidi_clock_monotonic_now(void *data)
+{
+    AIL_UNUSED(data);
+    return ail_time_now_ns();
+}
+
+static void pidi_clock_monotonic_wait(void *data, u64 deadline_ns, bool spin)
+{
+    AIL_UNUSED(data);
+    u64 now = ail_time_now_ns();
+    if (now >= deadline_ns) return;
+    // The scheduler only asks for spinning in the last `spin_ns` before a deadline, which a sleep would overshoot
+    if (spin) {
+        while (ail_time_now_ns() < deadline_ns) AIL_CPU_RELAX();
+        return;
+    }
+#if defined(_WIN32)
+    u64 ms = (deadline_ns - now)/1000000;
+    if (ms) Sleep((DWORD)ms);
+#elif defined(TIMER_ABSTIME)
+    struct timespec ts;
+    ts.tv_sec  = (time_t)(deadline_ns / 1000000000ULL);
+    ts.tv_nsec = (long)(deadline_ns % 1000000000ULL);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {} // Any other error just ends the sleep early
+#else
+    struct timespec ts;
+    ts.tv_sec  = (time_t)((deadline_ns - now) / 1000000000ULL);
+    ts.tv_nsec = (long)((deadline_ns - now) % 1000000000ULL);
+    nanosleep(&ts, NULL);
+#endif
+}
+
+PidiClock pidi_clock_monotonic(void)
+{
+    PidiClock clock;
+    clock.data          = NULL;
+    clock.now_ns        = &pidi_clock_monotonic_now;
+    clock.wait_until_ns = &pidi_clock_monotonic_wait;
+    return clock;
+}
+
+PidiScheduler pidi_scheduler_new(PidiClock clock)
+{
+    PidiScheduler s = {0};
+    s.clock     = clock;
+    s.speed     = 1.0f;
+    s.spin_ns   = PIDI_SCHEDULER_SPIN_NS;
+    s.anchor_ns = clock.now_ns(clock.data);
+    pidi_scheduler_reset_stats(&s);
+    return s;
+}
+
+void pidi_scheduler_set_speed(PidiScheduler *s, f32 speed)
+{
+    AIL_ASSERT(speed > 0);
+    // Re-anchor at the current time, so that the song continues from where it is now
+    u64 now = s->clock.now_ns(s->clock.data);
+    if (now > s->anchor_ns) {
+        s->anchor_position_ns += (u64)((f64)(now - s->anchor_ns)*s->speed + 0.5);
+        s->anchor_ns = now;
+    }
+    s->speed = speed;
+}
+
+u64 pidi_scheduler_deadline(const PidiScheduler *s, u64 position_ms)
+{
+    u64 position_ns = position_ms*1000000ULL;
+    if (position_ns <= s->anchor_position_ns) return s->anchor_ns;
+    return s->anchor_ns + (u64)((f64)(position_ns - s->anchor_position_ns)/s->speed + 0.5);
+}
+
+i64 pidi_scheduler_wait_ms(PidiScheduler *s, u32 dt_ms)
+{
+    s->position_ms += dt_ms;
+    u64 deadline = pidi_scheduler_deadline(s, s->position_ms);
+    u64 now      = s->clock.now_ns(s->clock.data);
+    if (now + s->spin_ns < deadline) {
+        s->clock.wait_until_ns(s->clock.data, deadline - s->spin_ns, false);
+        now = s->clock.now_ns(s->clock.data);
+    }
+    if (now < deadline) {
+        s->clock.wait_until_ns(s->clock.data, deadline, true);
+        now = s->clock.now_ns(s->clock.data);
+    }
+
+    i64 lateness = (i64)(now - deadline);
+    PidiSchedulerStats *st = &s->stats;
+    st->waits++;
+    if (lateness > (i64)s->spin_ns)   st->late++;
+    if (lateness < st->min_lateness_ns) st->min_lateness_ns = lateness;
+    if (lateness > st->max_lateness_ns) st->max_lateness_ns = lateness;
+    st->sum_lateness_ns    += (f64)lateness;
+    st->sum_sq_lateness_ns += (f64)lateness*(f64)lateness;
+    return lateness;
+}
+
+i64 pidi_scheduler_wait(PidiScheduler *s, PidiCmd cmd)
+{
+    return pidi_scheduler_wait_ms(s, pidi_dt(cmd));
+}
+
+f64 pidi_scheduler_mean_lateness_ns(const PidiSchedulerStats *stats)
+{
+    return stats->waits ? stats->sum_lateness_ns/(f64)stats->waits : 0;
+}
+
+f64 pidi_scheduler_jitter_ns(const PidiSchedulerStats *stats)
+{
+    if (!stats->waits) return 0;
+    f64 mean = pidi_scheduler_mean_lateness_ns(stats);
+    f64 var  = stats->sum_sq_lateness_ns/(f64)stats->waits - mean*mean;
+    return var > 0 ? sqrt(var) : 0;
+}
+
+void pidi_scheduler_reset_stats(PidiScheduler *s)
+{
+    PidiSchedulerStats stats = {0};
+    stats.min_lateness_ns = INT64_MAX;
+    stats.max_lateness_ns = INT64_MIN;
+    s->stats = stats;
+}
+
+#endif // _PIDI_SCHEDULER_IMPL_GUARD_
+#endif // PIDI_SCHEDULER_IMPL
@@ -0,0 +1,493 @@
+// Host-side simulator for streaming and playing a song over SPPP
+//
+// Define PIDI_SIM_IMPL in some file, to include the function bodies
+//
+// The simulator plays both nodes of the Self-Playing-Piano Protocol (see Protocols.md) in simulated time, so that the
+// MC's timing can be measured without any hardware:
+// The UI streams a song just like the protocol prescribes (Ping, New-Music and one Music or Music-Delta message per Request) and the
+// emulated MC parses the resulting byte stream through a ring buffer, one byte at a time, as it trickles in over a serial
+// line with the configured baud rate (see SPPP_BITS_PER_BYTE).
+// The MC keeps up to `buffer_cap` received commands in a queue and sends a Request, whenever there is room for another
+// message with the amount of commands that it advertised in its Pong. Each command fires `dt` after the previous one,
+// unless it has not arrived yet. Such an underrun delays the command and with it all following commands.
+// Every command's firing time is compared with the ideal timeline, i.e. with the sum of all dts since the song started.
+//
+// Pausing, volume changes and baud rate changes are parsed and acknowledged by the MC, but do not have any effect on the simulation.
+
+#ifndef PIDI_SIM_H_
+#define PIDI_SIM_H_
+
+#include "common.h"
+
+#ifndef PIDI_SIM_DEF
+#ifdef  AIL_DEF
+#define PIDI_SIM_DEF AIL_DEF
+#else
+#define PIDI_SIM_DEF
+#endif // AIL_DEF
+#endif // PIDI_SIM_DEF
+
+typedef struct PidiSimConfig {
+    u32 baud_rate;
+    u16 buffer_cap;    // Amount of commands that the MC can buffer
+    u16 max_cmds;      // Maximum amount of commands per message, as advertised in the Pong (0 means `buffer_cap/2`)
+    u16 chunk_cmds;    // Amount of commands that the UI sends per message (0 means `max_cmds`), unless `adaptive` is set
+    bool adaptive;     // Whether the UI sizes its chunks with a SpppChunker
+    bool delta;        // Whether the MC supports Music-Delta messages, which the UI then sends whenever they are smaller
+    u32 ui_latency_us; // Time between the UI receiving a message and it starting to send its response (e.g. USB and scheduling latency)
+    u32 mc_latency_us; // Time between the MC receiving a message and it starting to send its response
+    f32 speed;         // Factor by which the MC's timer is multiplied (see CMSG_SPEED)
+} PidiSimConfig;
+
+typedef struct PidiSimReport {
+    u32 fired;          // Amount of commands that were fired, which is less than the amount of commands only if the stream got stuck
+    u32 underruns;      // Amount of commands that had not arrived yet, when they were supposed to fire
+    u64 stall_ns;       // Total time by which underruns delayed the playback
+    i64 max_error_ns;   // Largest difference between a command's firing time and its time on the ideal timeline
+    f64 mean_error_ns;
+    u64 start_ns;       // Time from sending the Ping until the song started
+    u64 duration_ns;    // Time from the start of the song until the last command fired
+    u16 min_buffered;   // Lowest amount of commands left in the MC's buffer after firing a command, until the end of the song was streamed
+    u32 overflows;      // Amount of commands that the MC dropped, because its buffer was full
+    u32 requests;       // Amount of Request messages sent by the MC
+    u32 ui_msgs;        // Amount of messages sent by the UI
+    u64 ui_bytes;       // Amount of bytes sent from the UI to the MC
+    u64 mc_bytes;       // Amount of bytes sent from the MC to the UI
+} PidiSimReport;
+
+// Default configuration, using BAUD_RATE and no latencies
+PIDI_SIM_DEF PidiSimConfig pidi_sim_default_config(void);
+// Streams and plays `cmds` in simulated time
+// If `fire_ns` is not NULL, the firing time of the i-th command (relative to the start of the song) is written into `fire_ns[i]`
+PIDI_SIM_DEF PidiSimReport pidi_sim_run(const PidiCmd *cmds, u32 count, PidiSimConfig cfg, u64 *fire_ns);
+PIDI_SIM_DEF void          pidi_sim_print_report(const PidiSimReport *r);
+
+#endif // PIDI_SIM_H_
+
+
+#ifdef PIDI_SIM_IMPL
+#ifndef _PIDI_SIM_IMPL_GUARD_
+#define _PIDI_SIM_IMPL_GUARD_
+
+#include <stdio.h> // For printf
+
+#define PIDI_SIM_NEVER UINT64_MAX
+#define PIDI_SIM_MAX_MC_MSGS 8 // Maximum amount of messages from the MC, that can be in transit at the same time
+
+typedef enum PidiSimRxState {
+    PIDI_SIM_RX_HEADER,
+    PIDI_SIM_RX_PING,
+    PIDI_SIM_RX_BYTE,       // Continue
+    PIDI_SIM_RX_4BYTES,     // Speed, Volume or Baud
+    PIDI_SIM_RX_PKS_COUNT,
+    PIDI_SIM_RX_PKS,
+    PIDI_SIM_RX_CMDS_COUNT,
+    PIDI_SIM_RX_CMDS,
+    PIDI_SIM_RX_DELTA_COUNTS,
+    PIDI_SIM_RX_DELTA,
+} PidiSimRxState;
+
+typedef struct PidiSimQueuedCmd {
+    PidiCmd cmd;
+    u64 arrival;
+} PidiSimQueuedCmd;
+
+typedef struct PidiSimMcMsg {
+    u64 end;     // Index in `mc_tx` after the message's last byte
+    u64 arrival; // Time at which the message was completely received by the UI
+} PidiSimMcMsg;
+
+typedef struct PidiSim {
+    PidiSimConfig cfg;
+    u64 byte_ns;
+    u64 now;
+    const PidiCmd *cmds;
+    u32 count;
+
+    // UI
+    u32 sent;          // Amount of commands that were sent to the MC already
+    bool awaiting;     // Whether the UI waits for a response to its last message
+    bool requested;    // Whether a Request arrived while waiting for a Success message
+    bool song_sent;    // Whether the end of the song was sent already
+    AIL_Buffer ui_tx;  // The message that is currently being sent to the MC
+    u64 ui_tx_start;   // Time at which the first byte of `ui_tx` started being sent
+    bool ui_tx_new_music;
+    SpppChunker chunker;
+    u8  encodings;     // Encodings that the MC supports according to its Pong
+    u64 ui_rx_idx;     // Index in `mc_tx` of the next message that the UI reads
+
+    // MC
+    AIL_RingBuffer rx;
+    PidiSimRxState rx_state;
+    ClientMsgType  rx_type;
+    u16 rx_left;       // Amount of played keys or commands left in the current message
+    SpppDeltaDecoder delta;
+    u16 max_cmds;
+    f32 speed;
+    bool playing;
+    bool song_received;
+    bool request_open; // Whether a Request was sent and not answered yet
+    PidiSimQueuedCmd *queue;
+    u16 queue_start;
+    u16 queue_len;
+    u64 anchor_ns;     // Time of the last underrun or of the start of the song
+    u64 anchor_ms;     // Position in the song at `anchor_ns`
+    u64 pos_ms;        // Position in the song of the last fired command
+    AIL_Buffer mc_tx;
+    u64 mc_tx_queued;  // Index in `mc_tx` after the last message that was queued for sending
+    u64 mc_tx_free;    // Time at which the MC's serial line is free to send another message
+    PidiSimMcMsg mc_msgs[PIDI_SIM_MAX_MC_MSGS];
+    u8 mc_msgs_start;
+    u8 mc_msgs_len;
+
+    // Measurements
+    u64 song_start;
+    u64 *fire_ns;
+    f64 sum_error_ns;
+    PidiSimReport report;
+} PidiSim;
+
+PidiSimConfig pidi_sim_default_config(void)
+{
+    PidiSimConfig cfg = {0};
+    cfg.baud_rate  = BAUD_RATE;
+    cfg.buffer_cap = 256;
+    cfg.speed      = 1.0f;
+    return cfg;
+}
+
+static void pidi_sim_mc_send(PidiSim *sim, u64 ready)
+{
+    AIL_ASSERT(sim->mc_msgs_len < PIDI_SIM_MAX_MC_MSGS);
+    u64 start = ready > sim->mc_tx_free ? ready : sim->mc_tx_free;
+    u64 len   = sim->mc_tx.len - sim->mc_tx_queued;
+    sim->mc_tx_queued = sim->mc_tx.len;
+    sim->mc_tx_free   = start + len*sim->byte_ns;
+    PidiSimMcMsg msg = { sim->mc_tx.len, sim->mc_tx_free };
+    sim->mc_msgs[(sim->mc_msgs_start + sim->mc_msgs_len++) % PIDI_SIM_MAX_MC_MSGS] = msg;
+    sim->report.mc_bytes += len;
+}
+
+static void pidi_sim_mc_maybe_request(PidiSim *sim)
+{
+    if (!sim->playing || sim->song_received || sim->request_open || sim->rx_state != PIDI_SIM_RX_HEADER) return;
+    if (sim->cfg.buffer_cap - sim->queue_len < sim->max_cmds) return;
+    sim->request_open = true;
+    sim->report.requests++;
+    sppp_write_header(&sim->mc_tx, SMSG_REQUEST);
+    pidi_sim_mc_send(sim, sim->now);
+}
+
+static void pidi_sim_mc_msg_done(PidiSim *sim, bool new_music)
+{
+    if (new_music) {
+        sim->playing    = true;
+        sim->song_start = sim->now;
+        sim->anchor_ns  = sim->now;
+        sim->report.start_ns = sim->now;
+    }
+    sim->rx_state = PIDI_SIM_RX_HEADER;
+    sppp_write_header(&sim->mc_tx, SMSG_SUCCESS);
+    pidi_sim_mc_send(sim, sim->now + (u64)sim->cfg.mc_latency_us*1000);
+    pidi_sim_mc_maybe_request(sim);
+}
+
+static void pidi_sim_mc_push_cmd(PidiSim *sim, PidiCmd cmd)
+{
+    if (sim->queue_len == sim->cfg.buffer_cap) {
+        sim->report.overflows++;
+        return;
+    }
+    PidiSimQueuedCmd qc = { cmd, sim->now };
+    sim->queue[(sim->queue_start + sim->queue_len++) % sim->cfg.buffer_cap] = qc;
+}
+
+// Parses as much of the received bytes as possible
+static void pidi_sim_mc_parse(PidiSim *sim)
+{
+    AIL_RingBuffer *rx = &sim->rx;
+    for (;;) {
+        u8 len = ail_ring_len(*rx);
+        switch (sim->rx_state) {
+            case PIDI_SIM_RX_HEADER: {
+                if (len < SPPP_HEADER_SIZE) return;
+                u32 header = ail_ring_peek4msb(*rx);
+                if ((header & 0xffffff00) != SPPP_MAGIC) {
+                    ail_ring_pop(rx); // Skip bytes until the magic bytes are found again
+                    break;
+                }
+                ail_ring_popn(rx, SPPP_HEADER_SIZE);
+                sim->rx_type = (ClientMsgType)(header & 0xff);
+                switch (sim->rx_type) {
+                    case CMSG_PING:      sim->rx_state = PIDI_SIM_RX_PING;       break;
+                    case CMSG_CONTINUE:  sim->rx_state = PIDI_SIM_RX_BYTE;       break;
+                    case CMSG_SPEED:
+                    case CMSG_VOLUME:
+                    case CMSG_BAUD:      sim->rx_state = PIDI_SIM_RX_4BYTES;     break;
+                    case CMSG_NEW_MUSIC: sim->rx_state = PIDI_SIM_RX_PKS_COUNT;  break;
+                    case CMSG_MUSIC:     sim->rx_state = PIDI_SIM_RX_CMDS_COUNT; break;
+                    case CMSG_MUSIC_DELTA:
+                        if (sim->cfg.delta) sim->rx_state = PIDI_SIM_RX_DELTA_COUNTS;
+                        break;
+                    default: break;
+                }
+            } break;
+            case PIDI_SIM_RX_PING: {
+                if (len < 1) return;
+                ail_ring_pop(rx); // No checksums are simulated
+                sim->rx_state = PIDI_SIM_RX_HEADER;
+                sppp_write_pong(&sim->mc_tx, sim->max_cmds, sppp_baud_bit(sim->cfg.baud_rate), SPPP_CHECKSUM_NONE, sim->cfg.delta ? SPPP_ENCODING_DELTA : 0);
+                pidi_sim_mc_send(sim, sim->now + (u64)sim->cfg.mc_latency_us*1000);
+            } break;
+            case PIDI_SIM_RX_BYTE: {
+                if (len < 1) return;
+                ail_ring_pop(rx);
+                pidi_sim_mc_msg_done(sim, false);
+            } break;
+            case PIDI_SIM_RX_4BYTES: {
+                if (len < 4) return;
+                u32 x = ail_ring_read4lsb(rx);
+                f32 f;
+                memcpy(&f, &x, sizeof(f));
+                if (sim->rx_type == CMSG_SPEED && f > 0) {
+                    // Continue from the current position in the song with the new speed
+                    sim->anchor_ns = sim->now;
+                    sim->anchor_ms = sim->pos_ms;
+                    sim->speed     = f;
+                }
+                pidi_sim_mc_msg_done(sim, false);
+            } break;
+            case PIDI_SIM_RX_PKS_COUNT: {
+                if (len < 1) return;
+                sim->rx_left  = ail_ring_read(rx);
+                sim->rx_state = sim->rx_left ? PIDI_SIM_RX_PKS : PIDI_SIM_RX_CMDS_COUNT;
+                // A new song replaces everything that was still buffered
+                sim->playing       = false;
+                sim->song_received = false;
+                sim->request_open  = false;
+                sim->queue_len     = 0;
+                sim->anchor_ms     = 0;
+                sim->pos_ms        = 0;
+            } break;
+            case PIDI_SIM_RX_PKS: {
+                if (len < SPPP_PK_ENCODED_SIZE) return;
+                decode_played_key(rx);
+                if (!--sim->rx_left) sim->rx_state = PIDI_SIM_RX_CMDS_COUNT;
+            } break;
+            case PIDI_SIM_RX_CMDS_COUNT: {
+                if (len < 2) return;
+                sim->rx_left = ail_ring_read2lsb(rx);
+                if (sim->rx_type == CMSG_MUSIC) {
+                    sim->request_open = false;
+                    if (!sim->rx_left) sim->song_received = true;
+                }
+                if (sim->rx_left) sim->rx_state = PIDI_SIM_RX_CMDS;
+                else pidi_sim_mc_msg_done(sim, sim->rx_type == CMSG_NEW_MUSIC);
+            } break;
+            case PIDI_SIM_RX_CMDS: {
+                if (len < ENCODED_CMD_LEN) return;
+                pidi_sim_mc_push_cmd(sim, pidi_unpack(ail_ring_read4lsb(rx)));
+                if (!--sim->rx_left) pidi_sim_mc_msg_done(sim, sim->rx_type == CMSG_NEW_MUSIC);
+            } break;
+            case PIDI_SIM_RX_DELTA_COUNTS: {
+                if (len < 4) return;
+                u16 cmds_count  = ail_ring_read2lsb(rx);
+                u16 bytes_count = ail_ring_read2lsb(rx);
+                sim->request_open = false;
+                if (!cmds_count) sim->song_received = true;
+                sim->delta    = sppp_delta_decoder_new(cmds_count, bytes_count);
+                sim->rx_state = PIDI_SIM_RX_DELTA;
+            } break;
+            case PIDI_SIM_RX_DELTA: {
+                // Commands are decoded as soon as their bytes arrived
+                bool progress = false;
+                while (ail_ring_len(*rx) && sppp_delta_decoder_wants(&sim->delta)) {
+                    sppp_delta_decoder_push(&sim->delta, ail_ring_read(rx));
+                    progress = true;
+                }
+                PidiCmd cmd;
+                while (sppp_delta_decoder_next(&sim->delta, &cmd)) {
+                    pidi_sim_mc_push_cmd(sim, cmd);
+                    progress = true;
+                }
+                if (sppp_delta_decoder_done(&sim->delta)) pidi_sim_mc_msg_done(sim, false);
+                else if (sim->delta.failed) sim->rx_state = PIDI_SIM_RX_HEADER; // Malformed messages are dropped
+                else if (!progress) return;
+            } break;
+        }
+    }
+}
+
+// Time at which the MC fires the next buffered command
+static u64 pidi_sim_mc_next_fire(const PidiSim *sim)
+{
+    if (!sim->playing || !sim->queue_len) return PIDI_SIM_NEVER;
+    const PidiSimQueuedCmd *qc = &sim->queue[sim->queue_start];
+    u64 due = sim->anchor_ns + (u64)((f64)(sim->pos_ms + pidi_dt(qc->cmd) - sim->anchor_ms)*1000000.0/sim->speed + 0.5);
+    return qc->arrival > due ? qc->arrival : due;
+}
+
+static void pidi_sim_mc_fire(PidiSim *sim)
+{
+    PidiSimQueuedCmd qc = sim->queue[sim->queue_start];
+    sim->queue_start = (sim->queue_start + 1) % sim->cfg.buffer_cap;
+    sim->queue_len--;
+
+    u64 due = sim->anchor_ns + (u64)((f64)(sim->pos_ms + pidi_dt(qc.cmd) - sim->anchor_ms)*1000000.0/sim->speed + 0.5);
+    sim->pos_ms += pidi_dt(qc.cmd);
+    if (sim->now > due) {
+        // The MC only continues once the command arrived, so all following commands are delayed as well
+        sim->report.underruns++;
+        sim->report.stall_ns += sim->now - due;
+        sim->anchor_ns = sim->now;
+        sim->anchor_ms = sim->pos_ms;
+    }
+
+    u64 ideal = sim->song_start + (u64)((f64)sim->pos_ms*1000000.0/sim->cfg.speed + 0.5);
+    i64 error = (i64)(sim->now - ideal);
+    if (error > sim->report.max_error_ns) sim->report.max_error_ns = error;
+    sim->sum_error_ns += (f64)error;
+    if (sim->fire_ns) sim->fire_ns[sim->report.fired] = sim->now - sim->song_start;
+    sim->report.fired++;
+    sim->report.duration_ns = sim->now - sim->song_start;
+    if (!sim->song_received && sim->queue_len < sim->report.min_buffered) sim->report.min_buffered = sim->queue_len;
+
+    pidi_sim_mc_maybe_request(sim);
+}
+
+static void pidi_sim_ui_send_chunk(PidiSim *sim, bool new_music)
+{
+    u32 n = sim->count - sim->sent;
+    if (sim->cfg.adaptive) {
+        n = sppp_chunker_next(&sim->chunker, sim->now/1000, &sim->cmds[sim->sent], n);
+    } else {
+        if (n > sim->cfg.chunk_cmds) n = sim->cfg.chunk_cmds;
+        if (n > sim->max_cmds)       n = sim->max_cmds;
+    }
+    sim->ui_tx_new_music = new_music;
+    sim->ui_tx.idx = sim->ui_tx.len = 0;
+    if (new_music) sppp_write_new_music(&sim->ui_tx, NULL, 0, &sim->cmds[sim->sent], (u16)n);
+    else           sppp_write_music_smallest(&sim->ui_tx, &sim->cmds[sim->sent], (u16)n, sim->encodings);
+    if (!n) sim->song_sent = true;
+    sim->sent += n;
+}
+
+static void pidi_sim_ui_send(PidiSim *sim)
+{
+    sim->ui_tx.idx   = 0;
+    sim->ui_tx_start = sim->now;
+    sim->awaiting    = true;
+    sim->report.ui_msgs++;
+    sim->report.ui_bytes += sim->ui_tx.len;
+}
+
+static void pidi_sim_ui_receive(PidiSim *sim)
+{
+    PidiSimMcMsg msg = sim->mc_msgs[sim->mc_msgs_start];
+    sim->mc_msgs_start = (sim->mc_msgs_start + 1) % PIDI_SIM_MAX_MC_MSGS;
+    sim->mc_msgs_len--;
+
+    u64 ui_tx_end   = sim->ui_tx_start + sim->ui_tx.len*sim->byte_ns; // Time at which the UI's last message was sent completely
+    AIL_Buffer *buf = &sim->mc_tx;
+    buf->idx = sim->ui_rx_idx;
+    u32 header = ail_buf_read4msb(buf);
+    AIL_ASSERT((header & 0xffffff00) == SPPP_MAGIC);
+    switch ((ServerMsgType)(header & 0xff)) {
+        case SMSG_PONG:
+            sim->max_cmds = ail_buf_read2lsb(buf);
+            ail_buf_read2lsb(buf); // The baud rate is fixed by the configuration
+            ail_buf_read1(buf);    // No checksums are simulated
+            sim->encodings = ail_buf_read1(buf);
+            sim->chunker  = sppp_chunker_new(sim->cfg.baud_rate, sim->max_cmds);
+            sppp_chunker_set_speed(&sim->chunker, sim->now/1000, sim->cfg.speed);
+            sppp_chunker_observe_rtt(&sim->chunker, (u32)((sim->now - ui_tx_end)/1000));
+            pidi_sim_ui_send_chunk(sim, true);
+            pidi_sim_ui_send(sim);
+            break;
+        case SMSG_SUCCESS:
+            sim->awaiting = false;
+            sppp_chunker_observe_rtt(&sim->chunker, (u32)((sim->now - ui_tx_end)/1000));
+            if (sim->ui_tx_new_music) sppp_chunker_start(&sim->chunker, ui_tx_end/1000);
+            if (sim->requested) {
+                sim->requested = false;
+                pidi_sim_ui_send_chunk(sim, false);
+                pidi_sim_ui_send(sim);
+            }
+            break;
+        case SMSG_REQUEST:
+            if (sim->song_sent) break;
+            if (sim->awaiting) {
+                sim->requested = true;
+            } else {
+                pidi_sim_ui_send_chunk(sim, false);
+                pidi_sim_ui_send(sim);
+            }
+            break;
+        default: AIL_UNREACHABLE();
+    }
+    AIL_ASSERT(buf->idx == msg.end);
+    sim->ui_rx_idx = msg.end;
+    buf->idx = buf->len; // The MC keeps appending to the buffer
+}
+
+PidiSimReport pidi_sim_run(const PidiCmd *cmds, u32 count, PidiSimConfig cfg, u64 *fire_ns)
+{
+    AIL_ASSERT(cfg.baud_rate > 0 && cfg.buffer_cap > 0 && cfg.speed > 0);
+    if (!cfg.max_cmds)   cfg.max_cmds   = cfg.buffer_cap/2 ? cfg.buffer_cap/2 : 1;
+    if (!cfg.chunk_cmds) cfg.chunk_cmds = cfg.max_cmds;
+    AIL_ASSERT(cfg.max_cmds <= cfg.buffer_cap);
+
+    PidiSim sim = {0};
+    sim.cfg      = cfg;
+    sim.byte_ns  = (SPPP_BITS_PER_BYTE*1000000000ULL + cfg.baud_rate/2)/cfg.baud_rate;
+    sim.cmds     = cmds;
+    sim.count    = count;
+    sim.max_cmds = cfg.max_cmds;
+    sim.speed    = cfg.speed;
+    sim.queue    = AIL_MALLOC(sizeof(PidiSimQueuedCmd)*cfg.buffer_cap);
+    sim.ui_tx    = ail_buf_new(SPPP_MUSIC_MSG_SIZE(cfg.max_cmds) + 1 + 2);
+    sim.mc_tx    = ail_buf_new(1024);
+    sim.fire_ns  = fire_ns;
+    sim.report.min_buffered = cfg.buffer_cap;
+
+    sppp_write_ping(&sim.ui_tx, SPPP_CHECKSUM_NONE);
+    pidi_sim_ui_send(&sim);
+
+    while (sim.report.fired < count) {
+        // Find the next event
+        u64 t_byte = sim.ui_tx.idx < sim.ui_tx.len ? sim.ui_tx_start + (sim.ui_tx.idx + 1)*sim.byte_ns : PIDI_SIM_NEVER;
+        u64 t_ui   = sim.mc_msgs_len ? sim.mc_msgs[sim.mc_msgs_start].arrival + (u64)cfg.ui_latency_us*1000 : PIDI_SIM_NEVER;
+        u64 t_fire = pidi_sim_mc_next_fire(&sim);
+        if (t_byte == PIDI_SIM_NEVER && t_ui == PIDI_SIM_NEVER && t_fire == PIDI_SIM_NEVER) break; // The stream got stuck
+
+        if (t_byte <= t_ui && t_byte <= t_fire) {
+            sim.now = t_byte;
+            ail_ring_write1(&sim.rx, sim.ui_tx.data[sim.ui_tx.idx++]);
+            pidi_sim_mc_parse(&sim);
+        } else if (t_ui <= t_fire) {
+            sim.now = t_ui;
+            pidi_sim_ui_receive(&sim);
+        } else {
+            sim.now = t_fire;
+            pidi_sim_mc_fire(&sim);
+        }
+    }
+
+    sim.report.mean_error_ns = sim.report.fired ? sim.sum_error_ns/(f64)sim.report.fired : 0;
+    AIL_FREE(sim.queue);
+    ail_buf_free(sim.ui_tx);
+    ail_buf_free(sim.mc_tx);
+    return sim.report;
+}
+
+void pidi_sim_print_report(const PidiSimReport *r)
+{
+    printf("  fired: %u, underruns: %u, stalled: %.3fms, max error: %.3fms, mean error: %.3fms\n",
+           r->fired, r->underruns, (f64)r->stall_ns/1e6, (f64)r->max_error_ns/1e6, r->mean_error_ns/1e6);
+    printf("  start: %.3fms, duration: %.3fms, min buffered: %u, requests: %u, UI messages: %u, bytes (UI/MC): %llu/%llu\n",
+           (f64)r->start_ns/1e6, (f64)r->duration_ns/1e6, r->min_buffered, r->requests, r->ui_msgs,
+           (unsigned long long)r->ui_bytes, (unsigned long long)r->mc_bytes);
+}
+
+#endif // _PIDI_SIM_IMPL_GUARD_
+#endif // PIDI_SIM_IMPL
@@ -0,0 +1,337 @@
+// Serial port for the UI's side of SPPP
+//
+// Define SPPP_PORT_IMPL in some file, to include the function bodies
+// Timing uses ail_time.h, so AIL_TIME_IMPL has to be defined in some file as well
+// So far, only POSIX systems are supported (via termios)
+//
+// Besides reading and writing bytes, the port implements the UI's side of negotiating the baud rate (see Protocols.md):
+// After pinging the MC at the current rate, the highest rate that both nodes support is requested with a Baud message.
+// Once the MC acknowledged it, both nodes switch and the UI pings the MC at the new rate. If that Ping is not answered,
+// the UI falls back to BAUD_RATE (just like the MC does after SPPP_BAUD_CONFIRM_TIMEOUT) and tries the next lower rate.
+//
+// Every Ping offers the checksums in `checksums` to the MC, which chooses one of them in its Pong. Afterwards, all frames in
+// both directions (except Pings and Pongs) end with that checksum. Messages are then best sent with sppp_port_send, which
+// immediately retransmits a message when the MC answers with a NAK, because the message arrived corrupted or incomplete.
+//
+// When `pace` is set, every write is delayed until it would have been transmitted completely at the port's baud rate.
+// Pseudo terminals transfer data instantly, regardless of their configured rate, so this allows emulating a real serial line on them.
+
+#ifndef SPPP_PORT_H_
+#define SPPP_PORT_H_
+
+#include "common.h"
+#include "ail/ail_time.h"
+
+#ifndef SPPP_PORT_DEF
+#ifdef  AIL_DEF
+#define SPPP_PORT_DEF AIL_DEF
+#else
+#define SPPP_PORT_DEF
+#endif // AIL_DEF
+#endif // SPPP_PORT_DEF
+
+// Time in ms that the UI waits for the baud rates in a Pong, since MCs that don't support negotiation only send the maximum amount of commands
+#ifndef SPPP_PORT_PONG_CAPS_TIMEOUT
+#define SPPP_PORT_PONG_CAPS_TIMEOUT 100
+#endif // SPPP_PORT_PONG_CAPS_TIMEOUT
+
+// Amount of times that sppp_port_send retransmits a message, before giving up
+#ifndef SPPP_PORT_RETRIES
+#define SPPP_PORT_RETRIES 3
+#endif // SPPP_PORT_RETRIES
+
+typedef struct SpppPort {
+    int  fd;
+    u32  baud;
+    bool pace;
+    u64  free_at;          // Time in ns at which the previous write would have been transmitted completely (only used when pacing)
+    u8   checksums;        // Bitmask of the checksums that are offered in Pings (SPPP_CHECKSUMS_ALL by default)
+    SpppChecksum checksum; // Checksum that the MC chose in its last Pong
+    u8   encodings;        // Encodings that the MC supports according to its last Pong (see SPPP_ENCODING_DELTA)
+    u32  naks;             // Amount of NAKs that were received so far
+} SpppPort;
+
+// Opens the serial port at `path` with BAUD_RATE
+SPPP_PORT_DEF bool sppp_port_open(SpppPort *p, const char *path);
+// Configures an already opened file descriptor (e.g. of a pseudo terminal) as a raw port with BAUD_RATE
+SPPP_PORT_DEF bool sppp_port_from_fd(SpppPort *p, int fd);
+SPPP_PORT_DEF void sppp_port_close(SpppPort *p);
+// Bitmask of the negotiable baud rates (see sppp_baud_rate) that this platform supports
+SPPP_PORT_DEF u16  sppp_port_baud_mask(void);
+// Waits until all written bytes were transmitted and then switches to `baud`
+SPPP_PORT_DEF bool sppp_port_set_baud(SpppPort *p, u32 baud);
+SPPP_PORT_DEF bool sppp_port_write(SpppPort *p, const u8 *data, u64 len);
+// Reads up to `len` bytes and returns how many were read before `timeout_ms` passed
+SPPP_PORT_DEF u64  sppp_port_read(SpppPort *p, u8 *data, u64 len, u32 timeout_ms);
+// Skips bytes until the header of a message was read and returns its type (or 0 if no header was found before `timeout_ms` passed)
+SPPP_PORT_DEF u8   sppp_port_read_header(SpppPort *p, u32 timeout_ms);
+// Writes the frame `frame` and appends the negotiated checksum to it
+SPPP_PORT_DEF bool sppp_port_write_frame(SpppPort *p, const u8 *frame, u64 len);
+// Reads frames until one without payload arrived intact and returns its type (or 0 if none arrived before `timeout_ms` passed)
+SPPP_PORT_DEF u8   sppp_port_read_reply(SpppPort *p, u32 timeout_ms);
+// Sends the frame `frame` and returns the type of the MC's reply (or 0 if the MC did not reply)
+// The frame is retransmitted up to SPPP_PORT_RETRIES times, immediately after a NAK or after `timeout_ms` without reply
+SPPP_PORT_DEF u8   sppp_port_send(SpppPort *p, const u8 *frame, u64 len, u32 timeout_ms);
+// Discards all bytes that were received but not read yet
+SPPP_PORT_DEF void sppp_port_discard(SpppPort *p);
+// Pings the MC and returns whether it answered
+// The Pong's payload is written into `max_cmds`, `baud_mask`, `p->checksum` and `p->encodings`
+SPPP_PORT_DEF bool sppp_port_ping(SpppPort *p, u16 *max_cmds, u16 *baud_mask, u32 timeout_ms);
+// Negotiates the highest baud rate in `local_mask` that the MC supports as well and returns the rate that both nodes use afterwards
+// Returns 0, if the MC did not answer at all
+SPPP_PORT_DEF u32  sppp_port_negotiate(SpppPort *p, u16 local_mask, u16 *max_cmds);
+
+#endif // SPPP_PORT_H_
+
+
+#ifdef SPPP_PORT_IMPL
+#ifndef _SPPP_PORT_IMPL_GUARD_
+#define _SPPP_PORT_IMPL_GUARD_
+
+#include <fcntl.h>   // For open
+#include <poll.h>    // For poll
+#include <termios.h> // For tcgetattr, tcsetattr, cfsetispeed, cfsetospeed, tcdrain, tcflush
+#include <unistd.h>  // For read, write, close
+
+// Sleeps until shortly before `end_ns` and spins for the rest of the time
+static void sppp_port_wait_until(u64 end_ns)
+{
+    while (ail_time_now_ns() + 1000000 < end_ns) ail_time_sleep(1);
+    while (ail_time_now_ns() < end_ns) AIL_CPU_RELAX();
+}
+
+static bool sppp_port_speed(u32 baud, speed_t *speed)
+{
+    switch (baud) {
+        case 9600:   *speed = B9600;   return true;
+        case 19200:  *speed = B19200;  return true;
+        case 38400:  *speed = B38400;  return true;
+#ifdef B57600
+        case 57600:  *speed = B57600;  return true;
+#endif
+#ifdef B115200
+        case 115200: *speed = B115200; return true;
+#endif
+#ifdef B230400
+        case 230400: *speed = B230400; return true;
+#endif
+#ifdef B460800
+        case 460800: *speed = B460800; return true;
+#endif
+#ifdef B921600
+        case 921600: *speed = B921600; return true;
+#endif
+        default: return false;
+    }
+}
+
+u16 sppp_port_baud_mask(void)
+{
+    u16 mask = 0;
+    speed_t speed;
+    for (u8 i = 0; i < SPPP_BAUD_RATES_COUNT; i++) {
+        if (sppp_port_speed(sppp_baud_rate(i), &speed)) mask |= (u16)(1u << i);
+    }
+    return mask;
+}
+
+bool sppp_port_set_baud(SpppPort *p, u32 baud)
+{
+    speed_t speed;
+    struct termios tty;
+    if (!sppp_port_speed(baud, &speed) || tcgetattr(p->fd, &tty)) return false;
+    if (p->pace) sppp_port_wait_until(p->free_at);
+    tcdrain(p->fd);
+    cfsetispeed(&tty, speed);
+    cfsetospeed(&tty, speed);
+    if (tcsetattr(p->fd, TCSANOW, &tty)) return false;
+    p->baud = baud;
+    return true;
+}
+
+bool sppp_port_from_fd(SpppPort *p, int fd)
+{
+    struct termios tty;
+    p->fd      = fd;
+    p->baud    = 0;
+    p->pace    = false;
+    p->free_at = 0;
+    p->checksums = SPPP_CHECKSUMS_ALL;
+    p->checksum  = SPPP_CHECKSUM_NONE;
+    p->encodings = 0;
+    p->naks      = 0;
+    if (tcgetattr(fd, &tty)) return false;
+    // Raw mode with 8N1, reads never block (timeouts are handled with poll)
+    tty.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF);
+    tty.c_oflag &= ~OPOST;
+    tty.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    tty.c_cflag &= ~(CSIZE | PARENB | CSTOPB);
+    tty.c_cflag |= CS8 | CLOCAL | CREAD;
+    tty.c_cc[VMIN]  = 0;
+    tty.c_cc[VTIME] = 0;
+    if (tcsetattr(fd, TCSANOW, &tty)) return false;
+    return sppp_port_set_baud(p, BAUD_RATE);
+}
+
+bool sppp_port_open(SpppPort *p, const char *path)
+{
+    int fd = open(path, O_RDWR | O_NOCTTY);
+    if (fd < 0) return false;
+    if (sppp_port_from_fd(p, fd)) return true;
+    close(fd);
+    return false;
+}
+
+void sppp_port_close(SpppPort *p)
+{
+    close(p->fd);
+    p->fd = -1;
+}
+
+bool sppp_port_write(SpppPort *p, const u8 *data, u64 len)
+{
+    if (p->pace) {
+        u64 now = ail_time_now_ns();
+        u64 end = (now > p->free_at ? now : p->free_at) + len*SPPP_BITS_PER_BYTE*1000000000ULL/p->baud;
+        sppp_port_wait_until(end);
+        p->free_at = end;
+    }
+    while (len) {
+        ssize_t n = write(p->fd, data, len);
+        if (n < 0) return false;
+        data += n;
+        len  -= (u64)n;
+    }
+    return true;
+}
+
+u64 sppp_port_read(SpppPort *p, u8 *data, u64 len, u32 timeout_ms)
+{
+    u64 deadline = ail_time_now_ns() + (u64)timeout_ms*1000000;
+    u64 got = 0;
+    while (got < len) {
+        // Bytes that already arrived are read even after the deadline passed
+        u64 now = ail_time_now_ns();
+        struct pollfd pfd = { p->fd, POLLIN, 0 };
+        int res = poll(&pfd, 1, now < deadline ? (int)((deadline - now + 999999)/1000000) : 0);
+        if (res <= 0 || !(pfd.revents & POLLIN)) break;
+        ssize_t n = read(p->fd, data + got, len - got);
+        if (n <= 0) break;
+        got += (u64)n;
+    }
+    return got;
+}
+
+u8 sppp_port_read_header(SpppPort *p, u32 timeout_ms)
+{
+    u64 deadline = ail_time_now_ns() + (u64)timeout_ms*1000000;
+    u32 window = 0;
+    u32 count  = 0;
+    for (;;) {
+        u64 now = ail_time_now_ns();
+        u8 c;
+        if (!sppp_port_read(p, &c, 1, now < deadline ? (u32)((deadline - now + 999999)/1000000) : 0)) return 0;
+        window = (window << 8) | c;
+        if (++count >= SPPP_HEADER_SIZE && (window & 0xffffff00) == SPPP_MAGIC) return (u8)(window & 0xff);
+    }
+}
+
+bool sppp_port_write_frame(SpppPort *p, const u8 *frame, u64 len)
+{
+    u8 trailer[4];
+    u8 size = sppp_encode_checksum(p->checksum, sppp_frame_checksum(p->checksum, frame[SPPP_HEADER_SIZE - 1], frame + SPPP_HEADER_SIZE, len - SPPP_HEADER_SIZE), trailer);
+    return sppp_port_write(p, frame, len) && (!size || sppp_port_write(p, trailer, size));
+}
+
+u8 sppp_port_read_reply(SpppPort *p, u32 timeout_ms)
+{
+    u64 deadline = ail_time_now_ns() + (u64)timeout_ms*1000000;
+    u8  size     = sppp_checksum_size(p->checksum);
+    for (;;) {
+        u64 now  = ail_time_now_ns();
+        u8  type = sppp_port_read_header(p, now < deadline ? (u32)((deadline - now + 999999)/1000000) : 0);
+        if (!type || !size) return type;
+        u8 trailer[4];
+        if (sppp_port_read(p, trailer, size, SPPP_FRAME_GAP) == size &&
+            sppp_decode_checksum(p->checksum, trailer) == sppp_frame_checksum(p->checksum, type, NULL, 0)) return type;
+        // Corrupted replies are skipped
+    }
+}
+
+u8 sppp_port_send(SpppPort *p, const u8 *frame, u64 len, u32 timeout_ms)
+{
+    for (u8 attempt = 0; attempt <= SPPP_PORT_RETRIES; attempt++) {
+        if (!sppp_port_write_frame(p, frame, len)) return 0;
+        u8 reply = sppp_port_read_reply(p, timeout_ms);
+        if (reply == SMSG_NAK) p->naks++;
+        else if (reply) return reply;
+    }
+    return 0;
+}
+
+void sppp_port_discard(SpppPort *p)
+{
+    tcflush(p->fd, TCIFLUSH);
+}
+
+bool sppp_port_ping(SpppPort *p, u16 *max_cmds, u16 *baud_mask, u32 timeout_ms)
+{
+    u8 msg[SPPP_HEADER_SIZE + 1];
+    AIL_Buffer buf = ail_buf_from_data(msg, 0, 0);
+    buf.cap = sizeof(msg);
+    sppp_write_ping(&buf, p->checksums);
+    if (!sppp_port_write(p, msg, sizeof(msg))) return false;
+    if (sppp_port_read_header(p, timeout_ms) != SMSG_PONG) return false;
+    u8 payload[6];
+    if (sppp_port_read(p, payload, 2, timeout_ms) != 2) return false;
+    *max_cmds = (u16)(payload[0] | (payload[1] << 8));
+    // MCs without support for negotiating the baud rate or checksums don't send them
+    if (sppp_port_read(p, &payload[2], 2, SPPP_PORT_PONG_CAPS_TIMEOUT) == 2) *baud_mask = (u16)(payload[2] | (payload[3] << 8));
+    else *baud_mask = sppp_baud_bit(BAUD_RATE);
+    p->checksum  = SPPP_CHECKSUM_NONE;
+    p->encodings = 0;
+    if (sppp_port_read(p, &payload[4], 1, SPPP_PORT_PONG_CAPS_TIMEOUT) == 1) {
+        p->checksum = sppp_checksum_choose(payload[4], p->checksums);
+        if (sppp_port_read(p, &payload[5], 1, SPPP_PORT_PONG_CAPS_TIMEOUT) == 1) p->encodings = payload[5];
+    }
+    return true;
+}
+
+u32 sppp_port_negotiate(SpppPort *p, u16 local_mask, u16 *max_cmds)
+{
+    u16 remote_mask;
+    if (!sppp_port_ping(p, max_cmds, &remote_mask, MSG_TIMEOUT)) return 0;
+    u16 candidates = local_mask & remote_mask;
+    u32 rate;
+    while ((rate = sppp_baud_highest(candidates)) && rate != p->baud) {
+        candidates &= ~sppp_baud_bit(rate);
+
+        u8 msg[SPPP_HEADER_SIZE + 4];
+        AIL_Buffer buf = ail_buf_from_data(msg, 0, 0);
+        buf.cap = sizeof(msg);
+        sppp_write_baud(&buf, rate);
+        if (!sppp_port_write_frame(p, msg, sizeof(msg))) return 0;
+        if (sppp_port_read_reply(p, MSG_TIMEOUT) != SMSG_SUCCESS) continue;
+
+        u32 prev = p->baud;
+        sppp_port_wait_until(ail_time_now_ns() + SPPP_BAUD_SWITCH_DELAY*1000000ULL);
+        if (!sppp_port_set_baud(p, rate)) return 0;
+        u16 mask;
+        if (sppp_port_ping(p, max_cmds, &mask, SPPP_BAUD_CONFIRM_TIMEOUT/2)) return rate;
+
+        // The MC falls back to BAUD_RATE, unless it received our Ping and only its Pong got lost
+        sppp_port_wait_until(ail_time_now_ns() + SPPP_BAUD_CONFIRM_TIMEOUT*1000000ULL);
+        sppp_port_set_baud(p, BAUD_RATE);
+        sppp_port_discard(p);
+        if (sppp_port_ping(p, max_cmds, &mask, MSG_TIMEOUT)) continue;
+        sppp_port_set_baud(p, rate);
+        sppp_port_discard(p);
+        if (sppp_port_ping(p, max_cmds, &mask, MSG_TIMEOUT)) return rate;
+        sppp_port_set_baud(p, prev);
+        return 0;
+    }
+    return p->baud;
+}
+
+#endif // _SPPP_PORT_IMPL_GUARD_
+#endif // SPPP_PORT_IMPL
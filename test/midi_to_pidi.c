@@ -0,0 +1,165 @@
+// Test midi_to_pidi.h
+
+#define AIL_TYPES_IMPL
+#define MIDI_TO_PIDI_IMPL
+#include "../midi_to_pidi.h"
+#include "../ail/test/test_assert.h"
+#include "test_util.h"
+#include <stdio.h>
+
+static u64 begin_track(AIL_Buffer *buf)
+{
+    ail_buf_write4msb(buf, 0x4d54726b); // "MTrk"
+    u64 idx = buf->idx;
+    ail_buf_write4msb(buf, 0);
+    return idx;
+}
+
+static void end_track(AIL_Buffer *buf, u64 len_idx)
+{
+    write_varlen(buf, 0);
+    ail_buf_write1(buf, 0xff);
+    ail_buf_write1(buf, 0x2f);
+    ail_buf_write1(buf, 0);
+    u64 idx  = buf->idx;
+    buf->idx = len_idx;
+    ail_buf_write4msb(buf, (u32)(idx - len_idx - 4));
+    buf->idx = idx;
+}
+
+// Two tracks at 480 ticks per beat:
+// Track 0 sets the tempo to 60bpm (1 beat = 1s) and plays middle C for one beat, using running status for the note-off
+// Track 1 plays the E above middle C half a beat later for half a beat and a drum hit, that should be ignored
+static AIL_Buffer build_smf(void)
+{
+    AIL_Buffer buf = ail_buf_new(256);
+    ail_buf_write4msb(&buf, 0x4d546864); // "MThd"
+    ail_buf_write4msb(&buf, 6);
+    ail_buf_write2msb(&buf, 1);
+    ail_buf_write2msb(&buf, 2);
+    ail_buf_write2msb(&buf, 480);
+
+    u64 t = begin_track(&buf);
+    write_varlen(&buf, 0);
+    ail_buf_write1(&buf, 0xff); ail_buf_write1(&buf, 0x51); ail_buf_write1(&buf, 3);
+    ail_buf_write1(&buf, 0x0f); ail_buf_write1(&buf, 0x42); ail_buf_write1(&buf, 0x40); // 1000000us per beat
+    write_varlen(&buf, 0);
+    ail_buf_write1(&buf, 0x90); ail_buf_write1(&buf, 60); ail_buf_write1(&buf, 127);
+    write_varlen(&buf, 480);
+    ail_buf_write1(&buf, 60); ail_buf_write1(&buf, 0);
+    end_track(&buf, t);
+
+    t = begin_track(&buf);
+    write_varlen(&buf, 240);
+    ail_buf_write1(&buf, 0x91); ail_buf_write1(&buf, 64); ail_buf_write1(&buf, 64);
+    write_varlen(&buf, 0);
+    ail_buf_write1(&buf, 0x99); ail_buf_write1(&buf, 36); ail_buf_write1(&buf, 100);
+    write_varlen(&buf, 240);
+    ail_buf_write1(&buf, 0x81); ail_buf_write1(&buf, 64); ail_buf_write1(&buf, 0);
+    end_track(&buf, t);
+    return buf;
+}
+
+bool convertTest(void)
+{
+    AIL_Buffer smf = build_smf();
+    AIL_DA(PidiCmd) cmds = ail_da_new_empty(PidiCmd);
+    MidiToPidiStats stats;
+    ASSERT(midi_to_pidi_cmds(smf.data, smf.len, &cmds, NULL, &stats));
+    ASSERT(stats.tracks == 2);
+    ASSERT(cmds.len == 2);
+    ASSERT(stats.len == 1000);
+
+    ASSERT(pidi_dt(cmds.data[0]) == 0);
+    ASSERT(pidi_len(cmds.data[0]) == 100);
+    ASSERT(pidi_octave(cmds.data[0]) == 0);
+    ASSERT(pidi_key(cmds.data[0]) == PIANO_KEY_C);
+    ASSERT(pidi_velocity(cmds.data[0]) == MAX_VELOCITY - 1);
+
+    ASSERT(pidi_dt(cmds.data[1]) == 500);
+    ASSERT(pidi_len(cmds.data[1]) == 50);
+    ASSERT(pidi_octave(cmds.data[1]) == 0);
+    ASSERT(pidi_key(cmds.data[1]) == PIANO_KEY_E);
+    ASSERT(pidi_velocity(cmds.data[1]) == 8);
+    ail_da_free(&cmds);
+    ail_buf_free(smf);
+    return true;
+}
+
+// Only the number of track chunks given in the header are read, even if some of them are empty
+bool trackCountTest(void)
+{
+    AIL_Buffer smf = ail_buf_new(64);
+    ail_buf_write4msb(&smf, 0x4d546864); // "MThd"
+    ail_buf_write4msb(&smf, 6);
+    ail_buf_write2msb(&smf, 0);
+    ail_buf_write2msb(&smf, 1);
+    ail_buf_write2msb(&smf, 480);
+    ail_buf_write4msb(&smf, 0x4d54726b); // Empty "MTrk"
+    ail_buf_write4msb(&smf, 0);
+    u64 t = begin_track(&smf);           // Trailing chunk, that isn't part of the song
+    write_varlen(&smf, 0);
+    ail_buf_write1(&smf, 0x90); ail_buf_write1(&smf, 60); ail_buf_write1(&smf, 127);
+    write_varlen(&smf, 480);
+    ail_buf_write1(&smf, 60); ail_buf_write1(&smf, 0);
+    end_track(&smf, t);
+
+    AIL_DA(PidiCmd) cmds = ail_da_new_empty(PidiCmd);
+    MidiToPidiStats stats;
+    ASSERT(midi_to_pidi_cmds(smf.data, smf.len, &cmds, NULL, &stats));
+    ASSERT(stats.tracks == 1);
+    ASSERT(cmds.len == 0);
+    ail_da_free(&cmds);
+    ail_buf_free(smf);
+    return true;
+}
+
+bool fileTest(void)
+{
+    AIL_Buffer smf  = build_smf();
+    AIL_Buffer pidi = ail_buf_new(64);
+    ASSERT(midi_to_pidi_file(smf.data, smf.len, &pidi, NULL, NULL));
+    ASSERT(pidi.len == 8 + 2*ENCODED_CMD_LEN);
+    pidi.idx = 0;
+    ASSERT(ail_buf_read4msb(&pidi) == PIDI_MAGIC);
+    ASSERT(ail_buf_read4lsb(&pidi) == 2);
+    PidiCmd cmd = decode_cmd(&pidi);
+    ASSERT(pidi_len(cmd) == 100);
+    ail_buf_free(pidi);
+
+    // The commands count is only written for successful conversions
+    pidi = ail_buf_new(64);
+    smf.data[smf.len - 1] = 0x7f; // The end-of-track event of the last track claims more data than there is
+    ASSERT(!midi_to_pidi_file(smf.data, smf.len, &pidi, NULL, NULL));
+    ASSERT(pidi.len > 8); // Some commands were written before the error
+    pidi.idx = 4;
+    ASSERT(ail_buf_read4lsb(&pidi) == 0);
+    ail_buf_free(pidi);
+    ail_buf_free(smf);
+    return true;
+}
+
+bool malformedTest(void)
+{
+    AIL_Buffer smf = build_smf();
+    AIL_DA(PidiCmd) cmds = ail_da_new_empty(PidiCmd);
+    ASSERT(!midi_to_pidi_cmds(smf.data, 10, &cmds, NULL, NULL));
+    smf.data[0] = 'X';
+    ASSERT(!midi_to_pidi_cmds(smf.data, smf.len, &cmds, NULL, NULL));
+    ail_da_free(&cmds);
+    ail_buf_free(smf);
+    return true;
+}
+
+int main(void)
+{
+    if (convertTest())   printf("\033[32mConversion Test successful :)\033[0m\n");
+    else                 printf("\033[31mConversion Test failed     :(\033[0m\n");
+    if (trackCountTest()) printf("\033[32mTrack Count Test successful :)\033[0m\n");
+    else                  printf("\033[31mTrack Count Test failed     :(\033[0m\n");
+    if (fileTest())      printf("\033[32mFile Test successful       :)\033[0m\n");
+    else                 printf("\033[31mFile Test failed           :(\033[0m\n");
+    if (malformedTest()) printf("\033[32mMalformed Test successful  :)\033[0m\n");
+    else                 printf("\033[31mMalformed Test failed      :(\033[0m\n");
+    return 0;
+}
@@ -0,0 +1,97 @@
+// Benchmark for midi_to_pidi.h
+//
+// Usage: ./midi_to_pidi_perf [file.mid]...
+// Without arguments, a synthetic orchestral score (many tracks, dense chords, frequent tempo changes) is generated instead
+
+#define _POSIX_C_SOURCE 199309L
+#define AIL_TYPES_IMPL
+#define AIL_FS_IMPL
+#define AIL_TIME_IMPL
+#define MIDI_TO_PIDI_IMPL
+#include "../midi_to_pidi.h"
+#include "../ail/ail_fs.h"
+#include "../ail/ail_time.h"
+#define TEST_RNG_SEED 0x12345678
+#include "test_util.h"
+#include <stdio.h>
+
+#define SYNTH_TRACKS     48
+#define SYNTH_NOTES      40000 // Per track
+#define BENCH_ITERATIONS 5
+
+static AIL_Buffer build_synthetic_smf(void)
+{
+    AIL_Buffer buf = ail_buf_new(1 << 20);
+    ail_buf_write4msb(&buf, 0x4d546864);
+    ail_buf_write4msb(&buf, 6);
+    ail_buf_write2msb(&buf, 1);
+    ail_buf_write2msb(&buf, SYNTH_TRACKS);
+    ail_buf_write2msb(&buf, 960);
+    for (u32 t = 0; t < SYNTH_TRACKS; t++) {
+        ail_buf_write4msb(&buf, 0x4d54726b);
+        u64 len_idx = buf.idx;
+        ail_buf_write4msb(&buf, 0);
+        u8 channel = t % 16 == 9 ? 0 : t % 16;
+        u8 base    = 36 + (t*7) % 48;
+        for (u32 i = 0; i < SYNTH_NOTES; i++) {
+            if (t == 0 && i % 64 == 0) {
+                u32 tempo = 400000 + rng() % 400000;
+                write_varlen(&buf, 0);
+                ail_buf_write1(&buf, 0xff); ail_buf_write1(&buf, 0x51); ail_buf_write1(&buf, 3);
+                ail_buf_write1(&buf, (u8)(tempo >> 16)); ail_buf_write1(&buf, (u8)(tempo >> 8)); ail_buf_write1(&buf, (u8)tempo);
+            }
+            u8 note = base + rng() % 24;
+            write_varlen(&buf, rng() % 240);
+            ail_buf_write1(&buf, 0x90 | channel); ail_buf_write1(&buf, note); ail_buf_write1(&buf, 1 + rng() % 127);
+            write_varlen(&buf, 60 + rng() % 1800);
+            ail_buf_write1(&buf, 0x80 | channel); ail_buf_write1(&buf, note); ail_buf_write1(&buf, 64);
+        }
+        write_varlen(&buf, 0);
+        ail_buf_write1(&buf, 0xff); ail_buf_write1(&buf, 0x2f); ail_buf_write1(&buf, 0);
+        u64 idx = buf.idx;
+        buf.idx = len_idx;
+        ail_buf_write4msb(&buf, (u32)(idx - len_idx - 4));
+        buf.idx = idx;
+    }
+    return buf;
+}
+
+static void bench(const char *name, const u8 *smf, u64 len)
+{
+    MidiToPidiStats stats = {0};
+    AIL_Buffer out = ail_buf_new(1 << 20);
+    double best = 1e30;
+    for (u32 i = 0; i < BENCH_ITERATIONS; i++) {
+        out.idx = out.len = 0;
+        double start = ail_time_clock_start();
+        bool ok = midi_to_pidi_file(smf, len, &out, NULL, &stats);
+        double elapsed = ail_time_clock_elapsed(start);
+        if (!ok) {
+            printf("\033[31m%s: Failed to convert\033[0m\n", name);
+            return;
+        }
+        if (elapsed < best) best = elapsed;
+    }
+    printf("%s (size: %llu)\n", name, (unsigned long long)len);
+    printf("  Tracks: %u, Events: %llu, Commands: %u\n", stats.tracks, (unsigned long long)stats.events, stats.notes);
+    printf("  Max pending notes: %u, cut notes: %u\n", stats.max_pending, stats.cut_notes);
+    printf("  Best time: %.03lfms (%.01lf MB/s, %.01lf Mevents/s)\n", best*1e3, len/best/1e6, stats.events/best/1e6);
+    ail_buf_free(out);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            u64 len;
+            u8 *smf = (u8 *)ail_fs_read_entire_file(argv[i], &len);
+            if (smf) bench(argv[i], smf, len);
+            else     printf("\033[31mCould not read '%s'\033[0m\n", argv[i]);
+        }
+    } else {
+        AIL_Buffer smf = build_synthetic_smf();
+        bench("Synthetic orchestral score", smf.data, smf.len);
+        ail_buf_free(smf);
+    }
+    return 0;
+}
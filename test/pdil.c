@@ -0,0 +1,776 @@
+// Test and benchmark for pdil.h
+//
+// Usage: ./pdil
+// After the tests, the throughput of pidi_fingerprint is measured with and without SSE2 (if available) and the time to load
+// a library full of duplicates is compared to loading every entry's PIDI file. Finally, adding songs to a large library
+// through the journal is compared to rewriting the whole file and searching entries by prefix with a SongIndex is compared
+// to filtering and sorting all entries on every keystroke.
+
+#define _POSIX_C_SOURCE 199309L
+#define AIL_TYPES_IMPL
+#define AIL_FS_IMPL
+#define AIL_HM_IMPL
+#define AIL_TIME_IMPL
+#define PDIL_IMPL
+#include <unistd.h> // For rmdir
+#include "../pdil.h"
+#include "../ail/ail_time.h"
+#include "../ail/test/test_assert.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <string.h>
+
+#define TMP_DIR "./tmp_pdil/"
+#define BENCH_CMDS        (1 << 20)
+#define BENCH_ITERATIONS  20
+#define BENCH_SONGS       16
+#define BENCH_COPIES      8
+#define BENCH_LIBRARY     20000 // Entries of the library that songs are added to
+#define BENCH_INDEX       100000 // Songs that are searched by prefix
+
+static u64 fingerprint_scalar(const PidiCmd *cmds, u64 count)
+{
+    // Same as pidi_fingerprint, but always with the scalar stripes
+    u32 *words = malloc(sizeof(u32)*(count + PIDI_FINGERPRINT_STRIPE));
+    for (u64 i = 0; i < count; i++) words[i] = pidi_pack(cmds[i]);
+    for (u64 i = count; i % PIDI_FINGERPRINT_STRIPE; i++) words[i] = 0;
+    u64 acc[4] = { PIDI_FINGERPRINT_P1, PIDI_FINGERPRINT_P2, PIDI_FINGERPRINT_P3, PIDI_FINGERPRINT_P4 };
+    pidi_fingerprint_stripes_scalar(acc, words, (count + PIDI_FINGERPRINT_STRIPE - 1)/PIDI_FINGERPRINT_STRIPE);
+    free(words);
+    u64 h = count*PIDI_FINGERPRINT_P5;
+    for (u32 j = 0; j < 4; j++) h = (h ^ pidi_fingerprint_avalanche(acc[j]))*PIDI_FINGERPRINT_P1 + PIDI_FINGERPRINT_P4;
+    h = pidi_fingerprint_avalanche(h);
+    return h == PIDI_FINGERPRINT_NONE ? 1 : h;
+}
+
+static bool write_buf(AIL_Buffer buf, const char *path)
+{
+    // ail_fs_write_file can't create files, so stdio is used instead
+    FILE *f  = fopen(path, "wb");
+    bool res = f && fwrite(buf.data, 1, buf.len, f) == buf.len;
+    if (f) fclose(f);
+    ail_buf_free(buf);
+    return res;
+}
+
+static bool write_pidi(const char *name, const PidiCmd *cmds, u32 count)
+{
+    char path[256];
+    snprintf(path, sizeof(path), TMP_DIR "%s", name);
+    AIL_Buffer buf = ail_buf_new(8 + (u64)count*ENCODED_CMD_LEN);
+    PidiWriter w   = pidi_writer_begin(&buf);
+    for (u32 i = 0; i < count; i++) pidi_writer_push(&w, cmds[i]);
+    pidi_writer_end(&w);
+    return write_buf(buf, path);
+}
+
+static bool write_pdil(const char *name, const char **names, const u64 *fingerprints, u32 count)
+{
+    char path[256];
+    snprintf(path, sizeof(path), TMP_DIR "%s", name);
+    PdilLibrary lib = pdil_new();
+    for (u32 i = 0; i < count; i++) {
+        PdilEntry e = { (char *)names[i], 1000*i, fingerprints ? fingerprints[i] : PIDI_FINGERPRINT_NONE, PDIL_NO_SONG };
+        ail_da_push(&lib.entries, e);
+    }
+    AIL_Buffer buf = ail_buf_new(256);
+    pdil_write(&buf, &lib);
+    ail_da_free(&lib.entries);
+    ail_da_free(&lib.songs);
+    song_index_free(&lib.index);
+    return write_buf(buf, path);
+}
+
+bool fingerprintTest(void)
+{
+    // Fingerprints are stored in PDIL files, so they must never change
+    PidiCmd golden[3] = { pidi_unpack(0x00000000), pidi_unpack(0x87564123), pidi_unpack(0x4f3281f4) };
+    ASSERT(pidi_fingerprint(NULL, 0)   == 0x7c2480de89199f0fULL);
+    ASSERT(pidi_fingerprint(golden, 1) == 0x0772244a095488c0ULL);
+    ASSERT(pidi_fingerprint(golden, 3) == 0x6ab5de23697b2616ULL);
+
+    u32 lens[] = { 1, 7, 8, 9, 255, 256, 257, 1000, 4099 };
+    for (u32 i = 0; i < sizeof(lens)/sizeof(lens[0]); i++) {
+        AIL_DA(PidiCmd) song = synth_song(STYLE_RANDOM, lens[i]);
+        u64 h = pidi_fingerprint(song.data, song.len);
+        ASSERT(h == fingerprint_scalar(song.data, song.len));
+
+        // Appending a command that packs to 0 must change the fingerprint, even though it is the same as the padding
+        ail_da_push(&song, pidi_unpack(0));
+        ASSERT(pidi_fingerprint(song.data, song.len) != h);
+        song.len--;
+
+        // Every bit of every command matters
+        u32 idx = rng() % song.len, bit = rng() & 31;
+        PidiCmd orig = song.data[idx];
+        song.data[idx] = pidi_unpack(pidi_pack(orig) ^ (1UL << bit));
+        ASSERT(pidi_fingerprint(song.data, song.len) != h);
+        song.data[idx] = orig;
+
+        // Swapping two stripes changes the order of the song, so it must change the fingerprint as well
+        if (song.len >= 2*PIDI_FINGERPRINT_STRIPE) {
+            PidiCmd tmp[PIDI_FINGERPRINT_STRIPE];
+            memcpy(tmp, song.data, sizeof(tmp));
+            memcpy(song.data, &song.data[PIDI_FINGERPRINT_STRIPE], sizeof(tmp));
+            memcpy(&song.data[PIDI_FINGERPRINT_STRIPE], tmp, sizeof(tmp));
+            ASSERT(pidi_fingerprint(song.data, song.len) != h);
+        }
+        ail_da_free(&song);
+    }
+    return true;
+}
+
+bool parseTest(void)
+{
+    PdilLibrary lib = pdil_new();
+    PdilEntry a = { "a.pidi", 1234, 0x0123456789abcdefULL, PDIL_NO_SONG };
+    PdilEntry b = { "songs/b.pidi", 0xffffffffffULL, PIDI_FINGERPRINT_NONE, PDIL_NO_SONG };
+    ail_da_push(&lib.entries, a);
+    ail_da_push(&lib.entries, b);
+    AIL_Buffer buf = ail_buf_new(64);
+    pdil_write(&buf, &lib);
+    ail_da_free(&lib.entries);
+    song_index_free(&lib.index);
+    ASSERT(buf.len == PDIL_HEADER_SIZE + 2*PDIL_ENTRY_HEADER_SIZE + strlen(a.name) + strlen(b.name));
+    ASSERT(memcmp(buf.data, "PDL2", 4) == 0);
+
+    PdilLibrary parsed;
+    ASSERT(pdil_parse(buf.data, buf.len, &parsed));
+    ASSERT(parsed.entries.len == 2);
+    ASSERT(strcmp(parsed.entries.data[0].name, a.name) == 0);
+    ASSERT(parsed.entries.data[0].len == a.len);
+    ASSERT(parsed.entries.data[0].fingerprint == a.fingerprint);
+    ASSERT(parsed.entries.data[0].song == PDIL_NO_SONG);
+    ASSERT(strcmp(parsed.entries.data[1].name, b.name) == 0);
+    ASSERT(parsed.entries.data[1].len == b.len);
+    ASSERT(parsed.entries.data[1].fingerprint == PIDI_FINGERPRINT_NONE);
+    pdil_free(&parsed);
+
+    // Truncated files must be rejected, wherever they were cut off
+    for (u64 len = 0; len < buf.len; len++) {
+        ASSERT(!pdil_parse(buf.data, len, &parsed));
+        pdil_free(&parsed);
+    }
+    buf.data[0] = 'X';
+    ASSERT(!pdil_parse(buf.data, buf.len, &parsed));
+    pdil_free(&parsed);
+    ail_buf_free(buf);
+    return true;
+}
+
+bool loadTest(void)
+{
+    mkdir(TMP_DIR, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+    AIL_DA(PidiCmd) x = synth_song(STYLE_RANDOM, 300);
+    AIL_DA(PidiCmd) y = synth_song(STYLE_RANDOM, 50);
+    ASSERT(write_pidi("x.pidi",      x.data, x.len));
+    ASSERT(write_pidi("x_copy.pidi", x.data, x.len));
+    ASSERT(write_pidi("y.pidi",      y.data, y.len));
+    u64 fx = pidi_fingerprint(x.data, x.len), fy = pidi_fingerprint(y.data, y.len);
+
+    // Without fingerprints, every file is read once and the copy is merged with the original afterwards
+    const char *names[] = { "x.pidi", "y.pidi", "x_copy.pidi", "missing.pidi", "x.pidi" };
+    ASSERT(write_pdil("lib.pdil", names, NULL, 5));
+    PdilLibrary lib;
+    PdilLoadStats stats;
+    ASSERT(pdil_load(TMP_DIR "lib.pdil", &lib, &stats));
+    ASSERT(stats.files_read == 4); // The last entry is read again, since its fingerprint wasn't stored
+    ASSERT(stats.duplicates == 2);
+    ASSERT(stats.missing == 1);
+    ASSERT(stats.stale == 0);
+    ASSERT(lib.songs.len == 2);
+    ASSERT(lib.entries.data[0].song == 0);
+    ASSERT(lib.entries.data[1].song == 1);
+    ASSERT(lib.entries.data[2].song == 0);
+    ASSERT(lib.entries.data[3].song == PDIL_NO_SONG);
+    ASSERT(lib.entries.data[4].song == 0);
+    ASSERT(lib.entries.data[0].fingerprint == fx);
+    ASSERT(lib.entries.data[1].fingerprint == fy);
+    ASSERT(lib.entries.data[3].fingerprint == PIDI_FINGERPRINT_NONE);
+    ASSERT(strcmp(lib.songs.data[0].name, "x.pidi") == 0);
+    ASSERT(lib.songs.data[0].len == 0);
+    ASSERT(lib.songs.data[1].cmds.len == y.len);
+    for (u32 i = 0; i < y.len; i++) ASSERT(pidi_pack(lib.songs.data[1].cmds.data[i]) == pidi_pack(y.data[i]));
+
+    // Writing the library back stores the fingerprints, so duplicates aren't read anymore
+    AIL_Buffer buf = ail_buf_new(256);
+    pdil_write(&buf, &lib);
+    pdil_free(&lib);
+    ASSERT(write_buf(buf, TMP_DIR "lib.pdil"));
+    ASSERT(pdil_load(TMP_DIR "lib.pdil", &lib, &stats));
+    ASSERT(stats.files_read == 2);
+    ASSERT(stats.duplicates == 2);
+    ASSERT(stats.missing == 1);
+    ASSERT(lib.songs.len == 2);
+    ASSERT(lib.entries.data[4].song == 0);
+    pdil_free(&lib);
+
+    // A wrong fingerprint is replaced by the one of the file
+    u64 fingerprints[] = { fx, fx, fx };
+    ASSERT(write_pdil("stale.pdil", names, fingerprints, 3));
+    ASSERT(pdil_load(TMP_DIR "stale.pdil", &lib, &stats));
+    ASSERT(stats.files_read == 1);
+    ASSERT(stats.duplicates == 2);
+    ASSERT(lib.entries.data[1].song == 0); // Stored fingerprints are trusted, so the wrong one maps y to x without reading it
+    pdil_free(&lib);
+    fingerprints[0] = fy;
+    ASSERT(write_pdil("stale.pdil", names, fingerprints, 3));
+    ASSERT(pdil_load(TMP_DIR "stale.pdil", &lib, &stats));
+    ASSERT(stats.files_read == 1);
+    ASSERT(stats.stale == 1);
+    ASSERT(lib.entries.data[0].fingerprint == fx);
+    ASSERT(lib.songs.len == 1);
+    pdil_free(&lib);
+
+    ASSERT(!pdil_load(TMP_DIR "nothing.pdil", &lib, &stats));
+    pdil_free(&lib);
+
+    const char *files[] = { "x.pidi", "x_copy.pidi", "y.pidi", "lib.pdil", "stale.pdil" };
+    for (u32 i = 0; i < sizeof(files)/sizeof(files[0]); i++) {
+        char path[256];
+        snprintf(path, sizeof(path), TMP_DIR "%s", files[i]);
+        remove(path);
+    }
+    rmdir(TMP_DIR);
+    ail_da_free(&x);
+    ail_da_free(&y);
+    return true;
+}
+
+static u64 file_size(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    fseek(f, 0, SEEK_END);
+    u64 size = (u64)ftell(f);
+    fclose(f);
+    return size;
+}
+
+static bool append_bytes(const char *path, const u8 *data, u64 len)
+{
+    FILE *f  = fopen(path, "ab");
+    bool res = f && fwrite(data, 1, len, f) == len;
+    if (f) fclose(f);
+    return res;
+}
+
+static bool same_entries(const PdilLibrary *a, const PdilLibrary *b)
+{
+    if (a->entries.len != b->entries.len) return false;
+    for (u32 i = 0; i < a->entries.len; i++) {
+        PdilEntry x = a->entries.data[i], y = b->entries.data[i];
+        if (strcmp(x.name, y.name) != 0 || x.len != y.len || x.fingerprint != y.fingerprint) return false;
+    }
+    return true;
+}
+
+// Files from before fingerprints existed are still read and get upgraded on their first change
+bool v1Test(void)
+{
+    const char *fpath = TMP_DIR "v1.pdil";
+    mkdir(TMP_DIR, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+    AIL_DA(PidiCmd) x = synth_song(STYLE_RANDOM, 300);
+    ASSERT(write_pidi("x.pidi",      x.data, x.len));
+    ASSERT(write_pidi("x_copy.pidi", x.data, x.len));
+    const char *names[] = { "x.pidi", "x_copy.pidi" };
+    AIL_Buffer buf = ail_buf_new(64);
+    ail_buf_write4msb(&buf, PDIL_MAGIC_V1);
+    ail_buf_write4lsb(&buf, 2);
+    for (u32 i = 0; i < 2; i++) {
+        ail_buf_write4lsb(&buf, (u32)strlen(names[i]));
+        ail_buf_write8lsb(&buf, 1000 + i);
+        ail_buf_ensure_size(&buf, strlen(names[i]));
+        ail_buf_writestr(&buf, (char *)names[i], strlen(names[i]));
+    }
+    ASSERT(buf.len == PDIL_HEADER_SIZE + 2*PDIL_ENTRY_HEADER_SIZE_V1 + strlen(names[0]) + strlen(names[1]));
+    ASSERT(write_buf(buf, fpath));
+
+    PdilLibrary lib;
+    PdilLoadStats stats;
+    ASSERT(pdil_load(fpath, &lib, &stats));
+    ASSERT(lib.v1);
+    ASSERT(lib.entries.len == 2);
+    for (u32 i = 0; i < 2; i++) {
+        ASSERT(strcmp(lib.entries.data[i].name, names[i]) == 0);
+        ASSERT(lib.entries.data[i].len == 1000 + i);
+    }
+    ASSERT(stats.files_read == 2 && stats.duplicates == 1);
+    ASSERT(lib.entries.data[0].fingerprint == pidi_fingerprint(x.data, x.len));
+
+    // The first change rewrites the file in the current format, which stores the fingerprints computed while loading
+    ASSERT(pdil_rename(fpath, &lib, "x_copy.pidi", "x_again.pidi"));
+    ASSERT(!lib.v1);
+    ASSERT(lib.journal_records == 1);
+    PdilLibrary loaded;
+    ASSERT(pdil_load(fpath, &loaded, &stats));
+    ASSERT(!loaded.v1);
+    ASSERT(same_entries(&lib, &loaded));
+    ASSERT(strcmp(loaded.entries.data[1].name, "x_again.pidi") == 0);
+    ASSERT(loaded.entries.data[1].fingerprint == lib.entries.data[0].fingerprint);
+    pdil_free(&loaded);
+    pdil_free(&lib);
+
+    ail_da_free(&x);
+    remove(TMP_DIR "x.pidi");
+    remove(TMP_DIR "x_copy.pidi");
+    remove(fpath);
+    rmdir(TMP_DIR);
+    return true;
+}
+
+bool journalTest(void)
+{
+    const char *fpath = TMP_DIR "journal.pdil";
+    mkdir(TMP_DIR, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+    AIL_DA(PidiCmd) x = synth_song(STYLE_RANDOM, 200);
+    AIL_DA(PidiCmd) y = synth_song(STYLE_RANDOM, 70);
+    ASSERT(write_pidi("x.pidi",      x.data, x.len));
+    ASSERT(write_pidi("x_copy.pidi", x.data, x.len));
+    ASSERT(write_pidi("y.pidi",      y.data, y.len));
+
+    // Compacting an empty library creates the file
+    PdilLibrary lib = pdil_new();
+    ASSERT(pdil_compact(fpath, &lib));
+    ASSERT(file_size(fpath) == PDIL_HEADER_SIZE);
+    pdil_free(&lib);
+    ASSERT(pdil_load(fpath, &lib, NULL));
+    ASSERT(lib.entries.len == 0);
+
+    // Every change only appends a single record
+    ASSERT(pdil_add(fpath, &lib, "x.pidi", 100));
+    ASSERT(file_size(fpath) == PDIL_HEADER_SIZE + PDIL_RECORD_OVERHEAD + PDIL_ENTRY_HEADER_SIZE + strlen("x.pidi"));
+    ASSERT(pdil_add(fpath, &lib, "y.pidi", 200));
+    ASSERT(pdil_add(fpath, &lib, "x_copy.pidi", 300));
+    ASSERT(lib.songs.len == 2);
+    ASSERT(lib.entries.data[2].song == 0);
+    ASSERT(lib.entries.data[2].fingerprint == pidi_fingerprint(x.data, x.len));
+    ASSERT(rename(TMP_DIR "y.pidi", TMP_DIR "y2.pidi") == 0);
+    ASSERT(pdil_rename(fpath, &lib, "y.pidi", "y2.pidi"));
+    ASSERT(strcmp(lib.songs.data[1].name, "y2.pidi") == 0);
+    u64 size = file_size(fpath);
+    ASSERT(!pdil_rename(fpath, &lib, "nothing.pidi", "z.pidi"));
+    ASSERT(!pdil_remove(fpath, &lib, "nothing.pidi"));
+    ASSERT(file_size(fpath) == size);
+
+    // The song stays, as long as another entry refers to it
+    ASSERT(pdil_remove(fpath, &lib, "x.pidi"));
+    ASSERT(lib.entries.len == 2);
+    ASSERT(strcmp(lib.entries.data[0].name, "y2.pidi") == 0);
+    ASSERT(strcmp(lib.songs.data[0].name, "x_copy.pidi") == 0);
+    ASSERT(lib.songs.data[0].cmds.len == x.len);
+    ASSERT(lib.journal_records == 5);
+    ASSERT(lib.file_len == file_size(fpath));
+    ASSERT(!pdil_needs_compaction(&lib));
+
+    // Replaying the journal gives the same library
+    PdilLibrary loaded;
+    PdilLoadStats stats;
+    ASSERT(pdil_load(fpath, &loaded, &stats));
+    ASSERT(same_entries(&lib, &loaded));
+    ASSERT(loaded.journal_records == 5);
+    ASSERT(loaded.body_len == PDIL_HEADER_SIZE);
+    ASSERT(stats.files_read == 2);
+    ASSERT(stats.missing == 0);
+    pdil_free(&loaded);
+
+    // A partially written record is ignored and overwritten by the next one
+    u8 torn[PDIL_RECORD_OVERHEAD + 4] = { PDIL_OP_REMOVE, 12, 0, 0, 0, 7, 0, 0, 0, 'y', '2' };
+    ASSERT(append_bytes(fpath, torn, sizeof(torn)));
+    ASSERT(pdil_load(fpath, &loaded, NULL));
+    ASSERT(same_entries(&lib, &loaded));
+    ASSERT(loaded.file_len == size + PDIL_RECORD_OVERHEAD + 4 + strlen("x.pidi"));
+    ASSERT(pdil_add(fpath, &loaded, "x.pidi", 400));
+    pdil_free(&loaded);
+    ASSERT(pdil_load(fpath, &loaded, NULL));
+    ASSERT(loaded.entries.len == 3);
+    ASSERT(strcmp(loaded.entries.data[2].name, "x.pidi") == 0);
+    ASSERT(loaded.entries.data[2].song == loaded.entries.data[1].song);
+    ASSERT(loaded.journal_records == 6);
+    pdil_free(&loaded);
+    ASSERT(pdil_add(fpath, &lib, "x.pidi", 400));
+
+    // The journal ends at the first record with a wrong checksum
+    u64 len;
+    u8 *data = (u8 *)ail_fs_read_entire_file(fpath, &len);
+    data[PDIL_HEADER_SIZE + PDIL_RECORD_OVERHEAD + PDIL_ENTRY_HEADER_SIZE + strlen("x.pidi") + 10] ^= 1;
+    ASSERT(pdil_parse(data, len, &loaded));
+    ASSERT(loaded.entries.len == 1);
+    ASSERT(loaded.journal_records == 1);
+    pdil_free(&loaded);
+    AIL_FREE(data);
+
+    // Compaction writes all entries into the body
+    ASSERT(pdil_compact(fpath, &lib));
+    ASSERT(lib.journal_records == 0);
+    ASSERT(lib.file_len == file_size(fpath));
+    ASSERT(file_size(fpath) == lib.body_len);
+    ASSERT(file_size(TMP_DIR "journal.pdil" PDIL_TMP_SUFFIX) == 0);
+    ASSERT(pdil_load(fpath, &loaded, &stats));
+    ASSERT(same_entries(&lib, &loaded));
+    ASSERT(loaded.journal_records == 0);
+    ASSERT(stats.files_read == 2);
+    pdil_free(&loaded);
+
+    // Removing every entry of a song frees it, adding it again gives it a new slot
+    ASSERT(pdil_remove(fpath, &lib, "x_copy.pidi"));
+    ASSERT(pdil_remove(fpath, &lib, "x.pidi"));
+    ASSERT(lib.songs.data[0].name == NULL);
+    ASSERT(lib.songs.data[0].cmds.len == 0);
+    ASSERT(pdil_add(fpath, &lib, "x.pidi", 500));
+    ASSERT(lib.entries.data[1].song == 2);
+    ASSERT(lib.songs.data[2].cmds.len == x.len);
+
+    for (u32 i = 0; lib.journal_records < PDIL_JOURNAL_MAX_RECORDS; i++) ASSERT(pdil_rename(fpath, &lib, (i & 1) ? "z.pidi" : "x.pidi", (i & 1) ? "x.pidi" : "z.pidi"));
+    ASSERT(pdil_needs_compaction(&lib));
+    ASSERT(pdil_load(fpath, &loaded, NULL));
+    ASSERT(same_entries(&lib, &loaded));
+    pdil_free(&loaded);
+    pdil_free(&lib);
+
+    const char *files[] = { "x.pidi", "x_copy.pidi", "y2.pidi", "journal.pdil" };
+    for (u32 i = 0; i < sizeof(files)/sizeof(files[0]); i++) {
+        char path[256];
+        snprintf(path, sizeof(path), TMP_DIR "%s", files[i]);
+        remove(path);
+    }
+    rmdir(TMP_DIR);
+    ail_da_free(&x);
+    ail_da_free(&y);
+    return true;
+}
+
+static char *random_name(void)
+{
+    // Few different letters in both cases, so that many names share prefixes
+    static const char letters[] = "abcABC_";
+    u32   len  = rng() % 6;
+    char *name = AIL_BUF_MALLOC(len + 1);
+    for (u32 i = 0; i < len; i++) name[i] = letters[rng() % (sizeof(letters) - 1)];
+    name[len] = 0;
+    return name;
+}
+
+static bool starts_with(const char *name, const char *prefix)
+{
+    for (u32 i = 0; prefix[i]; i++) {
+        if (!name[i] || song_index_fold(name[i]) != song_index_fold(prefix[i])) return false;
+    }
+    return true;
+}
+
+// Checks that the index contains exactly the entries with a song in sorted order and that all queries match a linear scan
+static bool index_valid(const SongIndex *idx, const PdilEntry *entries, u32 count)
+{
+    u32 indexed = 0;
+    for (u32 i = 0; i < count; i++) indexed += entries[i].song != PDIL_NO_SONG;
+    ASSERT(idx->by_name.len == indexed);
+    ASSERT(idx->by_len.len  == indexed);
+    for (u32 i = 1; i < indexed; i++) {
+        ASSERT(song_index_name_cmp(entries, idx->by_name.data[i - 1], idx->by_name.data[i]) < 0);
+        ASSERT(song_index_len_cmp(entries, idx->by_len.data[i - 1], idx->by_len.data[i]) < 0);
+    }
+
+    const char *prefixes[] = { "", "a", "A", "ab", "aB_", "c", "_", "cab", "b_a", "x", "abcabc" };
+    for (u32 p = 0; p < sizeof(prefixes)/sizeof(prefixes[0]); p++) {
+        u32 lo, hi, expected = 0;
+        song_index_prefix(idx, entries, prefixes[p], &lo, &hi);
+        for (u32 i = 0; i < count; i++) expected += entries[i].song != PDIL_NO_SONG && starts_with(entries[i].name, prefixes[p]);
+        ASSERT(hi - lo == expected);
+        for (u32 i = lo; i < hi; i++) ASSERT(starts_with(entries[idx->by_name.data[i]].name, prefixes[p]));
+    }
+
+    u64 ranges[][2] = { { 0, 0 }, { 0, 1000 }, { 250, 750 }, { 500, 500 }, { 900, 100 }, { 2000, 3000 } };
+    for (u32 r = 0; r < sizeof(ranges)/sizeof(ranges[0]); r++) {
+        u32 lo, hi, expected = 0;
+        song_index_len_range(idx, entries, ranges[r][0], ranges[r][1], &lo, &hi);
+        for (u32 i = 0; i < count; i++) expected += entries[i].song != PDIL_NO_SONG && entries[i].len >= ranges[r][0] && entries[i].len <= ranges[r][1];
+        ASSERT(hi - lo == expected);
+        for (u32 i = lo; i < hi; i++) ASSERT(entries[idx->by_len.data[i]].len >= ranges[r][0] && entries[idx->by_len.data[i]].len <= ranges[r][1]);
+    }
+    return true;
+}
+
+bool indexTest(void)
+{
+    AIL_DA(PdilEntry) entries = ail_da_new_empty(PdilEntry);
+    for (u32 i = 0; i < 300; i++) {
+        PdilEntry e = { random_name(), rng() % 1001, PIDI_FINGERPRINT_NONE, (i % 17 == 0) ? PDIL_NO_SONG : i };
+        ail_da_push(&entries, e);
+    }
+    SongIndex idx = song_index_new(entries.data, 200);
+    ASSERT(index_valid(&idx, entries.data, 200));
+
+    // Inserting entries one by one gives the same index as sorting all of them at once
+    for (u32 i = 200; i < entries.len; i++) song_index_insert(&idx, entries.data, i);
+    ASSERT(index_valid(&idx, entries.data, entries.len));
+    SongIndex sorted = song_index_new(entries.data, entries.len);
+    ASSERT(memcmp(sorted.by_name.data, idx.by_name.data, sizeof(u32)*idx.by_name.len) == 0);
+    ASSERT(memcmp(sorted.by_len.data,  idx.by_len.data,  sizeof(u32)*idx.by_len.len) == 0);
+    song_index_free(&sorted);
+
+    // Changing entries after removing them from the index
+    for (u32 i = 0; i < entries.len; i += 3) {
+        song_index_remove(&idx, entries.data, i);
+        AIL_BUF_FREE(entries.data[i].name);
+        entries.data[i].name = random_name();
+        entries.data[i].len  = rng() % 1001;
+        entries.data[i].song = (i % 2) ? i : PDIL_NO_SONG;
+        song_index_insert(&idx, entries.data, i);
+    }
+    ASSERT(index_valid(&idx, entries.data, entries.len));
+    song_index_free(&idx);
+
+    // The index of a library is kept up to date by all changes
+    mkdir(TMP_DIR, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+    const char *names[] = { "Zebra.pidi", "apple.pidi", "Apricot.pidi", "banana.pidi" };
+    for (u32 i = 0; i < sizeof(names)/sizeof(names[0]); i++) {
+        AIL_DA(PidiCmd) song = synth_song(STYLE_RANDOM, 10 + i);
+        ASSERT(write_pidi(names[i], song.data, song.len));
+        ail_da_free(&song);
+    }
+    const char *fpath = TMP_DIR "index.pdil";
+    PdilLibrary lib = pdil_new();
+    ASSERT(pdil_compact(fpath, &lib));
+    for (u32 i = 0; i < 3; i++) ASSERT(pdil_add(fpath, &lib, names[i], 100*i));
+    ASSERT(index_valid(&lib.index, lib.entries.data, lib.entries.len));
+    u32 lo, hi;
+    song_index_prefix(&lib.index, lib.entries.data, "AP", &lo, &hi);
+    ASSERT(hi - lo == 2);
+    ASSERT(strcmp(lib.entries.data[lib.index.by_name.data[lo]].name, "apple.pidi") == 0);
+    ASSERT(pdil_rename(fpath, &lib, "apple.pidi", "zz.pidi"));
+    ASSERT(pdil_remove(fpath, &lib, "Zebra.pidi"));
+    ASSERT(pdil_add(fpath, &lib, names[3], 50));
+    ASSERT(index_valid(&lib.index, lib.entries.data, lib.entries.len));
+    song_index_prefix(&lib.index, lib.entries.data, "z", &lo, &hi);
+    ASSERT(hi - lo == 1);
+    ASSERT(strcmp(lib.entries.data[lib.index.by_name.data[lo]].name, "zz.pidi") == 0);
+    pdil_free(&lib);
+    ASSERT(pdil_load(fpath, &lib, NULL));
+    // There is no zz.pidi file, so the renamed entry has no song after reloading
+    ASSERT(lib.index.by_name.len == 2);
+    ASSERT(index_valid(&lib.index, lib.entries.data, lib.entries.len));
+    pdil_free(&lib);
+
+    for (u32 i = 0; i < sizeof(names)/sizeof(names[0]); i++) {
+        char path[256];
+        snprintf(path, sizeof(path), TMP_DIR "%s", names[i]);
+        remove(path);
+    }
+    remove(fpath);
+    rmdir(TMP_DIR);
+    for (u32 i = 0; i < entries.len; i++) AIL_BUF_FREE(entries.data[i].name);
+    ail_da_free(&entries);
+    return true;
+}
+
+// Entries that share a song under different names must all be found by their own names
+bool duplicateIndexTest(void)
+{
+    const char *fpath = TMP_DIR "dups.pdil";
+    mkdir(TMP_DIR, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+    AIL_DA(PidiCmd) x = synth_song(STYLE_RANDOM, 100);
+    const char *names[] = { "Apple.pidi", "apfel.pidi", "pomme.pidi" };
+    for (u32 i = 0; i < 3; i++) ASSERT(write_pidi(names[i], x.data, x.len));
+    u64 fingerprints[] = { pidi_fingerprint(x.data, x.len), pidi_fingerprint(x.data, x.len), pidi_fingerprint(x.data, x.len) };
+    ASSERT(write_pdil("dups.pdil", names, fingerprints, 3));
+
+    PdilLibrary lib;
+    ASSERT(pdil_load(fpath, &lib, NULL));
+    ASSERT(lib.songs.len == 1);
+    ASSERT(index_valid(&lib.index, lib.entries.data, lib.entries.len));
+    u32 lo, hi;
+    song_index_prefix(&lib.index, lib.entries.data, "ap", &lo, &hi);
+    ASSERT(hi - lo == 2);
+    ASSERT(strcmp(lib.entries.data[lib.index.by_name.data[lo]].name,     "apfel.pidi") == 0);
+    ASSERT(strcmp(lib.entries.data[lib.index.by_name.data[lo + 1]].name, "Apple.pidi") == 0);
+    song_index_prefix(&lib.index, lib.entries.data, "pom", &lo, &hi);
+    ASSERT(hi - lo == 1);
+
+    // Renaming, removing and adding entries other than the one the song is named after updates the index as well
+    ASSERT(pdil_rename(fpath, &lib, "pomme.pidi", "Appel.pidi"));
+    song_index_prefix(&lib.index, lib.entries.data, "ap", &lo, &hi);
+    ASSERT(hi - lo == 3);
+    ASSERT(pdil_remove(fpath, &lib, "Apple.pidi"));
+    ASSERT(index_valid(&lib.index, lib.entries.data, lib.entries.len));
+    ASSERT(pdil_add(fpath, &lib, "pomme.pidi", 7));
+    ASSERT(lib.entries.data[2].song == lib.entries.data[0].song);
+    ASSERT(index_valid(&lib.index, lib.entries.data, lib.entries.len));
+    song_index_prefix(&lib.index, lib.entries.data, "ap", &lo, &hi);
+    ASSERT(hi - lo == 2);
+    song_index_prefix(&lib.index, lib.entries.data, "p", &lo, &hi);
+    ASSERT(hi - lo == 1);
+    pdil_free(&lib);
+
+    ail_da_free(&x);
+    for (u32 i = 0; i < 3; i++) {
+        char path[256];
+        snprintf(path, sizeof(path), TMP_DIR "%s", names[i]);
+        remove(path);
+    }
+    remove(fpath);
+    rmdir(TMP_DIR);
+    return true;
+}
+
+static int entry_ptr_cmp(const void *a, const void *b)
+{
+    const PdilEntry *x = *(const PdilEntry **)a, *y = *(const PdilEntry **)b;
+    u64 i = 0;
+    while (x->name[i] && song_index_fold(x->name[i]) == song_index_fold(y->name[i])) i++;
+    return (int)song_index_fold(x->name[i]) - (int)song_index_fold(y->name[i]);
+}
+
+void bench(void)
+{
+    AIL_DA(PidiCmd) song = synth_song(STYLE_RANDOM, BENCH_CMDS);
+    volatile u64 sink = 0; // Keeps the hashing from being optimized away
+    u64 start = ail_time_now_ns();
+    for (u32 it = 0; it < BENCH_ITERATIONS; it++) sink ^= pidi_fingerprint(song.data, song.len);
+    f64 secs = (f64)(ail_time_now_ns() - start)/1e9;
+#ifdef PIDI_FINGERPRINT_SSE2
+    printf("  pidi_fingerprint (SSE2):   %8.1f Mcmds/s\n", (f64)BENCH_CMDS*BENCH_ITERATIONS/secs/1e6);
+#else
+    printf("  pidi_fingerprint (scalar): %8.1f Mcmds/s\n", (f64)BENCH_CMDS*BENCH_ITERATIONS/secs/1e6);
+#endif
+
+    // Only the stripes are compared here, since packing the commands costs the same for both
+    u32 *words = malloc(sizeof(u32)*BENCH_CMDS);
+    for (u32 i = 0; i < BENCH_CMDS; i++) words[i] = pidi_pack(song.data[i]);
+    u64 acc[4] = {0};
+    start = ail_time_now_ns();
+    for (u32 it = 0; it < BENCH_ITERATIONS; it++) pidi_fingerprint_stripes_scalar(acc, words, BENCH_CMDS/PIDI_FINGERPRINT_STRIPE);
+    secs = (f64)(ail_time_now_ns() - start)/1e9;
+    sink = sink ^ acc[0];
+    printf("  stripes (scalar):          %8.1f Mcmds/s\n", (f64)BENCH_CMDS*BENCH_ITERATIONS/secs/1e6);
+#ifdef PIDI_FINGERPRINT_SSE2
+    start = ail_time_now_ns();
+    for (u32 it = 0; it < BENCH_ITERATIONS; it++) pidi_fingerprint_stripes_sse2(acc, words, BENCH_CMDS/PIDI_FINGERPRINT_STRIPE);
+    secs = (f64)(ail_time_now_ns() - start)/1e9;
+    sink = sink ^ acc[0];
+    printf("  stripes (SSE2):            %8.1f Mcmds/s\n", (f64)BENCH_CMDS*BENCH_ITERATIONS/secs/1e6);
+#endif
+    free(words);
+    ail_da_free(&song);
+
+    // A library with BENCH_COPIES entries for each of BENCH_SONGS songs, loaded with and without fingerprints
+    mkdir(TMP_DIR, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+    const char *names[BENCH_SONGS*BENCH_COPIES];
+    char name_bufs[BENCH_SONGS*BENCH_COPIES][32];
+    u64  fingerprints[BENCH_SONGS*BENCH_COPIES];
+    for (u32 i = 0; i < BENCH_SONGS; i++) {
+        AIL_DA(PidiCmd) s = synth_song(STYLE_RANDOM, 20000);
+        for (u32 c = 0; c < BENCH_COPIES; c++) {
+            u32 idx = c*BENCH_SONGS + i;
+            snprintf(name_bufs[idx], sizeof(name_bufs[idx]), "song%u_%u.pidi", i, c);
+            names[idx]        = name_bufs[idx];
+            fingerprints[idx] = pidi_fingerprint(s.data, s.len);
+            write_pidi(names[idx], s.data, s.len);
+        }
+        ail_da_free(&s);
+    }
+    for (u32 with_fingerprints = 0; with_fingerprints < 2; with_fingerprints++) {
+        write_pdil("bench.pdil", names, with_fingerprints ? fingerprints : NULL, BENCH_SONGS*BENCH_COPIES);
+        PdilLibrary lib;
+        PdilLoadStats stats;
+        start = ail_time_now_ns();
+        pdil_load(TMP_DIR "bench.pdil", &lib, &stats);
+        secs = (f64)(ail_time_now_ns() - start)/1e9;
+        printf("  load %u entries %-20s %8.2f ms (%u files read, %u songs in memory)\n", lib.entries.len,
+               with_fingerprints ? "with fingerprints:" : "without fingerprints:", secs*1e3, stats.files_read, lib.songs.len);
+        pdil_free(&lib);
+    }
+
+    // Adding a song to a large library, either with a journal record or by rewriting the whole file
+    PdilLibrary lib = pdil_new();
+    for (u32 i = 0; i < BENCH_LIBRARY; i++) {
+        PdilEntry e = { pdil_copy_name(names[i % (BENCH_SONGS*BENCH_COPIES)]), 1000, fingerprints[i % (BENCH_SONGS*BENCH_COPIES)], PDIL_NO_SONG };
+        ail_da_push(&lib.entries, e);
+    }
+    pdil_compact(TMP_DIR "bench.pdil", &lib);
+    u64 append_ns = 0, rewrite_ns = 0;
+    for (u32 i = 0; i < BENCH_ITERATIONS; i++) {
+        start = ail_time_now_ns();
+        pdil_add(TMP_DIR "bench.pdil", &lib, names[i], 1000);
+        append_ns += ail_time_now_ns() - start;
+        start = ail_time_now_ns();
+        pdil_compact(TMP_DIR "bench.pdil", &lib);
+        rewrite_ns += ail_time_now_ns() - start;
+    }
+    printf("  add to %u entries: %8.1f us with the journal, %8.1f us when rewriting the file\n", lib.entries.len,
+           (f64)append_ns/BENCH_ITERATIONS/1e3, (f64)rewrite_ns/BENCH_ITERATIONS/1e3);
+    pdil_free(&lib);
+
+    // Typing a search query one letter at a time, either with the index or by filtering and sorting all songs for each keystroke
+    PdilEntry *entries = malloc(sizeof(PdilEntry)*BENCH_INDEX);
+    for (u32 i = 0; i < BENCH_INDEX; i++) {
+        entries[i].name = malloc(16);
+        for (u32 j = 0; j < 15; j++) entries[i].name[j] = "abcdefghABCDEFGH"[rng() % 16];
+        entries[i].name[15]    = 0;
+        entries[i].len         = rng();
+        entries[i].fingerprint = PIDI_FINGERPRINT_NONE;
+        entries[i].song        = i;
+    }
+    start = ail_time_now_ns();
+    SongIndex idx = song_index_new(entries, BENCH_INDEX);
+    u64 build_ns = ail_time_now_ns() - start;
+    const char *query = "aBcDeF";
+    char prefix[8] = {0};
+    const PdilEntry **matches = malloc(sizeof(PdilEntry *)*BENCH_INDEX);
+    u64 index_ns = 0, scan_ns = 0;
+    for (u32 it = 0; it < BENCH_ITERATIONS; it++) {
+        for (u32 k = 0; query[k]; k++) {
+            prefix[k] = query[k];
+            u32 lo, hi;
+            start = ail_time_now_ns();
+            song_index_prefix(&idx, entries, prefix, &lo, &hi);
+            index_ns += ail_time_now_ns() - start;
+            sink = sink ^ (hi - lo);
+
+            start = ail_time_now_ns();
+            u32 n = 0;
+            for (u32 i = 0; i < BENCH_INDEX; i++) {
+                if (song_index_prefix_cmp(entries[i].name, prefix) == 0) matches[n++] = &entries[i];
+            }
+            qsort(matches, n, sizeof(PdilEntry *), entry_ptr_cmp);
+            scan_ns += ail_time_now_ns() - start;
+            sink = sink ^ n;
+        }
+        memset(prefix, 0, sizeof(prefix));
+    }
+    u32 keystrokes = BENCH_ITERATIONS*(u32)strlen(query);
+    printf("  prefix search in %u entries: %8.2f us with the index (built in %.1f ms), %8.2f us when scanning and sorting\n", BENCH_INDEX,
+           (f64)index_ns/keystrokes/1e3, (f64)build_ns/1e6, (f64)scan_ns/keystrokes/1e3);
+    song_index_free(&idx);
+    for (u32 i = 0; i < BENCH_INDEX; i++) free(entries[i].name);
+    free(entries);
+    free(matches);
+
+    for (u32 i = 0; i < BENCH_SONGS*BENCH_COPIES; i++) {
+        char path[256];
+        snprintf(path, sizeof(path), TMP_DIR "%s", names[i]);
+        remove(path);
+    }
+    remove(TMP_DIR "bench.pdil");
+    rmdir(TMP_DIR);
+}
+
+int main(void)
+{
+    if (fingerprintTest()) printf("\033[32mFingerprint Test successful :)\033[0m\n");
+    else                   printf("\033[31mFingerprint Test failed     :(\033[0m\n");
+    if (parseTest())       printf("\033[32mParse Test successful       :)\033[0m\n");
+    else                   printf("\033[31mParse Test failed           :(\033[0m\n");
+    if (loadTest())        printf("\033[32mLoad Test successful        :)\033[0m\n");
+    else                   printf("\033[31mLoad Test failed            :(\033[0m\n");
+    if (journalTest())     printf("\033[32mJournal Test successful     :)\033[0m\n");
+    else                   printf("\033[31mJournal Test failed         :(\033[0m\n");
+    if (v1Test())          printf("\033[32mV1 Test successful          :)\033[0m\n");
+    else                   printf("\033[31mV1 Test failed              :(\033[0m\n");
+    if (indexTest())       printf("\033[32mIndex Test successful       :)\033[0m\n");
+    else                   printf("\033[31mIndex Test failed           :(\033[0m\n");
+    if (duplicateIndexTest()) printf("\033[32mDuplicate Index Test successful :)\033[0m\n");
+    else                      printf("\033[31mDuplicate Index Test failed     :(\033[0m\n");
+    bench();
+    return 0;
+}
@@ -0,0 +1,284 @@
+// Test the PIDI functions in common.h
+
+#define AIL_TYPES_IMPL
+#include "../common.h"
+#include "../ail/test/test_assert.h"
+#include "test_util.h"
+#include <stdio.h>
+
+#define ARR_LEN(arr) (sizeof(arr)/sizeof((arr)[0]))
+
+typedef struct GoldenCmd {
+    u16 dt;
+    u8  velocity;
+    u8  len;
+    i8  octave;
+    u8  key;
+    u32 packed;
+    u8  bytes[ENCODED_CMD_LEN];
+} GoldenCmd;
+
+// Encodings as specified in Protocols.md - these must never change, as they are shared by all PIDI files and the MC
+static const GoldenCmd golden_cmds[] = {
+    {     0,  0,   0,  0,  0, 0x00000000, { 0x00, 0x00, 0x00, 0x00 } },
+    {     1,  0,   0,  0,  0, 0x00000001, { 0x01, 0x00, 0x00, 0x00 } },
+    {     0,  0,   0,  0, 11, 0xb0000000, { 0x00, 0x00, 0x00, 0xb0 } },
+    { 0xfff, 15, 255, -1, 15, 0xffffffff, { 0xff, 0xff, 0xff, 0xff } },
+    { 0x123,  4,0x56,  7,  8, 0x87564123, { 0x23, 0x41, 0x56, 0x87 } },
+    {   500,  8,  50, -1,  4, 0x4f3281f4, { 0xf4, 0x81, 0x32, 0x4f } },
+    {  4095,  1, 100, -8,  0, 0x08641fff, { 0xff, 0x1f, 0x64, 0x08 } },
+};
+
+static PidiCmd golden_to_cmd(GoldenCmd g)
+{
+    PidiCmd cmd  = {0};
+    cmd.dt       = g.dt;
+    cmd.velocity = g.velocity;
+    cmd.len      = g.len;
+    cmd.octave   = (u32)g.octave;
+    cmd.key      = g.key;
+    return cmd;
+}
+
+bool packTest(void)
+{
+    for (u32 i = 0; i < ARR_LEN(golden_cmds); i++) {
+        GoldenCmd g = golden_cmds[i];
+        PidiCmd cmd = golden_to_cmd(g);
+        ASSERT(pidi_pack(cmd) == g.packed);
+
+        PidiCmd out = pidi_unpack(g.packed);
+        ASSERT(pidi_dt(out) == g.dt);
+        ASSERT(pidi_velocity(out) == g.velocity);
+        ASSERT(pidi_len(out) == g.len);
+        ASSERT(pidi_octave(out) == g.octave);
+        ASSERT(pidi_key(out) == g.key);
+    }
+    return true;
+}
+
+bool encodeTest(void)
+{
+    AIL_Buffer buf = ail_buf_new(ARR_LEN(golden_cmds)*ENCODED_CMD_LEN);
+    for (u32 i = 0; i < ARR_LEN(golden_cmds); i++) encode_cmd(&buf, golden_to_cmd(golden_cmds[i]));
+    for (u32 i = 0; i < ARR_LEN(golden_cmds); i++) {
+        u8 simple[ENCODED_CMD_LEN];
+        encode_cmd_simple(simple, golden_to_cmd(golden_cmds[i]));
+        ASSERT(memcmp(simple, golden_cmds[i].bytes, ENCODED_CMD_LEN) == 0);
+        ASSERT(memcmp(&buf.data[i*ENCODED_CMD_LEN], golden_cmds[i].bytes, ENCODED_CMD_LEN) == 0);
+        ASSERT(pidi_pack(decode_cmd_simple((u8 *)golden_cmds[i].bytes)) == golden_cmds[i].packed);
+    }
+    buf.idx = 0;
+    for (u32 i = 0; i < ARR_LEN(golden_cmds); i++) ASSERT(pidi_pack(decode_cmd(&buf)) == golden_cmds[i].packed);
+    ail_buf_free(buf);
+    return true;
+}
+
+typedef struct Note {
+    u64 start;
+    u64 end;
+    i8  octave;
+    u8  key;
+} Note;
+
+// Replays the commands and writes the notes, that would be played, into `out`
+// Segments of the same key that directly follow each other (or overlap by `overlap` ms) are merged back into one note
+static u32 replay(PidiCmd *cmds, u32 count, u32 overlap, Note *out)
+{
+    u32 n = 0;
+    u64 t = 0;
+    for (u32 i = 0; i < count; i++) {
+        t += pidi_dt(cmds[i]);
+        if (!pidi_velocity(cmds[i])) continue;
+        u64 end = t + pidi_len(cmds[i])*LEN_FACTOR;
+        bool merged = false;
+        for (u32 j = n; j-- > 0;) {
+            if (out[j].octave == pidi_octave(cmds[i]) && out[j].key == pidi_key(cmds[i]) && out[j].end == t + overlap) {
+                out[j].end = end;
+                merged = true;
+                break;
+            }
+        }
+        if (!merged) out[n++] = (Note){ t, end, pidi_octave(cmds[i]), pidi_key(cmds[i]) };
+    }
+    return n;
+}
+
+static bool check_normalized(PidiCmdWide *src, u32 count, PidiLongNoteMode mode)
+{
+    AIL_DA(PidiCmd) cmds = ail_da_new_empty(PidiCmd);
+    pidi_normalize(src, count, mode, &cmds);
+    Note *notes = malloc(sizeof(Note)*cmds.len);
+    u32 n = replay(cmds.data, cmds.len, mode == PIDI_LONG_NOTE_CONTINUE ? LEN_FACTOR : 0, notes);
+    ASSERT(n == count);
+    u64 t = 0;
+    for (u32 i = 0; i < count; i++) {
+        t += src[i].dt;
+        ASSERT(notes[i].start == t);
+        ASSERT(notes[i].key == src[i].key && notes[i].octave == src[i].octave);
+        u64 len = notes[i].end - notes[i].start;
+        ASSERT(len + LEN_FACTOR/2 >= src[i].len && len <= src[i].len + LEN_FACTOR/2);
+    }
+    free(notes);
+    ail_da_free(&cmds);
+    return true;
+}
+
+bool normalizeTest(void)
+{
+    PidiCmdWide src[] = {
+        {     0,   500, 8,  0, PIANO_KEY_C },
+        {     0, 10000, 8,  0, PIANO_KEY_E }, // Long note with other notes during it
+        {  1000,   200, 4,  1, PIANO_KEY_G },
+        {  2000,  2550, 4, -1, PIANO_KEY_A }, // Exactly fits
+        { 10000,   300, 8,  0, PIANO_KEY_C }, // Long rest
+        {  4095,  2551, 8,  0, PIANO_KEY_D },
+        {     5,  6004, 8,  2, PIANO_KEY_B }, // Long note at the end
+    };
+    ASSERT(check_normalized(src, ARR_LEN(src), PIDI_LONG_NOTE_RESTRIKE));
+    ASSERT(check_normalized(src, ARR_LEN(src), PIDI_LONG_NOTE_CONTINUE));
+
+    AIL_DA(PidiCmd) cmds = ail_da_new_empty(PidiCmd);
+    pidi_normalize(src, ARR_LEN(src), PIDI_LONG_NOTE_RESTRIKE, &cmds);
+    u64 total = 0;
+    for (u32 i = 0; i < cmds.len; i++) total += pidi_dt(cmds.data[i]);
+    ASSERT(total == 0 + 0 + 1000 + 2000 + 10000 + 4095 + 5 + 2550*2); // The last note's last segment starts 2*2550ms after it
+    ail_da_free(&cmds);
+    return true;
+}
+
+bool normalizeFastPathTest(void)
+{
+    PidiCmdWide src[] = {
+        { 100, 1000, 8, 0, PIANO_KEY_C },
+        {   0,    4, 8, 0, PIANO_KEY_E }, // Shorter than a centisecond, but should still be played
+        { 4095, 2550, 1, 0, PIANO_KEY_G },
+    };
+    AIL_DA(PidiCmd) cmds = ail_da_new_empty(PidiCmd);
+    pidi_normalize(src, ARR_LEN(src), PIDI_LONG_NOTE_RESTRIKE, &cmds);
+    ASSERT(cmds.len == ARR_LEN(src));
+    ASSERT(pidi_len(cmds.data[1]) == 1);
+    ASSERT(pidi_dt(cmds.data[2]) == MAX_DT && pidi_len(cmds.data[2]) == MAX_LEN);
+    ail_da_free(&cmds);
+    return true;
+}
+
+bool timelineTest(void)
+{
+#define TIMELINE_CMDS 1003 // Not a multiple of 4 to test the scalar tail of the prefix-sum
+    PidiCmd *cmds = malloc(sizeof(PidiCmd)*TIMELINE_CMDS);
+    for (u32 i = 0; i < TIMELINE_CMDS; i++) {
+        cmds[i] = pidi_unpack(rng());
+        cmds[i].key %= PIANO_KEY_AMOUNT;
+        if (i % 3) cmds[i].dt = rng() % 8; // Lots of chords
+    }
+    PidiTimeline tl = pidi_timeline_new(cmds, TIMELINE_CMDS, &ail_default_allocator);
+    ASSERT(tl.len == TIMELINE_CMDS);
+
+    u32 t = 0, end = 0;
+    for (u32 i = 0; i < TIMELINE_CMDS; i++) {
+        t  += pidi_dt(cmds[i]);
+        end = AIL_MAX(end, t + pidi_len(cmds[i])*LEN_FACTOR);
+        ASSERT(tl.start_ms[i] == t);
+        ASSERT(tl.dur_ms[i] == pidi_len(cmds[i])*LEN_FACTOR);
+        ASSERT(tl.vel[i] == pidi_velocity(cmds[i]));
+        ASSERT(pidi_note_octave(tl.note[i]) == pidi_octave(cmds[i]));
+        ASSERT(pidi_note_key(tl.note[i]) == pidi_key(cmds[i]));
+    }
+    ASSERT(tl.end_ms == end);
+
+    u32 active[TIMELINE_CMDS];
+    for (u32 q = 0; q < 200; q++) {
+        u32 at = rng() % (tl.end_ms + 100);
+        u32 n  = pidi_timeline_active(&tl, at, active, TIMELINE_CMDS);
+        u32 expected = 0;
+        for (u32 i = 0; i < tl.len; i++) {
+            if (tl.vel[i] && tl.start_ms[i] <= at && at < tl.start_ms[i] + tl.dur_ms[i]) {
+                ASSERT(expected < n && active[expected] == i);
+                expected++;
+            }
+        }
+        ASSERT(n == expected);
+
+        u32 lo, hi, b = at + rng() % 5000;
+        pidi_timeline_window(&tl, at, b, &lo, &hi);
+        for (u32 i = 0; i < tl.len; i++) {
+            bool in = at <= tl.start_ms[i] && tl.start_ms[i] < b;
+            ASSERT(in == (lo <= i && i < hi));
+        }
+    }
+    pidi_timeline_free(&tl);
+    free(cmds);
+    return true;
+}
+
+bool intervalIndexTest(void)
+{
+    // Tests several sizes, so that the rightmost subtrees are incomplete in different ways
+    u32 sizes[] = { 0, 1, 2, 3, 7, 8, 9, 31, 100, 1025, 5000 };
+    u32 active[5000], stabbed[5000];
+    for (u32 s = 0; s < ARR_LEN(sizes); s++) {
+        u32 n = sizes[s];
+        PidiCmd *cmds = malloc(sizeof(PidiCmd)*n + 1);
+        for (u32 i = 0; i < n; i++) {
+            cmds[i] = pidi_unpack(rng());
+            cmds[i].key %= PIANO_KEY_AMOUNT;
+            cmds[i].dt   = rng() % 300;
+        }
+        PidiTimeline tl       = pidi_timeline_new(cmds, n, &ail_default_allocator);
+        PidiIntervalIndex idx = pidi_interval_index_new(&tl);
+        for (u32 q = 0; q < 300; q++) {
+            u32 t  = rng() % (tl.end_ms + 10);
+            u32 na = pidi_timeline_active(&tl, t, active, n);
+            u32 ns = pidi_interval_index_stab(&idx, t, stabbed, n);
+            ASSERT(na == ns);
+            for (u32 i = 0; i < na; i++) ASSERT(active[i] == stabbed[i]);
+
+            AIL_SDA(PlayedKeySPPP, 16) pks = ail_sda_new(PlayedKeySPPP, 16);
+            u8 npk = pidi_played_keys_at(&idx, t, &pks);
+            ASSERT(npk == AIL_MIN(na, 255) && pks.len == npk);
+            ASSERT(ail_sda_is_inline(&pks) == (npk <= 16));
+            ail_sda_fix(&pks);
+            for (u32 i = 0; i < npk; i++) {
+                u32 j = active[i];
+                ASSERT(sppp_pk_key(pks.data[i]) == pidi_key(cmds[j]));
+                ASSERT(sppp_pk_octave(pks.data[i]) == pidi_octave(cmds[j]));
+                ASSERT(sppp_pk_velocity(pks.data[i]) == pidi_velocity(cmds[j]));
+                ASSERT(sppp_pk_len(pks.data[i]) > 0 && sppp_pk_len(pks.data[i])*LEN_FACTOR >= tl.start_ms[j] + tl.dur_ms[j] - t);
+            }
+
+            // The message carries exactly these keys in front of the commands
+            u16 nc = (u16)AIL_MIN(4, n);
+            AIL_Buffer a = ail_buf_new(SPPP_HEADER_SIZE + 1 + 255*SPPP_PK_ENCODED_SIZE + 2 + nc*ENCODED_CMD_LEN);
+            AIL_Buffer b = ail_buf_new(a.cap);
+            sppp_write_new_music_at(&a, &idx, t, cmds, nc);
+            sppp_write_new_music(&b, pks.data, npk, cmds, nc);
+            ASSERT(a.len == b.len && a.len == (u64)(SPPP_HEADER_SIZE + 1 + npk*SPPP_PK_ENCODED_SIZE + 2 + nc*ENCODED_CMD_LEN));
+            ASSERT(memcmp(a.data, b.data, a.len) == 0);
+            ail_buf_free(a);
+            ail_buf_free(b);
+            ail_sda_free(&pks);
+        }
+        pidi_interval_index_free(&idx);
+        pidi_timeline_free(&tl);
+        free(cmds);
+    }
+    return true;
+}
+
+int main(void)
+{
+    if (packTest())              printf("\033[32mPack Test successful                    :)\033[0m\n");
+    else                         printf("\033[31mPack Test failed                        :(\033[0m\n");
+    if (encodeTest())            printf("\033[32mEncode Test successful                  :)\033[0m\n");
+    else                         printf("\033[31mEncode Test failed                      :(\033[0m\n");
+    if (normalizeTest())         printf("\033[32mNormalization Test successful           :)\033[0m\n");
+    else                         printf("\033[31mNormalization Test failed               :(\033[0m\n");
+    if (normalizeFastPathTest()) printf("\033[32mNormalization Fast-Path Test successful :)\033[0m\n");
+    else                         printf("\033[31mNormalization Fast-Path Test failed     :(\033[0m\n");
+    if (timelineTest())          printf("\033[32mTimeline Test successful                :)\033[0m\n");
+    else                         printf("\033[31mTimeline Test failed                    :(\033[0m\n");
+    if (intervalIndexTest())     printf("\033[32mInterval Index Test successful          :)\033[0m\n");
+    else                         printf("\033[31mInterval Index Test failed              :(\033[0m\n");
+    return 0;
+}
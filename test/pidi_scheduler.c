@@ -0,0 +1,138 @@
+// Test pidi_scheduler.h
+
+#define _POSIX_C_SOURCE 200809L // For clock_nanosleep
+#define AIL_TYPES_IMPL
+#define AIL_TIME_IMPL
+#define PIDI_SCHEDULER_IMPL
+#include "../pidi_scheduler.h"
+#include "../ail/test/test_assert.h"
+#include <stdio.h>
+
+// Simulated clock, that oversleeps every sleep by `oversleep_ns` and advances by `spin_step_ns` per spin
+typedef struct SimClock {
+    u64 now;
+    u64 oversleep_ns;
+    u64 spin_step_ns;
+    u64 sleeps;
+} SimClock;
+
+static u64 sim_now(void *data)
+{
+    return ((SimClock *)data)->now;
+}
+
+static void sim_wait_until(void *data, u64 deadline_ns, bool spin)
+{
+    SimClock *c = data;
+    if (c->now >= deadline_ns) return;
+    if (spin) {
+        while (c->now < deadline_ns) c->now += c->spin_step_ns;
+    } else {
+        c->sleeps++;
+        c->now = deadline_ns + c->oversleep_ns;
+    }
+}
+
+static PidiClock sim_clock(SimClock *c)
+{
+    PidiClock clock;
+    clock.data          = c;
+    clock.now_ns        = &sim_now;
+    clock.wait_until_ns = &sim_wait_until;
+    return clock;
+}
+
+bool testNoDrift(void)
+{
+    // Each sleep oversleeps by 50µs, which would add up to 5s over 100000 relative sleeps
+    SimClock c = { .now = 1000, .oversleep_ns = 50000, .spin_step_ns = 10 };
+    PidiScheduler s = pidi_scheduler_new(sim_clock(&c));
+    for (u32 i = 0; i < 100000; i++) {
+        PidiCmd cmd = {0};
+        cmd.dt = 7;
+        i64 late = pidi_scheduler_wait(&s, cmd);
+        ASSERT(late >= 0 && late < 10);
+    }
+    ASSERT(s.position_ms == 700000);
+    ASSERT(c.now - 1000 - 700000ULL*1000000 < 10);
+    ASSERT(s.stats.waits == 100000);
+    ASSERT(s.stats.late  == 0);
+    ASSERT(c.sleeps == 100000);
+    return true;
+}
+
+bool testLateCommands(void)
+{
+    // Oversleeping past the spin window makes single commands late, but the following ones catch up
+    SimClock c = { .now = 0, .oversleep_ns = 300000, .spin_step_ns = 1 };
+    PidiScheduler s = pidi_scheduler_new(sim_clock(&c));
+    for (u32 i = 0; i < 1000; i++) {
+        i64 late = pidi_scheduler_wait_ms(&s, 1);
+        ASSERT(late == 200000);
+    }
+    ASSERT(c.now == 1000ULL*1000000 + 200000);
+    ASSERT(s.stats.late == 1000);
+    ASSERT(s.stats.min_lateness_ns == 200000);
+    ASSERT(s.stats.max_lateness_ns == 200000);
+    ASSERT(pidi_scheduler_mean_lateness_ns(&s.stats) == 200000);
+    ASSERT(pidi_scheduler_jitter_ns(&s.stats) < 1);
+
+    // Commands without any dt are due immediately
+    u64 before = c.now;
+    ASSERT(pidi_scheduler_wait_ms(&s, 0) == 200000);
+    ASSERT(c.now == before);
+    return true;
+}
+
+bool testSpeed(void)
+{
+    SimClock c = { .now = 0, .oversleep_ns = 0, .spin_step_ns = 1 };
+    PidiScheduler s = pidi_scheduler_new(sim_clock(&c));
+
+    // 3 is not a divisor of 1ms, so every single conversion has to be rounded
+    pidi_scheduler_set_speed(&s, 3.0f);
+    for (u32 i = 0; i < 30000; i++) pidi_scheduler_wait_ms(&s, 1);
+    ASSERT(c.now == 10000ULL*1000000);
+
+    pidi_scheduler_set_speed(&s, 0.5f);
+    for (u32 i = 0; i < 1000; i++) pidi_scheduler_wait_ms(&s, 5);
+    ASSERT(c.now == 20000ULL*1000000);
+    ASSERT(s.anchor_position_ns == 30000ULL*1000000);
+
+    // Changing the speed in the middle of a command only affects the remaining part
+    pidi_scheduler_set_speed(&s, 1.0f);
+    c.now += 500000; // 0.5ms at speed 1
+    pidi_scheduler_set_speed(&s, 2.0f);
+    pidi_scheduler_wait_ms(&s, 1);
+    ASSERT(c.now == 20000ULL*1000000 + 750000);
+    ASSERT(s.stats.max_lateness_ns == 0);
+    return true;
+}
+
+bool testMonotonic(void)
+{
+    u64 start = ail_time_now_ns(); // Before the scheduler's anchor, since its deadlines are met exactly
+    PidiScheduler s = pidi_scheduler_new(pidi_clock_monotonic());
+    for (u32 i = 0; i < 20; i++) pidi_scheduler_wait_ms(&s, 1);
+    u64 elapsed = ail_time_now_ns() - start;
+    ASSERT(elapsed >= 20ULL*1000000);
+    ASSERT(s.stats.min_lateness_ns >= 0);
+    printf("  Monotonic clock: mean lateness %.0fns, jitter %.0fns, max lateness %lldns\n",
+           pidi_scheduler_mean_lateness_ns(&s.stats), pidi_scheduler_jitter_ns(&s.stats), (long long)s.stats.max_lateness_ns);
+    // The spin at the end of each wait makes up for the sleep's wake-up latency
+    ASSERT(pidi_scheduler_mean_lateness_ns(&s.stats) < (f64)s.spin_ns);
+    return true;
+}
+
+int main(void)
+{
+    if (testNoDrift())      printf("\033[32mNo Drift Test successful  :)\033[0m\n");
+    else                    printf("\033[31mNo Drift Test failed      :(\033[0m\n");
+    if (testLateCommands()) printf("\033[32mLateness Test successful  :)\033[0m\n");
+    else                    printf("\033[31mLateness Test failed      :(\033[0m\n");
+    if (testSpeed())        printf("\033[32mSpeed Test successful     :)\033[0m\n");
+    else                    printf("\033[31mSpeed Test failed         :(\033[0m\n");
+    if (testMonotonic())    printf("\033[32mMonotonic Test successful :)\033[0m\n");
+    else                    printf("\033[31mMonotonic Test failed     :(\033[0m\n");
+    return 0;
+}
@@ -0,0 +1,244 @@
+// Test and benchmark for pidi_sim.h
+//
+// Usage: ./pidi_sim [file.pidi]
+// After the tests, the latency and jitter of streaming the given song (or a synthetic song with dense passages)
+// are reported for several baud rates, buffer sizes and chunk sizes
+
+#define AIL_TYPES_IMPL
+#define AIL_FS_IMPL
+#define PIDI_SIM_IMPL
+#include "../pidi_sim.h"
+#include "../ail/ail_fs.h"
+#include "../ail/test/test_assert.h"
+#define TEST_RNG_SEED 0x12345678
+#include "test_util.h"
+#include <stdio.h>
+
+static PidiCmd note(u32 dt)
+{
+    PidiCmd cmd = {0};
+    cmd.dt       = dt;
+    cmd.velocity = 8;
+    cmd.len      = 20;
+    cmd.key      = rng() & 7;
+    return cmd;
+}
+
+bool sparseTest(void)
+{
+    AIL_DA(PidiCmd) cmds = ail_da_new_with_cap(PidiCmd, 500);
+    for (u32 i = 0; i < 500; i++) ail_da_push(&cmds, note(100));
+    u64 *fire_ns = malloc(sizeof(u64)*cmds.len);
+
+    PidiSimConfig cfg = pidi_sim_default_config();
+    cfg.baud_rate = 9600;
+    PidiSimReport r = pidi_sim_run(cmds.data, cmds.len, cfg, fire_ns);
+    ASSERT(r.fired == cmds.len);
+    ASSERT(r.underruns == 0);
+    ASSERT(r.overflows == 0);
+    ASSERT(r.max_error_ns == 0);
+    for (u32 i = 0; i < cmds.len; i++) ASSERT(fire_ns[i] == (u64)(i + 1)*100*1000000);
+    // New-Music with 128 commands, followed by Music messages with 128, 128, 116 and 0 commands
+    ASSERT(r.ui_msgs == 1 + 1 + 4);
+    ASSERT(r.requests == 4);
+    ASSERT(r.ui_bytes == SPPP_HEADER_SIZE + 1 + (SPPP_MUSIC_MSG_SIZE(128) + 1) + 3*SPPP_MUSIC_MSG_SIZE(128) - 12*ENCODED_CMD_LEN + SPPP_MUSIC_MSG_SIZE(0));
+    // The song starts once Ping, Pong and New-Music were sent
+    u64 byte_ns = (10*1000000000ULL + 9600/2)/9600;
+    ASSERT(r.start_ns == (SPPP_HEADER_SIZE + 1 + SPPP_HEADER_SIZE + 2 + 2 + 1 + 1 + SPPP_MUSIC_MSG_SIZE(128) + 1)*byte_ns);
+
+    // Playing twice as fast halves all times
+    cfg.speed = 2.0f;
+    r = pidi_sim_run(cmds.data, cmds.len, cfg, fire_ns);
+    ASSERT(r.underruns == 0);
+    ASSERT(r.max_error_ns == 0);
+    for (u32 i = 0; i < cmds.len; i++) ASSERT(fire_ns[i] == (u64)(i + 1)*50*1000000);
+
+    free(fire_ns);
+    ail_da_free(&cmds);
+    return true;
+}
+
+bool denseTest(void)
+{
+    // 4 bytes per command take ~4.2ms at 9600 baud, so a command per millisecond can't be streamed fast enough
+    AIL_DA(PidiCmd) cmds = ail_da_new_with_cap(PidiCmd, 2000);
+    for (u32 i = 0; i < 2000; i++) ail_da_push(&cmds, note(1));
+
+    PidiSimConfig cfg = pidi_sim_default_config();
+    cfg.baud_rate = 9600;
+    PidiSimReport slow = pidi_sim_run(cmds.data, cmds.len, cfg, NULL);
+    ASSERT(slow.fired == cmds.len);
+    ASSERT(slow.overflows == 0);
+    ASSERT(slow.underruns > 0);
+    ASSERT(slow.stall_ns > 0);
+    ASSERT(slow.max_error_ns == (i64)slow.stall_ns); // Errors only ever come from stalls
+    ASSERT(slow.min_buffered == 0);
+
+    cfg.baud_rate = 230400;
+    PidiSimReport fast = pidi_sim_run(cmds.data, cmds.len, cfg, NULL);
+    ASSERT(fast.fired == cmds.len);
+    ASSERT(fast.underruns == 0);
+    ASSERT(fast.max_error_ns == 0);
+
+    // Latencies only matter, if the buffer runs low before the response arrives
+    cfg.buffer_cap    = 16;
+    cfg.ui_latency_us = 20000;
+    PidiSimReport laggy = pidi_sim_run(cmds.data, cmds.len, cfg, NULL);
+    ASSERT(laggy.fired == cmds.len);
+    ASSERT(laggy.underruns > 0);
+
+    ail_da_free(&cmds);
+    return true;
+}
+
+bool chunkerTest(void)
+{
+    PidiCmd calm[64], dense[64];
+    for (u32 i = 0; i < 64; i++) {
+        calm[i]  = note(100);
+        dense[i] = note(0);
+    }
+
+    // A few calm commands already buffer enough
+    SpppChunker c = sppp_chunker_new(9600, 32);
+    ASSERT(sppp_chunker_next(&c, 0, calm, 64) == c.min_cmds);
+    ASSERT(c.sent_ms == c.min_cmds*100);
+    sppp_chunker_start(&c, 0);
+    ASSERT(sppp_chunker_buffered_ms(&c, 300000) == (u64)c.min_cmds*100 - 300);
+    ASSERT(sppp_chunker_buffered_ms(&c, 10000000) == 0);
+    // Dense commands don't buy any time, so as many as possible are sent
+    ASSERT(sppp_chunker_next(&c, 10000000, dense, 64) == 32);
+    ASSERT(sppp_chunker_next(&c, 10000000, dense, 5) == 5);
+
+    // Longer round trips and faster playback require larger chunks
+    SpppChunker slow = sppp_chunker_new(9600, 32);
+    sppp_chunker_observe_rtt(&slow, 1000000);
+    ASSERT(slow.rtt_us == 1000000);
+    ASSERT(sppp_chunker_next(&slow, 0, calm, 64) > c.min_cmds);
+    sppp_chunker_observe_rtt(&slow, 200000);
+    ASSERT(slow.rtt_us == 900000);
+    SpppChunker fast = sppp_chunker_new(9600, 32);
+    sppp_chunker_set_speed(&fast, 0, 4.0f);
+    ASSERT(sppp_chunker_next(&fast, 0, calm, 64) > c.min_cmds);
+
+    // A new speed only applies from the time it was sent on and nothing is played while the song is paused
+    SpppChunker sp = sppp_chunker_new(9600, 32);
+    sp.sent_ms = 10000;
+    sppp_chunker_start(&sp, 1000000);
+    ASSERT(sppp_chunker_buffered_ms(&sp, 3000000) == 8000);
+    sppp_chunker_set_speed(&sp, 3000000, 0.5f);
+    ASSERT(sppp_chunker_buffered_ms(&sp, 3000000) == 8000);
+    ASSERT(sppp_chunker_buffered_ms(&sp, 5000000) == 7000);
+    sppp_chunker_set_speed(&sp, 5000000, 2.0f);
+    ASSERT(sppp_chunker_buffered_ms(&sp, 6000000) == 5000);
+    sppp_chunker_continue(&sp, 6000000, false);
+    ASSERT(sppp_chunker_buffered_ms(&sp, 9000000) == 5000);
+    sppp_chunker_set_speed(&sp, 9000000, 1.0f);
+    sppp_chunker_continue(&sp, 9000000, false);
+    ASSERT(sppp_chunker_buffered_ms(&sp, 10000000) == 5000);
+    sppp_chunker_continue(&sp, 10000000, true);
+    ASSERT(sppp_chunker_buffered_ms(&sp, 10500000) == 4500);
+    ASSERT(sppp_chunker_buffered_ms(&sp, 20000000) == 0);
+    // Slowing down must not make the chunker think more is buffered than before
+    sp.sent_ms = 10000;
+    sppp_chunker_start(&sp, 0);
+    sppp_chunker_set_speed(&sp, 4000000, 0.25f);
+    ASSERT(sppp_chunker_buffered_ms(&sp, 4000000) == 6000);
+    ASSERT(sppp_chunker_buffered_ms(&sp, 8000000) == 5000);
+
+    // Streaming with the chunker starts the song quickly without causing more underruns than the largest chunks
+    AIL_DA(PidiCmd) song = synth_song(STYLE_BURSTS, 5000);
+    PidiSimConfig cfg = pidi_sim_default_config();
+    cfg.ui_latency_us = 2000;
+    PidiSimReport fixed = pidi_sim_run(song.data, song.len, cfg, NULL);
+    cfg.adaptive = true;
+    PidiSimReport adaptive = pidi_sim_run(song.data, song.len, cfg, NULL);
+    ASSERT(adaptive.fired == song.len);
+    ASSERT(adaptive.overflows == 0);
+    ASSERT(adaptive.start_ns*4 < fixed.start_ns);
+    ASSERT(adaptive.stall_ns <= fixed.stall_ns);
+    ail_da_free(&song);
+    return true;
+}
+
+bool deltaTest(void)
+{
+    // Playing the same notes over and over again compresses well
+    AIL_DA(PidiCmd) cmds = ail_da_new_with_cap(PidiCmd, 2000);
+    for (u32 i = 0; i < 2000; i++) {
+        PidiCmd cmd = note(i % 3 ? 0 : 6);
+        cmd.key = i % 3;
+        ail_da_push(&cmds, cmd);
+    }
+    u64 *plain_ns = malloc(sizeof(u64)*cmds.len);
+    u64 *delta_ns = malloc(sizeof(u64)*cmds.len);
+
+    PidiSimConfig cfg = pidi_sim_default_config();
+    cfg.baud_rate = 19200;
+    PidiSimReport plain = pidi_sim_run(cmds.data, cmds.len, cfg, plain_ns);
+    cfg.delta = true;
+    PidiSimReport delta = pidi_sim_run(cmds.data, cmds.len, cfg, delta_ns);
+    ASSERT(delta.fired == cmds.len);
+    ASSERT(delta.overflows == 0);
+    ASSERT(delta.ui_bytes*2 < plain.ui_bytes);
+    // The MC receives the commands faster, which avoids all the underruns
+    ASSERT(plain.underruns > 0);
+    ASSERT(delta.underruns == 0);
+    for (u32 i = 0; i < cmds.len; i++) ASSERT(delta_ns[i] <= plain_ns[i]);
+
+    free(plain_ns);
+    free(delta_ns);
+    ail_da_free(&cmds);
+    return true;
+}
+
+void bench(const char *path)
+{
+    AIL_DA(PidiCmd) cmds = path ? read_song(path) : synth_song(STYLE_BURSTS, 10000);
+    if (!cmds.len) {
+        printf("\033[31mCould not read PIDI file '%s'\033[0m\n", path);
+        return;
+    }
+    u64 song_ms = 0;
+    for (u32 i = 0; i < cmds.len; i++) song_ms += pidi_dt(cmds.data[i]);
+    printf("Song: %s (%u commands, %.1fs)\n", path ? path : "synthetic", cmds.len, (f64)song_ms/1000);
+
+    u32 bauds[]   = { 9600, 57600, 115200, 230400 };
+    u16 buffers[] = { 64, 256 };
+    u16 chunks[]  = { 8, 16, 0, 1 }; // 0 uses the maximum from the Pong, 1 uses a SpppChunker
+    printf("  %6s %6s %6s | %9s %11s %13s %10s %9s\n", "baud", "buffer", "chunk", "underruns", "stalled/ms", "max error/ms", "start/ms", "requests");
+    for (u32 b = 0; b < sizeof(bauds)/sizeof(bauds[0]); b++) {
+        for (u32 s = 0; s < sizeof(buffers)/sizeof(buffers[0]); s++) {
+            for (u32 c = 0; c < sizeof(chunks)/sizeof(chunks[0]); c++) {
+                PidiSimConfig cfg = pidi_sim_default_config();
+                cfg.baud_rate     = bauds[b];
+                cfg.buffer_cap    = buffers[s];
+                cfg.chunk_cmds    = chunks[c] == 1 ? 0 : chunks[c];
+                cfg.adaptive      = chunks[c] == 1;
+                cfg.ui_latency_us = 2000;
+                cfg.mc_latency_us = 100;
+                PidiSimReport r = pidi_sim_run(cmds.data, cmds.len, cfg, NULL);
+                if (r.fired == cmds.len) printf("\033[32m");
+                else printf("\033[31m");
+                if (cfg.adaptive) printf("  %6u %6u %6s |", bauds[b], buffers[s], "auto");
+                else printf("  %6u %6u %6u |", bauds[b], buffers[s], chunks[c] ? chunks[c] : buffers[s]/2);
+                printf(" %9u %11.1f %13.1f %10.1f %9u\033[0m\n", r.underruns, (f64)r.stall_ns/1e6, (f64)r.max_error_ns/1e6, (f64)r.start_ns/1e6, r.requests);
+            }
+        }
+    }
+    ail_da_free(&cmds);
+}
+
+int main(int argc, char **argv)
+{
+    if (sparseTest())  printf("\033[32mSparse Song Test successful :)\033[0m\n");
+    else               printf("\033[31mSparse Song Test failed     :(\033[0m\n");
+    if (denseTest())   printf("\033[32mDense Song Test successful  :)\033[0m\n");
+    else               printf("\033[31mDense Song Test failed      :(\033[0m\n");
+    if (chunkerTest()) printf("\033[32mChunker Test successful     :)\033[0m\n");
+    else               printf("\033[31mChunker Test failed         :(\033[0m\n");
+    if (deltaTest())   printf("\033[32mDelta Test successful       :)\033[0m\n");
+    else               printf("\033[31mDelta Test failed           :(\033[0m\n");
+    bench(argc > 1 ? argv[1] : NULL);
+    return 0;
+}
@@ -0,0 +1,276 @@
+// Test and benchmark the Music-Delta encoding in common.h
+//
+// Usage: ./sppp_delta [file.mid | file.pidi]...
+// After the tests, the compression ratio and decoding throughput are measured on a corpus of synthetic songs in different
+// styles and on all given songs
+
+#define _POSIX_C_SOURCE 199309L
+#define AIL_TYPES_IMPL
+#define AIL_FS_IMPL
+#define AIL_TIME_IMPL
+#define MIDI_TO_PIDI_IMPL
+#include "../midi_to_pidi.h"
+#include "../ail/ail_fs.h"
+#include "../ail/ail_time.h"
+#include "../ail/test/test_assert.h"
+#define TEST_RNG_SEED 0x9e3779b9
+#include "test_util.h"
+#include <stdio.h>
+#include <string.h>
+
+#define CHUNK_CMDS       128 // Commands per Music message
+#define BENCH_ITERATIONS 20
+
+// Encodes and decodes `cmds` as a single Music-Delta message
+static bool roundtrip(const PidiCmd *cmds, u16 count)
+{
+    AIL_Buffer msg = ail_buf_new(SPPP_DELTA_MSG_MAX_SIZE(count));
+    sppp_write_music_delta(&msg, cmds, count);
+    msg.idx = 0;
+    ASSERT(ail_buf_read4msb(&msg) == (SPPP_MAGIC | CMSG_MUSIC_DELTA));
+    ASSERT(ail_buf_read2lsb(&msg) == count);
+    u16 bytes = ail_buf_read2lsb(&msg);
+    ASSERT(bytes == sppp_delta_size(cmds, count));
+    ASSERT(msg.len == SPPP_HEADER_SIZE + 4 + (u64)bytes);
+    ASSERT(msg.len <= (u64)SPPP_DELTA_MSG_MAX_SIZE(count));
+
+    PidiCmd *out = malloc(sizeof(PidiCmd)*(count + 1));
+    ASSERT(sppp_delta_decode(&msg.data[msg.idx], bytes, out, count));
+    for (u16 i = 0; i < count; i++) ASSERT(cmd_eq(out[i], cmds[i]));
+
+    // Decoding while the bytes trickle in one at a time, just like on the MC
+    SpppDeltaDecoder d = sppp_delta_decoder_new(count, bytes);
+    u16 decoded = 0;
+    for (u16 b = 0; b < bytes; b++) {
+        ASSERT(sppp_delta_decoder_wants(&d));
+        sppp_delta_decoder_push(&d, msg.data[msg.idx + b]);
+        while (sppp_delta_decoder_next(&d, &out[decoded])) {
+            ASSERT(cmd_eq(out[decoded], cmds[decoded]));
+            decoded++;
+        }
+    }
+    while (sppp_delta_decoder_next(&d, &out[decoded])) decoded++;
+    ASSERT(decoded == count);
+    ASSERT(sppp_delta_decoder_done(&d));
+
+    // Malformed payloads are rejected
+    if (count) {
+        ASSERT(!sppp_delta_decode(&msg.data[msg.idx], bytes - 1, out, count));
+        ASSERT(!sppp_delta_decode(&msg.data[msg.idx], bytes, out, count + 1));
+    }
+    u64 payload = msg.idx;
+    msg.idx = msg.len;
+    ail_buf_write1(&msg, 0);
+    msg.idx = payload;
+    ASSERT(!sppp_delta_decode(&msg.data[msg.idx], bytes + 1, out, count));
+
+    free(out);
+    ail_buf_free(msg);
+    return true;
+}
+
+bool codeTest(void)
+{
+    // Both prefix codes are complete, i.e. every sequence of bits decodes to some symbol
+    const SpppDeltaCodes *codes = sppp_delta_codes();
+    const SpppDeltaCode  *cs[]  = { &codes->dt, &codes->note };
+    for (u32 c = 0; c < 2; c++) {
+        u32 kraft = 0;
+        for (u8 l = 1; l <= SPPP_DELTA_MAX_CODE_LEN; l++) kraft += (u32)cs[c]->count[l] << (SPPP_DELTA_MAX_CODE_LEN - l);
+        ASSERT(kraft == 1u << SPPP_DELTA_MAX_CODE_LEN);
+    }
+    ASSERT(codes->dt.len[SPPP_DELTA_DT_ZERO] == 2);
+    ASSERT(codes->note.len[SPPP_DELTA_NOTE_ESCAPE] == SPPP_DELTA_MAX_CODE_LEN);
+    return true;
+}
+
+// Code lengths as documented in the table of Protocols.md, 0 for symbols that aren't in the table
+static u8 doc_dt_len[SPPP_DELTA_DT_SYMBOLS];
+static u8 doc_note_len[SPPP_DELTA_NOTE_SYMBOLS];
+static u8 doc_dt_code_len(u8 sym)   { return doc_dt_len[sym]; }
+static u8 doc_note_code_len(u8 sym) { return doc_note_len[sym]; }
+
+// Parses one column of a row of the table, i.e. "same 2 bits", "bits 5 4 bits" or "bits 1 - 4 6 bits each"
+static bool parse_doc_cell(const char *cell, bool dt, u8 *lens)
+{
+    char name[16];
+    unsigned lo, hi, l;
+    unsigned offset = dt ? 1 : 0; // dt symbols start with same and zero, note symbols only with same
+    if (sscanf(cell, " bits %u - %u %u bits each", &lo, &hi, &l) == 3) {
+        lo += offset;
+        hi += offset;
+    } else if (sscanf(cell, " bits %u %u bits", &lo, &l) == 2) {
+        lo += offset;
+        hi  = lo;
+    } else if (sscanf(cell, " %15s %u bits", name, &l) == 2) {
+        if      (strcmp(name, "same") == 0)          lo = 0;
+        else if (strcmp(name, "zero") == 0 && dt)    lo = SPPP_DELTA_DT_ZERO;
+        else if (strcmp(name, "escape") == 0 && !dt) lo = SPPP_DELTA_NOTE_ESCAPE;
+        else return false;
+        hi = lo;
+    } else return false;
+    u8 symbols = dt ? SPPP_DELTA_DT_SYMBOLS : SPPP_DELTA_NOTE_SYMBOLS;
+    for (unsigned sym = lo; sym <= hi; sym++) {
+        if (sym >= symbols || lens[sym]) return false;
+        lens[sym] = (u8)l;
+    }
+    return true;
+}
+
+bool docTest(void)
+{
+    // The tables in Protocols.md are what the MC is implemented from, so they have to describe the same codes
+    FILE *f = fopen("../Protocols.md", "r");
+    ASSERT(f != NULL);
+    char line[256];
+    u32  note_col = 0, rows = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (!note_col) {
+            char *note = strstr(line, "note:");
+            if (strncmp(line, "delta time:", 11) == 0 && note) note_col = (u32)(note - line);
+            continue;
+        }
+        if (strncmp(line, "```", 3) == 0) break;
+        line[strcspn(line, "\n")] = 0;
+        if (strlen(line) > note_col) {
+            ASSERT(parse_doc_cell(&line[note_col], false, doc_note_len));
+            line[note_col] = 0;
+        }
+        if (strspn(line, " ") < strlen(line)) { ASSERT(parse_doc_cell(line, true, doc_dt_len)); }
+        rows++;
+    }
+    fclose(f);
+    ASSERT(rows > 0);
+
+    // Every symbol is documented, the documented lengths form complete prefix codes and they match the implementation
+    u8 (*doc[2])(u8)  = { doc_dt_code_len, doc_note_code_len };
+    u8 (*impl[2])(u8) = { sppp_delta_dt_code_len, sppp_delta_note_code_len };
+    u8 symbols[2]     = { SPPP_DELTA_DT_SYMBOLS, SPPP_DELTA_NOTE_SYMBOLS };
+    for (u32 c = 0; c < 2; c++) {
+        for (u8 sym = 0; sym < symbols[c]; sym++) {
+            ASSERT(doc[c](sym) >= 1 && doc[c](sym) <= SPPP_DELTA_MAX_CODE_LEN);
+            ASSERT(doc[c](sym) == impl[c](sym));
+        }
+        SpppDeltaCode code;
+        sppp_delta_code_build(&code, symbols[c], doc[c]);
+        u32 kraft = 0;
+        for (u8 l = 1; l <= SPPP_DELTA_MAX_CODE_LEN; l++) kraft += (u32)code.count[l] << (SPPP_DELTA_MAX_CODE_LEN - l);
+        ASSERT(kraft == 1u << SPPP_DELTA_MAX_CODE_LEN);
+    }
+    return true;
+}
+
+bool roundtripTest(void)
+{
+    ASSERT(roundtrip(NULL, 0));
+
+    // Extreme values of every field
+    PidiCmd edge[] = {
+        cmd_new(MAX_DT, PIDI_NOTE(-8, PIANO_KEY_C), MAX_VELOCITY - 1, MAX_LEN),
+        cmd_new(1,      PIDI_NOTE(7, PIANO_KEY_B),  0,                0),
+        cmd_new(0,      PIDI_NOTE(-8, PIANO_KEY_C), 0,                0),
+        cmd_new(2048,   PIDI_NOTE(7, PIANO_KEY_B),  1,                1),
+        cmd_new(2048,   PIDI_NOTE(7, PIANO_KEY_B),  1,                1),
+    };
+    ASSERT(roundtrip(edge, sizeof(edge)/sizeof(edge[0])));
+
+    // Keys above B are escaped
+    PidiCmd odd[3] = { cmd_new(10, 60, 5, 5), pidi_unpack(0xf0000000), cmd_new(10, 60, 5, 5) };
+    ASSERT(roundtrip(odd, 3));
+
+    for (SongStyle style = 0; style < STYLE_COUNT; style++) {
+        AIL_DA(PidiCmd) song = synth_song(style, 1000);
+        for (u16 count = 1; count <= 300; count += 37) ASSERT(roundtrip(song.data, count));
+        ASSERT(roundtrip(song.data, CHUNK_CMDS));
+        ail_da_free(&song);
+    }
+    return true;
+}
+
+bool smallestTest(void)
+{
+    AIL_DA(PidiCmd) chorale = synth_song(STYLE_CHORALE, CHUNK_CMDS);
+    AIL_DA(PidiCmd) noise   = synth_song(STYLE_RANDOM,  CHUNK_CMDS);
+    ASSERT(sppp_delta_size(chorale.data, CHUNK_CMDS)*2 < CHUNK_CMDS*ENCODED_CMD_LEN);
+    ASSERT(sppp_delta_size(noise.data,   CHUNK_CMDS)   > CHUNK_CMDS*ENCODED_CMD_LEN);
+
+    AIL_Buffer msg = ail_buf_new(SPPP_MUSIC_MSG_SIZE(CHUNK_CMDS));
+    sppp_write_music_smallest(&msg, chorale.data, CHUNK_CMDS, SPPP_ENCODING_DELTA);
+    ASSERT(msg.data[SPPP_HEADER_SIZE - 1] == CMSG_MUSIC_DELTA);
+    msg.idx = msg.len = 0;
+    sppp_write_music_smallest(&msg, chorale.data, CHUNK_CMDS, 0);
+    ASSERT(msg.data[SPPP_HEADER_SIZE - 1] == CMSG_MUSIC);
+    msg.idx = msg.len = 0;
+    sppp_write_music_smallest(&msg, noise.data, CHUNK_CMDS, SPPP_ENCODING_DELTA);
+    ASSERT(msg.data[SPPP_HEADER_SIZE - 1] == CMSG_MUSIC);
+    ASSERT(msg.len == SPPP_MUSIC_MSG_SIZE(CHUNK_CMDS));
+
+    ail_buf_free(msg);
+    ail_da_free(&chorale);
+    ail_da_free(&noise);
+    return true;
+}
+
+static void bench_song(const char *name, const PidiCmd *cmds, u32 count)
+{
+    // Every chunk is encoded as its own message, just like when streaming the song
+    u32 chunks = (count + CHUNK_CMDS - 1)/CHUNK_CMDS;
+    AIL_Buffer *msgs  = malloc(sizeof(AIL_Buffer)*chunks);
+    u64 raw_bytes = 0, delta_bytes = 0, smallest_bytes = 0;
+    for (u32 c = 0; c < chunks; c++) {
+        u16 n = (u16)(count - c*CHUNK_CMDS < CHUNK_CMDS ? count - c*CHUNK_CMDS : CHUNK_CMDS);
+        msgs[c] = ail_buf_new(SPPP_DELTA_MSG_MAX_SIZE(n));
+        sppp_write_music_delta(&msgs[c], &cmds[c*CHUNK_CMDS], n);
+        raw_bytes   += SPPP_MUSIC_MSG_SIZE(n);
+        delta_bytes += msgs[c].len;
+        smallest_bytes += msgs[c].len < (u64)SPPP_MUSIC_MSG_SIZE(n) ? msgs[c].len : (u64)SPPP_MUSIC_MSG_SIZE(n);
+    }
+
+    PidiCmd out[CHUNK_CMDS];
+    bool ok = true;
+    u64 start = ail_time_now_ns();
+    for (u32 it = 0; it < BENCH_ITERATIONS; it++) {
+        for (u32 c = 0; c < chunks; c++) {
+            const u8 *p = &msgs[c].data[SPPP_HEADER_SIZE];
+            u16 n     = (u16)(p[0] | (p[1] << 8));
+            u16 bytes = (u16)(p[2] | (p[3] << 8));
+            ok &= sppp_delta_decode(p + 4, bytes, out, n);
+        }
+    }
+    f64 secs = (f64)(ail_time_now_ns() - start)/1e9;
+
+    printf("  %-20.20s %8u | %9llu %9llu %6.2f %9llu | %9.1f %s\n", name, count, (unsigned long long)raw_bytes, (unsigned long long)delta_bytes,
+           (f64)raw_bytes/(f64)delta_bytes, (unsigned long long)smallest_bytes, (f64)count*BENCH_ITERATIONS/secs/1e6, ok ? "" : "\033[31m(decoding failed)\033[0m");
+    for (u32 c = 0; c < chunks; c++) ail_buf_free(msgs[c]);
+    free(msgs);
+}
+
+void bench(int argc, char **argv)
+{
+    printf("  %-20s %8s | %9s %9s %6s %9s | %9s\n", "song", "commands", "music/B", "delta/B", "ratio", "smallest", "Mcmds/s");
+    for (SongStyle style = 0; style < STYLE_COUNT; style++) {
+        AIL_DA(PidiCmd) song = synth_song(style, 100000);
+        bench_song(style_name(style), song.data, song.len);
+        ail_da_free(&song);
+    }
+    for (int i = 1; i < argc; i++) {
+        AIL_DA(PidiCmd) song = read_song(argv[i]);
+        if (song.len) bench_song(argv[i], song.data, song.len);
+        else printf("\033[31mCould not read song '%s'\033[0m\n", argv[i]);
+        ail_da_free(&song);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (codeTest())      printf("\033[32mCode Test successful      :)\033[0m\n");
+    else                 printf("\033[31mCode Test failed          :(\033[0m\n");
+    if (docTest())       printf("\033[32mDoc Test successful       :)\033[0m\n");
+    else                 printf("\033[31mDoc Test failed           :(\033[0m\n");
+    if (roundtripTest()) printf("\033[32mRoundtrip Test successful :)\033[0m\n");
+    else                 printf("\033[31mRoundtrip Test failed     :(\033[0m\n");
+    if (smallestTest())  printf("\033[32mSmallest Test successful  :)\033[0m\n");
+    else                 printf("\033[31mSmallest Test failed      :(\033[0m\n");
+    bench(argc, argv);
+    return 0;
+}
@@ -0,0 +1,460 @@
+// Test sppp_port.h
+//
+// The MC is emulated by a child process on the other end of a pseudo terminal. Both ends pace their writes to the negotiated
+// baud rate, so the measured throughput is roughly what a real serial line would achieve.
+// Usage: ./sppp_port [serial port]
+// With a serial port, the negotiation and throughput measurements are run against the MC connected to it instead
+// Afterwards the throughput of the checksum implementations is measured
+
+#define _XOPEN_SOURCE 600 // For posix_openpt, grantpt, unlockpt and ptsname
+#define AIL_TYPES_IMPL
+#define AIL_TIME_IMPL
+#define SPPP_PORT_IMPL
+#include "../sppp_port.h"
+#include "../ail/test/test_assert.h"
+#include <stdio.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+typedef struct McConfig {
+    u16  max_cmds;
+    u16  baud_mask;
+    u32  broken_rate;   // Rate at which the MC can't receive anything
+    bool legacy;        // Whether the MC doesn't support negotiating the baud rate, checksums or Music-Delta messages
+    u8   checksums;     // Checksums that the MC supports
+    u32  corrupt_every; // Every n-th Music message is corrupted on the line (0 for never)
+    bool corrupt_count; // Whether the count of commands is corrupted instead of a command
+} McConfig;
+
+static void mc_send(SpppPort *port, AIL_Buffer *out)
+{
+    sppp_port_write_frame(port, out->data, out->len);
+    out->idx = out->len = 0;
+}
+
+// Reads the rest of a frame, which is incomplete once no byte arrived for SPPP_FRAME_GAP
+static bool mc_read(SpppPort *port, u8 *data, u64 len)
+{
+    u64 got = 0, n;
+    while (got < len && (n = sppp_port_read(port, data + got, len - got, SPPP_FRAME_GAP))) got += n;
+    return got == len;
+}
+
+static void run_mc(int fd, McConfig cfg)
+{
+    SpppPort port;
+    if (!sppp_port_from_fd(&port, fd)) _exit(1);
+    port.pace = true;
+    SpppBaudSwitch sw  = sppp_baud_switch_new();
+    AIL_Buffer     out = ail_buf_new(64);
+    u8  payload[4*1024];
+    u32 music_msgs = 0;
+    u64 start = ail_time_now_ns();
+    pid_t parent = getppid();
+    for (;;) {
+        if (getppid() != parent) _exit(0); // Don't outlive a crashed test
+        if (sppp_baud_switch_expired(&sw, (u32)((ail_time_now_ns() - start)/1000000))) sppp_port_set_baud(&port, sw.rate);
+        u8 type = sppp_port_read_header(&port, 10);
+        if (!type || port.baud == cfg.broken_rate) continue;
+        if (type == CMSG_PING) {
+            u8 offered = 0; // Older UIs don't offer any checksums
+            sppp_port_read(&port, &offered, 1, SPPP_FRAME_GAP);
+            SpppChecksum checksum = sppp_checksum_choose(offered, cfg.checksums);
+            sppp_baud_switch_confirm(&sw);
+            port.checksum = SPPP_CHECKSUM_NONE;
+            if (cfg.legacy) {
+                sppp_write_header(&out, SMSG_PONG);
+                ail_buf_write2lsb(&out, cfg.max_cmds);
+            } else {
+                sppp_write_pong(&out, cfg.max_cmds, cfg.baud_mask, checksum, SPPP_ENCODING_DELTA);
+            }
+            mc_send(&port, &out);
+            port.checksum = cfg.legacy ? SPPP_CHECKSUM_NONE : checksum;
+            continue;
+        }
+
+        u64  len = 0;
+        bool ok  = false;
+        switch (type) {
+            case CMSG_BAUD:
+                len = 4;
+                ok  = !cfg.legacy && mc_read(&port, payload, len);
+                break;
+            case CMSG_MUSIC: {
+                if (!mc_read(&port, payload, 2)) break;
+                bool corrupt = cfg.corrupt_every && ++music_msgs == cfg.corrupt_every;
+                if (corrupt) music_msgs = 0;
+                if (corrupt && cfg.corrupt_count) payload[0]++;
+                u16 count = (u16)(payload[0] | (payload[1] << 8));
+                len = 2 + count*ENCODED_CMD_LEN;
+                ok  = count <= cfg.max_cmds && mc_read(&port, payload + 2, len - 2);
+                if (corrupt && !cfg.corrupt_count) payload[2] ^= 0x10;
+            } break;
+            case CMSG_MUSIC_DELTA: {
+                if (cfg.legacy || !mc_read(&port, payload, 4)) break;
+                PidiCmd cmds[sizeof(payload)/ENCODED_CMD_LEN];
+                u16 count = (u16)(payload[0] | (payload[1] << 8));
+                u16 bytes = (u16)(payload[2] | (payload[3] << 8));
+                len = 4 + (u64)bytes;
+                ok  = count <= cfg.max_cmds && len <= sizeof(payload) && mc_read(&port, payload + 4, bytes) && sppp_delta_decode(payload + 4, bytes, cmds, count);
+            } break;
+            default: continue;
+        }
+        u8 size = sppp_checksum_size(port.checksum);
+        u8 trailer[4];
+        if (ok && size) ok = mc_read(&port, trailer, size) && sppp_decode_checksum(port.checksum, trailer) == sppp_frame_checksum(port.checksum, type, payload, len);
+        if (!ok) {
+            // Without a checksum, the UI doesn't know about NAKs and has to wait for its timeout
+            if (size) {
+                sppp_write_header(&out, SMSG_NAK);
+                mc_send(&port, &out);
+            }
+            continue;
+        }
+
+        if (type == CMSG_BAUD) {
+            u32 rate = (u32)payload[0] | ((u32)payload[1] << 8) | ((u32)payload[2] << 16) | ((u32)payload[3] << 24);
+            if (!(sppp_baud_bit(rate) & cfg.baud_mask)) continue;
+            sppp_write_header(&out, SMSG_SUCCESS);
+            mc_send(&port, &out);
+            sppp_port_set_baud(&port, rate);
+            sppp_baud_switch_begin(&sw, rate, (u32)((ail_time_now_ns() - start)/1000000));
+        } else {
+            sppp_write_header(&out, SMSG_SUCCESS);
+            mc_send(&port, &out);
+        }
+    }
+}
+
+typedef struct Harness {
+    pid_t pid;
+    SpppPort port;
+} Harness;
+
+static bool harness_start(Harness *h, McConfig cfg)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) || unlockpt(master)) return false;
+    int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    if (slave < 0) return false;
+    h->pid = fork();
+    if (h->pid < 0) return false;
+    if (!h->pid) {
+        close(master);
+        run_mc(slave, cfg);
+    }
+    close(slave);
+    if (!sppp_port_from_fd(&h->port, master)) return false;
+    h->port.pace = true;
+    return true;
+}
+
+static void harness_stop(Harness *h)
+{
+    kill(h->pid, SIGTERM);
+    waitpid(h->pid, NULL, 0);
+    sppp_port_close(&h->port);
+}
+
+static AIL_DA(PidiCmd) test_cmds(u16 count)
+{
+    AIL_DA(PidiCmd) cmds = ail_da_new_with_cap(PidiCmd, count);
+    for (u16 i = 0; i < count; i++) {
+        PidiCmd cmd = {0};
+        cmd.dt  = i;
+        cmd.key = i % PIANO_KEY_AMOUNT;
+        ail_da_push(&cmds, cmd);
+    }
+    return cmds;
+}
+
+static AIL_Buffer music_frame(u16 count)
+{
+    AIL_Buffer msg = ail_buf_new(SPPP_MUSIC_MSG_SIZE(count));
+    AIL_DA(PidiCmd) cmds = test_cmds(count);
+    sppp_write_music(&msg, cmds.data, count);
+    ail_da_free(&cmds);
+    return msg;
+}
+
+// Streams Music messages for `duration_ms` and returns the amount of command bytes that were transferred per second
+static f64 measure_throughput(SpppPort *p, u16 max_cmds, u32 duration_ms)
+{
+    AIL_Buffer msg = music_frame(max_cmds);
+    u64 start = ail_time_now_ns();
+    u64 bytes = 0;
+    while (ail_time_now_ns() - start < (u64)duration_ms*1000000) {
+        if (sppp_port_send(p, msg.data, msg.len, MSG_TIMEOUT) != SMSG_SUCCESS) {
+            bytes = 0;
+            break;
+        }
+        bytes += max_cmds*ENCODED_CMD_LEN;
+    }
+    f64 elapsed = (f64)(ail_time_now_ns() - start)/1e9;
+    ail_buf_free(msg);
+    return (f64)bytes/elapsed;
+}
+
+// Sends `count` Music messages and returns how many ms it took (or a negative number if a message wasn't acknowledged)
+static f64 send_music(SpppPort *p, u16 max_cmds, u32 count)
+{
+    AIL_Buffer msg = music_frame(max_cmds);
+    u64 start = ail_time_now_ns();
+    f64 ms    = 0;
+    for (u32 i = 0; i < count && ms >= 0; i++) {
+        if (sppp_port_send(p, msg.data, msg.len, MSG_TIMEOUT) != SMSG_SUCCESS) ms = -1;
+    }
+    if (ms >= 0) ms = (f64)(ail_time_now_ns() - start)/1e6;
+    ail_buf_free(msg);
+    return ms;
+}
+
+// Straightforward implementations to check the table-driven ones against
+static u16 crc16_ref(const u8 *data, u64 len)
+{
+    u16 crc = 0xffff;
+    for (u64 i = 0; i < len; i++) {
+        for (u8 j = 0; j < 8; j++) {
+            bool bit = ((crc >> 15) ^ (data[i] >> (7 - j))) & 1;
+            crc = (u16)(crc << 1);
+            if (bit) crc ^= 0x1021;
+        }
+    }
+    return crc;
+}
+
+static u32 crc32_ref(const u8 *data, u64 len)
+{
+    u32 crc = 0xffffffff;
+    for (u64 i = 0; i < len; i++) {
+        for (u8 j = 0; j < 8; j++) {
+            bool bit = (crc ^ (data[i] >> j)) & 1;
+            crc >>= 1;
+            if (bit) crc ^= 0xedb88320;
+        }
+    }
+    return ~crc;
+}
+
+bool baudTest(void)
+{
+    ASSERT(sppp_baud_rate(0) == BAUD_RATE);
+    ASSERT(sppp_baud_rate(SPPP_BAUD_RATES_COUNT) == 0);
+    ASSERT(sppp_baud_bit(9600)   == 1);
+    ASSERT(sppp_baud_bit(115200) == 1 << 4);
+    ASSERT(sppp_baud_bit(12345)  == 0);
+    ASSERT(sppp_baud_highest(0) == 0);
+    ASSERT(sppp_baud_highest(0x3f) == 230400);
+    ASSERT(sppp_baud_highest(sppp_baud_bit(9600) | sppp_baud_bit(57600)) == 57600);
+    ASSERT(sppp_port_baud_mask() & sppp_baud_bit(BAUD_RATE));
+
+    SpppBaudSwitch sw = sppp_baud_switch_new();
+    ASSERT(sw.rate == BAUD_RATE);
+    sppp_baud_switch_begin(&sw, 115200, 1000);
+    ASSERT(!sppp_baud_switch_expired(&sw, 1000 + SPPP_BAUD_CONFIRM_TIMEOUT - 1));
+    ASSERT(sppp_baud_switch_expired(&sw, 1000 + SPPP_BAUD_CONFIRM_TIMEOUT));
+    ASSERT(sw.rate == BAUD_RATE);
+    sppp_baud_switch_begin(&sw, 115200, 1000);
+    sppp_baud_switch_confirm(&sw);
+    ASSERT(!sppp_baud_switch_expired(&sw, 100000));
+    ASSERT(sw.rate == 115200);
+    return true;
+}
+
+bool negotiateTest(void)
+{
+    McConfig cfg = { 32, 0x3f, 0, false, SPPP_CHECKSUMS_ALL, 0, false }; // Up to 230400
+    Harness h;
+    ASSERT(harness_start(&h, cfg));
+    u16 max_cmds = 0;
+    ASSERT(sppp_port_negotiate(&h.port, sppp_port_baud_mask(), &max_cmds) == 230400);
+    ASSERT(max_cmds == 32);
+    ASSERT(h.port.baud == 230400);
+    ASSERT(h.port.encodings == SPPP_ENCODING_DELTA);
+    AIL_DA(PidiCmd) cmds = test_cmds(max_cmds);
+    AIL_Buffer delta = ail_buf_new(SPPP_DELTA_MSG_MAX_SIZE(max_cmds));
+    sppp_write_music_delta(&delta, cmds.data, max_cmds);
+    ASSERT(sppp_port_send(&h.port, delta.data, delta.len, MSG_TIMEOUT) == SMSG_SUCCESS);
+    ail_buf_free(delta);
+    ail_da_free(&cmds);
+    // Negotiating again, without any higher rate, stays at the current rate
+    ASSERT(sppp_port_negotiate(&h.port, sppp_port_baud_mask(), &max_cmds) == 230400);
+    // Going back down
+    ASSERT(sppp_port_negotiate(&h.port, sppp_baud_bit(BAUD_RATE), &max_cmds) == BAUD_RATE);
+    harness_stop(&h);
+
+    // The MC can't receive at 230400, so after the switch times out, both nodes fall back and use the next lower rate
+    cfg.broken_rate = 230400;
+    ASSERT(harness_start(&h, cfg));
+    u64 start = ail_time_now_ns();
+    ASSERT(sppp_port_negotiate(&h.port, sppp_port_baud_mask(), &max_cmds) == 115200);
+    ASSERT(ail_time_now_ns() - start < (u64)MSG_TIMEOUT*1000000);
+    harness_stop(&h);
+
+    // MCs that don't know about negotiating stay at BAUD_RATE
+    cfg.broken_rate = 0;
+    cfg.legacy      = true;
+    ASSERT(harness_start(&h, cfg));
+    ASSERT(sppp_port_negotiate(&h.port, sppp_port_baud_mask(), &max_cmds) == BAUD_RATE);
+    ASSERT(max_cmds == 32);
+    ASSERT(h.port.checksum == SPPP_CHECKSUM_NONE);
+    ASSERT(h.port.encodings == 0);
+    harness_stop(&h);
+    return true;
+}
+
+bool crcTest(void)
+{
+    const u8 *check = (const u8 *)"123456789";
+    ASSERT(sppp_crc16(SPPP_CRC16_INIT, check, 9) == 0x29b1);
+    ASSERT(sppp_crc32(SPPP_CRC32_INIT, check, 9) == 0xcbf43926);
+    ASSERT(sppp_crc32(sppp_crc32(SPPP_CRC32_INIT, check, 3), check + 3, 6) == 0xcbf43926);
+
+    // Slice-by-8 has to handle any length and alignment
+    u8 data[128];
+    for (u32 i = 0; i < sizeof(data); i++) data[i] = (u8)(i*151 + 7);
+    for (u32 start = 0; start < 8; start++) {
+        for (u32 len = 0; start + len <= sizeof(data); len++) {
+            ASSERT(sppp_crc16(SPPP_CRC16_INIT, data + start, len) == crc16_ref(data + start, len));
+            ASSERT(sppp_crc32(SPPP_CRC32_INIT, data + start, len) == crc32_ref(data + start, len));
+        }
+    }
+
+    ASSERT(sppp_checksum_choose(SPPP_CHECKSUMS_ALL, SPPP_CHECKSUMS_ALL) == SPPP_CHECKSUM_CRC32);
+    ASSERT(sppp_checksum_choose(SPPP_CHECKSUMS_ALL, SPPP_CHECKSUM_CRC16) == SPPP_CHECKSUM_CRC16);
+    ASSERT(sppp_checksum_choose(SPPP_CHECKSUM_NONE, SPPP_CHECKSUMS_ALL) == SPPP_CHECKSUM_NONE);
+
+    // Every single bit error in a frame is detected
+    SpppChecksum css[] = { SPPP_CHECKSUM_CRC16, SPPP_CHECKSUM_CRC32 };
+    for (u32 c = 0; c < sizeof(css)/sizeof(css[0]); c++) {
+        AIL_Buffer frame = music_frame(8);
+        u64 len = frame.len;
+        sppp_write_checksum(&frame, 0, css[c]);
+        ASSERT(frame.len == len + sppp_checksum_size(css[c]));
+        ASSERT(sppp_decode_checksum(css[c], &frame.data[len]) == sppp_frame_checksum(css[c], CMSG_MUSIC, &frame.data[SPPP_HEADER_SIZE], len - SPPP_HEADER_SIZE));
+        for (u64 bit = SPPP_HEADER_SIZE*8; bit < len*8; bit++) {
+            frame.data[bit/8] ^= (u8)(1 << (bit & 7));
+            ASSERT(sppp_decode_checksum(css[c], &frame.data[len]) != sppp_frame_checksum(css[c], CMSG_MUSIC, &frame.data[SPPP_HEADER_SIZE], len - SPPP_HEADER_SIZE));
+            frame.data[bit/8] ^= (u8)(1 << (bit & 7));
+        }
+        ail_buf_free(frame);
+    }
+    return true;
+}
+
+bool nakTest(void)
+{
+    McConfig cfg = { 32, 0x3f, 0, false, SPPP_CHECKSUMS_ALL, 0, false };
+    Harness h;
+    u16 max_cmds;
+    ASSERT(harness_start(&h, cfg));
+    ASSERT(sppp_port_negotiate(&h.port, sppp_port_baud_mask(), &max_cmds) == 230400);
+    ASSERT(h.port.checksum == SPPP_CHECKSUM_CRC32);
+    f64 clean = send_music(&h.port, max_cmds, 12);
+    ASSERT(clean > 0);
+    ASSERT(h.port.naks == 0);
+    harness_stop(&h);
+
+    // Every 4th message (including retransmissions) arrives with a corrupted command or count of commands
+    // Either way, the MC answers with a NAK and the message is retransmitted within a round trip
+    cfg.corrupt_every = 4;
+    for (u32 i = 0; i < 4; i++) {
+        cfg.checksums     = (i & 1) ? SPPP_CHECKSUM_CRC16 : SPPP_CHECKSUMS_ALL;
+        cfg.corrupt_count = i >= 2;
+        ASSERT(harness_start(&h, cfg));
+        ASSERT(sppp_port_negotiate(&h.port, sppp_port_baud_mask(), &max_cmds) == 230400);
+        ASSERT(h.port.checksum == ((i & 1) ? SPPP_CHECKSUM_CRC16 : SPPP_CHECKSUM_CRC32));
+        f64 noisy = send_music(&h.port, max_cmds, 12);
+        ASSERT(noisy > 0);
+        ASSERT(h.port.naks == 3); // Attempts 4, 8 and 12 were corrupted, so the 12 messages took 15 attempts
+        ASSERT(noisy < clean + 3*(SPPP_FRAME_GAP + 50));
+        harness_stop(&h);
+    }
+
+    // Without checksums, an incomplete message is only retransmitted after the UI's timeout
+    cfg.corrupt_every = 12;
+    ASSERT(harness_start(&h, cfg));
+    h.port.checksums = SPPP_CHECKSUM_NONE;
+    ASSERT(sppp_port_negotiate(&h.port, sppp_port_baud_mask(), &max_cmds) == 230400);
+    ASSERT(h.port.checksum == SPPP_CHECKSUM_NONE);
+    f64 slow = send_music(&h.port, max_cmds, 12);
+    ASSERT(slow >= MSG_TIMEOUT);
+    ASSERT(h.port.naks == 0);
+    harness_stop(&h);
+    return true;
+}
+
+bool throughputTest(void)
+{
+    McConfig cfg = { 64, 0x3f, 0, false, SPPP_CHECKSUMS_ALL, 0, false };
+    Harness h;
+    ASSERT(harness_start(&h, cfg));
+    printf("  %8s | %14s %11s\n", "baud", "payload B/s", "efficiency");
+    f64 prev = 0;
+    for (u8 i = 0; i < SPPP_BAUD_RATES_COUNT; i++) {
+        u32 rate = sppp_baud_rate(i);
+        if (!(sppp_baud_bit(rate) & cfg.baud_mask & sppp_port_baud_mask())) continue;
+        u16 max_cmds;
+        ASSERT(sppp_port_negotiate(&h.port, sppp_baud_bit(rate), &max_cmds) == rate);
+        f64 throughput = measure_throughput(&h.port, max_cmds, 300);
+        printf("  %8u | %14.0f %10.1f%%\n", rate, throughput, 100*throughput*SPPP_BITS_PER_BYTE/rate);
+        ASSERT(throughput > prev);
+        prev = throughput;
+    }
+    harness_stop(&h);
+    return true;
+}
+
+static void crc_bench(void)
+{
+    u64 len  = 1 << 20;
+    u8 *data = malloc(len);
+    for (u64 i = 0; i < len; i++) data[i] = (u8)(i*31 + (i >> 8));
+    printf("  %-22s | %8s\n", "checksum", "MB/s");
+    for (u32 impl = 0; impl < 4; impl++) {
+        const char *names[] = { "CRC-16 (bit by bit)", "CRC-16 (table)", "CRC-32 (bit by bit)", "CRC-32 (slice-by-8)" };
+        u32 reps  = (impl & 1) ? 64 : 8;
+        u32 sink  = 0;
+        u64 start = ail_time_now_ns();
+        for (u32 r = 0; r < reps; r++) {
+            switch (impl) {
+                case 0: sink ^= crc16_ref(data, len); break;
+                case 1: sink ^= sppp_crc16(SPPP_CRC16_INIT, data, len); break;
+                case 2: sink ^= crc32_ref(data, len); break;
+                case 3: sink ^= sppp_crc32(SPPP_CRC32_INIT, data, len); break;
+            }
+        }
+        f64 secs = (f64)(ail_time_now_ns() - start)/1e9;
+        printf("  %-22s | %8.1f%s\n", names[impl], (f64)(reps*len)/secs/1e6, sink == 1 ? " " : "");
+    }
+    free(data);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) {
+        SpppPort port;
+        u16 max_cmds;
+        if (!sppp_port_open(&port, argv[1])) {
+            printf("\033[31mCould not open '%s'\033[0m\n", argv[1]);
+            return 1;
+        }
+        u32 rate = sppp_port_negotiate(&port, sppp_port_baud_mask(), &max_cmds);
+        if (rate) printf("Negotiated %u baud, payload throughput: %.0f B/s\n", rate, measure_throughput(&port, max_cmds, 1000));
+        else      printf("\033[31mThe MC did not answer\033[0m\n");
+        sppp_port_close(&port);
+        return 0;
+    }
+    if (baudTest())       printf("\033[32mBaud Test successful       :)\033[0m\n");
+    else                  printf("\033[31mBaud Test failed           :(\033[0m\n");
+    if (negotiateTest())  printf("\033[32mNegotiate Test successful  :)\033[0m\n");
+    else                  printf("\033[31mNegotiate Test failed      :(\033[0m\n");
+    if (crcTest())        printf("\033[32mCRC Test successful        :)\033[0m\n");
+    else                  printf("\033[31mCRC Test failed            :(\033[0m\n");
+    if (nakTest())        printf("\033[32mNAK Test successful        :)\033[0m\n");
+    else                  printf("\033[31mNAK Test failed            :(\033[0m\n");
+    if (throughputTest()) printf("\033[32mThroughput Test successful :)\033[0m\n");
+    else                  printf("\033[31mThroughput Test failed     :(\033[0m\n");
+    crc_bench();
+    return 0;
+}
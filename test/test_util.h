@@ -0,0 +1,153 @@
+// Helpers shared by the tests and benchmarks in this folder
+//
+// Include after the headers that are tested, since read_song is only available if ail_fs.h was included and only converts
+// MIDI files if midi_to_pidi.h was included as well.
+// Define TEST_RNG_SEED before including this file to start rng() with another seed.
+
+#ifndef TEST_UTIL_H_
+#define TEST_UTIL_H_
+
+#include "../common.h"
+
+#ifndef TEST_RNG_SEED
+#define TEST_RNG_SEED 0x2545f491
+#endif // TEST_RNG_SEED
+
+// xorshift32, so that the random data is the same on every platform
+static u32 rng_state = TEST_RNG_SEED;
+static u32 rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// Writes `x` as a variable-length quantity, as used for delta times in MIDI files
+static void write_varlen(AIL_Buffer *buf, u32 x)
+{
+    u8  bytes[4];
+    u32 n = 0;
+    do {
+        bytes[n++] = x & 0x7f;
+        x >>= 7;
+    } while (x);
+    while (n-- > 1) ail_buf_write1(buf, bytes[n] | 0x80);
+    ail_buf_write1(buf, bytes[0]);
+}
+
+static PidiCmd cmd_new(u16 dt, u8 note, u8 velocity, u8 len)
+{
+    PidiCmd cmd = {0};
+    cmd.dt       = dt;
+    cmd.velocity = velocity;
+    cmd.len      = len;
+    cmd.octave   = (u8)(note/PIANO_KEY_AMOUNT - 8) & 0xf;
+    cmd.key      = note % PIANO_KEY_AMOUNT;
+    return cmd;
+}
+
+static bool cmd_eq(PidiCmd a, PidiCmd b)
+{
+    return pidi_pack(a) == pidi_pack(b);
+}
+
+typedef enum SongStyle {
+    STYLE_CHORALE,     // Four-voice chords on every beat
+    STYLE_ALBERTI,     // Melody over a broken-chord accompaniment in strict time
+    STYLE_PERFORMANCE, // Like STYLE_ALBERTI, but recorded from a human performance with jittery timing and dynamics
+    STYLE_RANDOM,      // Uniformly random fields (the worst case)
+    STYLE_BURSTS,      // Alternates between calm passages and passages with dense chords every 500 commands
+    STYLE_COUNT,
+} SongStyle;
+
+static const char *style_name(SongStyle style)
+{
+    switch (style) {
+        case STYLE_CHORALE:     return "chorale";
+        case STYLE_ALBERTI:     return "alberti";
+        case STYLE_PERFORMANCE: return "performance";
+        case STYLE_RANDOM:      return "random";
+        case STYLE_BURSTS:      return "bursts";
+        default:                return "?";
+    }
+}
+
+static AIL_DA(PidiCmd) synth_song(SongStyle style, u32 count)
+{
+    AIL_DA(PidiCmd) cmds = ail_da_new_with_cap(PidiCmd, AIL_MAX(count, 1));
+    u8 root = PIDI_NOTE(-1, PIANO_KEY_C);
+    u8 melody = PIDI_NOTE(0, PIANO_KEY_E);
+    u8 chord[4] = { 0, 4, 7, 12 };
+    for (u32 i = 0; cmds.len < count; i++) {
+        if (i % 8 == 0 && style != STYLE_RANDOM && style != STYLE_BURSTS) {
+            // Move to another chord of the key
+            u8 steps[] = { 0, 5, 7, 9, 2 };
+            root = (u8)(PIDI_NOTE(-1, PIANO_KEY_C) + steps[rng() % 5]);
+            chord[1] = (rng() & 1) ? 4 : 3;
+        }
+        switch (style) {
+            case STYLE_CHORALE: {
+                u8 velocity = 8 + (i/16) % 4;
+                for (u8 v = 0; v < 4 && cmds.len < count; v++) ail_da_push(&cmds, cmd_new(v ? 0 : 500, root + chord[v], velocity, 48));
+            } break;
+            case STYLE_ALBERTI:
+            case STYLE_PERFORMANCE: {
+                bool human = style == STYLE_PERFORMANCE;
+                u8 pattern[4] = { 0, 2, 1, 2 };
+                for (u8 j = 0; j < 4 && cmds.len < count; j++) {
+                    u16 dt  = 125;
+                    u8  vel = 6, len = 12;
+                    if (human) {
+                        dt  = (u16)(dt - 6 + rng() % 13);
+                        vel = (u8)(5 + rng() % 3);
+                        len = (u8)(10 + rng() % 5);
+                    }
+                    ail_da_push(&cmds, cmd_new(dt, root + chord[pattern[j]], vel, len));
+                    if (j % 2 == 0) {
+                        i8 step[] = { -2, -1, 1, 2, 0, 3, -3 };
+                        melody = (u8)(melody + step[rng() % 7]);
+                        if (melody < PIDI_NOTE(0, PIANO_KEY_C) || melody > PIDI_NOTE(1, PIANO_KEY_C)) melody = PIDI_NOTE(0, PIANO_KEY_G);
+                        if (cmds.len < count) ail_da_push(&cmds, cmd_new(human ? (u16)(rng() % 8) : 0, melody, human ? (u8)(8 + rng() % 4) : 9, 24));
+                    }
+                }
+            } break;
+            case STYLE_RANDOM: {
+                ail_da_push(&cmds, pidi_unpack(rng()));
+            } break;
+            case STYLE_BURSTS: {
+                bool dense = (i/500) & 1;
+                u16  dt    = dense ? ((rng() & 7) ? 0 : 20) : (u16)(50 + (rng() & 127));
+                ail_da_push(&cmds, cmd_new(dt, PIDI_NOTE(0, rng() & 7), 8, 20));
+            } break;
+            default: AIL_UNREACHABLE();
+        }
+    }
+    return cmds;
+}
+
+#ifdef AIL_FS_H_
+// Reads all commands of a PIDI file (or of a MIDI file, if midi_to_pidi.h is included)
+// Gives an empty array if the file couldn't be read
+static AIL_DA(PidiCmd) read_song(const char *path)
+{
+    AIL_DA(PidiCmd) cmds = ail_da_new_empty(PidiCmd);
+    u64 len;
+    u8 *data = (u8 *)ail_fs_read_entire_file(path, &len);
+    if (!data) return cmds;
+    AIL_Buffer buf = ail_buf_from_data(data, len, 0);
+    if (len >= 8 && ail_buf_read4msb(&buf) == PIDI_MAGIC) {
+        u32 count = ail_buf_read4lsb(&buf);
+        for (u32 i = 0; i < count && buf.idx + ENCODED_CMD_LEN <= buf.len; i++) ail_da_push(&cmds, decode_cmd(&buf));
+    }
+#ifdef MIDI_TO_PIDI_H_
+    else {
+        midi_to_pidi_cmds(data, len, &cmds, NULL, NULL);
+    }
+#endif // MIDI_TO_PIDI_H_
+    AIL_FREE(data);
+    return cmds;
+}
+#endif // AIL_FS_H_
+
+#endif // TEST_UTIL_H_